@@ -0,0 +1,88 @@
+/**
+ * @file bench_bitmap.c
+ * @brief Microbenchmark for find_first_free_bit() across all bitmap scanners.
+ *
+ * Uses a 4 KiB bitmap (one 4 KiB block, 32768 bits) in two shapes:
+ * - full: every bit set except the last, the worst case for an allocator;
+ * - fragmented: 97% of bytes fully allocated, with free bits scattered.
+ */
+
+#include "bitmap.h"
+#include "globals.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BITMAP_BYTES 4096
+#define BITMAP_BITS (BITMAP_BYTES * 8)
+#define ITERATIONS 20000
+
+static const char *scanner_names[] = {
+    [EXT2_BITMAP_SCAN_BYTEWISE] = "bytewise",
+    [EXT2_BITMAP_SCAN_SCALAR] = "scalar64",
+    [EXT2_BITMAP_SCAN_SSE2] = "sse2",
+    [EXT2_BITMAP_SCAN_AVX2] = "avx2",
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Times a full scan sequence: find a free bit, take it, repeat, then restore.
+ * @return Nanoseconds per find_first_free_bit() call.
+ */
+static double run(const uint8_t *pattern) {
+    uint8_t bitmap[BITMAP_BYTES];
+    uint64_t calls = 0;
+    volatile uint32_t sink = 0;
+
+    const double start = now_seconds();
+    for (int iteration = 0; iteration < ITERATIONS; ++iteration) {
+        memcpy(bitmap, pattern, BITMAP_BYTES);
+        // Allocate the first few free bits, as successive allocations in one group would.
+        for (int k = 0; k < 4; ++k) {
+            uint32_t index;
+            ++calls;
+            if (find_first_free_bit(bitmap, BITMAP_BITS, &index) != SUCCESS) {
+                break;
+            }
+            set_bit(bitmap, index);
+            sink += index;
+        }
+    }
+    const double elapsed = now_seconds() - start;
+
+    (void) sink;
+    return elapsed * 1e9 / (double) calls;
+}
+
+int main(void) {
+    static uint8_t full[BITMAP_BYTES];
+    static uint8_t fragmented[BITMAP_BYTES];
+
+    memset(full, 0xFF, BITMAP_BYTES);
+    full[BITMAP_BYTES - 1] = 0x7F;
+
+    srand(42);
+    for (uint32_t i = 0; i < BITMAP_BYTES; ++i) {
+        fragmented[i] = rand() % 100 < 97 ? 0xFF : (uint8_t) (rand() | 0x01);
+    }
+
+    printf("%-10s %14s %14s\n", "scanner", "full ns/call", "frag ns/call");
+    for (int scanner = EXT2_BITMAP_SCAN_BYTEWISE; scanner <= EXT2_BITMAP_SCAN_AVX2; ++scanner) {
+        if (set_bitmap_scanner((ext2_bitmap_scanner) scanner) != SUCCESS) {
+            printf("%-10s %14s %14s\n", scanner_names[scanner], "n/a", "n/a");
+            continue;
+        }
+        printf("%-10s %14.1f %14.1f\n", scanner_names[scanner], run(full), run(fragmented));
+    }
+
+    set_bitmap_scanner(EXT2_BITMAP_SCAN_AUTO);
+    printf("auto-selected: %s\n", scanner_names[get_bitmap_scanner()]);
+    return EXIT_SUCCESS;
+}
@@ -46,4 +46,153 @@ int allocate_block(
     uint32_t *new_block_num_out
 );
 
+/**
+ * @brief Allocates a new inode using a filesystem context.
+ *
+ * Behaves like allocate_inode(), but all bitmap and metadata I/O goes through the
+ * context's block cache and the context's superblock and BGDT are updated.
+ *
+ * @param fs The filesystem context.
+ * @param new_inode_num_out Pointer to a uint32_t where the number of the newly allocated inode will be stored.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_allocate_inode(
+    ext2_filesystem *fs,
+    uint32_t *new_inode_num_out
+);
+
+/**
+ * @brief Allocates an inode for a new file or directory, choosing its group by policy.
+ *
+ * With EXT2_INODE_ALLOC_ORLOV (the default) directories created in the root are
+ * spread over groups with above-average free inodes and blocks and the fewest
+ * directories; other directories stay near their parent unless its group is
+ * crowded; files go in their parent's group, or the first group with room found
+ * by quadratic probing. With EXT2_INODE_ALLOC_LINEAR this behaves like
+ * ext2_allocate_inode(). New directories are counted in bg_used_dirs_count.
+ *
+ * @param fs The filesystem context; `fs->inode_policy` selects the policy.
+ * @param parent_inode_num The directory that will contain the new inode.
+ * @param is_directory Non-zero if the new inode is a directory.
+ * @param new_inode_num_out Pointer to a uint32_t where the number of the newly allocated inode will be stored.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_allocate_inode_for(
+    ext2_filesystem *fs,
+    uint32_t parent_inode_num,
+    int is_directory,
+    uint32_t *new_inode_num_out
+);
+
+/**
+ * @brief Allocates a new data block using a filesystem context.
+ *
+ * Behaves like allocate_block(), but all bitmap and metadata I/O goes through the
+ * context's block cache and the context's superblock and BGDT are updated.
+ *
+ * @param fs The filesystem context.
+ * @param new_block_num_out Pointer to a uint32_t where the number of the newly allocated block will be stored.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_allocate_block(
+    ext2_filesystem *fs,
+    uint32_t *new_block_num_out
+);
+
+/**
+ * @brief Allocates a data block as close as possible to a goal block.
+ *
+ * Inside the goal's group the goal itself is taken if free, then the nearest
+ * free block in the same 64-block window, then the start of a free run of at
+ * least 8 blocks, then any free block. Other groups are tried in order of
+ * distance from the goal group (g+1, g-1, g+2, ...) with the same preferences.
+ *
+ * @param fs The filesystem context.
+ * @param goal The preferred block, e.g. the file's previous block + 1 or
+ *             ext2_inode_block_goal(). Out-of-range goals mean "no preference".
+ * @param new_block_num_out Pointer to a uint32_t where the number of the newly allocated block will be stored.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_allocate_block_near(
+    ext2_filesystem *fs,
+    uint32_t goal,
+    uint32_t *new_block_num_out
+);
+
+/**
+ * @brief Allocates `count` blocks in as few contiguous extents as possible.
+ *
+ * Groups are visited in the same order as ext2_allocate_block_near(). Each group's
+ * bitmap is scanned once for free runs, and its counters are updated once per
+ * call rather than once per block. Either all `count` blocks are allocated or none are.
+ *
+ * @param fs The filesystem context.
+ * @param goal The preferred first block.
+ * @param count Number of blocks to allocate.
+ * @param extents_out Array receiving the allocated extents in allocation order.
+ * @param max_extents Capacity of `extents_out`.
+ * @param extent_count_out Set to the number of extents written to `extents_out`.
+ * @return 0 on success, ERROR if there is not enough free space (or it is split
+ *         into more than `max_extents` pieces), or another negative error code.
+ */
+int ext2_allocate_blocks(
+    ext2_filesystem *fs,
+    uint32_t goal,
+    uint32_t count,
+    ext2_block_extent *extents_out,
+    uint32_t max_extents,
+    uint32_t *extent_count_out
+);
+
+/**
+ * @brief Returns blocks to the free pool.
+ *
+ * Extents may cross block group boundaries. The bitmaps and free counts are
+ * updated in memory and written back on filesystem_sync(). Blocks that are
+ * already free are logged and left out of the free counts.
+ *
+ * @param fs The filesystem context.
+ * @param extents The runs of blocks to free.
+ * @param extent_count Number of entries in `extents`.
+ * @return 0 on success, INVALID_PARAMETER if an extent lies outside the
+ *         filesystem (the others are still freed), or another negative error code.
+ */
+int ext2_free_blocks(
+    ext2_filesystem *fs,
+    const ext2_block_extent *extents,
+    uint32_t extent_count
+);
+
+/**
+ * @brief Allocates `count` inodes, filling the hinted group first.
+ *
+ * Groups are tried in order from `group_hint`, wrapping around. Each group's
+ * bitmap is scanned once and its counters are updated once. Either all `count`
+ * inodes are allocated or none are.
+ *
+ * @param fs The filesystem context.
+ * @param group_hint The preferred block group.
+ * @param count Number of inodes to allocate.
+ * @param inodes_out Array of at least `count` entries receiving the inode numbers in ascending order per group.
+ * @return 0 on success, ERROR if there are fewer than `count` free inodes, or another negative error code.
+ */
+int ext2_allocate_inodes(
+    ext2_filesystem *fs,
+    uint32_t group_hint,
+    uint32_t count,
+    uint32_t *inodes_out
+);
+
+/**
+ * @brief Returns a good goal block for the first data block of an inode.
+ *
+ * @param fs The filesystem context.
+ * @param inode_num The inode that will own the block (1-based).
+ * @return The first block of the inode's block group.
+ */
+uint32_t ext2_inode_block_goal(
+    const ext2_filesystem *fs,
+    uint32_t inode_num
+);
+
 #endif //ALLOCATION_H
@@ -0,0 +1,175 @@
+/**
+ * @file async.h
+ * @brief Declares a queue of asynchronous metadata operations served by worker threads.
+ *
+ * An ext2_async engine owns a pool of worker threads that take operations from
+ * a FIFO queue and run them against one filesystem context with the ordinary
+ * blocking calls. The caller can queue any number of lookups, inode reads and
+ * directory reads without blocking its own thread, but a worker blocks on each
+ * cache miss, so at most one operation per worker is doing I/O at a time and
+ * the rest wait in the queue. Size the pool for the I/O concurrency wanted.
+ * Every operation returns a handle. The caller either waits on it with
+ * ext2_async_wait() or passes a callback that runs on the worker thread when
+ * the operation completes.
+ *
+ * The context must be one that may be shared between threads (see
+ * filesystem_init_device()); stream-wrapped contexts may not be used.
+ */
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+typedef struct ext2_async ext2_async;
+typedef struct ext2_async_op ext2_async_op;
+
+/**
+ * @brief Called on a worker thread when an operation completes.
+ *
+ * The callback owns `op` from then on and must release it with
+ * ext2_async_op_free(), either during the call or later.
+ *
+ * @param op The completed operation.
+ * @param user_data The pointer given when the operation was queued.
+ */
+typedef void (*ext2_async_callback)(ext2_async_op *op, void *user_data);
+
+/**
+ * @brief Kinds of operation the engine runs.
+ */
+typedef enum {
+    EXT2_ASYNC_LOOKUP,     //!< Resolve a path, like ext2_lookup().
+    EXT2_ASYNC_READ_INODE, //!< Read an inode, like ext2_read_inode().
+    EXT2_ASYNC_READDIR,    //!< Copy out the in-use entries of a directory.
+} ext2_async_kind;
+
+/**
+ * @brief One directory entry returned by ext2_readdir_async().
+ */
+typedef struct {
+    uint32_t inode;    //!< Inode number of the entry.
+    uint8_t file_type; //!< EXT2_FT_* type recorded in the entry.
+    uint8_t name_len;  //!< Length of `name`.
+    const char *name;  //!< NUL-terminated name, owned by the operation.
+} ext2_async_dirent;
+
+/**
+ * @brief An operation queued on an engine, and its results once it completes.
+ *
+ * Results are valid after ext2_async_wait() returns or inside the callback.
+ */
+struct ext2_async_op {
+    ext2_async_kind kind;       //!< What the operation does.
+    int status;                 //!< 0 on success or a negative error code; set on completion.
+    uint32_t inode_num;         //!< The inode read or listed, or the inode a lookup resolved to.
+    ext2_inode inode;           //!< EXT2_ASYNC_READ_INODE: the inode.
+    ext2_async_dirent *entries; //!< EXT2_ASYNC_READDIR: the entries, in directory order.
+    uint32_t entry_count;       //!< EXT2_ASYNC_READDIR: number of entries.
+
+    // Internal state
+    ext2_async *engine;
+    char *path;
+    char *names;
+    ext2_async_callback callback;
+    void *user_data;
+    int complete;
+    ext2_async_op *next;
+};
+
+/**
+ * @brief Starts an engine for a filesystem context.
+ *
+ * @param fs The filesystem context. It must outlive the engine.
+ * @param threads Number of worker threads, which bounds how many operations can
+ *        wait on the device at once, or 0 for one per online CPU.
+ * @return The engine, or NULL on failure. Stop it with ext2_async_destroy().
+ */
+ext2_async *ext2_async_create(ext2_filesystem *fs, uint32_t threads);
+
+/**
+ * @brief Runs every queued operation to completion, then stops the engine.
+ *
+ * Handles without a callback stay valid and still have to be freed.
+ *
+ * @param engine The engine. May be NULL.
+ */
+void ext2_async_destroy(ext2_async *engine);
+
+/**
+ * @brief Queues the resolution of an absolute path to an inode number.
+ *
+ * On completion `inode_num` holds the inode, and `status` is ERROR if the
+ * path does not resolve.
+ *
+ * @param engine The engine.
+ * @param path The absolute path; it is copied.
+ * @param callback Called on completion, or NULL to wait with ext2_async_wait().
+ * @param user_data Passed to the callback.
+ * @return The operation, or NULL if it could not be queued. With a callback the
+ *         operation may already be complete (and freed) when this returns.
+ */
+ext2_async_op *ext2_lookup_async(
+    ext2_async *engine,
+    const char *path,
+    ext2_async_callback callback,
+    void *user_data
+);
+
+/**
+ * @brief Queues a read of an inode into the operation's `inode`.
+ *
+ * @param engine The engine.
+ * @param inode_num The inode to read (1-based).
+ * @param callback Called on completion, or NULL to wait with ext2_async_wait().
+ * @param user_data Passed to the callback.
+ * @return The operation, or NULL if it could not be queued (see ext2_lookup_async()).
+ */
+ext2_async_op *ext2_read_inode_async(
+    ext2_async *engine,
+    uint32_t inode_num,
+    ext2_async_callback callback,
+    void *user_data
+);
+
+/**
+ * @brief Queues a copy of the in-use entries of a directory into the operation.
+ *
+ * @param engine The engine.
+ * @param dir_inode_num The directory's inode number.
+ * @param callback Called on completion, or NULL to wait with ext2_async_wait().
+ * @param user_data Passed to the callback.
+ * @return The operation, or NULL if it could not be queued (see ext2_lookup_async()).
+ */
+ext2_async_op *ext2_readdir_async(
+    ext2_async *engine,
+    uint32_t dir_inode_num,
+    ext2_async_callback callback,
+    void *user_data
+);
+
+/**
+ * @brief Reports whether an operation queued without a callback has completed.
+ *
+ * @param op The operation.
+ * @return 1 if it has completed, 0 if not.
+ */
+int ext2_async_poll(ext2_async_op *op);
+
+/**
+ * @brief Blocks until an operation queued without a callback completes.
+ *
+ * @param op The operation.
+ * @return The operation's status.
+ */
+int ext2_async_wait(ext2_async_op *op);
+
+/**
+ * @brief Releases a completed operation and its results.
+ *
+ * @param op The operation. May be NULL.
+ */
+void ext2_async_op_free(ext2_async_op *op);
+
+#endif //ASYNC_H
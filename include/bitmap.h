@@ -40,6 +40,138 @@ int write_bitmap(
     const uint8_t *bitmap_buffer
 );
 
+/**
+ * @brief Reads a bitmap block through the filesystem context's block cache.
+ *
+ * @param fs The filesystem context.
+ * @param bitmap_block_id The block ID where the bitmap is located.
+ * @param bitmap_buffer The buffer to read the bitmap into (block_size bytes).
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_read_bitmap(
+    ext2_filesystem *fs,
+    uint32_t bitmap_block_id,
+    uint8_t *bitmap_buffer
+);
+
+/**
+ * @brief Writes a bitmap block through the filesystem context's block cache.
+ *
+ * @param fs The filesystem context.
+ * @param bitmap_block_id The block ID where the bitmap should be written.
+ * @param bitmap_buffer The buffer containing the bitmap data to write.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_write_bitmap(
+    ext2_filesystem *fs,
+    uint32_t bitmap_block_id,
+    const uint8_t *bitmap_buffer
+);
+
+/**
+ * @brief Selects which of a group's two bitmaps an operation applies to.
+ */
+typedef enum {
+    EXT2_BLOCK_BITMAP,
+    EXT2_INODE_BITMAP,
+} ext2_bitmap_kind;
+
+/**
+ * @brief Returns the in-memory copy of a group's bitmap, loading it on first use.
+ *
+ * The buffer stays owned by the context. After changing it, call
+ * ext2_mark_group_bitmap_dirty() so that filesystem_sync() writes it back.
+ * On contexts shared between threads, hold the group's lock (ext2_lock_group())
+ * while loading, reading or changing the bitmap.
+ *
+ * @param fs The filesystem context.
+ * @param group_index The 0-based block group index.
+ * @param kind Which bitmap to return.
+ * @return The bitmap (one block), or NULL on failure.
+ */
+uint8_t *ext2_get_group_bitmap(
+    ext2_filesystem *fs,
+    uint32_t group_index,
+    ext2_bitmap_kind kind
+);
+
+/**
+ * @brief Loads one of the bitmaps of every group into the context's bitmap cache.
+ *
+ * Bitmaps not loaded yet are fetched ahead through block_cache_prefetch(), a
+ * window of groups at a time, so whole-filesystem scans of free space issue a
+ * few batched reads instead of one read per group. Each group is locked while
+ * its bitmap is loaded.
+ *
+ * @param fs The filesystem context.
+ * @param kind Which bitmap to load.
+ * @return 0 on success, or a negative error code if any bitmap could not be read.
+ */
+int ext2_load_group_bitmaps(
+    ext2_filesystem *fs,
+    ext2_bitmap_kind kind
+);
+
+/**
+ * @brief Records that a cached group bitmap was modified.
+ *
+ * @param fs The filesystem context.
+ * @param group_index The 0-based block group index.
+ * @param kind Which bitmap was modified.
+ */
+void ext2_mark_group_bitmap_dirty(
+    ext2_filesystem *fs,
+    uint32_t group_index,
+    ext2_bitmap_kind kind
+);
+
+/**
+ * @brief Writes every dirty cached bitmap back to the image.
+ *
+ * @param fs The filesystem context.
+ * @return 0 on success, or a negative error code if any bitmap could not be written.
+ */
+int ext2_flush_group_bitmaps(
+    ext2_filesystem *fs
+);
+
+/**
+ * @brief Frees the bitmap cache without writing anything back.
+ *
+ * @param fs The filesystem context.
+ */
+void ext2_release_group_bitmaps(
+    ext2_filesystem *fs
+);
+
+/**
+ * @brief Implementations available to find_first_free_bit().
+ */
+typedef enum {
+    EXT2_BITMAP_SCAN_AUTO,     //!< The widest scanner this CPU supports.
+    EXT2_BITMAP_SCAN_BYTEWISE, //!< One byte, then one bit, at a time. Reference implementation.
+    EXT2_BITMAP_SCAN_SCALAR,   //!< 64-bit words with count-trailing-zeros.
+    EXT2_BITMAP_SCAN_SSE2,     //!< Skips allocated 16-byte runs with SSE2 (x86 only).
+    EXT2_BITMAP_SCAN_AVX2,     //!< Skips allocated 32-byte runs with AVX2 (x86 only).
+} ext2_bitmap_scanner;
+
+/**
+ * @brief Selects the implementation used by find_first_free_bit().
+ *
+ * The widest supported scanner is selected automatically at startup; this is
+ * for tests and benchmarks that need a specific one.
+ *
+ * @param scanner The scanner to use, or EXT2_BITMAP_SCAN_AUTO.
+ * @return 0 on success, or INVALID_PARAMETER if the CPU does not support `scanner`.
+ */
+int set_bitmap_scanner(ext2_bitmap_scanner scanner);
+
+/**
+ * @brief Returns the scanner currently used by find_first_free_bit().
+ * @return The active scanner; never EXT2_BITMAP_SCAN_AUTO.
+ */
+ext2_bitmap_scanner get_bitmap_scanner(void);
+
 /**
  * @brief Finds the first free (zero) bit in a bitmap.
  *
@@ -76,4 +208,83 @@ void clear_bit(
     uint32_t bit_index
 );
 
+/**
+ * @brief Finds the first free bit at or after `from`, without wrapping around.
+ *
+ * @param bitmap_buffer The buffer containing the bitmap.
+ * @param size_in_bits The total number of bits in the bitmap.
+ * @param from The first bit to examine.
+ * @param free_bit_index Set to the index of the free bit found.
+ * @return 0 on success, or ERROR if every bit from `from` on is set.
+ */
+int find_next_free_bit(
+    const uint8_t *bitmap_buffer,
+    uint32_t size_in_bits,
+    uint32_t from,
+    uint32_t *free_bit_index
+);
+
+/**
+ * @brief Finds a run of at least `min_len` free bits, preferring runs at or after `goal`.
+ *
+ * The search starts at `goal` (which may fall inside a free run) and wraps
+ * around to the start of the bitmap if nothing is found before the end.
+ *
+ * @param bitmap_buffer The buffer containing the bitmap.
+ * @param size_in_bits The total number of bits in the bitmap.
+ * @param min_len The minimum acceptable run length, at least 1.
+ * @param goal The preferred first bit; values past the end are treated as 0.
+ * @param run_start Set to the first bit of the run found.
+ * @param run_length Set to the number of free bits from `run_start`, which may exceed `min_len`.
+ * @return 0 on success, ERROR if no run is long enough, or INVALID_PARAMETER.
+ */
+int find_free_run(
+    const uint8_t *bitmap_buffer,
+    uint32_t size_in_bits,
+    uint32_t min_len,
+    uint32_t goal,
+    uint32_t *run_start,
+    uint32_t *run_length
+);
+
+/**
+ * @brief Sets `count` consecutive bits starting at `first_bit`.
+ *
+ * @param bitmap_buffer The buffer containing the bitmap.
+ * @param first_bit The 0-based index of the first bit to set.
+ * @param count The number of bits to set.
+ */
+void set_bit_range(
+    uint8_t *bitmap_buffer,
+    uint32_t first_bit,
+    uint32_t count
+);
+
+/**
+ * @brief Clears `count` consecutive bits starting at `first_bit`.
+ *
+ * @param bitmap_buffer The buffer containing the bitmap.
+ * @param first_bit The 0-based index of the first bit to clear.
+ * @param count The number of bits to clear.
+ */
+void clear_bit_range(
+    uint8_t *bitmap_buffer,
+    uint32_t first_bit,
+    uint32_t count
+);
+
+/**
+ * @brief Counts the set bits among `count` consecutive bits starting at `first_bit`.
+ *
+ * @param bitmap_buffer The buffer containing the bitmap.
+ * @param first_bit The 0-based index of the first bit to count.
+ * @param count The number of bits to examine.
+ * @return The number of those bits that are set.
+ */
+uint32_t count_bits_in_range(
+    const uint8_t *bitmap_buffer,
+    uint32_t first_bit,
+    uint32_t count
+);
+
 #endif //C_EXT2_FILESYSTEM_BITMAP_H
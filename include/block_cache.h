@@ -0,0 +1,184 @@
+/**
+ * @file block_cache.h
+ * @brief Declares the block cache that sits beneath all filesystem metadata I/O.
+ *
+ * The cache keeps a fixed number of block-sized buffers in memory. Callers either
+ * pin a buffer with block_cache_get() and access its data directly, or use the
+ * byte-range helpers block_cache_read() and block_cache_write(). Modified buffers
+ * are only written to the device when they are evicted or the cache is flushed.
+ *
+ * All functions may be called from several threads at once. The cache guards its
+ * own state; the contents of a pinned buffer are the caller's to coordinate.
+ */
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "types.h"
+
+#define EXT2_DEFAULT_CACHE_BLOCKS 256 //!< Cache capacity used by filesystem_init().
+#define EXT2_PREFETCH_BATCH 64        //!< Most blocks block_cache_prefetch() reads in one batch.
+
+/**
+ * @brief Creates a block cache on top of a block device.
+ *
+ * @param device The device holding the filesystem image. The cache does not take ownership of it.
+ * @param block_size The filesystem block size in bytes.
+ * @param capacity The number of blocks the cache can hold (must be non-zero).
+ * @return Pointer to a new cache, or NULL on failure.
+ */
+ext2_block_cache *block_cache_create(
+    ext2_block_device *device,
+    uint32_t block_size,
+    uint32_t capacity
+);
+
+/**
+ * @brief Flushes all dirty buffers and frees the cache.
+ *
+ * @param cache The cache to destroy. May be NULL.
+ */
+void block_cache_destroy(ext2_block_cache *cache);
+
+/**
+ * @brief Returns a pinned buffer holding the given block, reading it on a miss.
+ *
+ * The returned buffer stays valid until it is passed to block_cache_release().
+ * Blocks that lie past the end of the image read back as zeros.
+ *
+ * @param cache The block cache.
+ * @param block_id The block number to look up.
+ * @return The pinned buffer, or NULL on I/O error or when every buffer is pinned.
+ */
+ext2_block_buffer *block_cache_get(
+    ext2_block_cache *cache,
+    uint32_t block_id
+);
+
+/**
+ * @brief Drops a reference obtained from block_cache_get().
+ *
+ * @param cache The block cache.
+ * @param buffer The buffer to unpin. May be NULL.
+ */
+void block_cache_release(
+    ext2_block_cache *cache,
+    ext2_block_buffer *buffer
+);
+
+/**
+ * @brief Marks a pinned buffer as modified so it is written back later.
+ *
+ * @param cache The block cache.
+ * @param buffer The buffer whose data has been changed.
+ */
+void block_cache_mark_dirty(
+    ext2_block_cache *cache,
+    ext2_block_buffer *buffer
+);
+
+/**
+ * @brief Copies a byte range out of the cache, loading blocks as needed.
+ *
+ * @param cache The block cache.
+ * @param offset Byte offset from the start of the image.
+ * @param length Number of bytes to copy.
+ * @param buffer Destination buffer of at least `length` bytes.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int block_cache_read(
+    ext2_block_cache *cache,
+    off_t offset,
+    size_t length,
+    void *buffer
+);
+
+/**
+ * @brief Copies a byte range into the cache and marks the affected blocks dirty.
+ *
+ * Blocks that are completely overwritten are not read from the device first.
+ *
+ * @param cache The block cache.
+ * @param offset Byte offset from the start of the image.
+ * @param length Number of bytes to copy.
+ * @param buffer Source buffer of at least `length` bytes.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int block_cache_write(
+    ext2_block_cache *cache,
+    off_t offset,
+    size_t length,
+    const void *buffer
+);
+
+/**
+ * @brief Loads blocks into the cache ahead of use with batched device reads.
+ *
+ * Blocks that are not cached yet are read through block_device_submit(), up
+ * to EXT2_PREFETCH_BATCH at a time, and installed unpinned and clean. Blocks
+ * that are already cached, or that another thread caches meanwhile, are left
+ * alone. Prefetching is a hint: a block is skipped when its shard has no
+ * unpinned buffer. Lookups of prefetched blocks count as hits.
+ *
+ * @param cache The block cache.
+ * @param block_ids The blocks to load; duplicates are allowed.
+ * @param count Number of entries in `block_ids`.
+ * @return 0 on success, or a negative error code if any read failed (the
+ *         blocks that were read are still installed).
+ */
+int block_cache_prefetch(
+    ext2_block_cache *cache,
+    const uint32_t *block_ids,
+    uint32_t count
+);
+
+/**
+ * @brief Reads a byte range straight from the device without filling the cache.
+ *
+ * The whole range is fetched with a single device read, then any blocks that
+ * are dirty in the cache are copied over it, so the result is as current as
+ * block_cache_read(). Meant for bulk file data that would only evict metadata.
+ *
+ * @param cache The block cache.
+ * @param offset Byte offset from the start of the image.
+ * @param length Number of bytes to copy.
+ * @param buffer Destination buffer of at least `length` bytes.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int block_cache_read_direct(
+    ext2_block_cache *cache,
+    off_t offset,
+    size_t length,
+    void *buffer
+);
+
+/**
+ * @brief Writes a byte range straight to the device without filling the cache.
+ *
+ * The range is written with a single device write. Blocks already in the cache
+ * are updated in place so cached readers stay coherent.
+ *
+ * @param cache The block cache.
+ * @param offset Byte offset from the start of the image.
+ * @param length Number of bytes to write.
+ * @param buffer Source buffer of at least `length` bytes.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int block_cache_write_direct(
+    ext2_block_cache *cache,
+    off_t offset,
+    size_t length,
+    const void *buffer
+);
+
+/**
+ * @brief Writes every dirty buffer back to the device.
+ *
+ * @param cache The block cache.
+ * @return 0 on success, or a negative error code if any write failed.
+ */
+int block_cache_flush(ext2_block_cache *cache);
+
+#endif //BLOCK_CACHE_H
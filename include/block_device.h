@@ -0,0 +1,169 @@
+/**
+ * @file block_device.h
+ * @brief Declares the block device abstraction and its built-in backends.
+ *
+ * Three backends are provided: a positional pread()/pwrite() backend on a raw file
+ * descriptor, which is safe to share between threads and avoids stdio buffering,
+ * a read-only mmap backend that can hand out pointers into the image, and a stdio
+ * backend that keeps the FILE*-based API working. The stdio backend locks the
+ * stream around each seek and transfer, so it is thread-safe too, but its
+ * accesses run one at a time.
+ *
+ * Batches of transfers go through block_device_submit(). On the pread()/pwrite()
+ * backend, block_device_enable_io_uring() lets a batch be queued to the kernel at
+ * once; every other device runs the batch one transfer at a time.
+ */
+#ifndef BLOCK_DEVICE_H
+#define BLOCK_DEVICE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "types.h"
+
+#define EXT2_IO_URING_DEFAULT_DEPTH 64 //!< Queue depth used when block_device_enable_io_uring() is given 0.
+
+/**
+ * @brief Opens an image file with the pread()/pwrite() backend.
+ *
+ * @param path Path to the filesystem image or device.
+ * @param writable Non-zero to open the image for writing as well as reading.
+ * @return A heap-allocated device, or NULL on failure. Release it with block_device_close().
+ */
+ext2_block_device *block_device_open(const char *path, int writable);
+
+/**
+ * @brief Wraps an already open file descriptor with the pread()/pwrite() backend.
+ *
+ * @param fd The open file descriptor.
+ * @param owns_fd Non-zero if block_device_close() should also close `fd`.
+ * @return A heap-allocated device, or NULL on failure.
+ */
+ext2_block_device *block_device_from_fd(int fd, int owns_fd);
+
+/**
+ * @brief Maps a whole image read-only with the mmap backend.
+ *
+ * Reads are served by copying out of the mapping and writes always fail.
+ * block_device_map() returns pointers straight into the mapping.
+ *
+ * @param path Path to the filesystem image.
+ * @return A heap-allocated device, or NULL on failure.
+ */
+ext2_block_device *block_device_open_mapped(const char *path);
+
+/**
+ * @brief Returns a pointer into the device's image mapping.
+ *
+ * @param device The block device.
+ * @param offset Byte offset from the start of the image.
+ * @param length Number of bytes the caller will access.
+ * @return Pointer to the bytes at `offset`, or NULL if the device is not mapped
+ *         or the range lies outside the image.
+ */
+const void *block_device_map(const ext2_block_device *device, off_t offset, size_t length);
+
+/**
+ * @brief Wraps a stdio stream with the compatibility backend.
+ *
+ * @param stream The open stream.
+ * @param owns_stream Non-zero if block_device_close() should also fclose() `stream`.
+ * @return A heap-allocated device, or NULL on failure.
+ */
+ext2_block_device *block_device_from_stream(FILE *stream, int owns_stream);
+
+/**
+ * @brief Initializes caller-provided storage as a non-owning stdio device.
+ *
+ * Used by the FILE*-based API to avoid a heap allocation per call.
+ *
+ * @param device Storage for the device.
+ * @param stream The open stream.
+ */
+void block_device_init_stream(ext2_block_device *device, FILE *stream);
+
+/**
+ * @brief Reads exactly `length` bytes at `offset`.
+ *
+ * @param device The block device.
+ * @param offset Byte offset from the start of the image.
+ * @param length Number of bytes to read.
+ * @param buffer Destination buffer.
+ * @return 0 on success, or a negative error code on failure or a short read.
+ */
+int block_device_read(ext2_block_device *device, off_t offset, size_t length, void *buffer);
+
+/**
+ * @brief Writes exactly `length` bytes at `offset`.
+ *
+ * @param device The block device.
+ * @param offset Byte offset from the start of the image.
+ * @param length Number of bytes to write.
+ * @param buffer Source buffer.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int block_device_write(ext2_block_device *device, off_t offset, size_t length, const void *buffer);
+
+/**
+ * @brief Performs a batch of reads and writes and waits for all of them.
+ *
+ * With io_uring enabled the whole batch is queued at once, up to the ring's
+ * depth at a time, and transfers may complete in any order; requests in one
+ * batch must therefore not overlap if any of them is a write. Otherwise the
+ * requests run one after another. Each request's `result` is set either way,
+ * and no transfer is still in flight when this returns, even if io_uring fails
+ * part way through; a ring that fails while waiting is retired and later
+ * batches run synchronously.
+ *
+ * @param device The block device.
+ * @param requests The transfers to perform.
+ * @param count Number of requests.
+ * @return 0 if every request transferred its full length, or a negative error
+ *         code (check the individual results, e.g. for short reads at end of image).
+ */
+int block_device_submit(ext2_block_device *device, ext2_io_request *requests, uint32_t count);
+
+/**
+ * @brief Switches a device's batches to an io_uring instance.
+ *
+ * Only devices from block_device_open() and block_device_from_fd() qualify. When
+ * the library was built without io_uring support or the kernel refuses to set
+ * up a ring, the device is left as it was and batches keep running
+ * synchronously, so callers may treat a failure as informational.
+ *
+ * @param device The block device.
+ * @param queue_depth Ring size, or 0 for EXT2_IO_URING_DEFAULT_DEPTH.
+ * @return 0 if io_uring is in use, ERROR if it is not available for this device,
+ *         or INVALID_PARAMETER.
+ */
+int block_device_enable_io_uring(ext2_block_device *device, uint32_t queue_depth);
+
+/**
+ * @brief Makes some of a device's io_uring_enter() calls fail with EIO.
+ *
+ * Lets tests reach the recovery paths of block_device_submit(). After `skip`
+ * calls go through, the next `count` fail.
+ *
+ * @param device A device with io_uring enabled.
+ * @param skip Number of calls to let through first.
+ * @param count Number of calls to fail; 0 stops injecting failures.
+ * @return 0 on success, ERROR if the device has no io_uring instance, or INVALID_PARAMETER.
+ */
+int block_device_fail_io_uring_enter(ext2_block_device *device, uint32_t skip, uint32_t count);
+
+/**
+ * @brief Pushes written data to stable storage.
+ *
+ * @param device The block device.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int block_device_flush(ext2_block_device *device);
+
+/**
+ * @brief Closes a device and releases its resources.
+ *
+ * @param device The device to close. May be NULL.
+ */
+void block_device_close(ext2_block_device *device);
+
+#endif //BLOCK_DEVICE_H
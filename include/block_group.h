@@ -60,6 +60,71 @@ int write_group_descriptor(
     const ext2_group_desc *group_desc
 );
 
+/**
+ * @brief Writes a descriptor from the context's in-memory BGDT back to the image.
+ *
+ * @param fs The filesystem context.
+ * @param group_index The 0-based index of the block group descriptor to write.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_write_group_descriptor(
+    ext2_filesystem *fs,
+    uint32_t group_index
+);
+
+/**
+ * @brief Records that a descriptor in the context's in-memory BGDT changed.
+ *
+ * The descriptor is written on the next filesystem_sync().
+ *
+ * @param fs The filesystem context.
+ * @param group_index The 0-based index of the modified descriptor.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_mark_group_descriptor_dirty(
+    ext2_filesystem *fs,
+    uint32_t group_index
+);
+
+/**
+ * @brief Locks a block group against changes by other threads.
+ *
+ * The lock guards the group's in-memory descriptor, its cached bitmaps and their
+ * dirty flags. Hold at most one group lock, or take several in ascending group
+ * order. Does nothing on contexts without locks, such as wrapped streams.
+ *
+ * @param fs The filesystem context.
+ * @param group_index The 0-based index of the group.
+ */
+void ext2_lock_group(
+    const ext2_filesystem *fs,
+    uint32_t group_index
+);
+
+/**
+ * @brief Releases a lock taken with ext2_lock_group().
+ *
+ * @param fs The filesystem context.
+ * @param group_index The 0-based index of the group.
+ */
+void ext2_unlock_group(
+    const ext2_filesystem *fs,
+    uint32_t group_index
+);
+
+/**
+ * @brief Writes every dirty group descriptor back to the image.
+ *
+ * Consecutive dirty descriptors are written with a single write. Every group is
+ * locked while the descriptors are written.
+ *
+ * @param fs The filesystem context.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_flush_group_descriptors(
+    ext2_filesystem *fs
+);
+
 /**
  * @brief Reads all block group descriptors from the filesystem image into an array.
  *
@@ -77,4 +142,31 @@ ext2_group_desc_table *read_group_descriptor_table(
     const ext2_super_block *superblock
 );
 
+/**
+ * @brief Reads the whole Block Group Descriptor Table from a block device in one read.
+ *
+ * @param device The device holding the filesystem image.
+ * @param superblock Pointer to the filesystem's superblock (already read into memory).
+ * @return Pointer to a newly allocated table, or NULL on failure.
+ */
+ext2_group_desc_table *ext2_read_group_descriptor_table(
+    ext2_block_device *device,
+    const ext2_super_block *superblock
+);
+
+/**
+ * @brief Builds a Block Group Descriptor Table whose descriptors point into a mapped image.
+ *
+ * Only the table header is allocated; `groups` borrows the read-only mapping and
+ * must not be freed or written through.
+ *
+ * @param device A device opened with block_device_open_mapped().
+ * @param superblock Pointer to the filesystem's superblock.
+ * @return Pointer to a newly allocated table header, or NULL on failure.
+ */
+ext2_group_desc_table *ext2_map_group_descriptor_table(
+    ext2_block_device *device,
+    const ext2_super_block *superblock
+);
+
 #endif // BLOCK_GROUP_H
@@ -0,0 +1,113 @@
+/**
+ * @file bmap.h
+ * @brief Declares the mapping from an inode's logical blocks to physical blocks.
+ *
+ * Logical blocks 0-11 map through the direct pointers, and the single, double
+ * and triple indirect pointers (i_block[12..14]) cover the rest. A block number
+ * of 0 anywhere along the way is a hole.
+ */
+#ifndef BMAP_H
+#define BMAP_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+#define EXT2_IND_BLOCK  12 //!< i_block index of the single indirect block.
+#define EXT2_DIND_BLOCK 13 //!< i_block index of the double indirect block.
+#define EXT2_TIND_BLOCK 14 //!< i_block index of the triple indirect block.
+
+/**
+ * @brief Prepares a block map for an inode.
+ *
+ * No memory is allocated until an indirect block is needed.
+ *
+ * @param map Caller-provided storage for the map.
+ * @param fs The filesystem context.
+ * @param inode The inode to map. It must stay valid while the map is used.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_block_map_init(ext2_block_map *map, ext2_filesystem *fs, const ext2_inode *inode);
+
+/**
+ * @brief Releases the indirect blocks a map holds.
+ *
+ * @param map The block map. May be NULL.
+ */
+void ext2_block_map_release(ext2_block_map *map);
+
+/**
+ * @brief Forgets the held indirect blocks after the inode's block tree changed.
+ *
+ * @param map The block map.
+ */
+void ext2_block_map_invalidate(ext2_block_map *map);
+
+/**
+ * @brief Returns the physical block behind one logical block.
+ *
+ * @param map The block map.
+ * @param logical_block Index of the block within the file.
+ * @param physical_out Set to the physical block number, or 0 for a hole.
+ * @return 0 on success, INVALID_PARAMETER if the index is beyond the triple
+ *         indirect range, or a negative error code if an indirect block cannot be read.
+ */
+int ext2_block_map_lookup(ext2_block_map *map, uint32_t logical_block, uint32_t *physical_out);
+
+/**
+ * @brief Points one logical block at a physical block, growing the tree as needed.
+ *
+ * Missing indirect blocks are allocated near `physical_block` and zeroed. Pointers
+ * stored inside indirect blocks are written through the block cache; pointers in
+ * i_block are only changed in `inode`, which the caller must mark dirty. Setting a
+ * block to 0 punches a hole but never frees indirect blocks.
+ *
+ * @param map The block map, initialised for `inode`.
+ * @param inode The writable inode the map was initialised with.
+ * @param logical_block Index of the block within the file.
+ * @param physical_block The new physical block, or 0 for a hole.
+ * @param indirect_allocated_out Optional; set to the number of indirect blocks allocated.
+ * @return 0 on success, INVALID_PARAMETER if the index is beyond the triple
+ *         indirect range, or another negative error code.
+ */
+int ext2_block_map_set(
+    ext2_block_map *map,
+    ext2_inode *inode,
+    uint32_t logical_block,
+    uint32_t physical_block,
+    uint32_t *indirect_allocated_out
+);
+
+/**
+ * @brief Returns the run of physically contiguous blocks starting at a logical block.
+ *
+ * The run ends at the first discontinuity, after `max_blocks` blocks, or at the
+ * end of the addressable range. A run of holes is reported with `start` 0.
+ *
+ * @param map The block map.
+ * @param logical_block Index of the first block of the run within the file.
+ * @param max_blocks Upper bound on the run length (must be non-zero).
+ * @param run_out Set to the physical start and length of the run.
+ * @return 0 on success, or a negative error code as for ext2_block_map_lookup().
+ */
+int ext2_block_map_range(
+    ext2_block_map *map,
+    uint32_t logical_block,
+    uint32_t max_blocks,
+    ext2_block_extent *run_out
+);
+
+/**
+ * @brief One-off lookup of the physical block behind a logical block.
+ *
+ * Use an ext2_block_map directly when mapping more than one block of an inode.
+ *
+ * @param fs The filesystem context.
+ * @param inode The inode to map.
+ * @param logical_block Index of the block within the file.
+ * @param physical_out Set to the physical block number, or 0 for a hole.
+ * @return 0 on success, or a negative error code as for ext2_block_map_lookup().
+ */
+int ext2_bmap(ext2_filesystem *fs, const ext2_inode *inode, uint32_t logical_block, uint32_t *physical_out);
+
+#endif //BMAP_H
@@ -0,0 +1,45 @@
+/**
+ * @file cache_shard.h
+ * @brief Declares the lock-striped shards shared by the block, inode and dentry caches.
+ *
+ * Each cache spreads its keys over a power-of-two number of shards. A shard has
+ * its own mutex, hash chains and CLOCK hand over a contiguous range of the
+ * cache's entries, so lookups that land in different shards run in parallel.
+ * Small caches get a single shard and behave exactly like an unsharded one.
+ */
+#ifndef CACHE_SHARD_H
+#define CACHE_SHARD_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+#define EXT2_CACHE_MAX_SHARDS        16 //!< Upper bound on the shards of one cache.
+#define EXT2_CACHE_MIN_SHARD_ENTRIES 32 //!< A cache is only split while every shard keeps at least this many entries.
+
+/**
+ * @brief Bumps a cache statistics counter that several shards may update at once.
+ */
+#define EXT2_CACHE_COUNT(counter) __atomic_fetch_add(&(counter), 1, __ATOMIC_RELAXED)
+
+/**
+ * @brief Creates the shards of a cache with empty hash chains and unlocked mutexes.
+ *
+ * The entries are divided as evenly as possible; shard i covers the range
+ * starting at shards[i].first.
+ *
+ * @param capacity Number of entries in the cache (must be non-zero).
+ * @param shard_count_out Set to the number of shards created.
+ * @return The shards, or NULL on allocation failure.
+ */
+ext2_cache_shard *cache_shards_create(uint32_t capacity, uint32_t *shard_count_out);
+
+/**
+ * @brief Frees shards created by cache_shards_create().
+ *
+ * @param shards The shards. May be NULL.
+ * @param shard_count Number of shards.
+ */
+void cache_shards_destroy(ext2_cache_shard *shards, uint32_t shard_count);
+
+#endif //CACHE_SHARD_H
@@ -0,0 +1,94 @@
+/**
+ * @file dentry_cache.h
+ * @brief Declares the directory entry cache used by path resolution.
+ *
+ * The cache maps (directory inode, name) to the inode the name refers to, and
+ * also remembers names that do not exist. ext2_find_entry() and ext2_lookup()
+ * consult it before scanning directory blocks; the functions that add entries
+ * to a directory keep it up to date. Lookups, inserts and invalidations may come
+ * from several threads at once.
+ */
+#ifndef DENTRY_CACHE_H
+#define DENTRY_CACHE_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+#define EXT2_DEFAULT_DENTRY_CACHE_SIZE 1024 //!< Dentry cache capacity used by filesystem_init_device().
+
+/**
+ * @brief Creates an empty dentry cache.
+ *
+ * @param capacity The number of lookups the cache can hold (must be non-zero).
+ * @return Pointer to a new cache, or NULL on failure.
+ */
+ext2_dentry_cache *dentry_cache_create(uint32_t capacity);
+
+/**
+ * @brief Frees a dentry cache.
+ *
+ * @param cache The cache to destroy. May be NULL.
+ */
+void dentry_cache_destroy(ext2_dentry_cache *cache);
+
+/**
+ * @brief Looks up a name in a directory.
+ *
+ * @param cache The dentry cache. May be NULL, which always misses.
+ * @param parent Inode number of the directory.
+ * @param name The name to look up (need not be NUL-terminated).
+ * @param name_len Length of `name` in bytes.
+ * @param child_out Set to the cached inode number, or 0 for a cached miss.
+ * @return 1 if the cache knows the answer, 0 if the directory must be scanned.
+ */
+int dentry_cache_lookup(
+    ext2_dentry_cache *cache,
+    uint32_t parent,
+    const char *name,
+    size_t name_len,
+    uint32_t *child_out
+);
+
+/**
+ * @brief Records the result of scanning a directory for a name.
+ *
+ * @param cache The dentry cache. May be NULL, which does nothing.
+ * @param parent Inode number of the directory.
+ * @param name The name that was looked up.
+ * @param name_len Length of `name` in bytes (names longer than EXT2_NAME_LEN are not cached).
+ * @param child The inode the name resolves to, or 0 if the directory has no such entry.
+ */
+void dentry_cache_insert(
+    ext2_dentry_cache *cache,
+    uint32_t parent,
+    const char *name,
+    size_t name_len,
+    uint32_t child
+);
+
+/**
+ * @brief Forgets cached lookups of a name, typically after an entry was added.
+ *
+ * @param cache The dentry cache. May be NULL, which does nothing.
+ * @param parent Inode number of the directory, or 0 to drop the name in every directory.
+ * @param name The name whose lookups are stale.
+ * @param name_len Length of `name` in bytes.
+ */
+void dentry_cache_invalidate(
+    ext2_dentry_cache *cache,
+    uint32_t parent,
+    const char *name,
+    size_t name_len
+);
+
+/**
+ * @brief Replaces the context's dentry cache with one of a different capacity.
+ *
+ * @param fs The filesystem context.
+ * @param capacity The new number of cached lookups, or 0 to disable the cache.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_set_dentry_cache_size(ext2_filesystem *fs, uint32_t capacity);
+
+#endif //DENTRY_CACHE_H
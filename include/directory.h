@@ -11,7 +11,6 @@
  *
  * This function reads the data blocks of the specified directory inode and prints
  * the details of each directory entry found within those blocks.
- * Currently, it only processes direct blocks (i_block[0] to i_block[11]).
  *
  * @param file Pointer to an open FILE stream for the filesystem image.
  * @param superblock Pointer to the filesystem's superblock.
@@ -116,4 +115,188 @@ uint32_t find_entry_in_directory(
     const char *entry_name
 );
 
+/**
+ * @brief Starts iterating over the entries of a directory.
+ *
+ * Blocks are read one at a time as the iteration reaches them, including those
+ * behind indirect blocks. Holes are skipped.
+ *
+ * @param iter The iterator to initialise. Release it with ext2_dir_iter_close().
+ * @param fs The filesystem context.
+ * @param dir_inode_num The inode number of the directory.
+ * @return 0 on success, ERROR if the inode cannot be read or is not a directory,
+ *         or another negative error code.
+ */
+int ext2_dir_iter_open(ext2_dir_iter *iter, ext2_filesystem *fs, uint32_t dir_inode_num);
+
+/**
+ * @brief Returns the next in-use entry of a directory.
+ *
+ * The entry points into the iterator's current block and stays valid until the
+ * next call to ext2_dir_iter_next() or ext2_dir_iter_close(). Its name is not
+ * NUL-terminated; use `name_len`. A block with a malformed entry is logged and
+ * skipped from that entry on.
+ *
+ * @param iter An open iterator.
+ * @param entry_out Set to the entry.
+ * @return 1 if an entry was returned, 0 at the end of the directory, or a
+ *         negative error code if a block cannot be mapped or read.
+ */
+int ext2_dir_iter_next(ext2_dir_iter *iter, const ext2_directory_entry **entry_out);
+
+/**
+ * @brief Releases the block and inode held by an iterator.
+ *
+ * @param iter The iterator. May be NULL.
+ */
+void ext2_dir_iter_close(ext2_dir_iter *iter);
+
+/**
+ * @brief Lists the entries of a directory using a filesystem context.
+ *
+ * Equivalent to list_directory_entries(), with all inode and data block reads
+ * served by the context's block cache. Prints the entries returned by an
+ * ext2_dir_iter; library callers should use the iterator directly.
+ *
+ * @param fs The filesystem context.
+ * @param dir_inode_num The inode number of the directory to list.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_list_directory(ext2_filesystem *fs, uint32_t dir_inode_num);
+
+/**
+ * @brief Creates a new directory using a filesystem context.
+ *
+ * Equivalent to create_directory(); the context's superblock and BGDT are updated
+ * and all I/O goes through its block cache.
+ *
+ * @param fs The filesystem context.
+ * @param parent_inode_num Inode number of the parent directory.
+ * @param new_dir_name The name for the new directory.
+ * @param new_inode_num_out Pointer to store the newly created inode number (may be NULL).
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_create_directory(
+    ext2_filesystem *fs,
+    uint32_t parent_inode_num,
+    const char *new_dir_name,
+    uint32_t *new_inode_num_out
+);
+
+/**
+ * @brief (Helper) Places a new entry in a directory block if it has room.
+ *
+ * Reuses a deleted entry or splits the slack off the end of a live one.
+ *
+ * @param block The directory block, modified in place.
+ * @param block_size Size of the block.
+ * @param inode_num Inode number for the new entry.
+ * @param name Name of the new entry (need not be NUL-terminated).
+ * @param name_len Length of the name.
+ * @param file_type File type for the new entry (EXT2_FT_*).
+ * @return 1 if the entry was placed, 0 if the block is full or malformed.
+ */
+int ext2_dir_block_insert(
+    char *block,
+    uint32_t block_size,
+    uint32_t inode_num,
+    const char *name,
+    uint8_t name_len,
+    uint8_t file_type
+);
+
+/**
+ * @brief (Helper) Prepares a name for ext2_dir_block_find().
+ *
+ * @param key The key to initialise; it points to `name`, which must outlive it.
+ * @param name The name (need not be NUL-terminated).
+ * @param name_len Length of the name (at most EXT2_NAME_LEN).
+ */
+void ext2_name_key_init(ext2_name_key *key, const char *name, uint8_t name_len);
+
+/**
+ * @brief (Helper) Searches one directory block for a name.
+ *
+ * Walks the block's records, bounds-checking each one, and compares a name only
+ * when its length and first bytes match the key.
+ *
+ * @param block The directory block.
+ * @param block_size Size of the block.
+ * @param key The name to find, from ext2_name_key_init().
+ * @param inode_out Set to the entry's inode number if it is found.
+ * @return 1 if the name was found, 0 if not, or ERROR if the block is malformed
+ *         before a match is reached.
+ */
+int ext2_dir_block_find(
+    const char *block,
+    uint32_t block_size,
+    const ext2_name_key *key,
+    uint32_t *inode_out
+);
+
+/**
+ * @brief (Helper) Allocates a new block at the end of a directory.
+ *
+ * The block is placed after the directory's last block where possible and
+ * mapped through indirect blocks when needed. The inode's size and block count
+ * are updated in memory; the block's contents are left to the caller.
+ *
+ * @param fs The filesystem context.
+ * @param dir_inode The directory's inode (updated in memory).
+ * @param logical_out Set to the new block's index within the directory.
+ * @param block_out Set to the new physical block.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_directory_append_block(
+    ext2_filesystem *fs,
+    ext2_inode *dir_inode,
+    uint32_t *logical_out,
+    uint32_t *block_out
+);
+
+/**
+ * @brief (Helper) Adds a new entry to a directory using a filesystem context.
+ *
+ * Equivalent to add_directory_entry(). The parent inode is updated in memory only.
+ * Entries of htree-indexed directories are placed through the index (see
+ * ext2_htree_add_entry()); if the index has no room left, EXT2_INDEX_FL is
+ * cleared and the directory is extended as a linear one.
+ *
+ * @param fs The filesystem context.
+ * @param parent_inode_num Inode number of the parent directory, whose cached lookups of
+ *        the name are dropped; 0 drops the name in every directory.
+ * @param parent_inode Pointer to the parent directory's inode (will be updated in memory).
+ * @param new_entry_inode_num Inode number for the new entry.
+ * @param new_entry_name Name for the new entry.
+ * @param new_entry_type File type for the new entry (EXT2_FT_*).
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_add_directory_entry(
+    ext2_filesystem *fs,
+    uint32_t parent_inode_num,
+    ext2_inode *parent_inode,
+    uint32_t new_entry_inode_num,
+    const char *new_entry_name,
+    uint8_t new_entry_type
+);
+
+/**
+ * @brief Resolves an absolute path to an inode number using a filesystem context.
+ *
+ * @param fs The filesystem context.
+ * @param path The absolute path to resolve.
+ * @return The inode number on success, or 0 if the path is not found or an error occurs.
+ */
+uint32_t ext2_lookup(ext2_filesystem *fs, const char *path);
+
+/**
+ * @brief Finds a directory entry by name using a filesystem context.
+ *
+ * @param fs The filesystem context.
+ * @param dir_inode_num The inode number of the directory to search in.
+ * @param entry_name The name of the entry to find.
+ * @return The inode number of the found entry, or 0 if not found or an error occurs.
+ */
+uint32_t ext2_find_entry(ext2_filesystem *fs, uint32_t dir_inode_num, const char *entry_name);
+
 #endif //DIRECTORY_H
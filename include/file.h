@@ -0,0 +1,129 @@
+/**
+ * @file file.h
+ * @brief Declares the API for reading and writing regular files.
+ *
+ * Reads are mapped to physical runs with the bmap layer, and each physically
+ * contiguous run is fetched with a single device read. Large reads go straight
+ * into the caller's buffer; small sequential reads are served from an adaptive
+ * readahead window. File data bypasses the block cache so it does not evict
+ * metadata.
+ *
+ * Writes use delayed allocation: new data is kept in memory per block, and
+ * blocks are only allocated when the handle is flushed, so a file written in
+ * small pieces still gets a few large contiguous extents near its inode.
+ */
+#ifndef FILE_H
+#define FILE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "types.h"
+
+#define EXT2_FILE_READAHEAD_MIN 4  //!< Readahead window, in blocks, after a random access.
+#define EXT2_FILE_READAHEAD_MAX 64 //!< Largest readahead window in blocks.
+#define EXT2_FILE_DIRTY_MAX 256    //!< Buffered blocks that trigger an automatic flush.
+#define EXT2_FILE_WRITE_RUN_MAX 64 //!< Largest run of blocks written with one device write.
+
+/**
+ * @brief Opens a regular file for reading and writing.
+ *
+ * @param fs The filesystem context.
+ * @param inode_num The inode number of the file.
+ * @return A new handle positioned at offset 0, or NULL if the inode cannot be
+ *         read or is not a regular file. Release it with ext2_file_close().
+ */
+ext2_file *ext2_file_open(ext2_filesystem *fs, uint32_t inode_num);
+
+/**
+ * @brief Reads from the current position and advances it.
+ *
+ * @param file The open file.
+ * @param buffer Destination buffer of at least `count` bytes.
+ * @param count Maximum number of bytes to read.
+ * @return Number of bytes read (0 at end of file), or a negative error code.
+ */
+ssize_t ext2_file_read(ext2_file *file, void *buffer, size_t count);
+
+/**
+ * @brief Reads at an explicit offset without moving the current position.
+ *
+ * Holes read back as zeros.
+ *
+ * @param file The open file.
+ * @param buffer Destination buffer of at least `count` bytes.
+ * @param count Maximum number of bytes to read.
+ * @param offset Byte offset within the file.
+ * @return Number of bytes read (0 at or past end of file), or a negative error code.
+ */
+ssize_t ext2_file_pread(ext2_file *file, void *buffer, size_t count, uint64_t offset);
+
+/**
+ * @brief Writes at the current position and advances it.
+ *
+ * @param file The open file.
+ * @param buffer Source buffer of `count` bytes.
+ * @param count Number of bytes to write.
+ * @return Number of bytes written, or a negative error code.
+ */
+ssize_t ext2_file_write(ext2_file *file, const void *buffer, size_t count);
+
+/**
+ * @brief Writes at an explicit offset without moving the current position.
+ *
+ * The data is buffered in the handle and reaches the image on ext2_file_flush(),
+ * ext2_file_close(), or once EXT2_FILE_DIRTY_MAX blocks are pending. The size is
+ * extended immediately; writing past the end leaves a hole in between.
+ *
+ * @param file The open file.
+ * @param buffer Source buffer of `count` bytes.
+ * @param count Number of bytes to write.
+ * @param offset Byte offset within the file.
+ * @return Number of bytes written, INVALID_PARAMETER if the range is beyond the
+ *         largest file the block tree can map, or another negative error code.
+ */
+ssize_t ext2_file_pwrite(ext2_file *file, const void *buffer, size_t count, uint64_t offset);
+
+/**
+ * @brief Allocates blocks for buffered writes and writes them to the image.
+ *
+ * Runs of unmapped blocks are allocated together, starting right after the
+ * preceding block of the file or, failing that, in the inode's group. Indirect
+ * blocks are created as needed. The inode is marked dirty; it reaches the image
+ * with the next filesystem_sync().
+ *
+ * @param file The open file.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_file_flush(ext2_file *file);
+
+/**
+ * @brief Changes the size of a file.
+ *
+ * Shrinking frees the data and indirect blocks past the new end and zeroes the
+ * rest of the new last block. Growing leaves a hole.
+ *
+ * @param file The open file.
+ * @param new_size The new size in bytes.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_file_truncate(ext2_file *file, uint64_t new_size);
+
+/**
+ * @brief Returns the size of an open file in bytes.
+ *
+ * @param file The open file.
+ * @return The file size.
+ */
+uint64_t ext2_file_size(const ext2_file *file);
+
+/**
+ * @brief Flushes buffered writes, closes a file handle and drops its inode reference.
+ *
+ * A failed flush is logged; call ext2_file_flush() first to see its result.
+ *
+ * @param file The handle to close. May be NULL.
+ */
+void ext2_file_close(ext2_file *file);
+
+#endif //FILE_H
@@ -1,26 +1,201 @@
 #ifndef FILESYSTEM_H
 #define FILESYSTEM_H
 
+#include <stdint.h>
 #include <stdio.h>
 
 #include "types.h"
 
+/**
+ * @brief Storage for a temporary, uncached filesystem context around a bare stream.
+ *
+ * The FILE*-based functions (read_inode(), read_bitmap(), ...) build one of these
+ * on the stack so they can share a single implementation with the context-based API.
+ */
+typedef struct {
+    ext2_filesystem fs;
+    ext2_group_desc_table table;
+    ext2_block_device device;
+} ext2_stream_context;
+
+#define EXT2_OPEN_WRITE 0x0001 //!< filesystem_open(): open the image for writing as well as reading.
+#define EXT2_OPEN_MMAP  0x0002 //!< filesystem_open(): map the image read-only and serve metadata without copies.
+#define EXT2_OPEN_IO_URING 0x0004 //!< filesystem_open(): batch block I/O through io_uring where the kernel allows it.
+
 /**
  * @brief Initializes the filesystem context.
  *
  * Opens the specified device, reads the superblock and the block group
- * descriptor table, and returns a new filesystem context object.
+ * descriptor table, and returns a new filesystem context object with a
+ * block cache of EXT2_DEFAULT_CACHE_BLOCKS blocks, an inode cache of
+ * EXT2_DEFAULT_INODE_CACHE_SIZE inodes and a dentry cache of
+ * EXT2_DEFAULT_DENTRY_CACHE_SIZE lookups.
  *
  * @param device_path The path to the filesystem image or device.
  * @return A pointer to a new ext2_filesystem object on success, or NULL on failure.
  */
 ext2_filesystem *filesystem_init(FILE *device_path);
 
+/**
+ * @brief Initializes the filesystem context with an explicitly sized block cache.
+ *
+ * @param device The open filesystem image. Ownership passes to the context on success.
+ * @param cache_blocks Number of blocks the cache may hold, or 0 to disable caching.
+ * @return A pointer to a new ext2_filesystem object on success, or NULL on failure.
+ */
+ext2_filesystem *filesystem_init_with_cache(FILE *device, uint32_t cache_blocks);
+
+/**
+ * @brief Opens an image by path using the positional pread()/pwrite() device backend.
+ *
+ * With EXT2_OPEN_MMAP the image is mapped read-only instead: the superblock and
+ * group descriptors point into the mapping, no block cache is created, and every
+ * write fails. EXT2_OPEN_MMAP cannot be combined with EXT2_OPEN_WRITE.
+ *
+ * EXT2_OPEN_IO_URING asks for block_device_enable_io_uring() on the device. If
+ * io_uring is unavailable the image is opened anyway and batches run
+ * synchronously. The flag is ignored together with EXT2_OPEN_MMAP.
+ *
+ * @param path Path to the filesystem image or device.
+ * @param flags Bitwise OR of EXT2_OPEN_* flags.
+ * @return A pointer to a new ext2_filesystem object on success, or NULL on failure.
+ */
+ext2_filesystem *filesystem_open(const char *path, int flags);
+
+/**
+ * @brief Initializes a filesystem context on top of any block device.
+ *
+ * This is the extension point for custom backends: fill in an ext2_block_device's
+ * operations and hand it over here. Mapped devices get zero-copy metadata and
+ * ignore `cache_blocks`. Every context gets default-sized inode and dentry
+ * caches; see ext2_set_inode_cache_size() and ext2_set_dentry_cache_size().
+ *
+ * The context may be shared between threads, provided the device's operations
+ * are thread-safe, as the built-in ones are. Lookups, directory iteration and
+ * reads run concurrently; the caches are lock-striped and allocations lock only
+ * the block group they work in. Changes to one inode or directory, resizing a
+ * cache and filesystem_free() must not overlap with other work on the same
+ * objects. File and iterator handles belong to one thread at a time.
+ *
+ * @param device The device holding the image. Ownership passes to the context on success only.
+ * @param cache_blocks Number of blocks the cache may hold, or 0 to disable caching.
+ * @return A pointer to a new ext2_filesystem object on success, or NULL on failure.
+ */
+ext2_filesystem *filesystem_init_device(ext2_block_device *device, uint32_t cache_blocks);
+
+/**
+ * @brief Writes all cached modifications back to the device.
+ *
+ * Dirty inodes, bitmaps, group descriptors and the superblock are written first, then
+ * the block cache and the device are flushed.
+ *
+ * @param fs The filesystem context.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int filesystem_sync(ext2_filesystem *fs);
+
 /**
  * @brief Frees all resources associated with a filesystem context.
  *
+ * Pending modifications are written back before the device is closed.
+ *
  * @param fs A pointer to the ext2_filesystem object to be freed.
  */
 void filesystem_free(ext2_filesystem *fs);
 
+/**
+ * @brief Reads a byte range of the image through the context's block cache.
+ *
+ * @param fs The filesystem context.
+ * @param offset Byte offset from the start of the image.
+ * @param length Number of bytes to read.
+ * @param buffer Destination buffer of at least `length` bytes.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int filesystem_read(ext2_filesystem *fs, off_t offset, size_t length, void *buffer);
+
+/**
+ * @brief Reads a byte range of the image with one device read, bypassing the block cache.
+ *
+ * Blocks modified in the cache are still honoured; see block_cache_read_direct().
+ *
+ * @param fs The filesystem context.
+ * @param offset Byte offset from the start of the image.
+ * @param length Number of bytes to read.
+ * @param buffer Destination buffer of at least `length` bytes.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int filesystem_read_direct(ext2_filesystem *fs, off_t offset, size_t length, void *buffer);
+
+/**
+ * @brief Writes a byte range of the image through the context's block cache.
+ *
+ * With a cache the data reaches the device on eviction or filesystem_sync().
+ *
+ * @param fs The filesystem context.
+ * @param offset Byte offset from the start of the image.
+ * @param length Number of bytes to write.
+ * @param buffer Source buffer of at least `length` bytes.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int filesystem_write(ext2_filesystem *fs, off_t offset, size_t length, const void *buffer);
+
+/**
+ * @brief Writes a byte range of the image with one device write, bypassing the block cache.
+ *
+ * Cached copies of the affected blocks are updated; see block_cache_write_direct().
+ *
+ * @param fs The filesystem context.
+ * @param offset Byte offset from the start of the image.
+ * @param length Number of bytes to write.
+ * @param buffer Source buffer of at least `length` bytes.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int filesystem_write_direct(ext2_filesystem *fs, off_t offset, size_t length, const void *buffer);
+
+/**
+ * @brief Returns a pointer to a byte range of a memory-mapped image.
+ *
+ * Lets read-only callers look at inodes and directory blocks in place instead of
+ * copying them out with filesystem_read().
+ *
+ * @param fs The filesystem context.
+ * @param offset Byte offset from the start of the image.
+ * @param length Number of bytes the caller will access.
+ * @return Read-only pointer into the mapping, or NULL if the image is not mapped
+ *         or the range lies outside it.
+ */
+const void *filesystem_map(const ext2_filesystem *fs, off_t offset, size_t length);
+
+/**
+ * @brief Builds an uncached context that reads and writes a stream through the stdio backend.
+ *
+ * No memory is allocated. The superblock and descriptors are borrowed, so the
+ * context must not outlive them and must not be passed to filesystem_free().
+ * The context has no locks; only one thread may use it at a time.
+ *
+ * @param context Caller-provided storage for the context.
+ * @param device The open filesystem image.
+ * @param superblock The superblock describing the image.
+ * @param groups The block group descriptors, or NULL if the caller never needs them.
+ * @return The context, pointing into `context`.
+ */
+ext2_filesystem *filesystem_wrap_stream(
+    ext2_stream_context *context,
+    FILE *device,
+    const ext2_super_block *superblock,
+    const ext2_group_desc *groups
+);
+
+/**
+ * @brief Writes back and frees the state a call cached in a wrapped stream context.
+ *
+ * Wrappers around calls that may allocate (and so load group bitmaps) finish with this.
+ *
+ * @param fs A context returned by filesystem_wrap_stream().
+ * @param status The result of the wrapped call.
+ * @return `status` if it reports an error, otherwise the result of the write-back.
+ */
+int filesystem_finish_stream(ext2_filesystem *fs, int status);
+
 #endif // FILESYSTEM_H
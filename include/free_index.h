@@ -0,0 +1,91 @@
+/**
+ * @file free_index.h
+ * @brief Declares the summary of per-group free counts used to choose allocation groups.
+ *
+ * The allocator asks the index for groups with enough free blocks or inodes
+ * instead of walking the descriptor table, and updates it whenever it changes a
+ * group's free counts. The index has no lock of its own; the allocator guards it
+ * with the superblock lock, which already covers every change to the counts.
+ */
+#ifndef FREE_INDEX_H
+#define FREE_INDEX_H
+
+#include <stdint.h>
+
+#include "types.h"
+#include "bitmap.h"
+
+/**
+ * @brief Builds an index over the free counts of a descriptor table.
+ *
+ * @param groups The group descriptors.
+ * @param groups_count Number of descriptors.
+ * @return Pointer to a new index, or NULL on failure.
+ */
+ext2_free_index *free_index_create(const ext2_group_desc *groups, uint32_t groups_count);
+
+/**
+ * @brief Frees an index.
+ *
+ * @param index The index to destroy. May be NULL.
+ */
+void free_index_destroy(ext2_free_index *index);
+
+/**
+ * @brief Records a group's new free block or inode count.
+ *
+ * @param index The index.
+ * @param kind Which count changed.
+ * @param group_idx The group.
+ * @param free_count The group's new count.
+ */
+void free_index_update(ext2_free_index *index, ext2_bitmap_kind kind, uint32_t group_idx, uint16_t free_count);
+
+/**
+ * @brief Finds the lowest group at or after `from` with at least `min_free` free.
+ *
+ * @param index The index.
+ * @param kind Whether to count free blocks or free inodes.
+ * @param from The first group to consider.
+ * @param min_free The count required; 0 is treated as 1.
+ * @param group_out Set to the group found.
+ * @return 0 on success, or ERROR if no such group exists.
+ */
+int free_index_find_next(
+    const ext2_free_index *index,
+    ext2_bitmap_kind kind,
+    uint32_t from,
+    uint32_t min_free,
+    uint32_t *group_out
+);
+
+/**
+ * @brief Finds the highest group at or before `from` with at least `min_free` free.
+ *
+ * Arguments and result are as for free_index_find_next().
+ */
+int free_index_find_prev(
+    const ext2_free_index *index,
+    ext2_bitmap_kind kind,
+    uint32_t from,
+    uint32_t min_free,
+    uint32_t *group_out
+);
+
+/**
+ * @brief Finds the group nearest to `goal` with at least `min_free` free.
+ *
+ * Of two groups equally far from the goal the higher one wins, which matches
+ * the order goal, goal + 1, goal - 1, goal + 2, ... the block allocator probes.
+ *
+ * Arguments and result are as for free_index_find_next().
+ */
+int free_index_find_near(
+    const ext2_free_index *index,
+    ext2_bitmap_kind kind,
+    uint32_t goal,
+    uint32_t min_free,
+    uint32_t *group_out
+);
+
+#endif //FREE_INDEX_H
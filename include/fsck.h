@@ -0,0 +1,126 @@
+/**
+ * @file fsck.h
+ * @brief Declares a read-only, multi-threaded filesystem consistency check.
+ *
+ * The check reads group bitmaps, inode tables, block trees and directories
+ * straight from the device, one block group per work item, and compares them
+ * with each other and with the counts in the superblock and group descriptors.
+ * Nothing is repaired. Results are collected as findings that can be written
+ * out one JSON object per line.
+ */
+#ifndef FSCK_H
+#define FSCK_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "types.h"
+
+#define EXT2_FSCK_DEFAULT_MAX_FINDINGS 10000      //!< Findings kept when ext2_fsck_options.max_findings is 0.
+#define EXT2_FSCK_NO_GROUP             UINT32_MAX //!< ext2_fsck_finding.group of filesystem-wide findings.
+
+/**
+ * @brief Kinds of inconsistency the check reports.
+ *
+ * In every finding `expected` is the value the check derived from the rest of
+ * the filesystem and `found` is the value recorded on disk. Like e2fsck, the
+ * check treats an inode as in use when it has links, and reserved inodes when
+ * they are marked in the inode bitmap.
+ */
+typedef enum {
+    EXT2_FSCK_UNREADABLE,         //!< A bitmap, inode table or indirect block could not be read (`block`).
+    EXT2_FSCK_GROUP_FREE_BLOCKS,  //!< bg_free_blocks_count differs from the free bits in the block bitmap.
+    EXT2_FSCK_GROUP_FREE_INODES,  //!< bg_free_inodes_count differs from the free bits in the inode bitmap.
+    EXT2_FSCK_GROUP_USED_DIRS,    //!< bg_used_dirs_count differs from the directories in use in the group.
+    EXT2_FSCK_SUPER_FREE_BLOCKS,  //!< s_free_blocks_count differs from the free bits in all block bitmaps.
+    EXT2_FSCK_SUPER_FREE_INODES,  //!< s_free_inodes_count differs from the free bits in all inode bitmaps.
+    EXT2_FSCK_BAD_BLOCK,          //!< `inode` points to `block`, which is outside the filesystem.
+    EXT2_FSCK_DUPLICATE_BLOCK,    //!< `block` is claimed by `inode` (0 for metadata) and by something else.
+    EXT2_FSCK_BLOCK_COUNT,        //!< i_blocks of `inode` differs from the blocks its tree maps.
+    EXT2_FSCK_BLOCK_NOT_MARKED,   //!< `count` blocks from `block` are in use but free in the bitmap.
+    EXT2_FSCK_BLOCK_NOT_USED,     //!< `count` blocks from `block` are marked in the bitmap but unused.
+    EXT2_FSCK_BAD_DIR_ENTRY,      //!< Directory `inode` has a bad record in `block`; `found` is its offset.
+    EXT2_FSCK_INODE_NOT_MARKED,   //!< `inode` has links but is free in the inode bitmap.
+    EXT2_FSCK_INODE_NOT_USED,     //!< `inode` is marked in the inode bitmap but has no links.
+    EXT2_FSCK_DANGLING_ENTRY,     //!< `inode` has no links but is named by `expected` directory entries.
+    EXT2_FSCK_LINK_COUNT,         //!< i_links_count of `inode` differs from the entries naming it.
+} ext2_fsck_problem;
+
+/**
+ * @brief One inconsistency found by ext2_fsck().
+ */
+typedef struct {
+    ext2_fsck_problem problem; //!< What is wrong.
+    uint32_t group;            //!< Block group concerned, or EXT2_FSCK_NO_GROUP.
+    uint32_t inode;            //!< Inode concerned, or 0.
+    uint32_t block;            //!< Block concerned (the first of a run), or 0.
+    uint32_t count;            //!< Number of consecutive blocks concerned, usually 1.
+    int64_t expected;          //!< Value derived by the check.
+    int64_t found;             //!< Value recorded on disk.
+} ext2_fsck_finding;
+
+/**
+ * @brief Tuning for ext2_fsck().
+ */
+typedef struct {
+    uint32_t threads;      //!< Worker threads, or 0 for one per online CPU. Capped at the group count.
+    uint32_t max_findings; //!< Findings to keep, or 0 for EXT2_FSCK_DEFAULT_MAX_FINDINGS.
+} ext2_fsck_options;
+
+/**
+ * @brief Results of ext2_fsck().
+ *
+ * Findings are sorted by group, inode and block. Release with ext2_fsck_report_free().
+ */
+typedef struct {
+    ext2_fsck_finding *findings; //!< The findings kept.
+    uint32_t count;              //!< Number of entries in `findings`.
+    uint64_t dropped;            //!< Findings beyond max_findings that were counted but not kept.
+    uint32_t groups;             //!< Block groups checked.
+    uint32_t threads;            //!< Worker threads used.
+    uint64_t inodes_in_use;      //!< Inodes in use.
+    uint64_t directories;        //!< Directories among them.
+    uint64_t blocks_claimed;     //!< Blocks claimed by metadata and inodes.
+} ext2_fsck_report;
+
+/**
+ * @brief Checks a filesystem without modifying it.
+ *
+ * Reads go to the context's device, bypassing its caches, so changes still held
+ * in the context are not seen; call filesystem_sync() first. Contexts around a
+ * stdio stream are checked with a single thread.
+ *
+ * @param fs The filesystem context.
+ * @param options Tuning, or NULL for the defaults.
+ * @param report_out Receives the findings; must be released with ext2_fsck_report_free().
+ * @return 0 if the check ran (whether or not it found problems), or a negative
+ *         error code if it could not.
+ */
+int ext2_fsck(ext2_filesystem *fs, const ext2_fsck_options *options, ext2_fsck_report *report_out);
+
+/**
+ * @brief Frees the findings held by a report.
+ *
+ * @param report The report. May be NULL.
+ */
+void ext2_fsck_report_free(ext2_fsck_report *report);
+
+/**
+ * @brief Returns the stable, machine-readable name of a problem kind, e.g. "link_count".
+ */
+const char *ext2_fsck_problem_name(ext2_fsck_problem problem);
+
+/**
+ * @brief Writes a report as JSON Lines: one object per finding, then a summary object.
+ *
+ * Findings look like {"type":"problem","problem":"link_count","group":0,"inode":12,
+ * "block":0,"count":1,"expected":2,"found":3}; `group` is null for filesystem-wide
+ * findings. The last line has "type":"summary" and the report's counters.
+ *
+ * @param out The stream to write to.
+ * @param report The report.
+ * @return 0 on success, or IO_ERROR if writing failed.
+ */
+int ext2_fsck_write_json(FILE *out, const ext2_fsck_report *report);
+
+#endif //FSCK_H
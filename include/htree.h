@@ -0,0 +1,94 @@
+/**
+ * @file htree.h
+ * @brief Declares lookup and insertion for hash-indexed (htree) directories.
+ *
+ * An indexed directory keeps its entries in leaf blocks ordered by the hash of
+ * their names. Block 0 holds "." and "..", followed by the index root; with
+ * indirect_levels 1 the root points to index nodes, which point to leaves.
+ * Lookups binary-search each index level and scan a single leaf.
+ */
+#ifndef HTREE_H
+#define HTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "types.h"
+
+/**
+ * @brief Computes the htree hash of a name.
+ *
+ * @param name The name (need not be NUL-terminated).
+ * @param name_len Length of the name in bytes.
+ * @param hash_version One of the EXT2_DX_HASH_* algorithms, including the unsigned variants.
+ * @param seed The superblock's s_hash_seed, or NULL. An all-zero seed selects the default.
+ * @param hash_out Set to the major hash (bit 0 is always clear).
+ * @param minor_hash_out Optional; set to the minor hash.
+ * @return 0 on success, or INVALID_PARAMETER for an unknown algorithm.
+ */
+int ext2_dx_hash(
+    const char *name,
+    size_t name_len,
+    int hash_version,
+    const uint32_t seed[4],
+    uint32_t *hash_out,
+    uint32_t *minor_hash_out
+);
+
+/**
+ * @brief Checks whether a directory should be accessed through its htree index.
+ *
+ * @param fs The filesystem context.
+ * @param dir_inode The directory's inode.
+ * @return Non-zero if the filesystem has the dir_index feature and the inode has EXT2_INDEX_FL.
+ */
+int ext2_htree_is_indexed(const ext2_filesystem *fs, const ext2_inode *dir_inode);
+
+/**
+ * @brief Looks a name up through a directory's htree index.
+ *
+ * @param fs The filesystem context.
+ * @param dir_inode The indexed directory's inode.
+ * @param name The name to look up (need not be NUL-terminated).
+ * @param name_len Length of the name in bytes.
+ * @param inode_out Set to the entry's inode number if it is found.
+ * @return 1 if the entry was found, 0 if it does not exist, or a negative error
+ *         code if the index is damaged or cannot be read (callers may then fall
+ *         back to a linear scan).
+ */
+int ext2_htree_lookup(
+    ext2_filesystem *fs,
+    const ext2_inode *dir_inode,
+    const char *name,
+    size_t name_len,
+    uint32_t *inode_out
+);
+
+/**
+ * @brief Inserts an entry into an indexed directory, keeping the index up to date.
+ *
+ * The entry goes into the leaf its hash belongs to. A full leaf is split in
+ * half by hash into a new block; a full index root gains a level of nodes, and
+ * a full node is split if the root has room. Changes to the directory's size,
+ * block count and i_block are made in `dir_inode` only; the caller writes it.
+ *
+ * @param fs The filesystem context.
+ * @param dir_inode The indexed directory's inode.
+ * @param inode_num Inode number for the new entry.
+ * @param name Name of the new entry (need not be NUL-terminated).
+ * @param name_len Length of the name (1 to EXT2_NAME_LEN).
+ * @param file_type File type for the new entry (EXT2_FT_*).
+ * @return 0 on success, 1 if the index is damaged or has no room left (the
+ *         directory's blocks are still a valid linear directory), or a negative
+ *         error code on failure.
+ */
+int ext2_htree_add_entry(
+    ext2_filesystem *fs,
+    ext2_inode *dir_inode,
+    uint32_t inode_num,
+    const char *name,
+    uint8_t name_len,
+    uint8_t file_type
+);
+
+#endif //HTREE_H
@@ -3,9 +3,31 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <time.h>
 
 #include "types.h"
 
+#define EXT2_INODE_SCAN_CHUNK_BLOCKS 64 //!< Inode table blocks ext2_inode_scan_next() reads at a time by default.
+
+/**
+ * @brief Returns entry `index` of a buffer holding consecutive inode table entries.
+ *
+ * Entries are `inode_size` bytes apart (see get_inode_size()), so the pointer
+ * may be handed to the large-inode accessors below with the same size.
+ */
+#define EXT2_INODE_AT(table, index, inode_size) \
+    ((const ext2_inode *) ((const uint8_t *) (table) + (size_t) (index) * (inode_size)))
+
+/**
+ * @brief Timestamps kept in an inode.
+ */
+typedef enum {
+    EXT2_INODE_ATIME,  //!< Last access.
+    EXT2_INODE_CTIME,  //!< Last inode change.
+    EXT2_INODE_MTIME,  //!< Last modification.
+    EXT2_INODE_CRTIME, //!< Creation; only recorded in large inodes.
+} ext2_inode_time;
+
 /**
  * @brief Reads an inode from the filesystem into memory.
  *
@@ -42,5 +64,203 @@ int write_inode(
     const ext2_inode *inode_in
 );
 
+/**
+ * @brief Reads an inode through the filesystem context's inode and block caches.
+ *
+ * @param fs The filesystem context.
+ * @param inode_num The number of the inode to read (1-based).
+ * @param inode_out Pointer to an `ext2_inode` structure to populate with the read data.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_read_inode(
+    ext2_filesystem *fs,
+    uint32_t inode_num,
+    ext2_inode *inode_out
+);
+
+/**
+ * @brief Returns an inode in place inside a memory-mapped image, without copying it.
+ *
+ * @param fs A filesystem context opened with EXT2_OPEN_MMAP.
+ * @param inode_num The number of the inode to look up (1-based).
+ * @return Read-only pointer to the whole get_inode_size() entry inside the
+ *         mapping, valid until filesystem_free(), or
+ *         NULL if the image is not mapped or the inode number is invalid.
+ */
+const ext2_inode *ext2_map_inode(
+    const ext2_filesystem *fs,
+    uint32_t inode_num
+);
+
+/**
+ * @brief Reads a whole inode table entry, including the large-inode fields and
+ *        in-inode extended attributes, with a single read.
+ *
+ * If the inode cache holds the inode, its copy replaces the first
+ * sizeof(ext2_inode) bytes, so changes not yet written back are seen.
+ *
+ * @param fs The filesystem context.
+ * @param inode_num The number of the inode to read (1-based).
+ * @param entry_out Buffer for the entry, e.g. an `ext2_inode_large` or
+ *        get_inode_size() bytes.
+ * @param length Size of `entry_out`, at least sizeof(ext2_inode). Bytes past the
+ *        end of the entry are zeroed.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_read_inode_full(
+    ext2_filesystem *fs,
+    uint32_t inode_num,
+    void *entry_out,
+    size_t length
+);
+
+/**
+ * @brief Writes an inode through the filesystem context's inode and block caches.
+ *
+ * With an inode cache the update stays in memory until the inode is evicted or
+ * filesystem_sync() runs.
+ *
+ * @param fs The filesystem context.
+ * @param inode_num The number of the inode to write (1-based).
+ * @param inode_in Pointer to an `ext2_inode` structure containing the data to write.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_write_inode(
+    ext2_filesystem *fs,
+    uint32_t inode_num,
+    const ext2_inode *inode_in
+);
+
+/**
+ * @brief Reads an inode from the inode table, bypassing the inode cache.
+ *
+ * @param fs The filesystem context.
+ * @param inode_num The number of the inode to read (1-based).
+ * @param inode_out Pointer to an `ext2_inode` structure to populate with the read data.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_load_inode(
+    ext2_filesystem *fs,
+    uint32_t inode_num,
+    ext2_inode *inode_out
+);
+
+/**
+ * @brief Writes an inode to the inode table, bypassing the inode cache.
+ *
+ * Used by the inode cache for write-back; other callers want ext2_write_inode().
+ *
+ * @param fs The filesystem context.
+ * @param inode_num The number of the inode to write (1-based).
+ * @param inode_in Pointer to an `ext2_inode` structure containing the data to write.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_store_inode(
+    ext2_filesystem *fs,
+    uint32_t inode_num,
+    const ext2_inode *inode_in
+);
+
+/**
+ * @brief Starts a scan over every in-use inode of a filesystem.
+ *
+ * Table chunks are read with filesystem_read_direct(), so they do not displace
+ * cached metadata. Inodes changed in the inode cache but not yet flushed are not
+ * seen; call filesystem_sync() first if that matters.
+ *
+ * @param scan The scan to initialise. Release it with ext2_inode_scan_close().
+ * @param fs The filesystem context.
+ * @param chunk_blocks Inode table blocks to read at a time, or 0 for
+ *        EXT2_INODE_SCAN_CHUNK_BLOCKS. Capped at one group's table.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_inode_scan_open(
+    ext2_inode_scan *scan,
+    ext2_filesystem *fs,
+    uint32_t chunk_blocks
+);
+
+/**
+ * @brief Returns the next inode marked in use in its group's inode bitmap.
+ *
+ * @param scan An open scan.
+ * @param inode_num_out Set to the inode's number.
+ * @param inode_out Set to the inode, which points at its whole `scan->inode_size`
+ *        byte entry in the current chunk and stays valid until the next call
+ *        to ext2_inode_scan_next() or ext2_inode_scan_close().
+ * @return 1 if an inode was returned, 0 after the last one, or a negative error
+ *         code if a bitmap or table chunk cannot be read.
+ */
+int ext2_inode_scan_next(
+    ext2_inode_scan *scan,
+    uint32_t *inode_num_out,
+    const ext2_inode **inode_out
+);
+
+/**
+ * @brief Releases the buffers held by a scan.
+ *
+ * @param scan The scan. May be NULL.
+ */
+void ext2_inode_scan_close(ext2_inode_scan *scan);
+
+/**
+ * @brief Returns the number of bytes a large inode uses past EXT2_GOOD_OLD_INODE_SIZE.
+ *
+ * @param inode An inode table entry.
+ * @param inode_size Bytes of the entry available at `inode`.
+ * @return i_extra_isize, or 0 if the entry has no extra fields or the value
+ *         does not fit in `inode_size`.
+ */
+uint32_t ext2_inode_extra_isize(const ext2_inode *inode, uint32_t inode_size);
+
+/**
+ * @brief Returns one of an inode's timestamps, with the nanoseconds and epoch
+ *        bits of large inodes when it has them.
+ *
+ * @param inode An inode table entry.
+ * @param inode_size Bytes of the entry available at `inode`.
+ * @param which The timestamp to return.
+ * @param time_out Receives the time. `tv_nsec` is 0 without the extra fields.
+ * @return 0 on success, or ERROR if the inode does not record `which`.
+ */
+int ext2_inode_get_time(
+    const ext2_inode *inode,
+    uint32_t inode_size,
+    ext2_inode_time which,
+    struct timespec *time_out
+);
+
+/**
+ * @brief Finds an extended attribute stored inside a large inode.
+ *
+ * @param inode An inode table entry.
+ * @param inode_size Bytes of the entry available at `inode`.
+ * @param name_index Namespace of the attribute (see ext2_xattr_entry).
+ * @param name Name without its namespace prefix.
+ * @param value_out Set to the value, which points into the entry.
+ * @param value_size_out Set to the value's length.
+ * @return 1 if the attribute was found, 0 if not (including inodes without
+ *         in-inode attributes), or ERROR if the attribute area is malformed or
+ *         the value lives in another inode.
+ */
+int ext2_inode_xattr_get(
+    const ext2_inode *inode,
+    uint32_t inode_size,
+    uint8_t name_index,
+    const char *name,
+    const void **value_out,
+    uint32_t *value_size_out
+);
+
+/**
+ * @brief Returns the size of an inode's data in bytes.
+ *
+ * For regular files the high 32 bits are stored in `i_dir_acl` (i_size_high).
+ *
+ * @param inode The inode.
+ * @return The size in bytes.
+ */
+uint64_t ext2_inode_size(const ext2_inode *inode);
 
 #endif //INODE_H
@@ -0,0 +1,101 @@
+/**
+ * @file inode_cache.h
+ * @brief Declares the reference-counted inode cache of a filesystem context.
+ *
+ * ext2_inode_get() returns a pointer to the cached copy of an inode and takes a
+ * reference on it; ext2_inode_put() drops the reference. Callers that modify the
+ * inode mark it dirty, and it is written back through the block cache when it is
+ * evicted or when filesystem_sync() runs.
+ *
+ * Contexts without an inode cache (such as the ones the FILE*-based API builds)
+ * still support get/put: each get returns a private copy that put writes back,
+ * if dirty, and frees.
+ *
+ * Get, put, mark-dirty and flush may be called from several threads at once.
+ * Threads that share a cached inode must coordinate changes to its fields.
+ * Resizing the cache is not safe while other threads use the context.
+ */
+#ifndef INODE_CACHE_H
+#define INODE_CACHE_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+#define EXT2_DEFAULT_INODE_CACHE_SIZE 128 //!< Inode cache capacity used by filesystem_init_device().
+
+/**
+ * @brief Creates an empty inode cache.
+ *
+ * @param capacity The number of inodes the cache can hold (must be non-zero).
+ * @return Pointer to a new cache, or NULL on failure.
+ */
+ext2_inode_cache *inode_cache_create(uint32_t capacity);
+
+/**
+ * @brief Frees an inode cache without writing anything back.
+ *
+ * Call ext2_flush_inodes() first to keep modifications.
+ *
+ * @param cache The cache to destroy. May be NULL.
+ */
+void inode_cache_destroy(ext2_inode_cache *cache);
+
+/**
+ * @brief Returns a referenced, in-memory copy of an inode, reading it on a miss.
+ *
+ * The pointer stays valid until it is passed to ext2_inode_put(). Every holder of
+ * the same inode sees the same copy.
+ *
+ * @param fs The filesystem context.
+ * @param inode_num The number of the inode (1-based).
+ * @return The inode, or NULL on I/O error or when every cache entry is referenced.
+ */
+ext2_inode *ext2_inode_get(ext2_filesystem *fs, uint32_t inode_num);
+
+/**
+ * @brief Copies an inode if the cache holds it, without reading it on a miss.
+ *
+ * @param fs The filesystem context.
+ * @param inode_num The number of the inode (1-based).
+ * @param inode_out Receives the cached copy, including changes not yet written back.
+ * @return 1 if the inode was cached, 0 if not.
+ */
+int ext2_inode_peek(ext2_filesystem *fs, uint32_t inode_num, ext2_inode *inode_out);
+
+/**
+ * @brief Drops a reference obtained from ext2_inode_get().
+ *
+ * @param fs The filesystem context.
+ * @param inode The inode to release. May be NULL.
+ */
+void ext2_inode_put(ext2_filesystem *fs, ext2_inode *inode);
+
+/**
+ * @brief Marks a referenced inode as modified so it is written back later.
+ *
+ * @param fs The filesystem context.
+ * @param inode An inode returned by ext2_inode_get().
+ */
+void ext2_inode_mark_dirty(ext2_filesystem *fs, ext2_inode *inode);
+
+/**
+ * @brief Writes every dirty cached inode back to the inode table.
+ *
+ * @param fs The filesystem context.
+ * @return 0 on success, or a negative error code if any write failed.
+ */
+int ext2_flush_inodes(ext2_filesystem *fs);
+
+/**
+ * @brief Replaces the context's inode cache with one of a different capacity.
+ *
+ * Dirty inodes are written back first. Fails if any inode is still referenced.
+ *
+ * @param fs The filesystem context.
+ * @param capacity The new number of cached inodes, or 0 to disable the cache.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_set_inode_cache_size(ext2_filesystem *fs, uint32_t capacity);
+
+#endif //INODE_CACHE_H
@@ -23,6 +23,24 @@ ext2_super_block *read_superblock(
     FILE *file
 );
 
+/**
+ * @brief Reads and validates the superblock from a block device.
+ * @param device The device holding the filesystem image.
+ * @return Pointer to a newly allocated ext2_super_block, or NULL on failure.
+ */
+ext2_super_block *ext2_read_superblock(
+    ext2_block_device *device
+);
+
+/**
+ * @brief Validates the superblock of a mapped image without copying it.
+ * @param device A device opened with block_device_open_mapped().
+ * @return Pointer into the read-only mapping, or NULL on failure. Do not free it.
+ */
+ext2_super_block *ext2_map_superblock(
+    ext2_block_device *device
+);
+
 /**
  * @brief Writes the superblock from memory to an open file stream.
  * @param file Pointer to an open FILE stream (e.g., for an ext2 image file).
@@ -34,6 +52,57 @@ int write_superblock(
     const ext2_super_block *superblock
 );
 
+/**
+ * @brief Writes the context's in-memory superblock through its block cache.
+ * @param fs The filesystem context whose `superblock` should be written.
+ * @return 0 on success, non-zero on failure (e.g., I/O error, invalid superblock data).
+ */
+int ext2_write_superblock(
+    ext2_filesystem *fs
+);
+
+/**
+ * @brief Locks the context's in-memory superblock against changes by other threads.
+ *
+ * Taken around updates of the free counts and feature flags, after any group
+ * lock. Does nothing on contexts without locks, such as wrapped streams.
+ *
+ * @param fs The filesystem context.
+ */
+void ext2_lock_superblock(
+    const ext2_filesystem *fs
+);
+
+/**
+ * @brief Releases the lock taken with ext2_lock_superblock().
+ *
+ * @param fs The filesystem context.
+ */
+void ext2_unlock_superblock(
+    const ext2_filesystem *fs
+);
+
+/**
+ * @brief Records that the context's in-memory superblock changed.
+ *
+ * The superblock is written on the next filesystem_sync(). Call with the
+ * superblock locked.
+ *
+ * @param fs The filesystem context.
+ */
+void ext2_mark_superblock_dirty(
+    ext2_filesystem *fs
+);
+
+/**
+ * @brief Writes the superblock if it was marked dirty, holding the superblock lock.
+ * @param fs The filesystem context.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int ext2_flush_superblock(
+    ext2_filesystem *fs
+);
+
 /**
  * @brief Calculates the block size in bytes from the superblock's log field.
  * @param superblock Pointer to a populated ext2_super_block structure.
@@ -56,4 +125,11 @@ uint32_t get_fragment_size(const ext2_super_block *superblock);
  */
 uint32_t get_block_group_count(const ext2_super_block *superblock);
 
+/**
+ * @brief Returns the size of an inode table entry.
+ * @param superblock Pointer to a populated ext2_super_block structure.
+ * @return s_inode_size, or EXT2_GOOD_OLD_INODE_SIZE on revision 0 filesystems.
+ */
+uint32_t get_inode_size(const ext2_super_block *superblock);
+
 #endif //SUPERBLOCK_H
@@ -1,7 +1,11 @@
 #ifndef TYPES_H
 #define TYPES_H
 
+#include <pthread.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
 
 #define EXT2_BG_INODE_UNINIT    0x0001  // Inode table and bitmap are not initialized
 #define EXT2_BG_BLOCK_UNINIT    0x0002  // Block bitmap is not initialized
@@ -112,6 +116,9 @@
 #define EXT2_FEATURE_RO_COMPAT_DIR_NLINK    0x0020 // Directory NLINK support
 #define EXT2_FEATURE_RO_COMPAT_EXTRA_ISIZE  0x0040 // Extra inode size
 
+#define EXT2_FLAGS_SIGNED_HASH   0x0001 // s_flags: directory hashes treat name bytes as signed
+#define EXT2_FLAGS_UNSIGNED_HASH 0x0002 // s_flags: directory hashes treat name bytes as unsigned
+
 /**
  * @brief The ext2 block group descriptor structure (typically 32 bytes).
  *
@@ -148,6 +155,45 @@ typedef struct {
                                   // The actual name occupies the first 'name_len' bytes.
 } ext2_directory_entry;
 
+// Directory hash algorithms (dx_root_info.hash_version). The unsigned variants
+// are used when the superblock has EXT2_FLAGS_UNSIGNED_HASH set.
+#define EXT2_DX_HASH_LEGACY            0
+#define EXT2_DX_HASH_HALF_MD4          1
+#define EXT2_DX_HASH_TEA               2
+#define EXT2_DX_HASH_LEGACY_UNSIGNED   3
+#define EXT2_DX_HASH_HALF_MD4_UNSIGNED 4
+#define EXT2_DX_HASH_TEA_UNSIGNED      5
+
+/**
+ * @brief Header of an htree index, stored after the "." and ".." entries of block 0.
+ */
+typedef struct {
+    uint32_t reserved_zero;   //!< Always 0.
+    uint8_t  hash_version;    //!< EXT2_DX_HASH_* algorithm, without the unsigned offset.
+    uint8_t  info_length;     //!< Size of this structure (8).
+    uint8_t  indirect_levels; //!< Levels of index nodes below the root (0 or 1).
+    uint8_t  unused_flags;
+} ext2_dx_root_info;
+
+/**
+ * @brief One htree index entry: the lowest hash stored under `block`.
+ *
+ * The first entry of every index block has an implicit hash of 0; its `hash`
+ * field holds an ext2_dx_countlimit instead.
+ */
+typedef struct {
+    uint32_t hash;  //!< Lowest hash in the subtree; bit 0 set if it continues the previous block's hash.
+    uint32_t block; //!< Logical block of the child within the directory.
+} ext2_dx_entry;
+
+/**
+ * @brief Capacity and fill of an htree index block, overlaid on its first entry's hash.
+ */
+typedef struct {
+    uint16_t limit; //!< Maximum number of entries in the block.
+    uint16_t count; //!< Entries in use, including the first.
+} ext2_dx_countlimit;
+
 /**
  * @brief The ext2 inode structure (on-disk, 128 bytes for rev 0, potentially larger for rev 1+).
  *
@@ -206,6 +252,54 @@ typedef struct {
     } i_osd2;
 } ext2_inode;
 
+#define EXT2_GOOD_OLD_INODE_SIZE 128       //!< Size of an inode table entry on revision 0 filesystems.
+#define EXT2_XATTR_MAGIC         0xEA020000 //!< Header of the extended attributes stored inside an inode.
+
+/**
+ * @brief An inode table entry larger than EXT2_GOOD_OLD_INODE_SIZE, as written by
+ *        filesystems with s_inode_size of 256 or more.
+ *
+ * The fields after `inode` only exist when they fit in the first
+ * EXT2_GOOD_OLD_INODE_SIZE + i_extra_isize bytes of the entry (see
+ * EXT2_INODE_HAS_FIELD()). In-inode extended attributes follow them, up to the
+ * end of the entry.
+ */
+typedef struct {
+    ext2_inode inode;        //!< The fields every inode has.
+    uint16_t i_extra_isize;  //!< Bytes in use after the first EXT2_GOOD_OLD_INODE_SIZE.
+    uint16_t i_checksum_hi;  //!< High 16 bits of the inode checksum.
+    uint32_t i_ctime_extra;  //!< Extra change time bits: epoch (low 2 bits) and nanoseconds.
+    uint32_t i_mtime_extra;  //!< Extra modification time bits.
+    uint32_t i_atime_extra;  //!< Extra access time bits.
+    uint32_t i_crtime;       //!< Creation time (POSIX time).
+    uint32_t i_crtime_extra; //!< Extra creation time bits.
+    uint32_t i_version_hi;   //!< High 32 bits of the inode version.
+    uint32_t i_projid;       //!< Project ID.
+} ext2_inode_large;
+
+/**
+ * @brief Tells whether a field of an ext2_inode_large lies within the entry's i_extra_isize.
+ */
+#define EXT2_INODE_HAS_FIELD(large, field)                          \
+    (offsetof(ext2_inode_large, field) + sizeof((large)->field) <= \
+     EXT2_GOOD_OLD_INODE_SIZE + (size_t) (large)->i_extra_isize)
+
+/**
+ * @brief An extended attribute entry, as stored after EXT2_XATTR_MAGIC in an inode.
+ *
+ * Entries are padded to 4 bytes and the list ends with four zero bytes. For
+ * in-inode attributes, `e_value_offs` counts from the first entry.
+ */
+typedef struct {
+    uint8_t  e_name_len;   //!< Length of `e_name`.
+    uint8_t  e_name_index; //!< Namespace of the name (1 = "user.", 2/3 = POSIX ACLs, 6 = "security.", ...).
+    uint16_t e_value_offs; //!< Offset of the value.
+    uint32_t e_value_inum; //!< Inode holding the value, or 0 when it is stored with the entry.
+    uint32_t e_value_size; //!< Length of the value in bytes.
+    uint32_t e_hash;       //!< Hash of the name and value.
+    char     e_name[];     //!< Name without its namespace prefix; not NUL-terminated.
+} ext2_xattr_entry;
+
 /**
  * @brief The ext2 superblock structure (1024 bytes).
  *
@@ -306,19 +400,377 @@ typedef struct {
     uint8_t    s_padding[300];         // Padding to 1024 bytes
 } ext2_super_block;
 
+typedef struct ext2_block_device ext2_block_device;
+
+/**
+ * @brief One transfer in a batch passed to block_device_submit().
+ */
+typedef struct {
+    off_t offset;   //!< Byte offset from the start of the image.
+    size_t length;  //!< Number of bytes to transfer.
+    void *buffer;   //!< Destination of a read, or source of a write.
+    int write;      //!< Non-zero for a write, zero for a read.
+    ssize_t result; //!< Set on completion: bytes transferred (short only for reads at end of image), or a negative error code.
+} ext2_io_request;
+
+/** Submission and completion rings of an io_uring instance; private to block_device.c. */
+typedef struct ext2_io_ring ext2_io_ring;
+
+/**
+ * @brief A byte-addressable backing store for a filesystem image.
+ *
+ * Every access names its own offset, so no seek state is shared between calls.
+ * Backends fill in the operations; callers go through the block_device_* helpers.
+ */
+struct ext2_block_device {
+    /** Reads up to `length` bytes at `offset`; returns the byte count (short only at end of image) or a negative error code. */
+    ssize_t (*read)(ext2_block_device *device, off_t offset, size_t length, void *buffer);
+    /** Writes exactly `length` bytes at `offset`; returns 0 or a negative error code. */
+    int (*write)(ext2_block_device *device, off_t offset, size_t length, const void *buffer);
+    /** Pushes written data to stable storage; returns 0 or a negative error code. */
+    int (*flush)(ext2_block_device *device);
+    /** Releases the backend's resources, including the device itself if it was heap-allocated. */
+    void (*close)(ext2_block_device *device);
+    /** Runs a batch of transfers, setting each request's result; NULL to run them one at a time through read and write. */
+    int (*submit)(ext2_block_device *device, ext2_io_request *requests, uint32_t count);
+
+    FILE *stream;  //!< Backing stream (stdio backend), or NULL.
+    int fd;        //!< Backing file descriptor (pread/pwrite and mmap backends), or -1.
+    int owns_handle; //!< Non-zero if close() should also close `stream` / `fd`.
+    const uint8_t *map; //!< Read-only mapping of the whole image (mmap backend), or NULL.
+    size_t map_length;  //!< Length of `map` in bytes.
+    ext2_io_ring *ring; //!< io_uring instance behind `submit` (pread/pwrite backend), or NULL.
+};
+
+/**
+ * @brief A single block-sized buffer held by the block cache.
+ *
+ * A buffer is pinned while `pin_count` is non-zero and will not be evicted.
+ * Dirty buffers are written back when they are evicted or the cache is flushed.
+ */
+typedef struct {
+    uint32_t block_id;   //!< Block number currently held in this buffer.
+    uint8_t *data;       //!< Block contents (block_size bytes).
+    uint32_t pin_count;  //!< Number of outstanding references from block_cache_get().
+    uint32_t hash_next;  //!< Index of the next buffer in the same hash chain.
+    uint32_t shard;      //!< Index of the cache shard the buffer belongs to.
+    uint8_t valid;       //!< Non-zero if `data` holds the contents of `block_id`.
+    uint8_t dirty;       //!< Non-zero if `data` differs from the on-disk block.
+    uint8_t referenced;  //!< CLOCK reference bit, set on every access.
+} ext2_block_buffer;
+
+/**
+ * @brief One lock-striped partition of a block, inode or dentry cache.
+ *
+ * A shard owns a contiguous range of its cache's entries together with the hash
+ * chains and CLOCK hand over them. Its mutex guards all of that, so threads
+ * working on keys of different shards never wait for each other.
+ */
+typedef struct {
+    pthread_mutex_t lock; //!< Guards the fields below and the entries in the shard's range.
+    uint32_t first;       //!< Index of the shard's first entry in the cache's entry array.
+    uint32_t capacity;    //!< Number of entries in the shard.
+    uint32_t used;        //!< Number of entries handed out at least once.
+    uint32_t clock_hand;  //!< Next entry, relative to `first`, the eviction sweep will inspect.
+    uint32_t hash_bits;   //!< log2 of the number of hash chains.
+    uint32_t *hash_heads; //!< First entry index (into the cache's array) of each hash chain.
+} ext2_cache_shard;
+
+/**
+ * @brief Counters describing the effectiveness of a block cache.
+ */
+typedef struct {
+    uint64_t hits;       //!< Lookups satisfied from memory.
+    uint64_t misses;     //!< Lookups that required a device read (or a fresh buffer).
+    uint64_t evictions;  //!< Buffers reclaimed to make room for another block.
+    uint64_t writebacks; //!< Dirty buffers written back to the device.
+    uint64_t prefetched; //!< Blocks loaded ahead of use by block_cache_prefetch().
+} ext2_block_cache_stats;
+
+/**
+ * @brief A fixed-capacity, write-back cache of filesystem blocks, safe to share between threads.
+ *
+ * Blocks are spread over shards by block number. Within a shard, buffers are
+ * found through a chained hash table and reclaimed with the CLOCK algorithm.
+ */
+typedef struct {
+    ext2_block_device *device;    //!< Device the cached blocks are read from and written to.
+    uint32_t block_size;          //!< Size of each cached block in bytes.
+    uint32_t capacity;            //!< Number of buffers in the cache.
+    uint32_t shard_count;         //!< Number of shards (a power of two).
+    ext2_cache_shard *shards;     //!< The shards (shard_count of them).
+    ext2_block_buffer *buffers;   //!< Buffer descriptors (capacity entries).
+    uint8_t *storage;             //!< Backing memory for all buffer data.
+    ext2_block_cache_stats stats; //!< Hit/miss/eviction counters, updated atomically.
+} ext2_block_cache;
+
+/**
+ * @brief One inode held by the inode cache.
+ *
+ * An entry is in use while `ref_count` is non-zero and will not be evicted.
+ * Dirty entries are written back when they are evicted or the cache is flushed.
+ */
+typedef struct {
+    ext2_inode inode;     //!< In-memory copy of the inode; callers of ext2_inode_get() point here.
+    uint32_t inode_num;   //!< Inode number currently held in this entry.
+    uint32_t ref_count;   //!< Number of outstanding references from ext2_inode_get().
+    uint32_t hash_next;   //!< Index of the next entry in the same hash chain.
+    uint32_t shard;       //!< Index of the cache shard the entry belongs to.
+    uint8_t valid;        //!< Non-zero if `inode` holds the contents of `inode_num`.
+    uint8_t dirty;        //!< Non-zero if `inode` differs from the inode table.
+    uint8_t referenced;   //!< CLOCK reference bit, set on every access.
+} ext2_cached_inode;
+
+/**
+ * @brief Counters describing the effectiveness of an inode cache.
+ */
+typedef struct {
+    uint64_t hits;       //!< Lookups satisfied from memory.
+    uint64_t misses;     //!< Lookups that had to read the inode table.
+    uint64_t evictions;  //!< Entries reclaimed to make room for another inode.
+    uint64_t writebacks; //!< Dirty inodes written back to the inode table.
+} ext2_inode_cache_stats;
+
+/**
+ * @brief A fixed-capacity, write-back cache of inodes keyed by inode number.
+ *
+ * Laid out like ext2_block_cache: shards of chained hash tables over an entry
+ * array, reclaimed with the CLOCK algorithm.
+ */
+typedef struct {
+    uint32_t capacity;            //!< Number of entries in the cache.
+    uint32_t shard_count;         //!< Number of shards (a power of two).
+    ext2_cache_shard *shards;     //!< The shards (shard_count of them).
+    ext2_cached_inode *entries;   //!< Entries (capacity of them).
+    ext2_inode_cache_stats stats; //!< Hit/miss/eviction counters, updated atomically.
+} ext2_inode_cache;
+
+/**
+ * @brief One cached name lookup: (directory, name) -> inode, or a remembered miss.
+ */
+typedef struct {
+    uint32_t parent;          //!< Inode number of the directory the name was looked up in.
+    uint32_t child;           //!< Inode the name resolves to, or 0 for a negative entry.
+    uint32_t hash;            //!< Hash of (parent, name), kept to skip most name comparisons.
+    uint32_t hash_next;       //!< Index of the next entry in the same hash chain.
+    uint8_t name_len;         //!< Length of `name` in bytes.
+    uint8_t valid;            //!< Non-zero if the entry holds a lookup result.
+    uint8_t referenced;       //!< CLOCK reference bit, set on every hit.
+    char name[EXT2_NAME_LEN]; //!< The name (not NUL-terminated).
+} ext2_dentry;
+
+/**
+ * @brief Counters describing the effectiveness of a dentry cache.
+ */
+typedef struct {
+    uint64_t hits;          //!< Lookups answered with a cached inode number.
+    uint64_t negative_hits; //!< Lookups answered with a remembered "no such name".
+    uint64_t misses;        //!< Lookups that had to scan the directory.
+    uint64_t evictions;     //!< Entries reclaimed to make room for another lookup.
+    uint64_t invalidations; //!< Entries dropped because the directory changed.
+} ext2_dentry_cache_stats;
+
+/**
+ * @brief A fixed-capacity cache of directory lookups, including misses.
+ *
+ * Laid out like ext2_block_cache: shards of chained hash tables over an entry
+ * array, reclaimed with the CLOCK algorithm.
+ */
+typedef struct {
+    uint32_t capacity;             //!< Number of entries in the cache.
+    uint32_t shard_count;          //!< Number of shards (a power of two).
+    ext2_cache_shard *shards;      //!< The shards (shard_count of them).
+    ext2_dentry *entries;          //!< Entries (capacity of them).
+    ext2_dentry_cache_stats stats; //!< Hit/miss/eviction counters, updated atomically.
+} ext2_dentry_cache;
+
+/**
+ * @brief In-memory copies of one block group's allocation bitmaps.
+ *
+ * Each bitmap is loaded on first use and written back on filesystem_sync().
+ */
+typedef struct {
+    uint8_t *block_bitmap;  //!< Block bitmap contents, or NULL if not loaded yet.
+    uint8_t *inode_bitmap;  //!< Inode bitmap contents, or NULL if not loaded yet.
+    int block_bitmap_dirty; //!< Non-zero if `block_bitmap` differs from the image.
+    int inode_bitmap_dirty; //!< Non-zero if `inode_bitmap` differs from the image.
+} ext2_group_bitmaps;
+
+/**
+ * @brief A run of consecutive blocks.
+ */
+typedef struct {
+    uint32_t start;  //!< First block of the run.
+    uint32_t length; //!< Number of blocks in the run.
+} ext2_block_extent;
+
+/**
+ * @brief Policies for choosing the block group of a new inode.
+ */
+typedef enum {
+    EXT2_INODE_ALLOC_ORLOV,  //!< Spread top-level directories; keep other inodes near their parent (default).
+    EXT2_INODE_ALLOC_LINEAR, //!< Lowest free inode in the lowest group with one.
+} ext2_inode_alloc_policy;
+
+/**
+ * @brief Free block and inode counts of every block group, summarised for fast group selection.
+ *
+ * Each count has a max segment tree over the groups: node 1 is the root, the
+ * children of node n are 2n and 2n + 1, and group g is leaf `leaves + g`. A
+ * node holds the largest count below it, so the first group at or after a goal
+ * with at least N free is found in O(log groups).
+ */
+typedef struct {
+    uint32_t groups_count; //!< Number of groups summarised.
+    uint32_t leaves;       //!< Leaves per tree: groups_count rounded up to a power of two.
+    uint16_t *free_blocks; //!< Tree over bg_free_blocks_count (2 * leaves nodes; unused leaves hold 0).
+    uint16_t *free_inodes; //!< Tree over bg_free_inodes_count (2 * leaves nodes).
+} ext2_free_index;
+
+/**
+ * @brief Locks that let several threads share one filesystem context.
+ *
+ * Locks are taken in this order: group locks (in ascending group order), the
+ * superblock lock, then cache shard locks.
+ */
+typedef struct {
+    pthread_mutex_t *groups;    //!< One per block group: its cached bitmaps, descriptor and dirty flag.
+    pthread_mutex_t superblock; //!< The superblock's free counts, feature flags and dirty flag.
+} ext2_fs_locks;
+
 /**
  * @brief Represents the entire state of a mounted ext2 filesystem.
  *
- * This structure encapsulates the file pointer to the device, the superblock,
- * and the block group descriptor table, providing a single context object
- * for all filesystem operations.
+ * This structure encapsulates the block device, the superblock,
+ * the block group descriptor table and the block, inode and dentry caches, providing a single
+ * context object for all filesystem operations.
  */
 typedef struct {
-    FILE *device;
-    ext2_super_block *superblock;
-    ext2_group_desc_table *bgdt;
+    ext2_block_device *device;
+    ext2_super_block *superblock; //!< Points into the image mapping when EXT2_OPEN_MMAP is set.
+    ext2_group_desc_table *bgdt;  //!< `groups` points into the image mapping when EXT2_OPEN_MMAP is set.
+    ext2_block_cache *cache; //!< Block cache for all metadata I/O, or NULL for direct device access.
+    int flags;               //!< EXT2_OPEN_* flags describing how the image was opened.
+    ext2_group_bitmaps *bitmaps; //!< Per-group bitmap cache (groups_count entries), or NULL until first use.
+    ext2_free_index *free_index; //!< Summary of the groups' free counts, or NULL until the first allocation.
+    uint8_t *group_desc_dirty;   //!< Per-group flags for descriptors changed in memory, or NULL if none are.
+    int superblock_dirty;        //!< Non-zero if the in-memory superblock differs from the image.
+    ext2_inode_alloc_policy inode_policy; //!< Group selection used by ext2_allocate_inode_for().
+    ext2_inode_cache *icache;    //!< Inode cache, or NULL to read and write inodes directly.
+    ext2_dentry_cache *dcache;   //!< Directory lookup cache, or NULL to scan directories on every lookup.
+    ext2_fs_locks *locks;        //!< Locks for sharing the context between threads, or NULL for single-threaded contexts.
 } ext2_filesystem;
 
+/**
+ * @brief Logical-to-physical block mapping state for one inode.
+ *
+ * Keeps the most recently used indirect block at each depth of the tree, so
+ * walking a file front to back reads each indirect block once.
+ */
+typedef struct {
+    ext2_filesystem *fs;         //!< Context the blocks are read through.
+    const ext2_inode *inode;     //!< Inode whose i_block tree is mapped (borrowed).
+    uint32_t per_block;          //!< Block numbers per indirect block.
+    uint32_t held[3];            //!< Indirect block currently held at each depth, or 0.
+    const uint32_t *entries[3];  //!< Contents of `held[d]`, in `storage` or the image mapping.
+    uint32_t *storage;           //!< Room for one indirect block per depth, or NULL until needed.
+    uint64_t indirect_reads;     //!< Indirect blocks loaded so far.
+} ext2_block_map;
+
+/**
+ * @brief One block of file data written but not yet flushed to the image.
+ */
+typedef struct {
+    uint32_t logical; //!< Logical block within the file.
+    uint8_t *data;    //!< The block's new contents (one block, heap-allocated).
+} ext2_dirty_block;
+
+/**
+ * @brief An open regular file.
+ *
+ * Holds a reference on the file's inode and a block map for the lifetime of the
+ * handle. Small reads are served from a readahead window whose size doubles
+ * while access stays sequential. Writes are buffered per block and only get
+ * physical blocks when the handle is flushed.
+ */
+typedef struct {
+    ext2_filesystem *fs;    //!< Context the file belongs to.
+    uint32_t inode_num;     //!< Inode number of the file.
+    ext2_inode *inode;      //!< The inode, referenced through ext2_inode_get().
+    ext2_block_map map;     //!< Logical-to-physical mapping of the file's blocks.
+    uint64_t position;      //!< Offset used and advanced by ext2_file_read().
+    uint8_t *ra_buffer;     //!< Readahead window contents, or NULL until the first buffered read.
+    uint32_t ra_start;      //!< First logical block held in `ra_buffer`.
+    uint32_t ra_count;      //!< Number of blocks held in `ra_buffer`.
+    uint32_t ra_window;     //!< Size in blocks of the most recent readahead.
+    uint32_t next_block;    //!< Logical block a sequential reader would ask for next.
+    uint64_t device_reads;  //!< Data reads issued to the device so far.
+    ext2_dirty_block *dirty; //!< Buffered writes, sorted by logical block, or NULL.
+    uint32_t dirty_count;    //!< Number of entries in `dirty`.
+    uint32_t dirty_capacity; //!< Allocated length of `dirty`.
+    uint64_t device_writes;  //!< Data writes issued to the device so far.
+} ext2_file;
+
+/**
+ * @brief Cursor over the entries of a directory.
+ *
+ * Holds a reference on the directory's inode and one data block at a time: in
+ * place on a mapped image, pinned in the block cache, or copied into `scratch`
+ * on contexts without a cache. Entries are returned as pointers into that block.
+ * With a cache, the blocks of larger directories are prefetched a window ahead.
+ */
+typedef struct {
+    ext2_filesystem *fs;        //!< Context the directory is read through.
+    uint32_t inode_num;         //!< Inode number of the directory.
+    ext2_inode *inode;          //!< The inode, referenced through ext2_inode_get().
+    ext2_block_map map;         //!< Logical-to-physical mapping of the directory's blocks.
+    uint32_t block_count;       //!< Logical blocks covered by the directory's size.
+    uint32_t next_block;        //!< Next logical block to load.
+    uint32_t prefetched;        //!< Logical blocks below this one have been prefetched.
+    const uint8_t *block;       //!< Current block contents, or NULL before the first block.
+    uint32_t block_id;          //!< Physical block behind `block`.
+    uint32_t offset;            //!< Offset of the next entry within `block`.
+    ext2_block_buffer *pinned;  //!< Cache buffer holding `block`, or NULL.
+    uint8_t *scratch;           //!< Private copy of the block, or NULL until needed.
+} ext2_dir_iter;
+
+/**
+ * @brief Cursor over the in-use inodes of a filesystem, in inode number order.
+ *
+ * Reads each group's inode table in chunks of whole blocks, starting at the
+ * next inode marked in the group's inode bitmap and stopping after the last
+ * one. Groups flagged EXT2_BG_INODE_UNINIT and the table entries counted in
+ * bg_itable_unused are not read when the filesystem has group descriptor
+ * checksums. On mapped images the chunks are the mapping itself.
+ */
+typedef struct {
+    ext2_filesystem *fs;        //!< Context the inode tables are read through.
+    uint32_t inode_size;        //!< Size of an inode table entry.
+    uint32_t chunk_inodes;      //!< Inodes one chunk can hold.
+    uint32_t group;             //!< Group being scanned.
+    int group_ready;            //!< Non-zero once `bitmap` and `limit` describe `group`.
+    uint32_t limit;             //!< One past the group's last in-use inode index.
+    uint32_t next_index;        //!< Next inode index within the group to consider.
+    uint8_t *bitmap;            //!< Copy of the group's inode bitmap.
+    const uint8_t *chunk;       //!< Current chunk of the inode table, or NULL.
+    uint32_t chunk_first;       //!< Index within the group of the chunk's first inode.
+    uint32_t chunk_count;       //!< Inodes in the chunk.
+    uint8_t *buffer;            //!< Storage for chunks, or NULL on mapped images.
+} ext2_inode_scan;
+
+/**
+ * @brief A name prepared once for matching against many directory entries.
+ *
+ * Entries are rejected on their length, then on their first four name bytes
+ * compared as one word, before the rest of the name is compared.
+ */
+typedef struct {
+    const char *name;  //!< The name (need not be NUL-terminated).
+    uint8_t name_len;  //!< Length of `name` in bytes.
+    uint32_t prefix;   //!< The first bytes of `name`, up to four, as loaded from memory.
+    uint32_t mask;     //!< Selects the bytes of a loaded word that belong to the name.
+} ext2_name_key;
+
 // Minimum size of a directory entry's fixed part (inode + rec_len + name_len + file_type)
 #define EXT2_DIR_ENTRY_FIXED_SIZE (sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t) + sizeof(uint8_t))
 
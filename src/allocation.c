@@ -1,151 +1,859 @@
 /**
  * @file allocation.c
  * @brief Implements resource allocation functions for the ext2 filesystem.
+ *
+ * A group's bitmaps and descriptor are only read and changed with the group
+ * locked, and the superblock totals with the superblock locked, so threads
+ * allocating in different groups only meet briefly on the superblock lock. The
+ * group-selection heuristics read consistent snapshots of each descriptor; the
+ * group they pick is re-checked under its lock.
+ *
+ * Searches for a group with free blocks or inodes go through the context's
+ * free index, which is built from the descriptors on the first allocation and
+ * kept up to date with them under the superblock lock.
  */
 
 #include "allocation.h"
 #include "bitmap.h"
+#include "free_index.h"
 #include "superblock.h"
 #include "block_group.h"
+#include "filesystem.h"
 #include "globals.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 
-int allocate_inode(
-    FILE *file,
-    ext2_super_block *superblock,
-    const ext2_group_desc_table *block_group_descriptor_table,
+/**
+ * @brief Applies an allocation's counter changes and marks the group dirty.
+ *
+ * The group must be locked; the superblock lock is taken here.
+ *
+ * @param delta Number of resources taken (positive) or returned (negative).
+ */
+static int adjust_group_counts(
+    ext2_filesystem *fs,
+    const uint32_t group_idx,
+    const ext2_bitmap_kind kind,
+    const int32_t delta
+) {
+    ext2_group_desc *group = &fs->bgdt->groups[group_idx];
+    ext2_lock_superblock(fs);
+    if (kind == EXT2_BLOCK_BITMAP) {
+        group->bg_free_blocks_count -= delta;
+        fs->superblock->s_free_blocks_count -= delta;
+        free_index_update(fs->free_index, kind, group_idx, group->bg_free_blocks_count);
+    } else {
+        group->bg_free_inodes_count -= delta;
+        fs->superblock->s_free_inodes_count -= delta;
+        free_index_update(fs->free_index, kind, group_idx, group->bg_free_inodes_count);
+    }
+    ext2_mark_superblock_dirty(fs);
+    ext2_unlock_superblock(fs);
+
+    ext2_mark_group_bitmap_dirty(fs, group_idx, kind);
+    return ext2_mark_group_descriptor_dirty(fs, group_idx);
+}
+
+/**
+ * @brief Returns the context's free index, building it on first use. The superblock must be locked.
+ *
+ * The free counts only change with the superblock locked, so the descriptors
+ * can be read here without their group locks.
+ */
+static ext2_free_index *locked_free_index(ext2_filesystem *fs) {
+    if (fs->free_index == NULL) {
+        fs->free_index = free_index_create(fs->bgdt->groups, fs->bgdt->groups_count);
+    }
+    return fs->free_index;
+}
+
+/**
+ * @brief Finds the next group, in the order first_group, first_group + 1, ...,
+ *        wrapping around, with at least `min_free` free blocks or inodes.
+ *
+ * @param position Groups of that order already passed over; advanced past the group found.
+ * @return 0 with `*group_out` set, or ERROR once no group remains.
+ */
+static int next_group_from(
+    ext2_filesystem *fs,
+    const ext2_bitmap_kind kind,
+    const uint32_t min_free,
+    const uint32_t first_group,
+    uint32_t *position,
+    uint32_t *group_out
+) {
+    const uint32_t groups_count = fs->bgdt->groups_count;
+    int status = ERROR;
+
+    ext2_lock_superblock(fs);
+    const ext2_free_index *index = locked_free_index(fs);
+    if (index != NULL && first_group + *position < groups_count) {
+        status = free_index_find_next(index, kind, first_group + *position, min_free, group_out);
+        if (status != SUCCESS) {
+            *position = groups_count - first_group;
+        }
+    }
+    if (index != NULL && status != SUCCESS && *position < groups_count) {
+        // The wrapped part of the order: groups below first_group.
+        status = free_index_find_next(index, kind, first_group + *position - groups_count, min_free, group_out);
+        if (status == SUCCESS && *group_out >= first_group) {
+            status = ERROR;
+        }
+    }
+    ext2_unlock_superblock(fs);
+
+    if (status == SUCCESS) {
+        *position = (*group_out + groups_count - first_group) % groups_count + 1;
+    } else {
+        *position = groups_count;
+    }
+    return status;
+}
+
+/**
+ * @brief Copies a group's descriptor while holding its lock.
+ */
+static ext2_group_desc group_snapshot(
+    const ext2_filesystem *fs,
+    const uint32_t group_idx
+) {
+    ext2_lock_group(fs, group_idx);
+    const ext2_group_desc group = fs->bgdt->groups[group_idx];
+    ext2_unlock_group(fs, group_idx);
+    return group;
+}
+
+/**
+ * @brief Reads the superblock's free block or inode total while holding its lock.
+ */
+static uint32_t free_total(
+    const ext2_filesystem *fs,
+    const ext2_bitmap_kind kind
+) {
+    ext2_lock_superblock(fs);
+    const uint32_t total = kind == EXT2_BLOCK_BITMAP ? fs->superblock->s_free_blocks_count
+                                                     : fs->superblock->s_free_inodes_count;
+    ext2_unlock_superblock(fs);
+    return total;
+}
+
+/**
+ * @brief Tries to allocate an inode in one group. The group must be locked.
+ * @return 0 on success, ERROR if the group is full, or another negative code on I/O failure.
+ */
+static int allocate_inode_in_locked_group(
+    ext2_filesystem *fs,
+    const uint32_t group_idx,
+    const int is_directory,
     uint32_t *new_inode_num_out
 ) {
-    if (file == NULL || superblock == NULL || block_group_descriptor_table == NULL || new_inode_num_out == NULL) {
-        return INVALID_PARAMETER;
+    const ext2_super_block *superblock = fs->superblock;
+    ext2_group_desc *group = &fs->bgdt->groups[group_idx];
+
+    if (group->bg_free_inodes_count == 0) {
+        return ERROR;
+    }
+
+    uint8_t *bitmap = ext2_get_group_bitmap(fs, group_idx, EXT2_INODE_BITMAP);
+    if (bitmap == NULL) {
+        log_error("Failed to read inode bitmap for group %u\n", group_idx);
+        return IO_ERROR;
     }
 
-    const uint32_t block_size = get_block_size(superblock);
-    uint8_t *bitmap_buffer = malloc(block_size);
-    if (bitmap_buffer == NULL) {
+    uint32_t free_bit_idx = 0;
+    if (find_first_free_bit(bitmap, superblock->s_inodes_per_group, &free_bit_idx) != SUCCESS) {
+        log_error("Group %u claims %u free inodes but its bitmap is full.\n", group_idx, group->bg_free_inodes_count);
         return ERROR;
     }
 
-    for (uint32_t group_idx = 0; group_idx < block_group_descriptor_table->groups_count; ++group_idx) {
-        if (block_group_descriptor_table->groups[group_idx].bg_free_inodes_count > 0) {
-            const uint32_t inode_bitmap_block_id = block_group_descriptor_table->groups[group_idx].bg_inode_bitmap;
+    set_bit(bitmap, free_bit_idx);
+    if (is_directory) {
+        group->bg_used_dirs_count++;
+    }
 
-            if (read_bitmap(file, superblock, inode_bitmap_block_id, bitmap_buffer) != SUCCESS) {
-                log_error("Failed to read inode bitmap for group %u\n", group_idx);
-                free(bitmap_buffer);
-                return ERROR;
-            }
+    if (adjust_group_counts(fs, group_idx, EXT2_INODE_BITMAP, 1) != SUCCESS) {
+        log_error("Failed to write updated group descriptor for group %u\n", group_idx);
+        return IO_ERROR;
+    }
 
-            uint32_t free_bit_idx = 0;
-            if (find_first_free_bit(bitmap_buffer, superblock->s_inodes_per_group, &free_bit_idx) != SUCCESS) {
-                log_error("Failed to find a free block.");
-                return ERROR;
-            }
+    *new_inode_num_out = group_idx * superblock->s_inodes_per_group + free_bit_idx + 1;
+    return SUCCESS;
+}
 
-            set_bit(bitmap_buffer, free_bit_idx);
+/**
+ * @brief Tries to allocate an inode in one group, locking it for the duration.
+ * @return 0 on success, ERROR if the group is full, or another negative code on I/O failure.
+ */
+static int allocate_inode_in_group(
+    ext2_filesystem *fs,
+    const uint32_t group_idx,
+    const int is_directory,
+    uint32_t *new_inode_num_out
+) {
+    ext2_lock_group(fs, group_idx);
+    const int status = allocate_inode_in_locked_group(fs, group_idx, is_directory, new_inode_num_out);
+    ext2_unlock_group(fs, group_idx);
+    return status;
+}
 
-            if (write_bitmap(file, superblock, inode_bitmap_block_id, bitmap_buffer) != SUCCESS) {
-                log_error("Failed to write updated inode bitmap for group %u\n", group_idx);
-                free(bitmap_buffer);
-                return ERROR;
-            }
+/**
+ * @brief Lowest group with a free inode, searching from `first_group` and wrapping around.
+ */
+static int allocate_inode_linear(
+    ext2_filesystem *fs,
+    const uint32_t first_group,
+    const int is_directory,
+    uint32_t *new_inode_num_out
+) {
+    uint32_t position = 0;
+    uint32_t group_idx;
+    while (next_group_from(fs, EXT2_INODE_BITMAP, 1, first_group, &position, &group_idx) == SUCCESS) {
+        const int status = allocate_inode_in_group(fs, group_idx, is_directory, new_inode_num_out);
+        if (status != ERROR) {
+            return status;
+        }
+    }
 
-            block_group_descriptor_table->groups[group_idx].bg_free_inodes_count--;
-            superblock->s_free_inodes_count--;
+    log_error("No free inodes found in any block group.\n");
+    return ERROR;
+}
+
+/**
+ * @brief Picks the group for a new directory (the Orlov allocator).
+ *
+ * Top-level directories (children of the root) go to the group with the fewest
+ * directories among those with at least average free inodes and blocks. Deeper
+ * directories stay in or after their parent's group, skipping groups that
+ * already hold more than their share of directories or have run low on inodes
+ * or blocks.
+ */
+static uint32_t find_group_orlov(
+    ext2_filesystem *fs,
+    const uint32_t parent_inode_num,
+    const uint32_t parent_group
+) {
+    const ext2_super_block *superblock = fs->superblock;
+    const uint32_t groups_count = fs->bgdt->groups_count;
 
-            if (write_group_descriptor(file, superblock, group_idx, &block_group_descriptor_table->groups[group_idx]) !=
-                SUCCESS) {
-                log_error("Failed to write updated group descriptor for group %u\n", group_idx);
-                free(bitmap_buffer);
-                return ERROR;
+    uint64_t total_dirs = 0;
+    for (uint32_t g = 0; g < groups_count; ++g) {
+        total_dirs += group_snapshot(fs, g).bg_used_dirs_count;
+    }
+    const uint32_t average_free_inodes = free_total(fs, EXT2_INODE_BITMAP) / groups_count;
+    const uint32_t average_free_blocks = free_total(fs, EXT2_BLOCK_BITMAP) / groups_count;
+
+    if (parent_inode_num == EXT2_ROOT_INO) {
+        uint32_t best_group = groups_count;
+        uint32_t best_dirs = 0;
+        for (uint32_t g = 0; g < groups_count; ++g) {
+            const ext2_group_desc group = group_snapshot(fs, g);
+            if (group.bg_free_inodes_count < average_free_inodes ||
+                group.bg_free_blocks_count < average_free_blocks ||
+                group.bg_free_inodes_count == 0) {
+                continue;
             }
-            if (write_superblock(file, superblock) != SUCCESS) {
-                log_error("Failed to write updated superblock\n");
-                free(bitmap_buffer);
-                return ERROR;
+            if (best_group == groups_count || group.bg_used_dirs_count < best_dirs) {
+                best_group = g;
+                best_dirs = group.bg_used_dirs_count;
             }
+        }
+        if (best_group != groups_count) {
+            return best_group;
+        }
+    } else {
+        const uint64_t max_dirs = total_dirs / groups_count + superblock->s_inodes_per_group / 16;
+        const uint32_t inode_slack = superblock->s_inodes_per_group / 4;
+        const uint32_t block_slack = superblock->s_blocks_per_group / 4;
+        const uint32_t min_inodes = average_free_inodes > inode_slack ? average_free_inodes - inode_slack : 1;
+        const uint32_t min_blocks = average_free_blocks > block_slack ? average_free_blocks - block_slack : 1;
 
-            *new_inode_num_out = group_idx * superblock->s_inodes_per_group + free_bit_idx + 1;
-            free(bitmap_buffer);
-            return SUCCESS;
+        for (uint32_t i = 0; i < groups_count; ++i) {
+            const uint32_t g = (parent_group + i) % groups_count;
+            const ext2_group_desc group = group_snapshot(fs, g);
+            if (group.bg_used_dirs_count < max_dirs &&
+                group.bg_free_inodes_count >= min_inodes &&
+                group.bg_free_blocks_count >= min_blocks) {
+                return g;
+            }
         }
     }
 
-    free(bitmap_buffer);
-    log_error("No free inodes found in any block group.\n");
-    return ERROR;
+    // Nothing qualifies: settle for any group with an average share of free inodes.
+    uint32_t position = 0;
+    uint32_t g;
+    if (next_group_from(fs, EXT2_INODE_BITMAP, average_free_inodes, parent_group, &position, &g) == SUCCESS) {
+        return g;
+    }
+    return parent_group;
 }
 
-int allocate_block(
-    FILE *file,
-    ext2_super_block *superblock,
-    const ext2_group_desc_table *block_group_descriptor_table,
+/**
+ * @brief Picks the group for a new non-directory inode: its parent's, or a quadratic probe from there.
+ */
+static uint32_t find_group_other(
+    const ext2_filesystem *fs,
+    const uint32_t parent_group
+) {
+    const uint32_t groups_count = fs->bgdt->groups_count;
+
+    const ext2_group_desc parent = group_snapshot(fs, parent_group);
+    if (parent.bg_free_inodes_count > 0 && parent.bg_free_blocks_count > 0) {
+        return parent_group;
+    }
+
+    uint32_t g = parent_group;
+    for (uint32_t step = 1; step < groups_count; step <<= 1) {
+        g = (g + step) % groups_count;
+        const ext2_group_desc group = group_snapshot(fs, g);
+        if (group.bg_free_inodes_count > 0 && group.bg_free_blocks_count > 0) {
+            return g;
+        }
+    }
+
+    // The linear search from the parent picks up groups with inodes but no blocks.
+    return parent_group;
+}
+
+int ext2_allocate_inode(
+    ext2_filesystem *fs,
+    uint32_t *new_inode_num_out
+) {
+    if (fs == NULL || fs->superblock == NULL || fs->bgdt == NULL || new_inode_num_out == NULL) {
+        return INVALID_PARAMETER;
+    }
+    if (fs->flags & EXT2_OPEN_MMAP) {
+        log_error("Cannot allocate an inode on a read-only mapped image.\n");
+        return ERROR;
+    }
+
+    return allocate_inode_linear(fs, 0, 0, new_inode_num_out);
+}
+
+int ext2_allocate_inode_for(
+    ext2_filesystem *fs,
+    const uint32_t parent_inode_num,
+    const int is_directory,
+    uint32_t *new_inode_num_out
+) {
+    if (fs == NULL || fs->superblock == NULL || fs->bgdt == NULL || new_inode_num_out == NULL ||
+        fs->bgdt->groups_count == 0) {
+        return INVALID_PARAMETER;
+    }
+    if (fs->flags & EXT2_OPEN_MMAP) {
+        log_error("Cannot allocate an inode on a read-only mapped image.\n");
+        return ERROR;
+    }
+
+    if (fs->inode_policy == EXT2_INODE_ALLOC_LINEAR) {
+        return allocate_inode_linear(fs, 0, is_directory, new_inode_num_out);
+    }
+
+    uint32_t parent_group = 0;
+    if (parent_inode_num != 0 && fs->superblock->s_inodes_per_group != 0) {
+        parent_group = (parent_inode_num - 1) / fs->superblock->s_inodes_per_group;
+    }
+    if (parent_group >= fs->bgdt->groups_count) {
+        parent_group = 0;
+    }
+
+    const uint32_t group = is_directory
+                               ? find_group_orlov(fs, parent_inode_num, parent_group)
+                               : find_group_other(fs, parent_group);
+    return allocate_inode_linear(fs, group, is_directory, new_inode_num_out);
+}
+
+/**
+ * @brief Number of blocks tracked by a group's block bitmap; the last group may be short.
+ */
+static uint32_t group_block_count(
+    const ext2_super_block *superblock,
+    const uint32_t group_idx
+) {
+    const uint32_t first_block = superblock->s_first_data_block + group_idx * superblock->s_blocks_per_group;
+    const uint32_t remaining = superblock->s_blocks_count - first_block;
+    return remaining < superblock->s_blocks_per_group ? remaining : superblock->s_blocks_per_group;
+}
+
+/**
+ * @brief Picks a free bit in one group's block bitmap, preferring bits near `goal_bit`.
+ * @param bitmap The group's block bitmap.
+ * @param size_in_bits Number of blocks in the group.
+ * @param goal_bit The preferred bit.
+ * @param bit_out Set to the chosen bit.
+ * @return 0 on success, or ERROR if the group is full.
+ */
+static int pick_block_in_group(
+    const uint8_t *bitmap,
+    const uint32_t size_in_bits,
+    const uint32_t goal_bit,
+    uint32_t *bit_out
+) {
+    uint32_t run_length;
+
+    // The goal itself, or the nearest free block in the rest of its 64-block window
+    const uint32_t window_end = (goal_bit | 63) + 1;
+    if (find_next_free_bit(bitmap, window_end < size_in_bits ? window_end : size_in_bits, goal_bit, bit_out) == SUCCESS) {
+        return SUCCESS;
+    }
+
+    // The start of a free run, which leaves room for the file to grow contiguously
+    if (find_free_run(bitmap, size_in_bits, 8, goal_bit, bit_out, &run_length) == SUCCESS) {
+        return SUCCESS;
+    }
+
+    return find_free_run(bitmap, size_in_bits, 1, goal_bit, bit_out, &run_length);
+}
+
+/**
+ * @brief Tries to allocate a block in one group. The group must be locked.
+ * @return 0 on success, ERROR if the group is full, or another negative code on I/O failure.
+ */
+static int allocate_block_in_locked_group(
+    ext2_filesystem *fs,
+    const uint32_t group_idx,
+    const uint32_t goal_bit,
     uint32_t *new_block_num_out
 ) {
-    if (file == NULL || superblock == NULL || block_group_descriptor_table == NULL || new_block_num_out == NULL) {
+    const ext2_super_block *superblock = fs->superblock;
+    ext2_group_desc *group = &fs->bgdt->groups[group_idx];
+
+    if (group->bg_free_blocks_count == 0) {
+        return ERROR;
+    }
+
+    uint8_t *bitmap = ext2_get_group_bitmap(fs, group_idx, EXT2_BLOCK_BITMAP);
+    if (bitmap == NULL) {
+        log_error("Failed to read block bitmap for group %u\n", group_idx);
+        return IO_ERROR;
+    }
+
+    uint32_t free_bit_idx = 0;
+    const uint32_t block_count = group_block_count(superblock, group_idx);
+    if (pick_block_in_group(bitmap, block_count, goal_bit < block_count ? goal_bit : 0, &free_bit_idx) != SUCCESS) {
+        log_error("Group %u claims %u free blocks but its bitmap is full.\n", group_idx, group->bg_free_blocks_count);
+        return ERROR;
+    }
+
+    // Mark bit as used; the bitmap reaches the disk on filesystem_sync()
+    set_bit(bitmap, free_bit_idx);
+
+    // Update counts; the descriptor and superblock reach the disk on filesystem_sync()
+    if (adjust_group_counts(fs, group_idx, EXT2_BLOCK_BITMAP, 1) != SUCCESS) {
+        log_error("Failed to write updated group descriptor for group %u\n", group_idx);
+        return IO_ERROR;
+    }
+
+    // The first data block is at superblock->s_first_data_block (usually 0 or 1)
+    *new_block_num_out = group_idx * superblock->s_blocks_per_group + superblock->s_first_data_block + free_bit_idx;
+    return SUCCESS;
+}
+
+/**
+ * @brief Tries to allocate a block in one group, locking it for the duration.
+ * @return 0 on success, ERROR if the group is full, or another negative code on I/O failure.
+ */
+static int allocate_block_in_group(
+    ext2_filesystem *fs,
+    const uint32_t group_idx,
+    const uint32_t goal_bit,
+    uint32_t *new_block_num_out
+) {
+    ext2_lock_group(fs, group_idx);
+    const int status = allocate_block_in_locked_group(fs, group_idx, goal_bit, new_block_num_out);
+    ext2_unlock_group(fs, group_idx);
+    return status;
+}
+
+/**
+ * @brief Walks the block groups with free blocks outward from a goal group:
+ *        g, g+1, g-1, g+2, g-2, ..., skipping full groups.
+ */
+typedef struct {
+    ext2_filesystem *fs;
+    uint32_t goal_group;
+    uint32_t above; //!< Lowest group at or above the goal not yet visited.
+    uint32_t below; //!< One past the highest group below the goal not yet visited.
+} group_cursor;
+
+/**
+ * @brief Starts a group cursor at the group holding `goal`.
+ * @param fs The filesystem context.
+ * @param goal The preferred block; out-of-range goals start at the first data block.
+ * @param goal_bit_out Set to the goal's bit within its group's block bitmap.
+ */
+static group_cursor start_group_cursor(
+    ext2_filesystem *fs,
+    uint32_t goal,
+    uint32_t *goal_bit_out
+) {
+    const ext2_super_block *superblock = fs->superblock;
+    if (goal < superblock->s_first_data_block || goal >= superblock->s_blocks_count) {
+        goal = superblock->s_first_data_block;
+    }
+
+    group_cursor cursor = {0};
+    cursor.fs = fs;
+    cursor.goal_group = (goal - superblock->s_first_data_block) / superblock->s_blocks_per_group;
+    cursor.above = cursor.goal_group;
+    cursor.below = cursor.goal_group < fs->bgdt->groups_count ? cursor.goal_group : fs->bgdt->groups_count;
+    *goal_bit_out = (goal - superblock->s_first_data_block) % superblock->s_blocks_per_group;
+    return cursor;
+}
+
+/**
+ * @brief Advances a group cursor to the nearest unvisited group the free index reports free blocks in.
+ * @return Non-zero with `*group_out` set, or zero once no such group remains.
+ */
+static int next_group(
+    group_cursor *cursor,
+    uint32_t *group_out
+) {
+    ext2_filesystem *fs = cursor->fs;
+    uint32_t above;
+    uint32_t below;
+
+    ext2_lock_superblock(fs);
+    const ext2_free_index *index = locked_free_index(fs);
+    const int found_above = index != NULL && cursor->above < fs->bgdt->groups_count &&
+                            free_index_find_next(index, EXT2_BLOCK_BITMAP, cursor->above, 1, &above) == SUCCESS;
+    const int found_below = index != NULL && cursor->below > 0 &&
+                            free_index_find_prev(index, EXT2_BLOCK_BITMAP, cursor->below - 1, 1, &below) == SUCCESS;
+    ext2_unlock_superblock(fs);
+
+    if (found_above && (!found_below || above - cursor->goal_group <= cursor->goal_group - below)) {
+        cursor->above = above + 1;
+        *group_out = above;
+        return 1;
+    }
+    if (found_below) {
+        cursor->below = below;
+        *group_out = below;
+        return 1;
+    }
+    cursor->above = fs->bgdt->groups_count;
+    cursor->below = 0;
+    return 0;
+}
+
+int ext2_allocate_block(
+    ext2_filesystem *fs,
+    uint32_t *new_block_num_out
+) {
+    if (fs == NULL || fs->superblock == NULL) {
         return INVALID_PARAMETER;
     }
+    return ext2_allocate_block_near(fs, fs->superblock->s_first_data_block, new_block_num_out);
+}
 
-    const uint32_t block_size = get_block_size(superblock);
-    uint8_t *bitmap_buffer = malloc(block_size);
-    if (bitmap_buffer == NULL) {
+int ext2_allocate_block_near(
+    ext2_filesystem *fs,
+    uint32_t goal,
+    uint32_t *new_block_num_out
+) {
+    if (fs == NULL || fs->superblock == NULL || fs->bgdt == NULL || new_block_num_out == NULL) {
+        return INVALID_PARAMETER;
+    }
+    if (fs->flags & EXT2_OPEN_MMAP) {
+        log_error("Cannot allocate a block on a read-only mapped image.\n");
         return ERROR;
     }
 
-    for (uint32_t group_idx = 0; group_idx < block_group_descriptor_table->groups_count; ++group_idx) {
-        if (block_group_descriptor_table->groups[group_idx].bg_free_blocks_count > 0) {
-            const uint32_t block_bitmap_block_id = block_group_descriptor_table->groups[group_idx].bg_block_bitmap;
+    uint32_t goal_bit;
+    group_cursor cursor = start_group_cursor(fs, goal, &goal_bit);
 
-            if (read_bitmap(file, superblock, block_bitmap_block_id, bitmap_buffer) != 0) {
-                log_error("Failed to read block bitmap for group %u\n", group_idx);
-                free(bitmap_buffer);
-                return ERROR;
-            }
+    int status = ERROR;
+    uint32_t group_idx;
+    while (status == ERROR && next_group(&cursor, &group_idx)) {
+        status = allocate_block_in_group(fs, group_idx, group_idx == cursor.goal_group ? goal_bit : 0,
+                                         new_block_num_out);
+    }
 
-            uint32_t free_bit_idx = 0;
-            if (find_first_free_bit(bitmap_buffer, superblock->s_inodes_per_group, &free_bit_idx) != SUCCESS) {
-                log_error("Failed to find a free block.");
-                return ERROR;
-            }
+    if (status == ERROR) {
+        log_error("No free blocks found in any block group.\n");
+    }
+    return status;
+}
 
-            // Mark bit as used
-            set_bit(bitmap_buffer, free_bit_idx);
+int ext2_free_blocks(
+    ext2_filesystem *fs,
+    const ext2_block_extent *extents,
+    const uint32_t extent_count
+) {
+    if (fs == NULL || fs->superblock == NULL || fs->bgdt == NULL || (extents == NULL && extent_count > 0)) {
+        return INVALID_PARAMETER;
+    }
+    if (fs->flags & EXT2_OPEN_MMAP) {
+        log_error("Cannot free blocks on a read-only mapped image.\n");
+        return ERROR;
+    }
 
-            // Write bitmap back to disk
-            if (write_bitmap(file, superblock, block_bitmap_block_id, bitmap_buffer) != 0) {
-                log_error("Failed to write updated block bitmap for group %u\n", group_idx);
-                free(bitmap_buffer);
-                return ERROR;
-            }
+    const ext2_super_block *superblock = fs->superblock;
+    int status = SUCCESS;
+    for (uint32_t i = 0; i < extent_count; ++i) {
+        if (extents[i].start < superblock->s_first_data_block ||
+            extents[i].start >= superblock->s_blocks_count ||
+            extents[i].length > superblock->s_blocks_count - extents[i].start) {
+            log_error("Cannot free blocks %u+%u: outside the filesystem.\n", extents[i].start, extents[i].length);
+            status = INVALID_PARAMETER;
+            continue;
+        }
 
-            // Update counts
-            block_group_descriptor_table->groups[group_idx].bg_free_blocks_count--;
-            superblock->s_free_blocks_count--;
+        // Split the extent at group boundaries.
+        uint32_t relative = extents[i].start - superblock->s_first_data_block;
+        uint32_t remaining = extents[i].length;
+        while (remaining > 0) {
+            const uint32_t group_idx = relative / superblock->s_blocks_per_group;
+            const uint32_t bit = relative % superblock->s_blocks_per_group;
+            const uint32_t room = superblock->s_blocks_per_group - bit;
+            const uint32_t length = remaining < room ? remaining : room;
 
-            // Write updated group descriptor and superblock back to disk
-            if (write_group_descriptor(file, superblock, group_idx, &block_group_descriptor_table->groups[group_idx]) !=
-                SUCCESS) {
-                log_error("Failed to write updated group descriptor for group %u\n", group_idx);
-                free(bitmap_buffer);
-                return ERROR;
+            ext2_lock_group(fs, group_idx);
+            uint8_t *bitmap = ext2_get_group_bitmap(fs, group_idx, EXT2_BLOCK_BITMAP);
+            if (bitmap == NULL) {
+                status = IO_ERROR;
+            } else {
+                // Only blocks that were in use go back to the free counts.
+                const uint32_t in_use = count_bits_in_range(bitmap, bit, length);
+                if (in_use != length) {
+                    log_error("Freeing blocks %u+%u: %u already free.\n",
+                              superblock->s_first_data_block + relative, length, length - in_use);
+                }
+                clear_bit_range(bitmap, bit, length);
+                if (in_use > 0 &&
+                    adjust_group_counts(fs, group_idx, EXT2_BLOCK_BITMAP, -(int32_t) in_use) != SUCCESS) {
+                    status = IO_ERROR;
+                }
             }
-            if (write_superblock(file, superblock) != 0) {
-                log_error("Failed to write updated superblock\n");
-                free(bitmap_buffer);
-                return ERROR;
+            ext2_unlock_group(fs, group_idx);
+
+            relative += length;
+            remaining -= length;
+        }
+    }
+
+    return status;
+}
+
+int ext2_allocate_blocks(
+    ext2_filesystem *fs,
+    const uint32_t goal,
+    const uint32_t count,
+    ext2_block_extent *extents_out,
+    const uint32_t max_extents,
+    uint32_t *extent_count_out
+) {
+    if (fs == NULL || fs->superblock == NULL || fs->bgdt == NULL || extents_out == NULL ||
+        extent_count_out == NULL || count == 0) {
+        return INVALID_PARAMETER;
+    }
+    if (fs->flags & EXT2_OPEN_MMAP) {
+        log_error("Cannot allocate blocks on a read-only mapped image.\n");
+        return ERROR;
+    }
+    const uint32_t free_blocks = free_total(fs, EXT2_BLOCK_BITMAP);
+    if (free_blocks < count) {
+        log_error("Only %u free blocks for a batch of %u.\n", free_blocks, count);
+        return ERROR;
+    }
+
+    const ext2_super_block *superblock = fs->superblock;
+    uint32_t goal_bit;
+    group_cursor cursor = start_group_cursor(fs, goal, &goal_bit);
+
+    uint32_t remaining = count;
+    uint32_t extent_count = 0;
+    int status = SUCCESS;
+    uint32_t group_idx;
+
+    while (remaining > 0 && status == SUCCESS && next_group(&cursor, &group_idx)) {
+        ext2_lock_group(fs, group_idx);
+        if (fs->bgdt->groups[group_idx].bg_free_blocks_count == 0) {
+            ext2_unlock_group(fs, group_idx);
+            continue;
+        }
+
+        uint8_t *bitmap = ext2_get_group_bitmap(fs, group_idx, EXT2_BLOCK_BITMAP);
+        if (bitmap == NULL) {
+            ext2_unlock_group(fs, group_idx);
+            status = IO_ERROR;
+            break;
+        }
+
+        const uint32_t block_count = group_block_count(superblock, group_idx);
+        uint32_t search_from = group_idx == cursor.goal_group && goal_bit < block_count ? goal_bit : 0;
+        uint32_t taken = 0;
+        uint32_t run_start;
+        uint32_t run_length;
+
+        while (remaining > 0 && find_free_run(bitmap, block_count, 1, search_from, &run_start, &run_length) == SUCCESS) {
+            if (extent_count == max_extents) {
+                status = ERROR;
+                break;
             }
 
-            // The first data block is at superblock->s_first_data_block (usually 0 or 1)
-            *new_block_num_out = group_idx * superblock->s_blocks_per_group + superblock->s_first_data_block +
-                                 free_bit_idx;
-            free(bitmap_buffer);
-            return SUCCESS;
+            const uint32_t length = run_length < remaining ? run_length : remaining;
+            set_bit_range(bitmap, run_start, length);
+
+            extents_out[extent_count].start = group_idx * superblock->s_blocks_per_group +
+                                              superblock->s_first_data_block + run_start;
+            extents_out[extent_count].length = length;
+            extent_count++;
+
+            taken += length;
+            remaining -= length;
+            search_from = run_start + length < block_count ? run_start + length : 0;
+        }
+
+        if (taken > 0 && adjust_group_counts(fs, group_idx, EXT2_BLOCK_BITMAP, (int32_t) taken) != SUCCESS) {
+            status = IO_ERROR;
         }
+        ext2_unlock_group(fs, group_idx);
     }
 
-    free(bitmap_buffer);
-    log_error("No free blocks found in any block group.\n");
-    return ERROR;
+    if (status == SUCCESS && remaining > 0) {
+        log_error("Free block counts disagree with the bitmaps; %u blocks short.\n", remaining);
+        status = ERROR;
+    }
+    if (status != SUCCESS) {
+        ext2_free_blocks(fs, extents_out, extent_count);
+        *extent_count_out = 0;
+        return status;
+    }
+
+    *extent_count_out = extent_count;
+    return SUCCESS;
+}
+
+int ext2_allocate_inodes(
+    ext2_filesystem *fs,
+    const uint32_t group_hint,
+    const uint32_t count,
+    uint32_t *inodes_out
+) {
+    if (fs == NULL || fs->superblock == NULL || fs->bgdt == NULL || inodes_out == NULL || count == 0 ||
+        fs->bgdt->groups_count == 0) {
+        return INVALID_PARAMETER;
+    }
+    if (fs->flags & EXT2_OPEN_MMAP) {
+        log_error("Cannot allocate inodes on a read-only mapped image.\n");
+        return ERROR;
+    }
+    const uint32_t free_inodes = free_total(fs, EXT2_INODE_BITMAP);
+    if (free_inodes < count) {
+        log_error("Only %u free inodes for a batch of %u.\n", free_inodes, count);
+        return ERROR;
+    }
+
+    const uint32_t inodes_per_group = fs->superblock->s_inodes_per_group;
+    const uint32_t first_group = group_hint < fs->bgdt->groups_count ? group_hint : 0;
+
+    uint32_t allocated = 0;
+    int status = SUCCESS;
+    uint32_t position = 0;
+    uint32_t group_idx;
+
+    while (allocated < count && status == SUCCESS &&
+           next_group_from(fs, EXT2_INODE_BITMAP, 1, first_group, &position, &group_idx) == SUCCESS) {
+        ext2_lock_group(fs, group_idx);
+        if (fs->bgdt->groups[group_idx].bg_free_inodes_count == 0) {
+            ext2_unlock_group(fs, group_idx);
+            continue;
+        }
+
+        uint8_t *bitmap = ext2_get_group_bitmap(fs, group_idx, EXT2_INODE_BITMAP);
+        if (bitmap == NULL) {
+            ext2_unlock_group(fs, group_idx);
+            status = IO_ERROR;
+            break;
+        }
+
+        uint32_t taken = 0;
+        uint32_t bit = 0;
+        while (allocated < count && find_next_free_bit(bitmap, inodes_per_group, bit, &bit) == SUCCESS) {
+            set_bit(bitmap, bit);
+            inodes_out[allocated++] = group_idx * inodes_per_group + bit + 1;
+            taken++;
+        }
+
+        if (taken > 0 && adjust_group_counts(fs, group_idx, EXT2_INODE_BITMAP, (int32_t) taken) != SUCCESS) {
+            status = IO_ERROR;
+        }
+        ext2_unlock_group(fs, group_idx);
+    }
+
+    if (status == SUCCESS && allocated < count) {
+        log_error("Free inode counts disagree with the bitmaps; %u inodes short.\n", count - allocated);
+        status = ERROR;
+    }
+    if (status != SUCCESS) {
+        // Give back what this call took.
+        for (uint32_t i = 0; i < allocated; ++i) {
+            const uint32_t group_idx = (inodes_out[i] - 1) / inodes_per_group;
+            ext2_lock_group(fs, group_idx);
+            clear_bit(ext2_get_group_bitmap(fs, group_idx, EXT2_INODE_BITMAP), (inodes_out[i] - 1) % inodes_per_group);
+            adjust_group_counts(fs, group_idx, EXT2_INODE_BITMAP, -1);
+            ext2_unlock_group(fs, group_idx);
+        }
+        return status;
+    }
+
+    return SUCCESS;
+}
+
+uint32_t ext2_inode_block_goal(
+    const ext2_filesystem *fs,
+    const uint32_t inode_num
+) {
+    const ext2_super_block *superblock = fs->superblock;
+    if (inode_num == 0 || superblock->s_inodes_per_group == 0) {
+        return superblock->s_first_data_block;
+    }
+
+    const uint32_t group_idx = (inode_num - 1) / superblock->s_inodes_per_group;
+    return superblock->s_first_data_block + group_idx * superblock->s_blocks_per_group;
+}
+
+/**
+ * @brief Wraps the stream-based allocation arguments in an uncached context.
+ */
+static ext2_filesystem *wrap_allocation_context(
+    ext2_stream_context *context,
+    FILE *file,
+    ext2_super_block *superblock,
+    const ext2_group_desc_table *block_group_descriptor_table
+) {
+    ext2_filesystem *fs = filesystem_wrap_stream(context, file, superblock, block_group_descriptor_table->groups);
+    context->table.groups_count = block_group_descriptor_table->groups_count;
+    return fs;
+}
+
+int allocate_inode(
+    FILE *file,
+    ext2_super_block *superblock,
+    const ext2_group_desc_table *block_group_descriptor_table,
+    uint32_t *new_inode_num_out
+) {
+    if (file == NULL || superblock == NULL || block_group_descriptor_table == NULL || new_inode_num_out == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    ext2_stream_context context;
+    ext2_filesystem *fs = wrap_allocation_context(&context, file, superblock, block_group_descriptor_table);
+    return filesystem_finish_stream(fs, ext2_allocate_inode(fs, new_inode_num_out));
+}
+
+int allocate_block(
+    FILE *file,
+    ext2_super_block *superblock,
+    const ext2_group_desc_table *block_group_descriptor_table,
+    uint32_t *new_block_num_out
+) {
+    if (file == NULL || superblock == NULL || block_group_descriptor_table == NULL || new_block_num_out == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    ext2_stream_context context;
+    ext2_filesystem *fs = wrap_allocation_context(&context, file, superblock, block_group_descriptor_table);
+    return filesystem_finish_stream(fs, ext2_allocate_block(fs, new_block_num_out));
 }
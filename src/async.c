@@ -0,0 +1,329 @@
+/**
+ * @file async.c
+ * @brief Implements the asynchronous metadata operation queue.
+ *
+ * Queued operations form a singly linked FIFO guarded by the engine's mutex.
+ * Worker threads take one operation at a time and run it with the ordinary
+ * synchronous calls, which are served from the context's caches whenever
+ * possible; a miss blocks the worker until its read returns. A waiter sleeps on a condition shared by all of the engine's
+ * operations and checks its own operation's completion flag. Callbacks run
+ * outside the lock, after which the engine no longer touches the operation.
+ */
+
+#include "async.h"
+#include "directory.h"
+#include "inode.h"
+#include "globals.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct ext2_async {
+    ext2_filesystem *fs;
+    pthread_mutex_t lock;
+    pthread_cond_t queued;     // Signalled when an operation is queued or the engine stops
+    pthread_cond_t completed;  // Broadcast when an operation without a callback completes
+    ext2_async_op *head;       // Next operation to run
+    ext2_async_op *tail;       // Last queued operation
+    int stopping;
+    uint32_t thread_count;
+    pthread_t *threads;
+};
+
+/**
+ * @brief Copies the in-use entries of a directory into an operation.
+ */
+static int run_readdir(ext2_filesystem *fs, ext2_async_op *op) {
+    ext2_dir_iter iter;
+    int status = ext2_dir_iter_open(&iter, fs, op->inode_num);
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    // Names are packed into one buffer and only pointed at once it stops moving.
+    uint32_t capacity = 0;
+    size_t names_length = 0;
+    size_t names_capacity = 0;
+    const ext2_directory_entry *entry;
+    while ((status = ext2_dir_iter_next(&iter, &entry)) > 0) {
+        if (op->entry_count == capacity) {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            ext2_async_dirent *grown = realloc(op->entries, capacity * sizeof(ext2_async_dirent));
+            if (grown == NULL) {
+                status = ERROR;
+                break;
+            }
+            op->entries = grown;
+        }
+        if (names_length + entry->name_len + 1 > names_capacity) {
+            names_capacity = names_capacity == 0 ? 256 : names_capacity * 2;
+            while (names_length + entry->name_len + 1 > names_capacity) {
+                names_capacity *= 2;
+            }
+            char *grown = realloc(op->names, names_capacity);
+            if (grown == NULL) {
+                status = ERROR;
+                break;
+            }
+            op->names = grown;
+        }
+
+        ext2_async_dirent *out = &op->entries[op->entry_count++];
+        out->inode = entry->inode;
+        out->file_type = entry->file_type;
+        out->name_len = entry->name_len;
+        out->name = (const char *) (uintptr_t) names_length;
+        memcpy(op->names + names_length, entry->name, entry->name_len);
+        op->names[names_length + entry->name_len] = '\0';
+        names_length += entry->name_len + 1;
+    }
+    ext2_dir_iter_close(&iter);
+
+    for (uint32_t i = 0; i < op->entry_count; ++i) {
+        op->entries[i].name = op->names + (uintptr_t) op->entries[i].name;
+    }
+    return status < 0 ? status : SUCCESS;
+}
+
+static void run_op(ext2_filesystem *fs, ext2_async_op *op) {
+    switch (op->kind) {
+        case EXT2_ASYNC_LOOKUP:
+            op->inode_num = ext2_lookup(fs, op->path);
+            op->status = op->inode_num != 0 ? SUCCESS : ERROR;
+            break;
+        case EXT2_ASYNC_READ_INODE:
+            op->status = ext2_read_inode(fs, op->inode_num, &op->inode);
+            break;
+        case EXT2_ASYNC_READDIR:
+            op->status = run_readdir(fs, op);
+            break;
+    }
+}
+
+static void *run_worker(void *arg) {
+    ext2_async *engine = arg;
+
+    pthread_mutex_lock(&engine->lock);
+    for (;;) {
+        while (engine->head == NULL && !engine->stopping) {
+            pthread_cond_wait(&engine->queued, &engine->lock);
+        }
+        ext2_async_op *op = engine->head;
+        if (op == NULL) {
+            break; // Stopping, and the queue is drained
+        }
+        engine->head = op->next;
+        if (engine->head == NULL) {
+            engine->tail = NULL;
+        }
+        pthread_mutex_unlock(&engine->lock);
+
+        run_op(engine->fs, op);
+        if (op->callback != NULL) {
+            op->complete = 1;
+            op->callback(op, op->user_data);
+            pthread_mutex_lock(&engine->lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&engine->lock);
+        __atomic_store_n(&op->complete, 1, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&engine->completed);
+    }
+    pthread_mutex_unlock(&engine->lock);
+    return NULL;
+}
+
+/**
+ * @brief Allocates an operation of the given kind.
+ */
+static ext2_async_op *new_op(
+    ext2_async *engine,
+    const ext2_async_kind kind,
+    const ext2_async_callback callback,
+    void *user_data
+) {
+    if (engine == NULL) {
+        log_error("Error (async): NULL engine.\n");
+        return NULL;
+    }
+
+    ext2_async_op *op = calloc(1, sizeof(ext2_async_op));
+    if (op == NULL) {
+        log_error("Error (async): Failed to allocate an operation.\n");
+        return NULL;
+    }
+    op->kind = kind;
+    op->engine = engine;
+    op->callback = callback;
+    op->user_data = user_data;
+    return op;
+}
+
+/**
+ * @brief Appends an operation to the queue and wakes a worker.
+ *
+ * @return The operation, or NULL (after freeing it) if the engine is stopping.
+ */
+static ext2_async_op *enqueue(ext2_async_op *op) {
+    ext2_async *engine = op->engine;
+
+    pthread_mutex_lock(&engine->lock);
+    if (engine->stopping) {
+        pthread_mutex_unlock(&engine->lock);
+        log_error("Error (async): Engine is stopping.\n");
+        ext2_async_op_free(op);
+        return NULL;
+    }
+    if (engine->tail != NULL) {
+        engine->tail->next = op;
+    } else {
+        engine->head = op;
+    }
+    engine->tail = op;
+    pthread_cond_signal(&engine->queued);
+    pthread_mutex_unlock(&engine->lock);
+    return op;
+}
+
+ext2_async *ext2_async_create(ext2_filesystem *fs, uint32_t threads) {
+    if (fs == NULL) {
+        log_error("Error (async): NULL filesystem context.\n");
+        return NULL;
+    }
+    if (threads == 0) {
+        const long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (uint32_t) online : 1;
+    }
+
+    ext2_async *engine = calloc(1, sizeof(ext2_async));
+    pthread_t *ids = calloc(threads, sizeof(pthread_t));
+    if (engine == NULL || ids == NULL) {
+        log_error("Error (async): Failed to allocate the engine.\n");
+        free(engine);
+        free(ids);
+        return NULL;
+    }
+    engine->fs = fs;
+    engine->threads = ids;
+    pthread_mutex_init(&engine->lock, NULL);
+    pthread_cond_init(&engine->queued, NULL);
+    pthread_cond_init(&engine->completed, NULL);
+
+    for (; engine->thread_count < threads; ++engine->thread_count) {
+        if (pthread_create(&engine->threads[engine->thread_count], NULL, run_worker, engine) != 0) {
+            log_error("Error (async): Failed to start worker %u.\n", engine->thread_count);
+            ext2_async_destroy(engine);
+            return NULL;
+        }
+    }
+
+    return engine;
+}
+
+void ext2_async_destroy(ext2_async *engine) {
+    if (engine == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&engine->lock);
+    engine->stopping = 1;
+    pthread_cond_broadcast(&engine->queued);
+    pthread_mutex_unlock(&engine->lock);
+
+    for (uint32_t i = 0; i < engine->thread_count; ++i) {
+        pthread_join(engine->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&engine->completed);
+    pthread_cond_destroy(&engine->queued);
+    pthread_mutex_destroy(&engine->lock);
+    free(engine->threads);
+    free(engine);
+}
+
+ext2_async_op *ext2_lookup_async(
+    ext2_async *engine,
+    const char *path,
+    const ext2_async_callback callback,
+    void *user_data
+) {
+    if (path == NULL) {
+        log_error("Error (async): NULL path.\n");
+        return NULL;
+    }
+
+    ext2_async_op *op = new_op(engine, EXT2_ASYNC_LOOKUP, callback, user_data);
+    if (op == NULL) {
+        return NULL;
+    }
+    op->path = strdup(path);
+    if (op->path == NULL) {
+        log_error("Error (async): Failed to copy the path.\n");
+        ext2_async_op_free(op);
+        return NULL;
+    }
+    return enqueue(op);
+}
+
+ext2_async_op *ext2_read_inode_async(
+    ext2_async *engine,
+    const uint32_t inode_num,
+    const ext2_async_callback callback,
+    void *user_data
+) {
+    ext2_async_op *op = new_op(engine, EXT2_ASYNC_READ_INODE, callback, user_data);
+    if (op == NULL) {
+        return NULL;
+    }
+    op->inode_num = inode_num;
+    return enqueue(op);
+}
+
+ext2_async_op *ext2_readdir_async(
+    ext2_async *engine,
+    const uint32_t dir_inode_num,
+    const ext2_async_callback callback,
+    void *user_data
+) {
+    ext2_async_op *op = new_op(engine, EXT2_ASYNC_READDIR, callback, user_data);
+    if (op == NULL) {
+        return NULL;
+    }
+    op->inode_num = dir_inode_num;
+    return enqueue(op);
+}
+
+int ext2_async_poll(ext2_async_op *op) {
+    return op != NULL && __atomic_load_n(&op->complete, __ATOMIC_ACQUIRE);
+}
+
+int ext2_async_wait(ext2_async_op *op) {
+    if (op == NULL) {
+        return INVALID_PARAMETER;
+    }
+    if (ext2_async_poll(op)) {
+        return op->status; // Also safe once the engine has been destroyed
+    }
+
+    ext2_async *engine = op->engine;
+    pthread_mutex_lock(&engine->lock);
+    while (!op->complete) {
+        pthread_cond_wait(&engine->completed, &engine->lock);
+    }
+    pthread_mutex_unlock(&engine->lock);
+    return op->status;
+}
+
+void ext2_async_op_free(ext2_async_op *op) {
+    if (op == NULL) {
+        return;
+    }
+
+    free(op->path);
+    free(op->entries);
+    free(op->names);
+    free(op);
+}
@@ -1,59 +1,306 @@
 /**
  * @file bitmap.c
  * @brief Implements functions for reading, writing, and manipulating ext2 bitmaps.
+ *
+ * find_first_free_bit() dispatches to the fastest scanner the CPU supports. The
+ * scalar scanner inverts 64-bit words and counts trailing zeros; the SSE2 and
+ * AVX2 scanners skip fully allocated 16- and 32-byte runs before handing the
+ * first run with a free bit to the word scanner.
  */
 
 #include "bitmap.h"
+#include "block_cache.h"
 #include "superblock.h"
+#include "block_group.h"
+#include "filesystem.h"
 #include "globals.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-int read_bitmap(
-    FILE *file,
-    const ext2_super_block *superblock,
+#if defined(__x86_64__) || defined(__i386__)
+#define EXT2_BITMAP_X86 1
+#include <immintrin.h>
+#endif
+
+typedef int (*bitmap_scan_fn)(const uint8_t *bitmap_buffer, uint32_t size_in_bits, uint32_t *first_free_bit_index);
+
+int ext2_read_bitmap(
+    ext2_filesystem *fs,
     const uint32_t bitmap_block_id,
     uint8_t *bitmap_buffer
 ) {
-    const uint32_t block_size = get_block_size(superblock);
+    const uint32_t block_size = get_block_size(fs->superblock);
     const off_t offset = (off_t) bitmap_block_id * block_size;
 
-    if (fseeko(file, offset, SEEK_SET) != 0) {
-        log_error("read_bitmap: fseeko");
+    if (filesystem_read(fs, offset, block_size, bitmap_buffer) != SUCCESS) {
+        log_error("read_bitmap: reading block %u", bitmap_block_id);
         return IO_ERROR;
     }
 
-    if (fread(bitmap_buffer, block_size, 1, file) != 1) {
-        log_error("read_bitmap: fread");
+    return SUCCESS;
+}
+
+int ext2_write_bitmap(
+    ext2_filesystem *fs,
+    const uint32_t bitmap_block_id,
+    const uint8_t *bitmap_buffer
+) {
+    const uint32_t block_size = get_block_size(fs->superblock);
+    const off_t offset = (off_t) bitmap_block_id * block_size;
+
+    if (filesystem_write(fs, offset, block_size, bitmap_buffer) != SUCCESS) {
+        log_error("write_bitmap: writing block %u", bitmap_block_id);
         return IO_ERROR;
     }
 
     return SUCCESS;
 }
 
+/**
+ * @brief Returns the cache slot and on-disk block of one of a group's bitmaps.
+ */
+static uint8_t **group_bitmap_slot(
+    const ext2_filesystem *fs,
+    const uint32_t group_index,
+    const ext2_bitmap_kind kind,
+    uint32_t *block_id_out,
+    int **dirty_out
+) {
+    ext2_group_bitmaps *entry = &fs->bitmaps[group_index];
+    const ext2_group_desc *desc = &fs->bgdt->groups[group_index];
+
+    if (kind == EXT2_INODE_BITMAP) {
+        *block_id_out = desc->bg_inode_bitmap;
+        *dirty_out = &entry->inode_bitmap_dirty;
+        return &entry->inode_bitmap;
+    }
+    *block_id_out = desc->bg_block_bitmap;
+    *dirty_out = &entry->block_bitmap_dirty;
+    return &entry->block_bitmap;
+}
+
+uint8_t *ext2_get_group_bitmap(
+    ext2_filesystem *fs,
+    const uint32_t group_index,
+    const ext2_bitmap_kind kind
+) {
+    if (fs == NULL || fs->bgdt == NULL || group_index >= fs->bgdt->groups_count) {
+        log_error("get_group_bitmap: invalid group %u", group_index);
+        return NULL;
+    }
+
+    if (fs->bitmaps == NULL) {
+        fs->bitmaps = calloc(fs->bgdt->groups_count, sizeof(ext2_group_bitmaps));
+        if (fs->bitmaps == NULL) {
+            log_error("get_group_bitmap: allocating bitmap cache");
+            return NULL;
+        }
+    }
+
+    uint32_t block_id;
+    int *dirty;
+    uint8_t **slot = group_bitmap_slot(fs, group_index, kind, &block_id, &dirty);
+    if (*slot != NULL) {
+        return *slot;
+    }
+
+    uint8_t *bitmap = malloc(get_block_size(fs->superblock));
+    if (bitmap == NULL) {
+        log_error("get_group_bitmap: allocating bitmap for group %u", group_index);
+        return NULL;
+    }
+    if (ext2_read_bitmap(fs, block_id, bitmap) != SUCCESS) {
+        free(bitmap);
+        return NULL;
+    }
+
+    *slot = bitmap;
+    *dirty = 0;
+    return bitmap;
+}
+
+int ext2_load_group_bitmaps(
+    ext2_filesystem *fs,
+    const ext2_bitmap_kind kind
+) {
+    if (fs == NULL || fs->bgdt == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    int status = SUCCESS;
+    const uint32_t groups = fs->bgdt->groups_count;
+    for (uint32_t first = 0; first < groups; first += EXT2_PREFETCH_BATCH) {
+        const uint32_t end = groups - first < EXT2_PREFETCH_BATCH ? groups : first + EXT2_PREFETCH_BATCH;
+
+        // Read the window's missing bitmaps in one batch, then take them from the cache.
+        if (fs->cache != NULL) {
+            uint32_t blocks[EXT2_PREFETCH_BATCH];
+            uint32_t count = 0;
+            for (uint32_t group = first; group < end; ++group) {
+                ext2_lock_group(fs, group);
+                uint32_t block_id;
+                int *dirty;
+                if (fs->bitmaps == NULL || *group_bitmap_slot(fs, group, kind, &block_id, &dirty) == NULL) {
+                    const ext2_group_desc *desc = &fs->bgdt->groups[group];
+                    blocks[count++] = kind == EXT2_INODE_BITMAP ? desc->bg_inode_bitmap : desc->bg_block_bitmap;
+                }
+                ext2_unlock_group(fs, group);
+            }
+            block_cache_prefetch(fs->cache, blocks, count);
+        }
+
+        for (uint32_t group = first; group < end; ++group) {
+            ext2_lock_group(fs, group);
+            if (ext2_get_group_bitmap(fs, group, kind) == NULL) {
+                status = IO_ERROR;
+            }
+            ext2_unlock_group(fs, group);
+        }
+    }
+
+    return status;
+}
+
+void ext2_mark_group_bitmap_dirty(
+    ext2_filesystem *fs,
+    const uint32_t group_index,
+    const ext2_bitmap_kind kind
+) {
+    if (fs == NULL || fs->bitmaps == NULL || group_index >= fs->bgdt->groups_count) {
+        return;
+    }
+
+    uint32_t block_id;
+    int *dirty;
+    if (*group_bitmap_slot(fs, group_index, kind, &block_id, &dirty) != NULL) {
+        *dirty = 1;
+    }
+}
+
+int ext2_flush_group_bitmaps(
+    ext2_filesystem *fs
+) {
+    if (fs == NULL || fs->bitmaps == NULL) {
+        return SUCCESS;
+    }
+
+    int status = SUCCESS;
+    for (uint32_t group_idx = 0; group_idx < fs->bgdt->groups_count; ++group_idx) {
+        ext2_lock_group(fs, group_idx);
+        for (int kind = EXT2_BLOCK_BITMAP; kind <= EXT2_INODE_BITMAP; ++kind) {
+            uint32_t block_id;
+            int *dirty;
+            uint8_t **slot = group_bitmap_slot(fs, group_idx, (ext2_bitmap_kind) kind, &block_id, &dirty);
+            if (*slot == NULL || !*dirty) {
+                continue;
+            }
+            if (ext2_write_bitmap(fs, block_id, *slot) != SUCCESS) {
+                status = IO_ERROR;
+                continue;
+            }
+            *dirty = 0;
+        }
+        ext2_unlock_group(fs, group_idx);
+    }
+
+    return status;
+}
+
+void ext2_release_group_bitmaps(
+    ext2_filesystem *fs
+) {
+    if (fs == NULL || fs->bitmaps == NULL) {
+        return;
+    }
+
+    for (uint32_t group_idx = 0; group_idx < fs->bgdt->groups_count; ++group_idx) {
+        free(fs->bitmaps[group_idx].block_bitmap);
+        free(fs->bitmaps[group_idx].inode_bitmap);
+    }
+    free(fs->bitmaps);
+    fs->bitmaps = NULL;
+}
+
+int read_bitmap(
+    FILE *file,
+    const ext2_super_block *superblock,
+    const uint32_t bitmap_block_id,
+    uint8_t *bitmap_buffer
+) {
+    ext2_stream_context context;
+    return ext2_read_bitmap(filesystem_wrap_stream(&context, file, superblock, NULL), bitmap_block_id, bitmap_buffer);
+}
+
 int write_bitmap(
     FILE *file,
     const ext2_super_block *superblock,
     const uint32_t bitmap_block_id,
     const uint8_t *bitmap_buffer
 ) {
-    const uint32_t block_size = get_block_size(superblock);
-    const off_t offset = (off_t) bitmap_block_id * block_size;
+    ext2_stream_context context;
+    return ext2_write_bitmap(filesystem_wrap_stream(&context, file, superblock, NULL), bitmap_block_id, bitmap_buffer);
+}
 
-    if (fseeko(file, offset, SEEK_SET) != 0) {
-        log_error("write_bitmap: fseeko");
-        return IO_ERROR;
+/**
+ * @brief Loads 64 bitmap bits so that bit i of the result is bitmap bit `byte * 8 + i`.
+ */
+static uint64_t load_bitmap_word(const uint8_t *bytes) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+/**
+ * @brief Scans for a free bit with 64-bit words, starting at a word-aligned byte.
+ * @param bitmap_buffer The buffer containing the bitmap.
+ * @param start_byte Byte to start at; a multiple of 8 no further than the last whole word.
+ * @param size_in_bits The total number of bits in the bitmap.
+ * @param first_free_bit_index The found index of the first free bit.
+ * @return 0 on success, or ERROR if every bit from `start_byte` on is set.
+ */
+static int scan_words(
+    const uint8_t *bitmap_buffer,
+    const uint32_t start_byte,
+    const uint32_t size_in_bits,
+    uint32_t *first_free_bit_index
+) {
+    const uint32_t whole_words_end = size_in_bits / 64 * 8;
+    uint32_t byte_idx = start_byte;
+
+    for (; byte_idx < whole_words_end; byte_idx += 8) {
+        const uint64_t free_bits = ~load_bitmap_word(bitmap_buffer + byte_idx);
+        if (free_bits != 0) {
+            *first_free_bit_index = byte_idx * 8 + (uint32_t) __builtin_ctzll(free_bits);
+            return SUCCESS;
+        }
     }
 
-    if (fwrite(bitmap_buffer, block_size, 1, file) != 1) {
-        log_error("write_bitmap: fwrite");
-        return IO_ERROR;
+    // Fewer than 64 bits remain; never read past the last byte of the bitmap.
+    const uint32_t tail_bits = size_in_bits - byte_idx * 8;
+    if (tail_bits == 0) {
+        return ERROR;
     }
 
+    uint64_t tail = 0;
+    for (uint32_t i = 0; i < (tail_bits + 7) / 8; ++i) {
+        tail |= (uint64_t) bitmap_buffer[byte_idx + i] << (8 * i);
+    }
+
+    const uint64_t free_bits = ~tail & ((UINT64_C(1) << tail_bits) - 1);
+    if (free_bits == 0) {
+        return ERROR;
+    }
+
+    *first_free_bit_index = byte_idx * 8 + (uint32_t) __builtin_ctzll(free_bits);
     return SUCCESS;
 }
 
-int find_first_free_bit(
+static int scan_bytes(
     const uint8_t *bitmap_buffer,
     const uint32_t size_in_bits,
     uint32_t *first_free_bit_index
@@ -73,6 +320,132 @@ int find_first_free_bit(
     return ERROR;
 }
 
+static int scan_scalar(
+    const uint8_t *bitmap_buffer,
+    const uint32_t size_in_bits,
+    uint32_t *first_free_bit_index
+) {
+    return scan_words(bitmap_buffer, 0, size_in_bits, first_free_bit_index);
+}
+
+#ifdef EXT2_BITMAP_X86
+__attribute__((target("sse2")))
+static int scan_sse2(
+    const uint8_t *bitmap_buffer,
+    const uint32_t size_in_bits,
+    uint32_t *first_free_bit_index
+) {
+    const uint32_t whole_bytes = size_in_bits / 8;
+    const __m128i all_ones = _mm_set1_epi8((char) 0xFF);
+
+    uint32_t byte_idx = 0;
+    for (; byte_idx + 16 <= whole_bytes; byte_idx += 16) {
+        const __m128i chunk = _mm_loadu_si128((const __m128i *) (bitmap_buffer + byte_idx));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, all_ones)) != 0xFFFF) {
+            break;
+        }
+    }
+
+    return scan_words(bitmap_buffer, byte_idx, size_in_bits, first_free_bit_index);
+}
+
+__attribute__((target("avx2")))
+static int scan_avx2(
+    const uint8_t *bitmap_buffer,
+    const uint32_t size_in_bits,
+    uint32_t *first_free_bit_index
+) {
+    const uint32_t whole_bytes = size_in_bits / 8;
+    const __m256i all_ones = _mm256_set1_epi8((char) 0xFF);
+
+    uint32_t byte_idx = 0;
+    for (; byte_idx + 32 <= whole_bytes; byte_idx += 32) {
+        const __m256i chunk = _mm256_loadu_si256((const __m256i *) (bitmap_buffer + byte_idx));
+        if (!_mm256_testc_si256(chunk, all_ones)) {
+            break;
+        }
+    }
+
+    return scan_words(bitmap_buffer, byte_idx, size_in_bits, first_free_bit_index);
+}
+#endif
+
+/**
+ * @brief Returns the implementation behind a scanner, or NULL if this CPU cannot run it.
+ */
+static bitmap_scan_fn scanner_function(const ext2_bitmap_scanner scanner) {
+#ifdef EXT2_BITMAP_X86
+    // Required when called from a constructor, before libgcc has probed the CPU.
+    __builtin_cpu_init();
+#endif
+    switch (scanner) {
+        case EXT2_BITMAP_SCAN_BYTEWISE:
+            return scan_bytes;
+        case EXT2_BITMAP_SCAN_SCALAR:
+            return scan_scalar;
+#ifdef EXT2_BITMAP_X86
+        case EXT2_BITMAP_SCAN_SSE2:
+            return __builtin_cpu_supports("sse2") ? scan_sse2 : NULL;
+        case EXT2_BITMAP_SCAN_AVX2:
+            return __builtin_cpu_supports("avx2") ? scan_avx2 : NULL;
+#endif
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * @brief Picks the widest scanner the CPU supports.
+ */
+static ext2_bitmap_scanner best_scanner(void) {
+    if (scanner_function(EXT2_BITMAP_SCAN_AVX2) != NULL) {
+        return EXT2_BITMAP_SCAN_AVX2;
+    }
+    if (scanner_function(EXT2_BITMAP_SCAN_SSE2) != NULL) {
+        return EXT2_BITMAP_SCAN_SSE2;
+    }
+    return EXT2_BITMAP_SCAN_SCALAR;
+}
+
+static bitmap_scan_fn active_scan = NULL;
+static ext2_bitmap_scanner active_scanner = EXT2_BITMAP_SCAN_AUTO;
+
+/**
+ * @brief Resolves the scanner once at load time so find_first_free_bit() never checks CPUID.
+ */
+__attribute__((constructor))
+static void init_bitmap_scanner(void) {
+    set_bitmap_scanner(EXT2_BITMAP_SCAN_AUTO);
+}
+
+int set_bitmap_scanner(const ext2_bitmap_scanner scanner) {
+    const ext2_bitmap_scanner resolved = scanner == EXT2_BITMAP_SCAN_AUTO ? best_scanner() : scanner;
+
+    const bitmap_scan_fn function = scanner_function(resolved);
+    if (function == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    active_scan = function;
+    active_scanner = resolved;
+    return SUCCESS;
+}
+
+ext2_bitmap_scanner get_bitmap_scanner(void) {
+    return active_scanner;
+}
+
+int find_first_free_bit(
+    const uint8_t *bitmap_buffer,
+    const uint32_t size_in_bits,
+    uint32_t *first_free_bit_index
+) {
+    if (active_scan == NULL) {
+        init_bitmap_scanner();
+    }
+    return active_scan(bitmap_buffer, size_in_bits, first_free_bit_index);
+}
+
 void set_bit(
     uint8_t *bitmap_buffer,
     const uint32_t bit_index
@@ -90,3 +463,212 @@ void clear_bit(
     const uint8_t bit_idx_in_byte = bit_index % 8;
     bitmap_buffer[byte_idx] &= ~(1 << bit_idx_in_byte);
 }
+
+/**
+ * @brief Loads the `word_idx`-th 64-bit word, reading bits past the end of the bitmap as set.
+ */
+static uint64_t load_word_at(
+    const uint8_t *bitmap_buffer,
+    const uint32_t word_idx,
+    const uint32_t size_in_bits
+) {
+    const uint32_t remaining_bits = size_in_bits - word_idx * 64;
+    if (remaining_bits >= 64) {
+        return load_bitmap_word(bitmap_buffer + (size_t) word_idx * 8);
+    }
+
+    uint64_t word = 0;
+    for (uint32_t i = 0; i < (remaining_bits + 7) / 8; ++i) {
+        word |= (uint64_t) bitmap_buffer[(size_t) word_idx * 8 + i] << (8 * i);
+    }
+    return word | ~UINT64_C(0) << remaining_bits;
+}
+
+/**
+ * @brief Finds the next bit at or after `from` that is set (or clear).
+ * @param bitmap_buffer The buffer containing the bitmap.
+ * @param size_in_bits The total number of bits in the bitmap.
+ * @param from The first bit to examine.
+ * @param want_set Non-zero to look for a set bit, zero for a clear one.
+ * @return Index of the bit, or `size_in_bits` if there is none.
+ */
+static uint32_t find_next_bit(
+    const uint8_t *bitmap_buffer,
+    const uint32_t size_in_bits,
+    const uint32_t from,
+    const int want_set
+) {
+    if (from >= size_in_bits) {
+        return size_in_bits;
+    }
+
+    uint32_t word_idx = from / 64;
+    uint64_t word = load_word_at(bitmap_buffer, word_idx, size_in_bits);
+    if (!want_set) {
+        word = ~word;
+    }
+    word &= ~UINT64_C(0) << (from % 64);
+
+    while (word == 0) {
+        if (++word_idx >= (size_in_bits + 63) / 64) {
+            return size_in_bits;
+        }
+        word = load_word_at(bitmap_buffer, word_idx, size_in_bits);
+        if (!want_set) {
+            word = ~word;
+        }
+    }
+
+    const uint32_t index = word_idx * 64 + (uint32_t) __builtin_ctzll(word);
+    return index < size_in_bits ? index : size_in_bits;
+}
+
+/**
+ * @brief Looks for a long enough free run that starts in [from, start_limit).
+ */
+static int scan_for_run(
+    const uint8_t *bitmap_buffer,
+    const uint32_t size_in_bits,
+    const uint32_t min_len,
+    const uint32_t from,
+    const uint32_t start_limit,
+    uint32_t *run_start,
+    uint32_t *run_length
+) {
+    uint32_t position = from;
+    while (position < start_limit) {
+        const uint32_t start = find_next_bit(bitmap_buffer, size_in_bits, position, 0);
+        if (start >= start_limit) {
+            break;
+        }
+
+        const uint32_t end = find_next_bit(bitmap_buffer, size_in_bits, start, 1);
+        if (end - start >= min_len) {
+            *run_start = start;
+            *run_length = end - start;
+            return SUCCESS;
+        }
+        position = end;
+    }
+    return ERROR;
+}
+
+int find_next_free_bit(
+    const uint8_t *bitmap_buffer,
+    const uint32_t size_in_bits,
+    const uint32_t from,
+    uint32_t *free_bit_index
+) {
+    const uint32_t index = find_next_bit(bitmap_buffer, size_in_bits, from, 0);
+    if (index >= size_in_bits) {
+        return ERROR;
+    }
+
+    *free_bit_index = index;
+    return SUCCESS;
+}
+
+int find_free_run(
+    const uint8_t *bitmap_buffer,
+    const uint32_t size_in_bits,
+    const uint32_t min_len,
+    uint32_t goal,
+    uint32_t *run_start,
+    uint32_t *run_length
+) {
+    if (bitmap_buffer == NULL || run_start == NULL || run_length == NULL || min_len == 0) {
+        return INVALID_PARAMETER;
+    }
+    if (min_len > size_in_bits) {
+        return ERROR;
+    }
+    if (goal >= size_in_bits) {
+        goal = 0;
+    }
+
+    if (scan_for_run(bitmap_buffer, size_in_bits, min_len, goal, size_in_bits, run_start, run_length) == SUCCESS) {
+        return SUCCESS;
+    }
+    return scan_for_run(bitmap_buffer, size_in_bits, min_len, 0, goal, run_start, run_length);
+}
+
+/**
+ * @brief Sets or clears a range of bits: masked edge bytes plus one memset for the middle.
+ */
+static void fill_bit_range(
+    uint8_t *bitmap_buffer,
+    const uint32_t first_bit,
+    const uint32_t count,
+    const int value
+) {
+    if (count == 0) {
+        return;
+    }
+
+    uint32_t bit = first_bit;
+    const uint32_t end = first_bit + count;
+
+    // Leading partial byte
+    if (bit % 8 != 0) {
+        const uint32_t bits_here = end - bit < 8 - bit % 8 ? end - bit : 8 - bit % 8;
+        const uint8_t mask = (uint8_t) (((1u << bits_here) - 1) << (bit % 8));
+        if (value) {
+            bitmap_buffer[bit / 8] |= mask;
+        } else {
+            bitmap_buffer[bit / 8] &= (uint8_t) ~mask;
+        }
+        bit += bits_here;
+    }
+
+    // Whole bytes
+    const uint32_t whole_bytes = (end - bit) / 8;
+    if (whole_bytes > 0) {
+        memset(bitmap_buffer + bit / 8, value ? 0xFF : 0x00, whole_bytes);
+        bit += whole_bytes * 8;
+    }
+
+    // Trailing partial byte
+    if (bit < end) {
+        const uint8_t mask = (uint8_t) ((1u << (end - bit)) - 1);
+        if (value) {
+            bitmap_buffer[bit / 8] |= mask;
+        } else {
+            bitmap_buffer[bit / 8] &= (uint8_t) ~mask;
+        }
+    }
+}
+
+void set_bit_range(
+    uint8_t *bitmap_buffer,
+    const uint32_t first_bit,
+    const uint32_t count
+) {
+    fill_bit_range(bitmap_buffer, first_bit, count, 1);
+}
+
+void clear_bit_range(
+    uint8_t *bitmap_buffer,
+    const uint32_t first_bit,
+    const uint32_t count
+) {
+    fill_bit_range(bitmap_buffer, first_bit, count, 0);
+}
+
+uint32_t count_bits_in_range(
+    const uint8_t *bitmap_buffer,
+    const uint32_t first_bit,
+    const uint32_t count
+) {
+    uint32_t total = 0;
+    uint32_t bit = first_bit;
+    const uint32_t end = first_bit + count;
+
+    // Partial bytes at either end are masked; whole bytes are counted directly.
+    while (bit < end) {
+        const uint32_t bits_here = end - bit < 8 - bit % 8 ? end - bit : 8 - bit % 8;
+        const uint8_t mask = (uint8_t) (((1u << bits_here) - 1) << (bit % 8));
+        total += (uint32_t) __builtin_popcount(bitmap_buffer[bit / 8] & mask);
+        bit += bits_here;
+    }
+    return total;
+}
@@ -0,0 +1,640 @@
+/**
+ * @file block_cache.c
+ * @brief Implements a fixed-capacity, write-back block cache with CLOCK eviction.
+ *
+ * Blocks are spread over the cache's shards by block number, so consecutive
+ * blocks land in different shards. Within its shard a buffer is located through
+ * a chained hash table keyed by block number. On a miss the shard first hands
+ * out buffers that have never been used, then sweeps its clock hand over its
+ * ring, skipping pinned buffers and giving referenced buffers a second chance
+ * before evicting them. Every function takes the lock of each shard it touches
+ * for the whole of its work on that shard, including device I/O on a miss. The
+ * exception is block_cache_prefetch(), which stages a batch outside the cache
+ * and only locks each shard to install the blocks that are still missing.
+ */
+
+#include "block_cache.h"
+#include "block_device.h"
+#include "cache_shard.h"
+#include "globals.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_BUFFER UINT32_MAX
+
+/**
+ * @brief Returns the shard responsible for a block.
+ */
+static ext2_cache_shard *shard_of(
+    const ext2_block_cache *cache,
+    const uint32_t block_id
+) {
+    return &cache->shards[block_id & (cache->shard_count - 1)];
+}
+
+/**
+ * @brief Maps a block number to a hash chain of its shard using Fibonacci hashing.
+ * @param shard The block's shard.
+ * @param block_id The block number to hash.
+ * @return Index of the hash chain for the block.
+ */
+static uint32_t hash_block(
+    const ext2_cache_shard *shard,
+    const uint32_t block_id
+) {
+    return (uint32_t) (block_id * 2654435761u) >> (32 - shard->hash_bits);
+}
+
+/**
+ * @brief Finds the buffer currently holding a block. The shard must be locked.
+ * @param cache The block cache.
+ * @param shard The block's shard.
+ * @param block_id The block number to look up.
+ * @return Index of the buffer, or NO_BUFFER if the block is not cached.
+ */
+static uint32_t find_buffer(
+    const ext2_block_cache *cache,
+    const ext2_cache_shard *shard,
+    const uint32_t block_id
+) {
+    uint32_t index = shard->hash_heads[hash_block(shard, block_id)];
+    while (index != NO_BUFFER) {
+        if (cache->buffers[index].block_id == block_id) {
+            return index;
+        }
+        index = cache->buffers[index].hash_next;
+    }
+    return NO_BUFFER;
+}
+
+static void hash_insert(
+    ext2_block_cache *cache,
+    ext2_cache_shard *shard,
+    const uint32_t index
+) {
+    const uint32_t chain = hash_block(shard, cache->buffers[index].block_id);
+    cache->buffers[index].hash_next = shard->hash_heads[chain];
+    shard->hash_heads[chain] = index;
+}
+
+static void hash_remove(
+    ext2_block_cache *cache,
+    ext2_cache_shard *shard,
+    const uint32_t index
+) {
+    uint32_t *link = &shard->hash_heads[hash_block(shard, cache->buffers[index].block_id)];
+    while (*link != NO_BUFFER) {
+        if (*link == index) {
+            *link = cache->buffers[index].hash_next;
+            return;
+        }
+        link = &cache->buffers[*link].hash_next;
+    }
+}
+
+/**
+ * @brief Reads a block from the device into a buffer.
+ *
+ * A short read at end of file zero-fills the rest of the buffer, so blocks past
+ * the end of a sparse image behave like unwritten blocks.
+ */
+static int load_buffer(
+    const ext2_block_cache *cache,
+    ext2_block_buffer *buffer
+) {
+    const off_t offset = (off_t) buffer->block_id * cache->block_size;
+
+    const ssize_t bytes_read = cache->device->read(cache->device, offset, cache->block_size, buffer->data);
+    if (bytes_read < 0) {
+        log_error("Error (block_cache): Reading block %u", buffer->block_id);
+        return IO_ERROR;
+    }
+
+    if ((size_t) bytes_read < cache->block_size) {
+        memset(buffer->data + bytes_read, 0, cache->block_size - (size_t) bytes_read);
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Writes a dirty buffer back to the device and clears its dirty flag.
+ */
+static int store_buffer(
+    ext2_block_cache *cache,
+    ext2_block_buffer *buffer
+) {
+    const off_t offset = (off_t) buffer->block_id * cache->block_size;
+
+    if (block_device_write(cache->device, offset, cache->block_size, buffer->data) != SUCCESS) {
+        log_error("Error (block_cache): Writing block %u", buffer->block_id);
+        return IO_ERROR;
+    }
+
+    buffer->dirty = 0;
+    EXT2_CACHE_COUNT(cache->stats.writebacks);
+    return SUCCESS;
+}
+
+/**
+ * @brief Picks a buffer of a shard for a new block, evicting an old one if necessary.
+ * @return Index of an unpinned, unhashed buffer, or NO_BUFFER if none is available.
+ */
+static uint32_t claim_buffer(
+    ext2_block_cache *cache,
+    ext2_cache_shard *shard
+) {
+    if (shard->used < shard->capacity) {
+        return shard->first + shard->used++;
+    }
+
+    // Two full sweeps: the first may only clear reference bits.
+    for (uint32_t step = 0; step < 2 * shard->capacity; ++step) {
+        const uint32_t index = shard->first + shard->clock_hand;
+        ext2_block_buffer *buffer = &cache->buffers[index];
+        shard->clock_hand = (shard->clock_hand + 1) % shard->capacity;
+
+        if (buffer->pin_count > 0) {
+            continue;
+        }
+        if (buffer->referenced) {
+            buffer->referenced = 0;
+            continue;
+        }
+        if (buffer->valid) {
+            if (buffer->dirty && store_buffer(cache, buffer) != SUCCESS) {
+                return NO_BUFFER;
+            }
+            hash_remove(cache, shard, index);
+            buffer->valid = 0;
+            EXT2_CACHE_COUNT(cache->stats.evictions);
+        }
+        return index;
+    }
+
+    log_error("Error (block_cache): All %u buffers of a shard are pinned.", shard->capacity);
+    return NO_BUFFER;
+}
+
+/**
+ * @brief Looks up a block and pins it, optionally skipping the device read on a miss.
+ *
+ * The block's shard must be locked.
+ *
+ * @param cache The block cache.
+ * @param shard The block's shard.
+ * @param block_id The block number to look up.
+ * @param read_from_device Whether a miss should load the block contents.
+ * @return The pinned buffer, or NULL on failure.
+ */
+static ext2_block_buffer *acquire_buffer(
+    ext2_block_cache *cache,
+    ext2_cache_shard *shard,
+    const uint32_t block_id,
+    const int read_from_device
+) {
+    uint32_t index = find_buffer(cache, shard, block_id);
+    if (index != NO_BUFFER) {
+        ext2_block_buffer *buffer = &cache->buffers[index];
+        EXT2_CACHE_COUNT(cache->stats.hits);
+        buffer->referenced = 1;
+        buffer->pin_count++;
+        return buffer;
+    }
+
+    EXT2_CACHE_COUNT(cache->stats.misses);
+    index = claim_buffer(cache, shard);
+    if (index == NO_BUFFER) {
+        return NULL;
+    }
+
+    ext2_block_buffer *buffer = &cache->buffers[index];
+    buffer->block_id = block_id;
+    buffer->dirty = 0;
+    buffer->referenced = 1;
+
+    if (read_from_device && load_buffer(cache, buffer) != SUCCESS) {
+        return NULL;
+    }
+
+    buffer->valid = 1;
+    buffer->pin_count = 1;
+    hash_insert(cache, shard, index);
+    return buffer;
+}
+
+/**
+ * @brief Installs a prefetched block unless the block is already cached.
+ */
+static void install_prefetched(
+    ext2_block_cache *cache,
+    const uint32_t block_id,
+    const uint8_t *data
+) {
+    ext2_cache_shard *shard = shard_of(cache, block_id);
+    pthread_mutex_lock(&shard->lock);
+
+    // A copy cached meanwhile may already be newer than the device.
+    if (find_buffer(cache, shard, block_id) == NO_BUFFER) {
+        const uint32_t index = claim_buffer(cache, shard);
+        if (index != NO_BUFFER) {
+            ext2_block_buffer *buffer = &cache->buffers[index];
+            memcpy(buffer->data, data, cache->block_size);
+            buffer->block_id = block_id;
+            buffer->dirty = 0;
+            buffer->referenced = 0;
+            buffer->pin_count = 0;
+            buffer->valid = 1;
+            hash_insert(cache, shard, index);
+            EXT2_CACHE_COUNT(cache->stats.prefetched);
+        }
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+}
+
+static int is_cached(
+    const ext2_block_cache *cache,
+    const uint32_t block_id
+) {
+    ext2_cache_shard *shard = shard_of(cache, block_id);
+    pthread_mutex_lock(&shard->lock);
+    const int cached = find_buffer(cache, shard, block_id) != NO_BUFFER;
+    pthread_mutex_unlock(&shard->lock);
+    return cached;
+}
+
+/**
+ * @brief Unpins a buffer. The buffer's shard must be locked.
+ */
+static void unpin_buffer(ext2_block_buffer *buffer) {
+    if (buffer->pin_count > 0) {
+        buffer->pin_count--;
+    }
+}
+
+/**
+ * @brief Copies between a caller's range and the cached copy of one block, if it is cached.
+ *
+ * Used by the direct I/O paths; only the overlap of the block and the range is copied.
+ *
+ * @param cache The block cache.
+ * @param block_id The block to consider.
+ * @param offset Byte offset of the caller's range.
+ * @param length Length of the caller's range.
+ * @param buffer The caller's buffer.
+ * @param to_cache Non-zero to update the cached block from `buffer`; zero to
+ *        overlay `buffer` with the cached block if it is dirty.
+ */
+static void sync_cached_block(
+    ext2_block_cache *cache,
+    const uint32_t block_id,
+    const off_t offset,
+    const size_t length,
+    void *buffer,
+    const int to_cache
+) {
+    ext2_cache_shard *shard = shard_of(cache, block_id);
+    pthread_mutex_lock(&shard->lock);
+
+    const uint32_t index = find_buffer(cache, shard, block_id);
+    if (index != NO_BUFFER && (to_cache || cache->buffers[index].dirty)) {
+        const off_t block_start = (off_t) block_id * cache->block_size;
+        const off_t copy_start = block_start > offset ? block_start : offset;
+        const off_t block_end = block_start + cache->block_size;
+        const off_t range_end = offset + (off_t) length;
+        const off_t copy_end = block_end < range_end ? block_end : range_end;
+        uint8_t *cached = cache->buffers[index].data + (copy_start - block_start);
+        uint8_t *outside = (uint8_t *) buffer + (copy_start - offset);
+        if (to_cache) {
+            memcpy(cached, outside, (size_t) (copy_end - copy_start));
+        } else {
+            memcpy(outside, cached, (size_t) (copy_end - copy_start));
+        }
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+}
+
+ext2_block_cache *block_cache_create(
+    ext2_block_device *device,
+    const uint32_t block_size,
+    const uint32_t capacity
+) {
+    if (device == NULL || block_size == 0 || capacity == 0) {
+        log_error("Error (block_cache_create): Invalid parameters.\n");
+        return NULL;
+    }
+
+    ext2_block_cache *cache = calloc(1, sizeof(ext2_block_cache));
+    if (cache == NULL) {
+        log_error("Error (block_cache_create): Failed to allocate cache.\n");
+        return NULL;
+    }
+
+    cache->device = device;
+    cache->block_size = block_size;
+    cache->capacity = capacity;
+
+    cache->shards = cache_shards_create(capacity, &cache->shard_count);
+    cache->buffers = calloc(capacity, sizeof(ext2_block_buffer));
+    cache->storage = malloc((size_t) capacity * block_size);
+    if (cache->shards == NULL || cache->buffers == NULL || cache->storage == NULL) {
+        log_error("Error (block_cache_create): Failed to allocate %u buffers.\n", capacity);
+        cache_shards_destroy(cache->shards, cache->shard_count);
+        free(cache->buffers);
+        free(cache->storage);
+        free(cache);
+        return NULL;
+    }
+
+    for (uint32_t s = 0; s < cache->shard_count; ++s) {
+        const ext2_cache_shard *shard = &cache->shards[s];
+        for (uint32_t i = shard->first; i < shard->first + shard->capacity; ++i) {
+            cache->buffers[i].data = cache->storage + (size_t) i * block_size;
+            cache->buffers[i].hash_next = NO_BUFFER;
+            cache->buffers[i].shard = s;
+        }
+    }
+
+    return cache;
+}
+
+void block_cache_destroy(ext2_block_cache *cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    if (block_cache_flush(cache) != SUCCESS) {
+        log_error("Warning (block_cache_destroy): Some dirty blocks could not be written back.\n");
+    }
+
+    cache_shards_destroy(cache->shards, cache->shard_count);
+    free(cache->buffers);
+    free(cache->storage);
+    free(cache);
+}
+
+ext2_block_buffer *block_cache_get(
+    ext2_block_cache *cache,
+    const uint32_t block_id
+) {
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    ext2_cache_shard *shard = shard_of(cache, block_id);
+    pthread_mutex_lock(&shard->lock);
+    ext2_block_buffer *buffer = acquire_buffer(cache, shard, block_id, 1);
+    pthread_mutex_unlock(&shard->lock);
+    return buffer;
+}
+
+void block_cache_release(
+    ext2_block_cache *cache,
+    ext2_block_buffer *buffer
+) {
+    if (cache == NULL || buffer == NULL) {
+        return;
+    }
+
+    ext2_cache_shard *shard = &cache->shards[buffer->shard];
+    pthread_mutex_lock(&shard->lock);
+    unpin_buffer(buffer);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void block_cache_mark_dirty(
+    ext2_block_cache *cache,
+    ext2_block_buffer *buffer
+) {
+    if (cache == NULL || buffer == NULL) {
+        return;
+    }
+
+    ext2_cache_shard *shard = &cache->shards[buffer->shard];
+    pthread_mutex_lock(&shard->lock);
+    buffer->dirty = 1;
+    pthread_mutex_unlock(&shard->lock);
+}
+
+int block_cache_read(
+    ext2_block_cache *cache,
+    const off_t offset,
+    const size_t length,
+    void *buffer
+) {
+    if (cache == NULL || buffer == NULL || offset < 0) {
+        return INVALID_PARAMETER;
+    }
+
+    uint8_t *out = buffer;
+    size_t remaining = length;
+    off_t position = offset;
+
+    while (remaining > 0) {
+        const uint32_t block_id = (uint32_t) (position / cache->block_size);
+        const uint32_t offset_in_block = (uint32_t) (position % cache->block_size);
+        size_t chunk = cache->block_size - offset_in_block;
+        if (chunk > remaining) {
+            chunk = remaining;
+        }
+
+        ext2_cache_shard *shard = shard_of(cache, block_id);
+        pthread_mutex_lock(&shard->lock);
+        ext2_block_buffer *block = acquire_buffer(cache, shard, block_id, 1);
+        if (block == NULL) {
+            pthread_mutex_unlock(&shard->lock);
+            return IO_ERROR;
+        }
+        memcpy(out, block->data + offset_in_block, chunk);
+        unpin_buffer(block);
+        pthread_mutex_unlock(&shard->lock);
+
+        out += chunk;
+        position += (off_t) chunk;
+        remaining -= chunk;
+    }
+
+    return SUCCESS;
+}
+
+int block_cache_write(
+    ext2_block_cache *cache,
+    const off_t offset,
+    const size_t length,
+    const void *buffer
+) {
+    if (cache == NULL || buffer == NULL || offset < 0) {
+        return INVALID_PARAMETER;
+    }
+
+    const uint8_t *in = buffer;
+    size_t remaining = length;
+    off_t position = offset;
+
+    while (remaining > 0) {
+        const uint32_t block_id = (uint32_t) (position / cache->block_size);
+        const uint32_t offset_in_block = (uint32_t) (position % cache->block_size);
+        size_t chunk = cache->block_size - offset_in_block;
+        if (chunk > remaining) {
+            chunk = remaining;
+        }
+
+        const int whole_block = offset_in_block == 0 && chunk == cache->block_size;
+        ext2_cache_shard *shard = shard_of(cache, block_id);
+        pthread_mutex_lock(&shard->lock);
+        ext2_block_buffer *block = acquire_buffer(cache, shard, block_id, !whole_block);
+        if (block == NULL) {
+            pthread_mutex_unlock(&shard->lock);
+            return IO_ERROR;
+        }
+        memcpy(block->data + offset_in_block, in, chunk);
+        block->dirty = 1;
+        unpin_buffer(block);
+        pthread_mutex_unlock(&shard->lock);
+
+        in += chunk;
+        position += (off_t) chunk;
+        remaining -= chunk;
+    }
+
+    return SUCCESS;
+}
+
+int block_cache_prefetch(
+    ext2_block_cache *cache,
+    const uint32_t *block_ids,
+    const uint32_t count
+) {
+    if (cache == NULL || (block_ids == NULL && count > 0)) {
+        return INVALID_PARAMETER;
+    }
+
+    // Blocks are staged outside the cache so that no shard stays locked during the batch.
+    const uint32_t batch = count < EXT2_PREFETCH_BATCH ? count : EXT2_PREFETCH_BATCH;
+    uint8_t *staging = batch > 0 ? malloc((size_t) batch * cache->block_size) : NULL;
+    if (batch > 0 && staging == NULL) {
+        log_error("Error (block_cache): Failed to allocate prefetch buffers.\n");
+        return ERROR;
+    }
+
+    ext2_io_request requests[EXT2_PREFETCH_BATCH];
+    uint32_t ids[EXT2_PREFETCH_BATCH];
+    int status = SUCCESS;
+    uint32_t next = 0;
+    while (next < count) {
+        uint32_t queued = 0;
+        for (; next < count && queued < batch; ++next) {
+            if (is_cached(cache, block_ids[next])) {
+                continue;
+            }
+            ids[queued] = block_ids[next];
+            requests[queued] = (ext2_io_request) {
+                .offset = (off_t) block_ids[next] * cache->block_size,
+                .length = cache->block_size,
+                .buffer = staging + (size_t) queued * cache->block_size,
+            };
+            queued++;
+        }
+
+        block_device_submit(cache->device, requests, queued);
+        for (uint32_t i = 0; i < queued; ++i) {
+            if (requests[i].result < 0) {
+                log_error("Error (block_cache): Prefetching block %u", ids[i]);
+                status = IO_ERROR;
+                continue;
+            }
+            if ((size_t) requests[i].result < cache->block_size) {
+                memset((uint8_t *) requests[i].buffer + requests[i].result, 0,
+                       cache->block_size - (size_t) requests[i].result);
+            }
+            install_prefetched(cache, ids[i], requests[i].buffer);
+        }
+    }
+
+    free(staging);
+    return status;
+}
+
+int block_cache_read_direct(
+    ext2_block_cache *cache,
+    const off_t offset,
+    const size_t length,
+    void *buffer
+) {
+    if (cache == NULL || buffer == NULL || offset < 0) {
+        return INVALID_PARAMETER;
+    }
+
+    const ssize_t bytes_read = cache->device->read(cache->device, offset, length, buffer);
+    if (bytes_read < 0) {
+        log_error("Error (block_cache): Reading %zu bytes at offset %lld", length, (long long) offset);
+        return IO_ERROR;
+    }
+    if ((size_t) bytes_read < length) {
+        memset((uint8_t *) buffer + bytes_read, 0, length - (size_t) bytes_read);
+    }
+
+    // Blocks modified in the cache are newer than what the device returned.
+    const uint32_t first_block = (uint32_t) (offset / cache->block_size);
+    const uint32_t last_block = (uint32_t) ((offset + (off_t) length - 1) / cache->block_size);
+    for (uint32_t block_id = first_block; length > 0 && block_id <= last_block; ++block_id) {
+        sync_cached_block(cache, block_id, offset, length, buffer, 0);
+    }
+
+    return SUCCESS;
+}
+
+int block_cache_write_direct(
+    ext2_block_cache *cache,
+    const off_t offset,
+    const size_t length,
+    const void *buffer
+) {
+    if (cache == NULL || buffer == NULL || offset < 0) {
+        return INVALID_PARAMETER;
+    }
+
+    if (block_device_write(cache->device, offset, length, buffer) != SUCCESS) {
+        log_error("Error (block_cache): Writing %zu bytes at offset %lld", length, (long long) offset);
+        return IO_ERROR;
+    }
+
+    // Refresh cached copies so later cached reads see the new data.
+    const uint32_t first_block = (uint32_t) (offset / cache->block_size);
+    const uint32_t last_block = (uint32_t) ((offset + (off_t) length - 1) / cache->block_size);
+    for (uint32_t block_id = first_block; length > 0 && block_id <= last_block; ++block_id) {
+        sync_cached_block(cache, block_id, offset, length, (void *) buffer, 1);
+    }
+
+    return SUCCESS;
+}
+
+int block_cache_flush(ext2_block_cache *cache) {
+    if (cache == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    int status = SUCCESS;
+    for (uint32_t s = 0; s < cache->shard_count; ++s) {
+        ext2_cache_shard *shard = &cache->shards[s];
+        pthread_mutex_lock(&shard->lock);
+        for (uint32_t i = shard->first; i < shard->first + shard->used; ++i) {
+            ext2_block_buffer *buffer = &cache->buffers[i];
+            if (buffer->valid && buffer->dirty && store_buffer(cache, buffer) != SUCCESS) {
+                status = IO_ERROR;
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    if (block_device_flush(cache->device) != SUCCESS) {
+        log_error("Error (block_cache): Flushing device");
+        status = IO_ERROR;
+    }
+
+    return status;
+}
@@ -0,0 +1,778 @@
+/**
+ * @file block_device.c
+ * @brief Implements the pread()/pwrite(), mmap and stdio block device backends.
+ *
+ * Batches passed to block_device_submit() run one transfer at a time unless the
+ * pread()/pwrite() backend has an io_uring instance. The ring is driven through
+ * the raw system calls, so no library is needed; builds without
+ * EXT2_HAVE_IO_URING simply never enable it.
+ */
+
+#include "block_device.h"
+#include "globals.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef EXT2_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#endif
+
+#define MAX_IO_URING_DEPTH 4096
+
+static ssize_t fd_read(
+    ext2_block_device *device,
+    const off_t offset,
+    const size_t length,
+    void *buffer
+) {
+    size_t total = 0;
+    while (total < length) {
+        const ssize_t n = pread(device->fd, (uint8_t *) buffer + total, length - total, offset + (off_t) total);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("Error (block_device): pread at offset %lld: %s", (long long) offset, strerror(errno));
+            return IO_ERROR;
+        }
+        if (n == 0) {
+            break; // End of image
+        }
+        total += (size_t) n;
+    }
+    return (ssize_t) total;
+}
+
+static int fd_write(
+    ext2_block_device *device,
+    const off_t offset,
+    const size_t length,
+    const void *buffer
+) {
+    size_t total = 0;
+    while (total < length) {
+        const ssize_t n = pwrite(device->fd, (const uint8_t *) buffer + total, length - total, offset + (off_t) total);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("Error (block_device): pwrite at offset %lld: %s", (long long) offset, strerror(errno));
+            return IO_ERROR;
+        }
+        total += (size_t) n;
+    }
+    return SUCCESS;
+}
+
+static int fd_flush(ext2_block_device *device) {
+    if (fdatasync(device->fd) != 0 && errno != EINVAL) {
+        log_error("Error (block_device): fdatasync: %s", strerror(errno));
+        return IO_ERROR;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Runs a batch through the device's read and write operations, in order.
+ */
+static int submit_one_at_a_time(ext2_block_device *device, ext2_io_request *requests, const uint32_t count) {
+    int status = SUCCESS;
+    for (uint32_t i = 0; i < count; ++i) {
+        ext2_io_request *request = &requests[i];
+        if (request->write) {
+            const int written = device->write(device, request->offset, request->length, request->buffer);
+            request->result = written == SUCCESS ? (ssize_t) request->length : written;
+        } else {
+            request->result = device->read(device, request->offset, request->length, request->buffer);
+        }
+        if (request->result < 0 || (size_t) request->result != request->length) {
+            status = IO_ERROR;
+        }
+    }
+    return status;
+}
+
+#ifdef EXT2_HAVE_IO_URING
+
+/**
+ * @brief Completes the part of a request not yet transferred with pread()/pwrite().
+ *
+ * @param device The device.
+ * @param request The request.
+ * @param done Bytes already transferred.
+ */
+static void finish_request(ext2_block_device *device, ext2_io_request *request, const size_t done) {
+    if (request->write) {
+        const int status = fd_write(device, request->offset + (off_t) done, request->length - done,
+                                    (const uint8_t *) request->buffer + done);
+        request->result = status == SUCCESS ? (ssize_t) request->length : status;
+        return;
+    }
+
+    const ssize_t n = fd_read(device, request->offset + (off_t) done, request->length - done,
+                              (uint8_t *) request->buffer + done);
+    request->result = n < 0 ? n : (ssize_t) done + n;
+}
+
+struct ext2_io_ring {
+    int fd;                     // Ring file descriptor from io_uring_setup()
+    pthread_mutex_t lock;       // One batch at a time owns the rings
+    uint32_t entries;           // Submission queue size
+    uint8_t *sq_map;            // Submission ring mapping
+    size_t sq_map_length;
+    uint8_t *cq_map;            // Completion ring mapping; equals sq_map with IORING_FEAT_SINGLE_MMAP
+    size_t cq_map_length;
+    struct io_uring_sqe *sqes;  // Submission queue entries
+    size_t sqes_length;
+    uint32_t *sq_tail;
+    uint32_t *sq_array;
+    uint32_t sq_mask;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe *cqes;
+    int dead;                   // Set once the ring has failed; later batches run synchronously
+    uint32_t fault_skip;        // io_uring_enter() calls to let through before injected failures
+    uint32_t fault_count;       // Injected io_uring_enter() failures still to come
+};
+
+static void ring_destroy(ext2_io_ring *ring) {
+    if (ring == NULL) {
+        return;
+    }
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_length);
+    }
+    if (ring->cq_map != NULL && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_length);
+    }
+    if (ring->sq_map != NULL) {
+        munmap(ring->sq_map, ring->sq_map_length);
+    }
+    close(ring->fd);
+    pthread_mutex_destroy(&ring->lock);
+    free(ring);
+}
+
+static void *map_ring(const int fd, const size_t length, const off_t offset) {
+    void *map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+/**
+ * @brief Sets up an io_uring instance and maps its rings.
+ *
+ * @return The ring, or NULL if the kernel refuses (too old, or io_uring disabled).
+ */
+static ext2_io_ring *ring_create(const uint32_t depth) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    const int fd = (int) syscall(__NR_io_uring_setup, depth, &params);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    ext2_io_ring *ring = calloc(1, sizeof(ext2_io_ring));
+    if (ring == NULL) {
+        close(fd);
+        return NULL;
+    }
+    ring->fd = fd;
+    ring->entries = params.sq_entries;
+    pthread_mutex_init(&ring->lock, NULL);
+
+    ring->sq_map_length = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    ring->cq_map_length = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_map_length > ring->sq_map_length) {
+            ring->sq_map_length = ring->cq_map_length;
+        }
+        ring->cq_map_length = ring->sq_map_length;
+    }
+    ring->sq_map = map_ring(fd, ring->sq_map_length, IORING_OFF_SQ_RING);
+    ring->cq_map = (params.features & IORING_FEAT_SINGLE_MMAP)
+                       ? ring->sq_map
+                       : map_ring(fd, ring->cq_map_length, IORING_OFF_CQ_RING);
+    ring->sqes_length = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = map_ring(fd, ring->sqes_length, IORING_OFF_SQES);
+    if (ring->sq_map == NULL || ring->cq_map == NULL || ring->sqes == NULL) {
+        log_error("Error (block_device): Mapping io_uring rings: %s", strerror(errno));
+        ring_destroy(ring);
+        return NULL;
+    }
+
+    ring->sq_tail = (uint32_t *) (ring->sq_map + params.sq_off.tail);
+    ring->sq_array = (uint32_t *) (ring->sq_map + params.sq_off.array);
+    ring->sq_mask = *(uint32_t *) (ring->sq_map + params.sq_off.ring_mask);
+    ring->cq_head = (uint32_t *) (ring->cq_map + params.cq_off.head);
+    ring->cq_tail = (uint32_t *) (ring->cq_map + params.cq_off.tail);
+    ring->cq_mask = *(uint32_t *) (ring->cq_map + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (ring->cq_map + params.cq_off.cqes);
+    return ring;
+}
+
+static int ring_enter(ext2_io_ring *ring, const uint32_t to_submit, const uint32_t min_complete) {
+    if (ring->fault_count > 0) {
+        if (ring->fault_skip > 0) {
+            ring->fault_skip--;
+        } else {
+            ring->fault_count--;
+            errno = EIO;
+            return -1;
+        }
+    }
+    for (;;) {
+        const int n = (int) syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete,
+                                    min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (n >= 0 || errno != EINTR) {
+            return n;
+        }
+    }
+}
+
+#define CANCEL_USER_DATA UINT64_MAX // Tags the completions of IORING_OP_ASYNC_CANCEL requests
+
+/**
+ * @brief Collects the completions that have arrived.
+ *
+ * A failed or short transfer is finished with pread()/pwrite(), which also
+ * covers kernels that lack IORING_OP_READ and IORING_OP_WRITE. A completion
+ * whose request index lies outside the batch is logged and dropped.
+ *
+ * @return Number of completions collected for requests in the batch.
+ */
+static uint32_t ring_reap(
+    ext2_block_device *device,
+    ext2_io_ring *ring,
+    ext2_io_request *requests,
+    const uint32_t count
+) {
+    uint32_t head = *ring->cq_head;
+    const uint32_t tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    uint32_t reaped = 0;
+
+    for (; head != tail; ++head) {
+        const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+        if (cqe->user_data == CANCEL_USER_DATA) {
+            continue;
+        }
+        if (cqe->user_data >= count) {
+            log_error("Error (block_device): io_uring completion for request %llu outside a batch of %u.",
+                      (unsigned long long) cqe->user_data, count);
+            continue;
+        }
+        ++reaped;
+        ext2_io_request *request = &requests[cqe->user_data];
+        if (cqe->res >= 0 && (size_t) cqe->res == request->length) {
+            request->result = cqe->res;
+        } else if (cqe->res == 0 && !request->write) {
+            request->result = 0; // End of image
+        } else {
+            finish_request(device, request, cqe->res > 0 ? (size_t) cqe->res : 0);
+        }
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return reaped;
+}
+
+/**
+ * @brief Asks the kernel to cancel the requests `first` to `first + count - 1` of a batch.
+ *
+ * Cancelled requests still post a completion, which ring_reap() finishes with
+ * pread()/pwrite(). Requests that already completed are unaffected.
+ */
+static void ring_cancel(ext2_io_ring *ring, const uint32_t first, const uint32_t count) {
+    uint32_t tail = *ring->sq_tail;
+    for (uint32_t i = 0; i < count; ++i, ++tail) {
+        const uint32_t slot = tail & ring->sq_mask;
+        struct io_uring_sqe *sqe = &ring->sqes[slot];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = first + i; // user_data of the request to cancel
+        sqe->user_data = CANCEL_USER_DATA;
+        ring->sq_array[slot] = slot;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    uint32_t submitted = 0;
+    while (submitted < count) {
+        const int n = ring_enter(ring, count - submitted, 0);
+        if (n <= 0) {
+            __atomic_store_n(ring->sq_tail, tail - (count - submitted), __ATOMIC_RELEASE);
+            return;
+        }
+        submitted += (uint32_t) n;
+    }
+}
+
+/**
+ * @brief Waits until every submitted request of a chunk has completed.
+ *
+ * If waiting through io_uring_enter() fails, the chunk's requests are
+ * cancelled and their completions are polled for, so the kernel never touches
+ * a request's buffer after this returns.
+ *
+ * @param first Index of the chunk's first request in the batch.
+ * @param submitted Number of the chunk's requests the kernel accepted.
+ * @return SUCCESS, or IO_ERROR if io_uring_enter() failed along the way.
+ */
+static int ring_drain(
+    ext2_block_device *device,
+    ext2_io_ring *ring,
+    ext2_io_request *requests,
+    const uint32_t count,
+    const uint32_t first,
+    const uint32_t submitted
+) {
+    int status = SUCCESS;
+    uint32_t completed = ring_reap(device, ring, requests, count);
+    while (completed < submitted) {
+        if (ring_enter(ring, 0, 1) < 0) {
+            if (status == SUCCESS) {
+                log_error("Error (block_device): io_uring_enter: %s", strerror(errno));
+                status = IO_ERROR;
+                ring_cancel(ring, first, submitted);
+            } else {
+                // Completions are posted on the way out of any system call.
+                const struct timespec pause = {.tv_sec = 0, .tv_nsec = 1000000};
+                nanosleep(&pause, NULL);
+            }
+        }
+        completed += ring_reap(device, ring, requests, count);
+    }
+    return status;
+}
+
+/**
+ * @brief Stops a device's batches from using its ring after a failure.
+ *
+ * Called with the ring's lock held and nothing in flight. The ring itself is
+ * released by block_device_close(), since other threads may still hold it.
+ */
+static void ring_retire(ext2_block_device *device, ext2_io_ring *ring) {
+    log_error("Error (block_device): Disabling io_uring after an unrecoverable error.");
+    __atomic_store_n(&ring->dead, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&device->submit, NULL, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Queues a batch on the device's ring in chunks of the ring's size and waits for all of it.
+ *
+ * A batch owns the ring until it completes. Rather than wait for the ring, a
+ * thread that finds it busy runs its batch with pread()/pwrite(), so threads
+ * sharing a device still overlap their I/O.
+ *
+ * If io_uring_enter() fails, the entries the kernel did not take are withdrawn
+ * from the submission ring, the ones it did take are waited for (cancelled
+ * first if waiting fails), and the rest of the batch runs with pread()/pwrite().
+ * No request is left in flight when this returns. A ring that fails while
+ * waiting is retired and the device falls back to synchronous I/O.
+ */
+static int ring_submit(ext2_block_device *device, ext2_io_request *requests, const uint32_t count) {
+    ext2_io_ring *ring = device->ring;
+    if (pthread_mutex_trylock(&ring->lock) != 0) {
+        return submit_one_at_a_time(device, requests, count);
+    }
+    if (ring->dead) {
+        pthread_mutex_unlock(&ring->lock);
+        return submit_one_at_a_time(device, requests, count);
+    }
+
+    for (uint32_t start = 0; start < count; start += ring->entries) {
+        const uint32_t chunk = count - start < ring->entries ? count - start : ring->entries;
+
+        uint32_t tail = *ring->sq_tail;
+        for (uint32_t i = 0; i < chunk; ++i, ++tail) {
+            const ext2_io_request *request = &requests[start + i];
+            const uint32_t slot = tail & ring->sq_mask;
+            struct io_uring_sqe *sqe = &ring->sqes[slot];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = request->write ? IORING_OP_WRITE : IORING_OP_READ;
+            sqe->fd = device->fd;
+            sqe->addr = (uint64_t) (uintptr_t) request->buffer;
+            sqe->len = (uint32_t) request->length;
+            sqe->off = (uint64_t) request->offset;
+            sqe->user_data = start + i;
+            ring->sq_array[slot] = slot;
+        }
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+        uint32_t submitted = 0;
+        int failed = 0;
+        while (submitted < chunk) {
+            const int n = ring_enter(ring, chunk - submitted, 0);
+            if (n <= 0) {
+                log_error("Error (block_device): io_uring_enter: %s", strerror(errno));
+                failed = 1;
+                break;
+            }
+            submitted += (uint32_t) n;
+        }
+
+        if (failed) {
+            // Withdraw what the kernel has not consumed so a later batch cannot submit it.
+            __atomic_store_n(ring->sq_tail, tail - (chunk - submitted), __ATOMIC_RELEASE);
+        }
+        const int drained = ring_drain(device, ring, requests, count, start, submitted);
+        if (failed || drained != SUCCESS) {
+            for (uint32_t i = start + submitted; i < start + chunk; ++i) {
+                finish_request(device, &requests[i], 0);
+            }
+            if (drained != SUCCESS) {
+                ring_retire(device, ring);
+            }
+            submit_one_at_a_time(device, requests + start + chunk, count - start - chunk);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&ring->lock);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        if (requests[i].result < 0 || (size_t) requests[i].result != requests[i].length) {
+            return IO_ERROR;
+        }
+    }
+    return SUCCESS;
+}
+
+#endif
+
+static void fd_close(ext2_block_device *device) {
+#ifdef EXT2_HAVE_IO_URING
+    ring_destroy(device->ring);
+#endif
+    if (device->owns_handle) {
+        close(device->fd);
+    }
+    free(device);
+}
+
+static ssize_t mapped_read(
+    ext2_block_device *device,
+    const off_t offset,
+    const size_t length,
+    void *buffer
+) {
+    if (offset < 0 || (size_t) offset >= device->map_length) {
+        return 0;
+    }
+
+    size_t available = device->map_length - (size_t) offset;
+    if (available > length) {
+        available = length;
+    }
+    memcpy(buffer, device->map + offset, available);
+    return (ssize_t) available;
+}
+
+static int mapped_write(
+    ext2_block_device *device,
+    const off_t offset,
+    const size_t length,
+    const void *buffer
+) {
+    (void) device;
+    (void) buffer;
+    log_error("Error (block_device): Write of %zu bytes at offset %lld to a read-only mapped image.",
+            length, (long long) offset);
+    return IO_ERROR;
+}
+
+static void mapped_close(ext2_block_device *device) {
+    munmap((void *) device->map, device->map_length);
+    close(device->fd);
+    free(device);
+}
+
+/*
+ * A stream has a single file position, so each access holds the stream's lock
+ * from the seek to the end of the transfer.
+ */
+
+static ssize_t stream_read(
+    ext2_block_device *device,
+    const off_t offset,
+    const size_t length,
+    void *buffer
+) {
+    flockfile(device->stream);
+    if (fseeko(device->stream, offset, SEEK_SET) != 0) {
+        funlockfile(device->stream);
+        return IO_ERROR;
+    }
+
+    const size_t bytes_read = fread(buffer, 1, length, device->stream);
+    if (bytes_read != length) {
+        const int failed = ferror(device->stream);
+        clearerr(device->stream);
+        if (failed) {
+            funlockfile(device->stream);
+            return IO_ERROR;
+        }
+    }
+    funlockfile(device->stream);
+    return (ssize_t) bytes_read;
+}
+
+static int stream_write(
+    ext2_block_device *device,
+    const off_t offset,
+    const size_t length,
+    const void *buffer
+) {
+    flockfile(device->stream);
+    const int status = fseeko(device->stream, offset, SEEK_SET) == 0 &&
+                       fwrite(buffer, length, 1, device->stream) == 1
+                           ? SUCCESS
+                           : IO_ERROR;
+    funlockfile(device->stream);
+    return status;
+}
+
+static int stream_flush(ext2_block_device *device) {
+    return fflush(device->stream) == 0 ? SUCCESS : IO_ERROR;
+}
+
+static void stream_close(ext2_block_device *device) {
+    if (device->owns_handle) {
+        fclose(device->stream);
+    }
+    free(device);
+}
+
+ext2_block_device *block_device_from_fd(const int fd, const int owns_fd) {
+    if (fd < 0) {
+        return NULL;
+    }
+
+    ext2_block_device *device = calloc(1, sizeof(ext2_block_device));
+    if (device == NULL) {
+        log_error("Error (block_device): Failed to allocate device.\n");
+        return NULL;
+    }
+
+    device->read = fd_read;
+    device->write = fd_write;
+    device->flush = fd_flush;
+    device->close = fd_close;
+    device->fd = fd;
+    device->owns_handle = owns_fd;
+    return device;
+}
+
+ext2_block_device *block_device_open(const char *path, const int writable) {
+    if (path == NULL) {
+        return NULL;
+    }
+
+    const int fd = open(path, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (fd < 0) {
+        log_error("Error (block_device): Opening %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    ext2_block_device *device = block_device_from_fd(fd, 1);
+    if (device == NULL) {
+        close(fd);
+    }
+    return device;
+}
+
+ext2_block_device *block_device_open_mapped(const char *path) {
+    if (path == NULL) {
+        return NULL;
+    }
+
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        log_error("Error (block_device): Opening %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        log_error("Error (block_device): %s has no size to map.", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        log_error("Error (block_device): Mapping %s: %s", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    ext2_block_device *device = calloc(1, sizeof(ext2_block_device));
+    if (device == NULL) {
+        log_error("Error (block_device): Failed to allocate device.\n");
+        munmap(map, (size_t) st.st_size);
+        close(fd);
+        return NULL;
+    }
+
+    device->read = mapped_read;
+    device->write = mapped_write;
+    device->flush = NULL;
+    device->close = mapped_close;
+    device->fd = fd;
+    device->owns_handle = 1;
+    device->map = map;
+    device->map_length = (size_t) st.st_size;
+    return device;
+}
+
+const void *block_device_map(
+    const ext2_block_device *device,
+    const off_t offset,
+    const size_t length
+) {
+    if (device == NULL || device->map == NULL || offset < 0) {
+        return NULL;
+    }
+    if ((size_t) offset > device->map_length || length > device->map_length - (size_t) offset) {
+        return NULL;
+    }
+    return device->map + offset;
+}
+
+void block_device_init_stream(ext2_block_device *device, FILE *stream) {
+    memset(device, 0, sizeof(ext2_block_device));
+    device->read = stream_read;
+    device->write = stream_write;
+    device->flush = stream_flush;
+    device->close = NULL; // Stack storage: nothing to release
+    device->stream = stream;
+    device->fd = -1;
+}
+
+ext2_block_device *block_device_from_stream(FILE *stream, const int owns_stream) {
+    if (stream == NULL) {
+        return NULL;
+    }
+
+    ext2_block_device *device = malloc(sizeof(ext2_block_device));
+    if (device == NULL) {
+        log_error("Error (block_device): Failed to allocate device.\n");
+        return NULL;
+    }
+
+    block_device_init_stream(device, stream);
+    device->close = stream_close;
+    device->owns_handle = owns_stream;
+    return device;
+}
+
+int block_device_read(
+    ext2_block_device *device,
+    const off_t offset,
+    const size_t length,
+    void *buffer
+) {
+    const ssize_t n = device->read(device, offset, length, buffer);
+    if (n < 0) {
+        return (int) n;
+    }
+    return (size_t) n == length ? SUCCESS : IO_ERROR;
+}
+
+int block_device_write(
+    ext2_block_device *device,
+    const off_t offset,
+    const size_t length,
+    const void *buffer
+) {
+    return device->write(device, offset, length, buffer);
+}
+
+int block_device_submit(
+    ext2_block_device *device,
+    ext2_io_request *requests,
+    const uint32_t count
+) {
+    if (device == NULL || (requests == NULL && count > 0)) {
+        return INVALID_PARAMETER;
+    }
+    if (count == 0) {
+        return SUCCESS;
+    }
+    if (device->submit != NULL) {
+        return device->submit(device, requests, count);
+    }
+
+    return submit_one_at_a_time(device, requests, count);
+}
+
+int block_device_enable_io_uring(ext2_block_device *device, uint32_t queue_depth) {
+    if (device == NULL) {
+        return INVALID_PARAMETER;
+    }
+    if (device->read != fd_read) {
+        return ERROR; // Only the pread()/pwrite() backend has a descriptor the ring can use
+    }
+
+#ifdef EXT2_HAVE_IO_URING
+    if (device->ring != NULL) {
+        return __atomic_load_n(&device->ring->dead, __ATOMIC_ACQUIRE) ? ERROR : SUCCESS;
+    }
+    if (queue_depth == 0) {
+        queue_depth = EXT2_IO_URING_DEFAULT_DEPTH;
+    }
+    if (queue_depth > MAX_IO_URING_DEPTH) {
+        queue_depth = MAX_IO_URING_DEPTH;
+    }
+
+    device->ring = ring_create(queue_depth);
+    if (device->ring == NULL) {
+        return ERROR;
+    }
+    device->submit = ring_submit;
+    return SUCCESS;
+#else
+    (void) queue_depth;
+    return ERROR;
+#endif
+}
+
+int block_device_fail_io_uring_enter(ext2_block_device *device, const uint32_t skip, const uint32_t count) {
+    if (device == NULL) {
+        return INVALID_PARAMETER;
+    }
+#ifdef EXT2_HAVE_IO_URING
+    if (device->ring == NULL) {
+        return ERROR;
+    }
+    pthread_mutex_lock(&device->ring->lock);
+    device->ring->fault_skip = skip;
+    device->ring->fault_count = count;
+    pthread_mutex_unlock(&device->ring->lock);
+    return SUCCESS;
+#else
+    (void) skip;
+    (void) count;
+    return ERROR;
+#endif
+}
+
+int block_device_flush(ext2_block_device *device) {
+    return device->flush != NULL ? device->flush(device) : SUCCESS;
+}
+
+void block_device_close(ext2_block_device *device) {
+    if (device != NULL && device->close != NULL) {
+        device->close(device);
+    }
+}
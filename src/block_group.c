@@ -8,6 +8,8 @@
  */
 #include "superblock.h"
 #include "block_group.h"
+#include "block_device.h"
+#include "filesystem.h"
 #include "globals.h"
 
 #include <stdio.h>
@@ -100,26 +102,16 @@ ext2_group_desc *read_group_descriptor(
 
     const off_t descriptor_offset = get_descriptor_offset(superblock, group_index);
 
-    if (fseeko(file, descriptor_offset, SEEK_SET) != 0) {
-        log_error("Error seeking to group descriptor");
+    ext2_group_desc *group_desc = malloc(sizeof(ext2_group_desc));
+    if (group_desc == NULL) {
+        log_error("Error allocating memory for group descriptor %u.\n", group_index);
         return NULL;
     }
 
-    ext2_group_desc *group_desc = malloc(sizeof(ext2_group_desc));
-
-    if (fread(group_desc, sizeof(ext2_group_desc), 1, file) != 1) {
-        if (feof(file)) {
-            log_error("Error reading group descriptor: unexpected end of file for group %u.\n", group_index);
-            free(group_desc);
-            return NULL;
-        }
-
-        if (ferror(file)) {
-            log_error("Error reading group descriptor");
-            free(group_desc);
-            return NULL;
-        }
-
+    ext2_block_device device;
+    block_device_init_stream(&device, file);
+    if (block_device_read(&device, descriptor_offset, sizeof(ext2_group_desc), group_desc) != SUCCESS) {
+        log_error("Error reading group descriptor: unexpected end of file or I/O error for group %u.\n", group_index);
         free(group_desc);
         return NULL;
     }
@@ -127,6 +119,28 @@ ext2_group_desc *read_group_descriptor(
     return group_desc;
 }
 
+/**
+ * @brief Writes one group descriptor to its slot in the BGDT through the context's I/O path.
+ * @param fs The filesystem context.
+ * @param group_index The 0-based index of the block group descriptor to write.
+ * @param group_desc The descriptor contents to write.
+ * @return 0 on success, or a negative error code on failure.
+ */
+static int store_group_descriptor(
+    ext2_filesystem *fs,
+    const uint32_t group_index,
+    const ext2_group_desc *group_desc
+) {
+    const off_t offset = get_descriptor_offset(fs->superblock, group_index);
+
+    if (filesystem_write(fs, offset, sizeof(ext2_group_desc), group_desc) != SUCCESS) {
+        log_error("Error (write_single_group_descriptor): Writing group descriptor %u", group_index);
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
 int write_group_descriptor(
     FILE *file,
     const ext2_super_block *superblock,
@@ -137,30 +151,111 @@ int write_group_descriptor(
         return INVALID_PARAMETER;
     }
 
-    const off_t offset = get_descriptor_offset(superblock, group_index);
+    ext2_stream_context context;
+    return store_group_descriptor(filesystem_wrap_stream(&context, file, superblock, NULL), group_index, group_desc);
+}
 
-    if (fseeko(file, offset, SEEK_SET) != 0) {
-        log_error("Error (write_single_group_descriptor): Seeking to group descriptor offset");
-        return ERROR;
+int ext2_write_group_descriptor(
+    ext2_filesystem *fs,
+    const uint32_t group_index
+) {
+    if (fs == NULL || fs->superblock == NULL || fs->bgdt == NULL) {
+        return INVALID_PARAMETER;
     }
 
-    if (fwrite(group_desc, sizeof(ext2_group_desc), 1, file) != 1) {
-        if (ferror(file)) {
-            log_error("Error (write_single_group_descriptor): Writing group descriptor");
-        } else {
-            log_error("Error (write_single_group_descriptor): fwrite did not write the expected number of items.\n");
+    if (group_index >= fs->bgdt->groups_count) {
+        log_error("Error (write_single_group_descriptor): Group %u is out of range.\n", group_index);
+        return INVALID_PARAMETER;
+    }
+
+    return store_group_descriptor(fs, group_index, &fs->bgdt->groups[group_index]);
+}
+
+void ext2_lock_group(
+    const ext2_filesystem *fs,
+    const uint32_t group_index
+) {
+    if (fs != NULL && fs->locks != NULL) {
+        pthread_mutex_lock(&fs->locks->groups[group_index]);
+    }
+}
+
+void ext2_unlock_group(
+    const ext2_filesystem *fs,
+    const uint32_t group_index
+) {
+    if (fs != NULL && fs->locks != NULL) {
+        pthread_mutex_unlock(&fs->locks->groups[group_index]);
+    }
+}
+
+int ext2_mark_group_descriptor_dirty(
+    ext2_filesystem *fs,
+    const uint32_t group_index
+) {
+    if (fs == NULL || fs->bgdt == NULL || group_index >= fs->bgdt->groups_count) {
+        return INVALID_PARAMETER;
+    }
+
+    if (fs->group_desc_dirty == NULL) {
+        fs->group_desc_dirty = calloc(fs->bgdt->groups_count, sizeof(uint8_t));
+        if (fs->group_desc_dirty == NULL) {
+            // Without tracking, fall back to writing through.
+            return ext2_write_group_descriptor(fs, group_index);
         }
-        return ERROR;
     }
 
+    fs->group_desc_dirty[group_index] = 1;
     return SUCCESS;
 }
 
-ext2_group_desc_table *read_group_descriptor_table(
-    FILE *file,
+int ext2_flush_group_descriptors(
+    ext2_filesystem *fs
+) {
+    if (fs == NULL || fs->group_desc_dirty == NULL) {
+        return SUCCESS;
+    }
+
+    for (uint32_t group_idx = 0; group_idx < fs->bgdt->groups_count; ++group_idx) {
+        ext2_lock_group(fs, group_idx);
+    }
+
+    int status = SUCCESS;
+    uint32_t group_idx = 0;
+    while (group_idx < fs->bgdt->groups_count) {
+        if (!fs->group_desc_dirty[group_idx]) {
+            ++group_idx;
+            continue;
+        }
+
+        uint32_t run_end = group_idx + 1;
+        while (run_end < fs->bgdt->groups_count && fs->group_desc_dirty[run_end]) {
+            ++run_end;
+        }
+
+        const off_t offset = get_descriptor_offset(fs->superblock, group_idx);
+        const size_t length = (size_t) (run_end - group_idx) * sizeof(ext2_group_desc);
+        if (filesystem_write(fs, offset, length, &fs->bgdt->groups[group_idx]) == SUCCESS) {
+            memset(&fs->group_desc_dirty[group_idx], 0, run_end - group_idx);
+        } else {
+            log_error("Error (flush_group_descriptors): Writing descriptors %u-%u", group_idx, run_end - 1);
+            status = IO_ERROR;
+        }
+
+        group_idx = run_end;
+    }
+
+    for (uint32_t i = fs->bgdt->groups_count; i > 0; --i) {
+        ext2_unlock_group(fs, i - 1);
+    }
+    return status;
+}
+
+ext2_group_desc_table *ext2_read_group_descriptor_table(
+    ext2_block_device *device,
     const ext2_super_block *superblock
 ) {
-    if (file == NULL || superblock == NULL) {
+    if (device == NULL || superblock == NULL) {
         log_error("Error: NULL pointer passed to read_all_group_descriptors.\n");
         return NULL;
     }
@@ -181,40 +276,70 @@ ext2_group_desc_table *read_group_descriptor_table(
 
     const off_t bgdt_start_offset = get_table_offset(superblock);
 
-    if (fseeko(file, bgdt_start_offset, SEEK_SET) != 0) {
-        log_error("Error seeking to start of BLOCK_GROUP_DESCRIPTOR_TABLE");
+    // One positional read for the whole table
+    if (block_device_read(device, bgdt_start_offset, num_groups * sizeof(ext2_group_desc), block_group_descriptors) != SUCCESS) {
+        log_error("Error reading BLOCK_GROUP_DESCRIPTOR_TABLE: unexpected end of file or I/O error. Expected %u groups.\n",
+                num_groups);
         free(block_group_descriptors);
         return NULL;
     }
 
-    const size_t items_read = fread(block_group_descriptors, sizeof(ext2_group_desc), num_groups, file);
-    if (items_read != num_groups) {
-        if (feof(file)) {
-            log_error("Error reading BLOCK_GROUP_DESCRIPTOR_TABLE: unexpected end of file. Expected %u groups, read %zu.\n", num_groups,
-                    items_read);
-            free(block_group_descriptors);
-            return NULL;
-        }
+    ext2_group_desc_table *table = malloc(sizeof(ext2_group_desc_table));
+    if (table == NULL) {
+        log_error("Error allocating memory for BLOCK_GROUP_DESCRIPTOR_TABLE table");
+        free(block_group_descriptors);
+        return NULL;
+    }
 
-        if (ferror(file)) {
-            log_error("Error reading BLOCK_GROUP_DESCRIPTOR_TABLE");
-            free(block_group_descriptors);
-            return NULL;
-        }
+    table->groups = block_group_descriptors;
+    table->groups_count = num_groups;
 
-        free(block_group_descriptors);
+    return table;
+}
+
+ext2_group_desc_table *ext2_map_group_descriptor_table(
+    ext2_block_device *device,
+    const ext2_super_block *superblock
+) {
+    if (device == NULL || superblock == NULL) {
+        log_error("Error: NULL pointer passed to ext2_map_group_descriptor_table.\n");
+        return NULL;
+    }
+
+    const uint32_t num_groups = count_block_groups(superblock);
+    if (num_groups == 0) {
+        log_error("Error: Filesystem has 0 block groups according to superblock.\n");
+        return NULL;
+    }
+
+    const void *mapped = block_device_map(device, get_table_offset(superblock), num_groups * sizeof(ext2_group_desc));
+    if (mapped == NULL) {
+        log_error("Error mapping BLOCK_GROUP_DESCRIPTOR_TABLE: image too small for %u groups.\n", num_groups);
         return NULL;
     }
 
     ext2_group_desc_table *table = malloc(sizeof(ext2_group_desc_table));
     if (table == NULL) {
         log_error("Error allocating memory for BLOCK_GROUP_DESCRIPTOR_TABLE table");
-        free(block_group_descriptors);
         return NULL;
     }
 
-    table->groups = block_group_descriptors;
+    table->groups = (ext2_group_desc *) mapped;
     table->groups_count = num_groups;
 
     return table;
 }
+
+ext2_group_desc_table *read_group_descriptor_table(
+    FILE *file,
+    const ext2_super_block *superblock
+) {
+    if (file == NULL || superblock == NULL) {
+        log_error("Error: NULL pointer passed to read_all_group_descriptors.\n");
+        return NULL;
+    }
+
+    ext2_block_device device;
+    block_device_init_stream(&device, file);
+    return ext2_read_group_descriptor_table(&device, superblock);
+}
@@ -0,0 +1,329 @@
+/**
+ * @file bmap.c
+ * @brief Implements logical-to-physical block mapping through the i_block tree.
+ */
+
+#include "bmap.h"
+#include "superblock.h"
+#include "filesystem.h"
+#include "allocation.h"
+#include "globals.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Returns the contents of an indirect block at a given depth, loading it if needed.
+ * @return Pointer to the block's entries, or NULL on failure.
+ */
+static const uint32_t *load_indirect(
+    ext2_block_map *map,
+    const int depth,
+    const uint32_t block_id
+) {
+    if (map->held[depth] == block_id) {
+        return map->entries[depth];
+    }
+
+    if (block_id >= map->fs->superblock->s_blocks_count) {
+        log_error("Error (bmap): Indirect block %u is out of range.", block_id);
+        return NULL;
+    }
+
+    const uint32_t block_size = get_block_size(map->fs->superblock);
+    const off_t offset = (off_t) block_id * block_size;
+
+    const uint32_t *entries = filesystem_map(map->fs, offset, block_size);
+    if (entries == NULL) {
+        if (map->storage == NULL) {
+            map->storage = malloc(3 * (size_t) block_size);
+            if (map->storage == NULL) {
+                log_error("Error (bmap): Failed to allocate indirect block buffers.");
+                return NULL;
+            }
+        }
+
+        uint32_t *slot = map->storage + (size_t) depth * map->per_block;
+        // Keep the slot consistent if the read fails part-way.
+        map->held[depth] = 0;
+        if (filesystem_read(map->fs, offset, block_size, slot) != SUCCESS) {
+            log_error("Error (bmap): Reading indirect block %u failed.", block_id);
+            return NULL;
+        }
+        entries = slot;
+    }
+
+    map->held[depth] = block_id;
+    map->entries[depth] = entries;
+    map->indirect_reads++;
+    return entries;
+}
+
+int ext2_block_map_init(
+    ext2_block_map *map,
+    ext2_filesystem *fs,
+    const ext2_inode *inode
+) {
+    if (map == NULL || fs == NULL || fs->superblock == NULL || inode == NULL) {
+        log_error("Error (bmap): NULL pointer argument provided.");
+        return INVALID_PARAMETER;
+    }
+
+    memset(map, 0, sizeof(ext2_block_map));
+    map->fs = fs;
+    map->inode = inode;
+    map->per_block = get_block_size(fs->superblock) / sizeof(uint32_t);
+    return SUCCESS;
+}
+
+void ext2_block_map_release(ext2_block_map *map) {
+    if (map == NULL) {
+        return;
+    }
+
+    free(map->storage);
+    map->storage = NULL;
+    ext2_block_map_invalidate(map);
+}
+
+void ext2_block_map_invalidate(ext2_block_map *map) {
+    memset(map->held, 0, sizeof(map->held));
+    memset(map->entries, 0, sizeof(map->entries));
+}
+
+/**
+ * @brief Splits a logical block index into its path through the block tree.
+ *
+ * @param map The block map.
+ * @param logical_block Index of the block within the file (at least EXT2_IND_BLOCK).
+ * @param slots_out Receives the slot to follow in each indirect block, root first.
+ * @return The depth of the tree holding the block (1-3), or 0 if it is beyond the triple indirect range.
+ */
+static int split_logical(
+    const ext2_block_map *map,
+    const uint32_t logical_block,
+    uint32_t slots_out[3]
+) {
+    const uint64_t per = map->per_block;
+    uint64_t remaining = logical_block - EXT2_IND_BLOCK;
+
+    if (remaining < per) {
+        slots_out[0] = (uint32_t) remaining;
+        return 1;
+    }
+    if ((remaining -= per) < per * per) {
+        slots_out[0] = (uint32_t) (remaining / per);
+        slots_out[1] = (uint32_t) (remaining % per);
+        return 2;
+    }
+    if ((remaining -= per * per) < per * per * per) {
+        slots_out[0] = (uint32_t) (remaining / (per * per));
+        slots_out[1] = (uint32_t) (remaining / per % per);
+        slots_out[2] = (uint32_t) (remaining % per);
+        return 3;
+    }
+    return 0;
+}
+
+int ext2_block_map_lookup(
+    ext2_block_map *map,
+    const uint32_t logical_block,
+    uint32_t *physical_out
+) {
+    if (map == NULL || physical_out == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    if (logical_block < EXT2_IND_BLOCK) {
+        *physical_out = map->inode->i_block[logical_block];
+        return SUCCESS;
+    }
+
+    uint32_t slots[3];
+    const int depth = split_logical(map, logical_block, slots);
+    if (depth == 0) {
+        return INVALID_PARAMETER;
+    }
+
+    uint32_t block_id = map->inode->i_block[EXT2_IND_BLOCK + depth - 1];
+    for (int level = 0; level < depth && block_id != 0; ++level) {
+        const uint32_t *entries = load_indirect(map, level, block_id);
+        if (entries == NULL) {
+            return IO_ERROR;
+        }
+        block_id = entries[slots[level]];
+    }
+
+    *physical_out = block_id;
+    return SUCCESS;
+}
+
+/**
+ * @brief Allocates and zeroes a new indirect block near a goal.
+ */
+static int allocate_indirect(
+    ext2_block_map *map,
+    const uint32_t goal,
+    uint32_t *block_out
+) {
+    const uint32_t block_size = get_block_size(map->fs->superblock);
+    uint8_t *zeros = calloc(1, block_size);
+    if (zeros == NULL) {
+        return ERROR;
+    }
+
+    int status = ext2_allocate_block_near(map->fs, goal, block_out);
+    if (status == SUCCESS) {
+        status = filesystem_write(map->fs, (off_t) *block_out * block_size, block_size, zeros);
+    }
+    free(zeros);
+    return status;
+}
+
+/**
+ * @brief Stores one block number in an indirect block, keeping the held copy in step.
+ */
+static int store_entry(
+    ext2_block_map *map,
+    const int level,
+    const uint32_t block_id,
+    const uint32_t slot,
+    const uint32_t value
+) {
+    const uint32_t block_size = get_block_size(map->fs->superblock);
+    const off_t offset = (off_t) block_id * block_size + (off_t) slot * sizeof(uint32_t);
+    if (filesystem_write(map->fs, offset, sizeof(uint32_t), &value) != SUCCESS) {
+        return IO_ERROR;
+    }
+
+    // Writable contexts never hold mapped blocks, so the held copy is in `storage`.
+    if (map->held[level] == block_id && map->storage != NULL &&
+        map->entries[level] == map->storage + (size_t) level * map->per_block) {
+        map->storage[(size_t) level * map->per_block + slot] = value;
+    }
+    return SUCCESS;
+}
+
+int ext2_block_map_set(
+    ext2_block_map *map,
+    ext2_inode *inode,
+    const uint32_t logical_block,
+    const uint32_t physical_block,
+    uint32_t *indirect_allocated_out
+) {
+    if (map == NULL || inode == NULL || inode != map->inode) {
+        return INVALID_PARAMETER;
+    }
+
+    uint32_t allocated = 0;
+    if (indirect_allocated_out != NULL) {
+        *indirect_allocated_out = 0;
+    }
+
+    if (logical_block < EXT2_IND_BLOCK) {
+        inode->i_block[logical_block] = physical_block;
+        return SUCCESS;
+    }
+
+    uint32_t slots[3];
+    const int depth = split_logical(map, logical_block, slots);
+    if (depth == 0) {
+        return INVALID_PARAMETER;
+    }
+
+    // Indirect blocks go just before the data they map, as far as the allocator allows.
+    uint32_t *root = &inode->i_block[EXT2_IND_BLOCK + depth - 1];
+    if (*root == 0) {
+        if (physical_block == 0) {
+            return SUCCESS; // Nothing to unmap
+        }
+        if (allocate_indirect(map, physical_block, root) != SUCCESS) {
+            return ERROR;
+        }
+        allocated++;
+    }
+
+    int status = SUCCESS;
+    uint32_t block_id = *root;
+    for (int level = 0; status == SUCCESS; ++level) {
+        const uint32_t *entries = load_indirect(map, level, block_id);
+        if (entries == NULL) {
+            status = IO_ERROR;
+            break;
+        }
+        if (level == depth - 1) {
+            status = store_entry(map, level, block_id, slots[level], physical_block);
+            break;
+        }
+
+        uint32_t child = entries[slots[level]];
+        if (child == 0) {
+            if (physical_block == 0) {
+                break; // Already a hole
+            }
+            if (allocate_indirect(map, physical_block, &child) != SUCCESS ||
+                store_entry(map, level, block_id, slots[level], child) != SUCCESS) {
+                status = ERROR;
+                break;
+            }
+            allocated++;
+        }
+        block_id = child;
+    }
+
+    if (indirect_allocated_out != NULL) {
+        *indirect_allocated_out = allocated;
+    }
+    return status;
+}
+
+int ext2_block_map_range(
+    ext2_block_map *map,
+    const uint32_t logical_block,
+    const uint32_t max_blocks,
+    ext2_block_extent *run_out
+) {
+    if (run_out == NULL || max_blocks == 0) {
+        return INVALID_PARAMETER;
+    }
+
+    uint32_t first;
+    const int status = ext2_block_map_lookup(map, logical_block, &first);
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    uint32_t length = 1;
+    while (length < max_blocks && logical_block + length > logical_block) {
+        uint32_t next;
+        // A failure ends the run here; the caller's next call reports it.
+        if (ext2_block_map_lookup(map, logical_block + length, &next) != SUCCESS) {
+            break;
+        }
+        if (first == 0 ? next != 0 : next != first + length) {
+            break;
+        }
+        ++length;
+    }
+
+    run_out->start = first;
+    run_out->length = length;
+    return SUCCESS;
+}
+
+int ext2_bmap(
+    ext2_filesystem *fs,
+    const ext2_inode *inode,
+    const uint32_t logical_block,
+    uint32_t *physical_out
+) {
+    ext2_block_map map;
+    int status = ext2_block_map_init(&map, fs, inode);
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    status = ext2_block_map_lookup(&map, logical_block, physical_out);
+    ext2_block_map_release(&map);
+    return status;
+}
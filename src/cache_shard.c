@@ -0,0 +1,74 @@
+/**
+ * @file cache_shard.c
+ * @brief Implements creation of the lock-striped cache shards.
+ */
+
+#include "cache_shard.h"
+#include "globals.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Largest power-of-two shard count that keeps every shard reasonably full.
+ */
+static uint32_t pick_shard_count(const uint32_t capacity) {
+    uint32_t count = 1;
+    while (count < EXT2_CACHE_MAX_SHARDS && capacity / (2 * count) >= EXT2_CACHE_MIN_SHARD_ENTRIES) {
+        count *= 2;
+    }
+    return count;
+}
+
+ext2_cache_shard *cache_shards_create(const uint32_t capacity, uint32_t *shard_count_out) {
+    if (capacity == 0 || shard_count_out == NULL) {
+        return NULL;
+    }
+
+    const uint32_t count = pick_shard_count(capacity);
+    ext2_cache_shard *shards = calloc(count, sizeof(ext2_cache_shard));
+    if (shards == NULL) {
+        log_error("Error (cache_shards_create): Failed to allocate %u shards.\n", count);
+        return NULL;
+    }
+
+    uint32_t first = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        ext2_cache_shard *shard = &shards[i];
+        shard->first = first;
+        shard->capacity = capacity / count + (i < capacity % count ? 1 : 0);
+        first += shard->capacity;
+
+        // Aim for roughly two chains per entry.
+        shard->hash_bits = 1;
+        while (shard->hash_bits < 31 && (1u << shard->hash_bits) < 2 * shard->capacity) {
+            shard->hash_bits++;
+        }
+
+        const size_t chain_count = (size_t) 1 << shard->hash_bits;
+        shard->hash_heads = malloc(chain_count * sizeof(uint32_t));
+        if (shard->hash_heads == NULL) {
+            log_error("Error (cache_shards_create): Failed to allocate hash chains.\n");
+            cache_shards_destroy(shards, i);
+            return NULL;
+        }
+        memset(shard->hash_heads, 0xFF, chain_count * sizeof(uint32_t)); // Every chain empty
+        pthread_mutex_init(&shard->lock, NULL);
+    }
+
+    *shard_count_out = count;
+    return shards;
+}
+
+void cache_shards_destroy(ext2_cache_shard *shards, const uint32_t shard_count) {
+    if (shards == NULL) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < shard_count; ++i) {
+        pthread_mutex_destroy(&shards[i].lock);
+        free(shards[i].hash_heads);
+    }
+    free(shards);
+}
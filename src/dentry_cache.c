@@ -0,0 +1,309 @@
+/**
+ * @file dentry_cache.c
+ * @brief Implements the directory entry cache with negative entries and CLOCK eviction.
+ *
+ * Entries are spread over shards by the hash of (parent, name) and located
+ * through each shard's chained hash table. The full hash is kept in each entry
+ * so a probe only compares names when the hashes already agree.
+ */
+
+#include "dentry_cache.h"
+#include "cache_shard.h"
+#include "globals.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_ENTRY UINT32_MAX
+
+/**
+ * @brief Hashes a (parent, name) pair with FNV-1a, seeded by the parent inode number.
+ */
+static uint32_t hash_name(
+    const uint32_t parent,
+    const char *name,
+    const size_t name_len
+) {
+    uint32_t hash = 2166136261u ^ (parent * 2654435761u);
+    for (size_t i = 0; i < name_len; ++i) {
+        hash ^= (uint8_t) name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Returns the shard responsible for a hash; the low bits pick the shard, the high bits the chain.
+ */
+static ext2_cache_shard *shard_of(
+    const ext2_dentry_cache *cache,
+    const uint32_t hash
+) {
+    return &cache->shards[hash & (cache->shard_count - 1)];
+}
+
+static uint32_t chain_of(
+    const ext2_cache_shard *shard,
+    const uint32_t hash
+) {
+    return hash >> (32 - shard->hash_bits);
+}
+
+static int matches(
+    const ext2_dentry *entry,
+    const uint32_t hash,
+    const uint32_t parent,
+    const char *name,
+    const size_t name_len
+) {
+    return entry->hash == hash && entry->parent == parent && entry->name_len == name_len &&
+           memcmp(entry->name, name, name_len) == 0;
+}
+
+static uint32_t find_entry(
+    const ext2_dentry_cache *cache,
+    const ext2_cache_shard *shard,
+    const uint32_t hash,
+    const uint32_t parent,
+    const char *name,
+    const size_t name_len
+) {
+    uint32_t index = shard->hash_heads[chain_of(shard, hash)];
+    while (index != NO_ENTRY) {
+        if (matches(&cache->entries[index], hash, parent, name, name_len)) {
+            return index;
+        }
+        index = cache->entries[index].hash_next;
+    }
+    return NO_ENTRY;
+}
+
+static void hash_insert(
+    ext2_dentry_cache *cache,
+    ext2_cache_shard *shard,
+    const uint32_t index
+) {
+    const uint32_t chain = chain_of(shard, cache->entries[index].hash);
+    cache->entries[index].hash_next = shard->hash_heads[chain];
+    shard->hash_heads[chain] = index;
+}
+
+static void hash_remove(
+    ext2_dentry_cache *cache,
+    ext2_cache_shard *shard,
+    const uint32_t index
+) {
+    uint32_t *link = &shard->hash_heads[chain_of(shard, cache->entries[index].hash)];
+    while (*link != NO_ENTRY) {
+        if (*link == index) {
+            *link = cache->entries[index].hash_next;
+            return;
+        }
+        link = &cache->entries[*link].hash_next;
+    }
+}
+
+static void drop_entry(
+    ext2_dentry_cache *cache,
+    ext2_cache_shard *shard,
+    const uint32_t index
+) {
+    hash_remove(cache, shard, index);
+    cache->entries[index].valid = 0;
+    cache->entries[index].referenced = 0;
+    EXT2_CACHE_COUNT(cache->stats.invalidations);
+}
+
+/**
+ * @brief Picks an entry of a shard for a new lookup, evicting an old one if necessary.
+ */
+static uint32_t claim_entry(
+    ext2_dentry_cache *cache,
+    ext2_cache_shard *shard
+) {
+    if (shard->used < shard->capacity) {
+        return shard->first + shard->used++;
+    }
+
+    // Nothing is ever pinned, so at most two sweeps are needed.
+    for (;;) {
+        const uint32_t index = shard->first + shard->clock_hand;
+        ext2_dentry *entry = &cache->entries[index];
+        shard->clock_hand = (shard->clock_hand + 1) % shard->capacity;
+
+        if (entry->referenced) {
+            entry->referenced = 0;
+            continue;
+        }
+        if (entry->valid) {
+            hash_remove(cache, shard, index);
+            entry->valid = 0;
+            EXT2_CACHE_COUNT(cache->stats.evictions);
+        }
+        return index;
+    }
+}
+
+ext2_dentry_cache *dentry_cache_create(const uint32_t capacity) {
+    if (capacity == 0) {
+        log_error("Error (dentry_cache_create): Invalid parameters.\n");
+        return NULL;
+    }
+
+    ext2_dentry_cache *cache = calloc(1, sizeof(ext2_dentry_cache));
+    if (cache == NULL) {
+        log_error("Error (dentry_cache_create): Failed to allocate cache.\n");
+        return NULL;
+    }
+
+    cache->capacity = capacity;
+
+    cache->shards = cache_shards_create(capacity, &cache->shard_count);
+    cache->entries = calloc(capacity, sizeof(ext2_dentry));
+    if (cache->shards == NULL || cache->entries == NULL) {
+        log_error("Error (dentry_cache_create): Failed to allocate %u entries.\n", capacity);
+        cache_shards_destroy(cache->shards, cache->shard_count);
+        free(cache->entries);
+        free(cache);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < capacity; ++i) {
+        cache->entries[i].hash_next = NO_ENTRY;
+    }
+
+    return cache;
+}
+
+void dentry_cache_destroy(ext2_dentry_cache *cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    cache_shards_destroy(cache->shards, cache->shard_count);
+    free(cache->entries);
+    free(cache);
+}
+
+int dentry_cache_lookup(
+    ext2_dentry_cache *cache,
+    const uint32_t parent,
+    const char *name,
+    const size_t name_len,
+    uint32_t *child_out
+) {
+    if (cache == NULL || name == NULL || name_len > EXT2_NAME_LEN) {
+        return 0;
+    }
+
+    const uint32_t hash = hash_name(parent, name, name_len);
+    ext2_cache_shard *shard = shard_of(cache, hash);
+    pthread_mutex_lock(&shard->lock);
+
+    const uint32_t index = find_entry(cache, shard, hash, parent, name, name_len);
+    if (index == NO_ENTRY) {
+        pthread_mutex_unlock(&shard->lock);
+        EXT2_CACHE_COUNT(cache->stats.misses);
+        return 0;
+    }
+
+    ext2_dentry *entry = &cache->entries[index];
+    entry->referenced = 1;
+    if (entry->child != 0) {
+        EXT2_CACHE_COUNT(cache->stats.hits);
+    } else {
+        EXT2_CACHE_COUNT(cache->stats.negative_hits);
+    }
+    *child_out = entry->child;
+    pthread_mutex_unlock(&shard->lock);
+    return 1;
+}
+
+void dentry_cache_insert(
+    ext2_dentry_cache *cache,
+    const uint32_t parent,
+    const char *name,
+    const size_t name_len,
+    const uint32_t child
+) {
+    if (cache == NULL || name == NULL || name_len > EXT2_NAME_LEN) {
+        return;
+    }
+
+    const uint32_t hash = hash_name(parent, name, name_len);
+    ext2_cache_shard *shard = shard_of(cache, hash);
+    pthread_mutex_lock(&shard->lock);
+
+    uint32_t index = find_entry(cache, shard, hash, parent, name, name_len);
+    if (index == NO_ENTRY) {
+        index = claim_entry(cache, shard);
+        ext2_dentry *entry = &cache->entries[index];
+        entry->parent = parent;
+        entry->hash = hash;
+        entry->name_len = (uint8_t) name_len;
+        memcpy(entry->name, name, name_len);
+        entry->valid = 1;
+        hash_insert(cache, shard, index);
+    }
+
+    cache->entries[index].child = child;
+    cache->entries[index].referenced = 1;
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void dentry_cache_invalidate(
+    ext2_dentry_cache *cache,
+    const uint32_t parent,
+    const char *name,
+    const size_t name_len
+) {
+    if (cache == NULL || name == NULL || name_len > EXT2_NAME_LEN) {
+        return;
+    }
+
+    if (parent != 0) {
+        const uint32_t hash = hash_name(parent, name, name_len);
+        ext2_cache_shard *shard = shard_of(cache, hash);
+        pthread_mutex_lock(&shard->lock);
+        const uint32_t index = find_entry(cache, shard, hash, parent, name, name_len);
+        if (index != NO_ENTRY) {
+            drop_entry(cache, shard, index);
+        }
+        pthread_mutex_unlock(&shard->lock);
+        return;
+    }
+
+    for (uint32_t s = 0; s < cache->shard_count; ++s) {
+        ext2_cache_shard *shard = &cache->shards[s];
+        pthread_mutex_lock(&shard->lock);
+        for (uint32_t i = shard->first; i < shard->first + shard->used; ++i) {
+            const ext2_dentry *entry = &cache->entries[i];
+            if (entry->valid && entry->name_len == name_len && memcmp(entry->name, name, name_len) == 0) {
+                drop_entry(cache, shard, i);
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+int ext2_set_dentry_cache_size(
+    ext2_filesystem *fs,
+    const uint32_t capacity
+) {
+    if (fs == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    ext2_dentry_cache *new_cache = NULL;
+    if (capacity > 0) {
+        new_cache = dentry_cache_create(capacity);
+        if (new_cache == NULL) {
+            return ERROR;
+        }
+    }
+
+    dentry_cache_destroy(fs->dcache);
+    fs->dcache = new_cache;
+    return SUCCESS;
+}
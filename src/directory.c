@@ -6,26 +6,246 @@
 #include "superblock.h"
 #include "directory.h"
 #include "inode.h"
+#include "inode_cache.h"
+#include "dentry_cache.h"
+#include "bmap.h"
 #include "block_group.h"
 #include "bitmap.h"
 #include "globals.h"
 #include "allocation.h"
+#include "filesystem.h"
+#include "block_cache.h"
+#include "htree.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
-#include <string.h>
 #include <stdlib.h>
 
 // Define for the number of direct blocks in an inode, typically 12
 #define EXT2_NDIR_BLOCKS 12
 
+// Directory blocks an iterator reads ahead in one batch
+#define DIR_PREFETCH_BLOCKS 16
+
+/**
+ * @brief Gets a directory data block for reading.
+ *
+ * On a memory-mapped image the block is returned in place; otherwise it is read
+ * into `scratch`.
+ *
+ * @param fs The filesystem context.
+ * @param block_id The block to load.
+ * @param scratch Buffer of at least one block, used when the image is not mapped.
+ * @return Pointer to the block contents, or NULL on I/O failure.
+ */
+static const char *load_directory_block(
+    ext2_filesystem *fs,
+    const uint32_t block_id,
+    char *scratch
+) {
+    const uint32_t block_size = get_block_size(fs->superblock);
+    const off_t block_offset = (off_t) block_id * block_size;
+
+    const char *mapped = filesystem_map(fs, block_offset, block_size);
+    if (mapped != NULL) {
+        return mapped;
+    }
+
+    return filesystem_read(fs, block_offset, block_size, scratch) == SUCCESS ? scratch : NULL;
+}
+
+/**
+ * @brief Returns the number of logical blocks a directory's size covers.
+ */
+static uint32_t directory_block_count(
+    const ext2_filesystem *fs,
+    const ext2_inode *dir_inode
+) {
+    const uint32_t block_size = get_block_size(fs->superblock);
+    return (uint32_t) (((uint64_t) dir_inode->i_size + block_size - 1) / block_size);
+}
+
+/**
+ * @brief Drops the iterator's hold on its current block.
+ */
+static void release_iter_block(ext2_dir_iter *iter) {
+    if (iter->pinned != NULL) {
+        block_cache_release(iter->fs->cache, iter->pinned);
+        iter->pinned = NULL;
+    }
+    iter->block = NULL;
+}
+
+/**
+ * @brief Reads the next window of a directory's blocks into the block cache in one batch.
+ *
+ * Only done for directories of more than one block on contexts with a cache of
+ * at least a few windows. Failures are ignored: the blocks are simply read one at a time later.
+ */
+static void prefetch_iter_blocks(ext2_dir_iter *iter) {
+    ext2_filesystem *fs = iter->fs;
+    if (fs->cache == NULL || iter->block_count < 2 || iter->next_block < iter->prefetched) {
+        return;
+    }
+
+    // Small caches would only evict the blocks just read ahead.
+    uint32_t window = fs->cache->capacity / 4;
+    if (window > DIR_PREFETCH_BLOCKS) {
+        window = DIR_PREFETCH_BLOCKS;
+    }
+
+    uint32_t blocks[DIR_PREFETCH_BLOCKS];
+    uint32_t count = 0;
+    uint32_t logical = iter->next_block;
+    for (; logical < iter->block_count && logical - iter->next_block < window; ++logical) {
+        uint32_t block_id;
+        if (ext2_block_map_lookup(&iter->map, logical, &block_id) != SUCCESS) {
+            break;
+        }
+        if (block_id != 0 && block_id < fs->superblock->s_blocks_count) {
+            blocks[count++] = block_id;
+        }
+    }
+    iter->prefetched = logical;
+    block_cache_prefetch(fs->cache, blocks, count);
+}
+
+/**
+ * @brief Moves the iterator to the next directory block that is not a hole.
+ *
+ * @return 1 if a block was loaded, 0 past the last block, or a negative error code.
+ */
+static int load_next_iter_block(ext2_dir_iter *iter) {
+    ext2_filesystem *fs = iter->fs;
+    const uint32_t block_size = get_block_size(fs->superblock);
+    release_iter_block(iter);
+
+    while (iter->next_block < iter->block_count) {
+        prefetch_iter_blocks(iter);
+        const uint32_t logical = iter->next_block++;
+        uint32_t block_id;
+        if (ext2_block_map_lookup(&iter->map, logical, &block_id) != SUCCESS) {
+            log_error("Error (dir_iter): Mapping block %u of inode %u failed.\n", logical, iter->inode_num);
+            return IO_ERROR;
+        }
+        if (block_id == 0) {
+            continue; // Hole
+        }
+        if (block_id >= fs->superblock->s_blocks_count) {
+            log_error("Error (dir_iter): Block %u of inode %u is out of range.\n", block_id, iter->inode_num);
+            return IO_ERROR;
+        }
+
+        const off_t block_offset = (off_t) block_id * block_size;
+        iter->block = filesystem_map(fs, block_offset, block_size);
+        if (iter->block == NULL && fs->cache != NULL) {
+            iter->pinned = block_cache_get(fs->cache, block_id);
+            iter->block = iter->pinned != NULL ? iter->pinned->data : NULL;
+        }
+        if (iter->block == NULL) {
+            if (iter->scratch == NULL && (iter->scratch = malloc(block_size)) == NULL) {
+                log_error("Error (dir_iter): Failed to allocate memory for block buffer.\n");
+                return ERROR;
+            }
+            if (filesystem_read(fs, block_offset, block_size, iter->scratch) != SUCCESS) {
+                log_error("Error (dir_iter): Reading data block %u failed.\n", block_id);
+                return IO_ERROR;
+            }
+            iter->block = iter->scratch;
+        }
+
+        iter->block_id = block_id;
+        iter->offset = 0;
+        return 1;
+    }
+
+    return 0;
+}
+
+int ext2_dir_iter_open(
+    ext2_dir_iter *iter,
+    ext2_filesystem *fs,
+    const uint32_t dir_inode_num
+) {
+    if (iter == NULL || fs == NULL || fs->superblock == NULL || fs->bgdt == NULL) {
+        log_error("Error (dir_iter): NULL pointer argument provided.\n");
+        return INVALID_PARAMETER;
+    }
+
+    memset(iter, 0, sizeof(ext2_dir_iter));
+    iter->inode = ext2_inode_get(fs, dir_inode_num);
+    if (iter->inode == NULL) {
+        log_error("Error (dir_iter): Failed to read inode %u.\n", dir_inode_num);
+        return ERROR;
+    }
+    if ((iter->inode->i_mode & EXT2_S_IFMT) != EXT2_S_IFDIR) {
+        log_error("Error (dir_iter): Inode %u is not a directory (mode: %04X).\n", dir_inode_num,
+                iter->inode->i_mode);
+        ext2_inode_put(fs, iter->inode);
+        iter->inode = NULL;
+        return ERROR;
+    }
+
+    iter->fs = fs;
+    iter->inode_num = dir_inode_num;
+    iter->block_count = directory_block_count(fs, iter->inode);
+    ext2_block_map_init(&iter->map, fs, iter->inode);
+    return SUCCESS;
+}
+
+int ext2_dir_iter_next(
+    ext2_dir_iter *iter,
+    const ext2_directory_entry **entry_out
+) {
+    if (iter == NULL || iter->inode == NULL || entry_out == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    const uint32_t block_size = get_block_size(iter->fs->superblock);
+    for (;;) {
+        if (iter->block == NULL || iter->offset + EXT2_DIR_ENTRY_FIXED_SIZE > block_size) {
+            const int loaded = load_next_iter_block(iter);
+            if (loaded <= 0) {
+                return loaded;
+            }
+        }
+
+        const ext2_directory_entry *entry = (const ext2_directory_entry *) (iter->block + iter->offset);
+        if (entry->rec_len < EXT2_DIR_ENTRY_FIXED_SIZE || entry->rec_len > block_size - iter->offset ||
+            EXT2_DIR_ENTRY_FIXED_SIZE + entry->name_len > entry->rec_len) {
+            log_error("Warning (dir_iter): Malformed entry at offset %u of block %u (rec_len=%u). Skipping the rest of the block.\n",
+                    iter->offset, iter->block_id, entry->rec_len);
+            iter->offset = block_size;
+            continue;
+        }
+
+        iter->offset += entry->rec_len;
+        if (entry->inode != 0) {
+            *entry_out = entry;
+            return 1;
+        }
+    }
+}
+
+void ext2_dir_iter_close(ext2_dir_iter *iter) {
+    if (iter == NULL || iter->inode == NULL) {
+        return;
+    }
+
+    release_iter_block(iter);
+    ext2_block_map_release(&iter->map);
+    ext2_inode_put(iter->fs, iter->inode);
+    free(iter->scratch);
+    memset(iter, 0, sizeof(ext2_dir_iter));
+}
+
 /**
  * @brief Reads and lists the entries of a directory.
  *
  * This function reads the data blocks of the specified directory inode and prints
- * the details of each directory entry found within those blocks.
- * Currently, it only processes direct blocks (i_block[0] to i_block[11]).
+ * the details of each directory entry found within those blocks, following
+ * the indirect block pointers of large directories.
  *
  * @param file Pointer to an open FILE stream for the filesystem image.
  * @param superblock Pointer to the filesystem's superblock.
@@ -36,7 +256,6 @@
  *         -2: Failed to read directory inode.
  *         -3: Specified inode is not a directory.
  *         -4: Memory allocation failure for block buffer.
- *         -5: Failed to seek to data block.
  *         -6: Failed to read data block.
  */
 int list_directory_entries(
@@ -50,301 +269,435 @@ int list_directory_entries(
         return INVALID_PARAMETER;
     }
 
-    ext2_inode dir_inode;
-    if (read_inode(file, superblock, block_group_descriptor_table, dir_inode_num, &dir_inode) != 0) {
-        log_error("Error (list_directory): Failed to read inode %u.\n", dir_inode_num);
-        return ERROR;
-    }
-
-    // Check if it's a directory (S_IFDIR is 0x4000)
-    if ((dir_inode.i_mode & 0xF000) != 0x4000) {
-        // S_IFMT is 0xF000, S_IFDIR is 0x4000
-        log_error("Error (list_directory): Inode %u is not a directory (mode: %04X).\n", dir_inode_num,
-                dir_inode.i_mode);
-        return ERROR;
-    }
+    ext2_stream_context context;
+    return ext2_list_directory(filesystem_wrap_stream(&context, file, superblock, block_group_descriptor_table), dir_inode_num);
+}
 
-    const uint32_t block_size = get_block_size(superblock);
-    char * block_buffer = malloc(block_size);
-    if (block_buffer == NULL) {
-        log_error("Error (list_directory): Failed to allocate memory for block buffer.\n");
-        return ERROR;
+int ext2_list_directory(
+    ext2_filesystem *fs,
+    const uint32_t dir_inode_num
+) {
+    ext2_dir_iter iter;
+    const int status = ext2_dir_iter_open(&iter, fs, dir_inode_num);
+    if (status != SUCCESS) {
+        return status;
     }
 
     printf("Directory listing for inode %u:\n", dir_inode_num);
     printf("Inode | Rec Len | Name Len | Type | Name\n");
     printf("----------------------------------------------------\n");
 
-    // Iterate over direct blocks only for now
-    for (int i = 0; i < EXT2_NDIR_BLOCKS; ++i) {
-        if (dir_inode.i_block[i] == 0) {
-            // Block pointer is 0, means no more data blocks for this directory in direct pointers
-            // or this specific direct block is not used.
-            continue;
-        }
+    const ext2_directory_entry *entry;
+    int result;
+    while ((result = ext2_dir_iter_next(&iter, &entry)) > 0) {
+        printf("%-5u | %-7u | %-8u | %-4u | %.*s\n",
+               entry->inode,
+               entry->rec_len,
+               entry->name_len,
+               entry->file_type,
+               entry->name_len,
+               entry->name);
+    }
 
-        const uint32_t data_block_id = dir_inode.i_block[i];
-        const off_t block_offset = (off_t) data_block_id * block_size;
+    ext2_dir_iter_close(&iter);
+    return result == 0 ? SUCCESS : -6;
+}
 
-        if (fseeko(file, block_offset, SEEK_SET) != 0) {
-            log_error("Error (list_directory): Seeking to data block");
-            free(block_buffer);
-            return -5;
+int add_directory_entry(
+    FILE *file,
+    ext2_super_block *superblock,
+    const ext2_group_desc_table *block_group_descriptor_table,
+    ext2_inode *parent_inode,
+    const uint32_t new_entry_inode_num,
+    const char *new_entry_name,
+    const uint8_t new_entry_type
+) {
+    ext2_stream_context context;
+    ext2_filesystem *fs = filesystem_wrap_stream(&context, file, superblock, block_group_descriptor_table->groups);
+    context.table.groups_count = block_group_descriptor_table->groups_count;
+    // A stream context has no dentry cache, so the parent's number is not needed.
+    return filesystem_finish_stream(fs, ext2_add_directory_entry(fs, 0, parent_inode, new_entry_inode_num, new_entry_name, new_entry_type));
+}
+
+int ext2_dir_block_insert(
+    char *block,
+    const uint32_t block_size,
+    const uint32_t inode_num,
+    const char *name,
+    const uint8_t name_len,
+    const uint8_t file_type
+) {
+    const uint16_t needed = EXT2_DIR_REC_LEN(name_len);
+
+    uint32_t offset = 0;
+    while (offset + EXT2_DIR_ENTRY_FIXED_SIZE <= block_size) {
+        ext2_directory_entry *entry = (ext2_directory_entry *) (block + offset);
+        if (entry->rec_len < EXT2_DIR_ENTRY_FIXED_SIZE || entry->rec_len > block_size - offset) {
+            return 0; // Corrupt block, do not loop forever
         }
 
-        if (fread(block_buffer, block_size, 1, file) != 1) {
-            if (feof(file)) {
-                log_error("Error (list_directory): Reading data block %u: unexpected end of file.\n",
-                        data_block_id);
-            } else if (ferror(file)) {
-                log_error("Error (list_directory): Reading data block");
+        // Space the entry itself needs; a deleted entry can be reused whole.
+        const uint16_t used = entry->inode != 0 ? EXT2_DIR_REC_LEN(entry->name_len) : 0;
+        if (entry->rec_len >= used + needed) {
+            ext2_directory_entry *new_entry = entry;
+            if (used > 0) {
+                new_entry = (ext2_directory_entry *) (block + offset + used);
+                new_entry->rec_len = entry->rec_len - used;
+                entry->rec_len = used;
             }
-            free(block_buffer);
-            return -6;
+            new_entry->inode = inode_num;
+            new_entry->name_len = name_len;
+            new_entry->file_type = file_type;
+            memcpy(new_entry->name, name, name_len);
+            return 1;
         }
 
-        uint32_t current_offset_in_block = 0;
-        while (current_offset_in_block < block_size) {
-            const ext2_directory_entry * entry = (ext2_directory_entry *) (block_buffer + current_offset_in_block);
+        offset += entry->rec_len;
+    }
 
-            if (entry->inode == 0 && entry->rec_len == 0) {
-                // Should not happen if rec_len is always valid
-                // This might indicate end of entries if not properly padded, or corruption.
-                // Standard says rec_len should span to end of block or next entry.
-                break;
-            }
+    return 0;
+}
 
-            if (entry->rec_len == 0) {
-                // Invalid entry, stop processing this block
-                log_error(
-                    "Warning (list_directory): Encountered directory entry with rec_len=0 in block %u. Stopping parse of this block.\n",
-                    data_block_id);
-                break;
-            }
+void ext2_name_key_init(ext2_name_key *key, const char *name, const uint8_t name_len) {
+    static const uint8_t ones[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+    const size_t head = name_len < 4 ? name_len : 4;
+
+    key->name = name;
+    key->name_len = name_len;
+    key->prefix = 0;
+    key->mask = 0;
+    memcpy(&key->prefix, name, head);
+    memcpy(&key->mask, ones, head);
+}
 
-            if (entry->inode != 0) {
-                // Only print valid entries
-                char name_buffer[EXT2_NAME_LEN + 1];
-                strncpy(name_buffer, entry->name, entry->name_len);
-                name_buffer[entry->name_len] = '\0'; // Ensure null termination
-
-                printf("%-5u | %-7u | %-8u | %-4u | %s\n",
-                       entry->inode,
-                       entry->rec_len,
-                       entry->name_len,
-                       entry->file_type,
-                       name_buffer);
+int ext2_dir_block_find(
+    const char *block,
+    const uint32_t block_size,
+    const ext2_name_key *key,
+    uint32_t *inode_out
+) {
+    if (key->name_len == 0) {
+        return 0;
+    }
+
+    uint32_t offset = 0;
+    while (offset + EXT2_DIR_ENTRY_FIXED_SIZE <= block_size) {
+        const ext2_directory_entry *entry = (const ext2_directory_entry *) (block + offset);
+        const uint16_t rec_len = entry->rec_len;
+        if (rec_len < EXT2_DIR_ENTRY_FIXED_SIZE || rec_len > block_size - offset) {
+            return ERROR;
+        }
+
+        // A record always has at least four bytes of (padded) name space, so the
+        // prefix load stays inside it once the record is known to be big enough.
+        if (entry->name_len == key->name_len && entry->inode != 0) {
+            if (rec_len < EXT2_DIR_REC_LEN(entry->name_len)) {
+                return ERROR;
             }
 
-            current_offset_in_block += entry->rec_len;
+            uint32_t prefix;
+            memcpy(&prefix, entry->name, sizeof(prefix));
+            if ((prefix & key->mask) == key->prefix &&
+                (key->name_len <= 4 || memcmp(entry->name + 4, key->name + 4, key->name_len - 4) == 0)) {
+                *inode_out = entry->inode;
+                return 1;
+            }
         }
+
+        offset += rec_len;
     }
 
-    free(block_buffer);
+    return 0;
+}
+
+int ext2_directory_append_block(
+    ext2_filesystem *fs,
+    ext2_inode *dir_inode,
+    uint32_t *logical_out,
+    uint32_t *block_out
+) {
+    const uint32_t block_size = get_block_size(fs->superblock);
+    const uint32_t logical = directory_block_count(fs, dir_inode);
+
+    ext2_block_map map;
+    ext2_block_map_init(&map, fs, dir_inode);
+
+    // Right after the directory's last block if possible.
+    uint32_t goal = 0;
+    if (logical > 0 && ext2_block_map_lookup(&map, logical - 1, &goal) == SUCCESS && goal != 0) {
+        goal++;
+    }
+
+    uint32_t new_block_num;
+    if (ext2_allocate_block_near(fs, goal, &new_block_num) != SUCCESS) {
+        ext2_block_map_release(&map);
+        return -2; // Failed to allocate new block
+    }
+
+    uint32_t indirect_blocks = 0;
+    const int status = ext2_block_map_set(&map, dir_inode, logical, new_block_num, &indirect_blocks);
+    ext2_block_map_release(&map);
+    if (status != SUCCESS) {
+        const ext2_block_extent unused = {new_block_num, 1};
+        ext2_free_blocks(fs, &unused, 1);
+        return status;
+    }
+
+    dir_inode->i_size += block_size;
+    dir_inode->i_blocks += (1 + indirect_blocks) * (block_size / 512);
+    *logical_out = logical;
+    *block_out = new_block_num;
     return SUCCESS;
 }
 
-int add_directory_entry(
-    FILE *file,
-    ext2_super_block *superblock,
-    const ext2_group_desc_table *block_group_descriptor_table,
+int ext2_add_directory_entry(
+    ext2_filesystem *fs,
+    const uint32_t parent_inode_num,
     ext2_inode *parent_inode,
     const uint32_t new_entry_inode_num,
     const char *new_entry_name,
     const uint8_t new_entry_type
 ) {
-    const uint32_t block_size = get_block_size(superblock);
-    const uint8_t name_len = strlen(new_entry_name);
-    const uint16_t new_entry_len = EXT2_DIR_REC_LEN(name_len);
+    const uint32_t block_size = get_block_size(fs->superblock);
+    const size_t name_length = strlen(new_entry_name);
+    if (name_length == 0 || name_length > EXT2_NAME_LEN) {
+        return INVALID_PARAMETER;
+    }
+    const uint8_t name_len = (uint8_t) name_length;
+
+    if (ext2_htree_is_indexed(fs, parent_inode)) {
+        const int status = ext2_htree_add_entry(fs, parent_inode, new_entry_inode_num, new_entry_name, name_len,
+                                                new_entry_type);
+        if (status <= 0) {
+            if (status == SUCCESS) {
+                dentry_cache_invalidate(fs->dcache, parent_inode_num, new_entry_name, name_len);
+            }
+            return status;
+        }
+
+        // The blocks still form a valid linear directory; carry on without the index.
+        log_error("Warning (add_directory_entry): Dropping the htree index of a directory.\n");
+        parent_inode->i_flags &= ~EXT2_INDEX_FL;
+    }
 
     char * block_buffer = malloc(block_size);
     if (!block_buffer) {
         return -1; // Malloc failed
     }
 
-    // Iterate through direct blocks only for now
-    for (int i = 0; i < 12; ++i) {
-        if (parent_inode->i_block[i] == 0) {
-            continue; // Skip unused blocks
-        }
+    ext2_block_map map;
+    ext2_block_map_init(&map, fs, parent_inode);
 
-        const off_t block_offset = parent_inode->i_block[i] * block_size;
-        fseeko(file, block_offset, SEEK_SET);
-        fread(block_buffer, block_size, 1, file);
-
-        char *current_pos = block_buffer;
-        ext2_directory_entry * entry = (ext2_directory_entry *) current_pos;
-
-        while (current_pos - block_buffer < block_size) {
-            // Actual space used by the current entry
-            const uint16_t current_entry_actual_len = EXT2_DIR_REC_LEN(entry->name_len);
-
-            // Check if this is the last entry in the block and if there's enough space
-            if (current_pos + current_entry_actual_len - block_buffer < block_size &&
-                entry->rec_len >= current_entry_actual_len + new_entry_len) {
-                // Resize current entry
-                const uint16_t old_rec_len = entry->rec_len;
-                entry->rec_len = current_entry_actual_len;
-
-                // Create the new entry in the remaining space
-                current_pos += entry->rec_len;
-                ext2_directory_entry * new_entry = (ext2_directory_entry *) current_pos;
-                new_entry->inode = new_entry_inode_num;
-                new_entry->rec_len = old_rec_len - entry->rec_len;
-                new_entry->name_len = name_len;
-                new_entry->file_type = new_entry_type;
-                strncpy(new_entry->name, new_entry_name, name_len);
-
-                // Write the modified block back to disk
-                fseeko(file, block_offset, SEEK_SET);
-                fwrite(block_buffer, block_size, 1, file);
-
-                free(block_buffer);
-                return SUCCESS;
-            }
+    const uint32_t block_count = directory_block_count(fs, parent_inode);
+    for (uint32_t i = 0; i < block_count; ++i) {
+        uint32_t data_block_id;
+        if (ext2_block_map_lookup(&map, i, &data_block_id) != SUCCESS) {
+            ext2_block_map_release(&map);
+            free(block_buffer);
+            return IO_ERROR;
+        }
+        if (data_block_id == 0) {
+            continue; // Skip holes
+        }
 
-            // Move to the next entry
-            current_pos += entry->rec_len;
-            entry = (ext2_directory_entry *) current_pos;
+        const off_t block_offset = (off_t) data_block_id * block_size;
+        if (filesystem_read(fs, block_offset, block_size, block_buffer) != SUCCESS) {
+            ext2_block_map_release(&map);
+            free(block_buffer);
+            return IO_ERROR;
         }
-    }
 
-    // If we are here, no space was found in existing blocks. Allocate a new one.
-    uint32_t new_block_num;
-    if (allocate_block(file, superblock, block_group_descriptor_table, &new_block_num) != 0) {
-        free(block_buffer);
-        return -2; // Failed to allocate new block
-    }
+        if (ext2_dir_block_insert(block_buffer, block_size, new_entry_inode_num, new_entry_name, name_len,
+                                  new_entry_type)) {
+            // Write the modified block back to disk
+            const int status = filesystem_write(fs, block_offset, block_size, block_buffer);
 
-    // Find a free i_block entry (direct only for now)
-    int free_block_idx = -1;
-    for (int i = 0; i < 12; ++i) {
-        if (parent_inode->i_block[i] == 0) {
-            free_block_idx = i;
-            break;
+            ext2_block_map_release(&map);
+            free(block_buffer);
+            dentry_cache_invalidate(fs->dcache, parent_inode_num, new_entry_name, name_len);
+            return status == SUCCESS ? SUCCESS : IO_ERROR;
         }
     }
 
-    if (free_block_idx == -1) {
-        // TODO: Handle indirect blocks
+    ext2_block_map_release(&map);
+
+    // If we are here, no space was found in existing blocks. Append a new one.
+    uint32_t logical_block, new_block_num;
+    const int appended = ext2_directory_append_block(fs, parent_inode, &logical_block, &new_block_num);
+    if (appended != SUCCESS) {
         free(block_buffer);
-        // We should probably free the block we just allocated here, but that's for later.
-        return -3; // No free direct block pointers
+        return appended;
     }
 
-    // Add new block to parent inode
-    parent_inode->i_block[free_block_idx] = new_block_num;
-    parent_inode->i_size += block_size;
-    parent_inode->i_blocks += block_size / 512;
-
     // Initialize the new block with the new entry
+    memset(block_buffer, 0, block_size);
     ext2_directory_entry * new_entry = (ext2_directory_entry *) block_buffer;
-    new_entry->inode = new_entry_inode_num;
     new_entry->rec_len = block_size;
-    new_entry->name_len = name_len;
-    new_entry->file_type = new_entry_type;
-    strncpy(new_entry->name, new_entry_name, name_len);
+    ext2_dir_block_insert(block_buffer, block_size, new_entry_inode_num, new_entry_name, name_len, new_entry_type);
 
     // Write the new block to disk
-    const off_t block_offset = new_block_num * block_size;
-    fseeko(file, block_offset, SEEK_SET);
-    fwrite(block_buffer, block_size, 1, file);
+    const off_t block_offset = (off_t) new_block_num * block_size;
+    const int status = filesystem_write(fs, block_offset, block_size, block_buffer);
 
     free(block_buffer);
-    return SUCCESS;
+    dentry_cache_invalidate(fs->dcache, parent_inode_num, new_entry_name, name_len);
+    return status == SUCCESS ? SUCCESS : IO_ERROR;
 }
 
 uint32_t find_entry_in_directory(FILE *file, const ext2_super_block *superblock, const ext2_group_desc *bgdt, uint32_t dir_inode_num, const char *entry_name) {
-    ext2_inode dir_inode;
-    if (read_inode(file, superblock, bgdt, dir_inode_num, &dir_inode) != 0) {
+    ext2_stream_context context;
+    return ext2_find_entry(filesystem_wrap_stream(&context, file, superblock, bgdt), dir_inode_num, entry_name);
+}
+
+/**
+ * @brief Scans a directory's blocks for a name, consulting and filling the dentry cache.
+ *
+ * @param fs The filesystem context.
+ * @param dir_inode_num The inode number of the directory to search in.
+ * @param entry_name The name to find (need not be NUL-terminated).
+ * @param name_len Length of `entry_name` in bytes.
+ * @return The inode number of the found entry, or 0 if not found or an error occurs.
+ */
+static uint32_t find_entry(
+    ext2_filesystem *fs,
+    const uint32_t dir_inode_num,
+    const char *entry_name,
+    const size_t name_len
+) {
+    if (name_len == 0 || name_len > EXT2_NAME_LEN) {
+        return 0;
+    }
+
+    uint32_t cached_inode;
+    if (dentry_cache_lookup(fs->dcache, dir_inode_num, entry_name, name_len, &cached_inode)) {
+        return cached_inode;
+    }
+
+    ext2_inode *dir_inode = ext2_inode_get(fs, dir_inode_num);
+    if (dir_inode == NULL) {
         log_error("find_entry: Failed to read directory inode %u", dir_inode_num);
         return 0;
     }
 
     // Use the macros from Inode.h to check if it's a directory
-    if ((dir_inode.i_mode & EXT2_S_IFMT) != EXT2_S_IFDIR) {
+    if ((dir_inode->i_mode & EXT2_S_IFMT) != EXT2_S_IFDIR) {
         log_error("find_entry: Inode %u is not a directory.", dir_inode_num);
+        ext2_inode_put(fs, dir_inode);
         return 0;
     }
 
-    const uint32_t block_size = get_block_size(superblock);
+    if (ext2_htree_is_indexed(fs, dir_inode)) {
+        uint32_t indexed_inode = 0;
+        const int result = ext2_htree_lookup(fs, dir_inode, entry_name, name_len, &indexed_inode);
+        if (result >= 0) {
+            ext2_inode_put(fs, dir_inode);
+            dentry_cache_insert(fs->dcache, dir_inode_num, entry_name, name_len, indexed_inode);
+            return indexed_inode;
+        }
+        // A damaged index still leaves a directory that can be scanned linearly.
+    }
+
+    const uint32_t block_size = get_block_size(fs->superblock);
     char *block_buffer = (char *)malloc(block_size);
     if (!block_buffer) {
         log_error("find_entry: Failed to allocate memory for a data block.");
+        ext2_inode_put(fs, dir_inode);
         return 0;
     }
 
-    // Iterate over direct blocks for now
-    for (int i = 0; i < EXT2_NDIR_BLOCKS; ++i) {
-        if (dir_inode.i_block[i] == 0) {
-            continue;
-        }
+    // A miss is only remembered if every block could be searched.
+    int complete = 1;
 
-        const uint32_t data_block_id = dir_inode.i_block[i];
-        const off_t block_offset = (off_t)data_block_id * block_size;
+    ext2_name_key key;
+    ext2_name_key_init(&key, entry_name, (uint8_t) name_len);
 
-        if (fseeko(file, block_offset, SEEK_SET) != 0) {
-            log_error("find_entry: Seeking to data block %u failed.", data_block_id);
-            continue;
+    ext2_block_map map;
+    ext2_block_map_init(&map, fs, dir_inode);
+
+    const uint32_t block_count = directory_block_count(fs, dir_inode);
+    for (uint32_t i = 0; i < block_count; ++i) {
+        uint32_t data_block_id;
+        if (ext2_block_map_lookup(&map, i, &data_block_id) != SUCCESS) {
+            log_error("find_entry: Mapping block %u of inode %u failed.", i, dir_inode_num);
+            complete = 0;
+            break;
+        }
+        if (data_block_id == 0) {
+            continue; // Hole
         }
 
-        if (fread(block_buffer, block_size, 1, file) != 1) {
+        const char *block_data = load_directory_block(fs, data_block_id, block_buffer);
+        if (block_data == NULL) {
             log_error("find_entry: Reading data block %u failed.", data_block_id);
+            complete = 0;
             continue;
         }
 
-        char *current_pos = block_buffer;
-        const char *limit = block_buffer + block_size;
-
-        while (current_pos < limit) {
-            ext2_directory_entry *entry = (ext2_directory_entry *)current_pos;
-            if (entry->rec_len == 0) {
-                log_error("find_entry: Invalid rec_len=0 found in block %u.", data_block_id);
-                break;
-            }
-
-            // Check if inode is valid and name matches
-            if (entry->inode != 0 && entry->name_len == strlen(entry_name) && strncmp(entry_name, entry->name, entry->name_len) == 0) {
-                uint32_t found_inode = entry->inode;
-                free(block_buffer);
-                return found_inode;
-            }
-            current_pos += entry->rec_len;
+        uint32_t found_inode;
+        const int found = ext2_dir_block_find(block_data, block_size, &key, &found_inode);
+        if (found == 1) {
+            ext2_block_map_release(&map);
+            free(block_buffer);
+            ext2_inode_put(fs, dir_inode);
+            dentry_cache_insert(fs->dcache, dir_inode_num, entry_name, name_len, found_inode);
+            return found_inode;
+        }
+        if (found < 0) {
+            log_error("find_entry: Malformed entry found in block %u.", data_block_id);
+            complete = 0;
         }
     }
 
+    ext2_block_map_release(&map);
     free(block_buffer);
+    ext2_inode_put(fs, dir_inode);
+    if (complete) {
+        dentry_cache_insert(fs->dcache, dir_inode_num, entry_name, name_len, 0);
+    }
     return 0; // Entry not found
 }
 
+uint32_t ext2_find_entry(ext2_filesystem *fs, const uint32_t dir_inode_num, const char *entry_name) {
+    if (fs == NULL || entry_name == NULL) {
+        return 0;
+    }
+    return find_entry(fs, dir_inode_num, entry_name, strlen(entry_name));
+}
+
 // Public function to resolve a full path
 uint32_t get_inode_for_path(FILE *file, const ext2_super_block *superblock, const ext2_group_desc *bgdt, const char *path) {
-    if (path == NULL) {
+    ext2_stream_context context;
+    return ext2_lookup(filesystem_wrap_stream(&context, file, superblock, bgdt), path);
+}
+
+uint32_t ext2_lookup(ext2_filesystem *fs, const char *path) {
+    if (fs == NULL || path == NULL) {
         return 0;
     }
-    if (strcmp(path, "/") == 0) {
-        return EXT2_ROOT_INO;
-    }
 
+    // Walk the components in place: each one is a single dentry cache probe when warm.
     uint32_t current_inode = EXT2_ROOT_INO;
-    char *path_copy = strdup(path);
-    if (!path_copy) {
-        log_error("get_inode_for_path: Failed to allocate memory for path copy");
-        return 0;
-    }
+    const char *component = path;
+    while (*component != '\0') {
+        if (*component == '/') {
+            ++component;
+            continue;
+        }
 
-    // If path starts with '/', strtok will handle it correctly.
-    char *token = strtok(path_copy, "/");
-    while (token != NULL) {
-        current_inode = find_entry_in_directory(file, superblock, bgdt, current_inode, token);
+        const char *end = strchr(component, '/');
+        const size_t length = end != NULL ? (size_t) (end - component) : strlen(component);
+        if (length > EXT2_NAME_LEN) {
+            return 0;
+        }
+
+        current_inode = find_entry(fs, current_inode, component, length);
         if (current_inode == 0) {
-            // Path component not found, log is handled in find_entry_in_directory
-            break;
+            // Path component not found, log is handled in find_entry
+            return 0;
         }
-        token = strtok(NULL, "/");
+        component += length;
     }
 
-    free(path_copy);
     return current_inode;
 }
 
@@ -355,24 +708,35 @@ int create_directory(
     const uint32_t parent_inode_num,
     const char *new_dir_name,
     uint32_t *new_inode_num_out
+) {
+    ext2_stream_context context;
+    ext2_filesystem *fs = filesystem_wrap_stream(&context, file, superblock, block_group_descriptor_table->groups);
+    context.table.groups_count = block_group_descriptor_table->groups_count;
+    return filesystem_finish_stream(fs, ext2_create_directory(fs, parent_inode_num, new_dir_name, new_inode_num_out));
+}
+
+int ext2_create_directory(
+    ext2_filesystem *fs,
+    const uint32_t parent_inode_num,
+    const char *new_dir_name,
+    uint32_t *new_inode_num_out
 ) {
     if (strlen(new_dir_name) > EXT2_NAME_LEN) {
         return -1; // Name too long
     }
 
     uint32_t new_inode_num;
-    if (allocate_inode(file, superblock, block_group_descriptor_table, &new_inode_num) != SUCCESS) {
+    if (ext2_allocate_inode_for(fs, parent_inode_num, 1, &new_inode_num) != SUCCESS) {
         return -2; // Failed to allocate inode
     }
 
     uint32_t new_block_num;
-    if (allocate_block(file, superblock, block_group_descriptor_table, &new_block_num) != SUCCESS) {
+    if (ext2_allocate_block_near(fs, ext2_inode_block_goal(fs, new_inode_num), &new_block_num) != SUCCESS) {
         // TODO: Deallocate inode
         return -3; // Failed to allocate block
     }
 
-    const uint32_t block_size = get_block_size(superblock);
-
+    const uint32_t block_size = get_block_size(fs->superblock);
     // Initialize the new directory's inode
     ext2_inode new_inode = {0};
     new_inode.i_mode = EXT2_S_IFDIR | 0755;
@@ -383,7 +747,10 @@ int create_directory(
     new_inode.i_block[0] = new_block_num;
 
     // Initialize the new data block with '.' and '..'
-    char * block_buffer = malloc(block_size);
+    char * block_buffer = calloc(1, block_size);
+    if (block_buffer == NULL) {
+        return ERROR;
+    }
     // '.' entry
     ext2_directory_entry * self_entry = (ext2_directory_entry *) block_buffer;
     self_entry->inode = new_inode_num;
@@ -400,20 +767,24 @@ int create_directory(
     parent_entry->rec_len = block_size - self_entry->rec_len;
 
     // Write the new block to disk
-    fseeko(file, (off_t) new_block_num * block_size, SEEK_SET);
-    fwrite(block_buffer, block_size, 1, file);
+    filesystem_write(fs, (off_t) new_block_num * block_size, block_size, block_buffer);
     free(block_buffer);
 
     // Add entry to parent directory
-    ext2_inode parent_inode;
-    read_inode(file, superblock, block_group_descriptor_table->groups, parent_inode_num, &parent_inode);
-    add_directory_entry(file, superblock, block_group_descriptor_table, &parent_inode, new_inode_num, new_dir_name, EXT2_FT_DIR);
-    parent_inode.i_links_count++;
-    parent_inode.i_mtime = parent_inode.i_ctime = time(NULL);
-    write_inode(file, superblock, block_group_descriptor_table->groups, parent_inode_num, &parent_inode);
+    ext2_inode *parent_inode = ext2_inode_get(fs, parent_inode_num);
+    if (parent_inode == NULL) {
+        return ERROR;
+    }
+    if (ext2_add_directory_entry(fs, parent_inode_num, parent_inode, new_inode_num, new_dir_name, EXT2_FT_DIR) == SUCCESS) {
+        dentry_cache_insert(fs->dcache, parent_inode_num, new_dir_name, strlen(new_dir_name), new_inode_num);
+    }
+    parent_inode->i_links_count++;
+    parent_inode->i_mtime = parent_inode->i_ctime = time(NULL);
+    ext2_inode_mark_dirty(fs, parent_inode);
+    ext2_inode_put(fs, parent_inode);
 
     // Write the new inode to disk
-    write_inode(file, superblock, block_group_descriptor_table->groups, new_inode_num, &new_inode);
+    ext2_write_inode(fs, new_inode_num, &new_inode);
 
     if (new_inode_num_out) {
         *new_inode_num_out = new_inode_num;
@@ -0,0 +1,778 @@
+/**
+ * @file file.c
+ * @brief Implements regular file I/O: coalesced reads with adaptive readahead, and
+ *        buffered writes with delayed, extent-sized block allocation.
+ */
+
+#include "file.h"
+#include "bmap.h"
+#include "inode.h"
+#include "inode_cache.h"
+#include "superblock.h"
+#include "filesystem.h"
+#include "allocation.h"
+#include "globals.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * @brief Returns the number of logical blocks the file's size covers.
+ */
+static uint64_t file_block_count(const ext2_file *file) {
+    const uint32_t block_size = get_block_size(file->fs->superblock);
+    return (ext2_inode_size(file->inode) + block_size - 1) / block_size;
+}
+
+/**
+ * @brief Finds the first buffered block at or after a logical block.
+ *
+ * @return Index into `file->dirty`; equal to `dirty_count` if there is none.
+ */
+static uint32_t dirty_lower_bound(
+    const ext2_file *file,
+    const uint32_t logical_block
+) {
+    uint32_t low = 0;
+    uint32_t high = file->dirty_count;
+    while (low < high) {
+        const uint32_t middle = low + (high - low) / 2;
+        if (file->dirty[middle].logical < logical_block) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/**
+ * @brief Copies buffered blocks over freshly read data.
+ */
+static void overlay_dirty(
+    const ext2_file *file,
+    const uint32_t logical_block,
+    const uint32_t count,
+    uint8_t *destination
+) {
+    const uint32_t block_size = get_block_size(file->fs->superblock);
+    for (uint32_t i = dirty_lower_bound(file, logical_block);
+         i < file->dirty_count && file->dirty[i].logical - logical_block < count; ++i) {
+        memcpy(destination + (size_t) (file->dirty[i].logical - logical_block) * block_size,
+               file->dirty[i].data, block_size);
+    }
+}
+
+/**
+ * @brief Drops every buffered block from `first` onwards.
+ */
+static void discard_dirty(
+    ext2_file *file,
+    const uint32_t first
+) {
+    const uint32_t keep = dirty_lower_bound(file, first);
+    for (uint32_t i = keep; i < file->dirty_count; ++i) {
+        free(file->dirty[i].data);
+    }
+    file->dirty_count = keep;
+}
+
+/**
+ * @brief Reads consecutive logical blocks, issuing one device read per physical run.
+ *
+ * @param file The open file.
+ * @param logical_block First logical block to read.
+ * @param count Number of blocks to read.
+ * @param destination Buffer of at least `count` blocks.
+ * @return 0 on success, or a negative error code on failure.
+ */
+static int read_blocks(
+    ext2_file *file,
+    const uint32_t logical_block,
+    const uint32_t count,
+    uint8_t *destination
+) {
+    const uint32_t block_size = get_block_size(file->fs->superblock);
+
+    uint32_t done = 0;
+    while (done < count) {
+        ext2_block_extent run;
+        const int status = ext2_block_map_range(&file->map, logical_block + done, count - done, &run);
+        if (status != SUCCESS) {
+            return status;
+        }
+
+        uint8_t *out = destination + (size_t) done * block_size;
+        const size_t run_bytes = (size_t) run.length * block_size;
+        if (run.start == 0) {
+            memset(out, 0, run_bytes); // Hole
+        } else {
+            if (filesystem_read_direct(file->fs, (off_t) run.start * block_size, run_bytes, out) != SUCCESS) {
+                log_error("Error (file_read): Reading %u blocks at block %u of inode %u failed.",
+                        run.length, run.start, file->inode_num);
+                return IO_ERROR;
+            }
+            file->device_reads++;
+        }
+        done += run.length;
+    }
+
+    overlay_dirty(file, logical_block, count, destination);
+    return SUCCESS;
+}
+
+/**
+ * @brief Returns the buffer for a logical block, adding it to the dirty list if needed.
+ *
+ * @param file The open file.
+ * @param logical_block The block about to be written.
+ * @param fill Non-zero to start from the block's current contents; zero if the
+ *             caller overwrites the whole block.
+ * @return The block's buffer, or NULL on failure.
+ */
+static uint8_t *dirty_block(
+    ext2_file *file,
+    const uint32_t logical_block,
+    const int fill
+) {
+    const uint32_t index = dirty_lower_bound(file, logical_block);
+    if (index < file->dirty_count && file->dirty[index].logical == logical_block) {
+        return file->dirty[index].data;
+    }
+
+    if (file->dirty_count == file->dirty_capacity) {
+        const uint32_t capacity = file->dirty_capacity == 0 ? 16 : file->dirty_capacity * 2;
+        ext2_dirty_block *grown = realloc(file->dirty, capacity * sizeof(ext2_dirty_block));
+        if (grown == NULL) {
+            log_error("Error (file_write): Failed to grow the dirty block list.");
+            return NULL;
+        }
+        file->dirty = grown;
+        file->dirty_capacity = capacity;
+    }
+
+    const uint32_t block_size = get_block_size(file->fs->superblock);
+    uint8_t *data = malloc(block_size);
+    if (data == NULL) {
+        log_error("Error (file_write): Failed to allocate a block buffer.");
+        return NULL;
+    }
+    if (!fill || logical_block >= file_block_count(file)) {
+        memset(data, 0, block_size);
+    } else if (read_blocks(file, logical_block, 1, data) != SUCCESS) {
+        free(data);
+        return NULL;
+    }
+
+    memmove(&file->dirty[index + 1], &file->dirty[index],
+            (file->dirty_count - index) * sizeof(ext2_dirty_block));
+    file->dirty[index].logical = logical_block;
+    file->dirty[index].data = data;
+    file->dirty_count++;
+    return data;
+}
+
+/**
+ * @brief Sets the file size, enabling the large file feature when it is needed.
+ */
+static void set_file_size(
+    ext2_file *file,
+    const uint64_t size
+) {
+    file->inode->i_size = (uint32_t) size;
+    file->inode->i_dir_acl = (uint32_t) (size >> 32);
+
+    if (size <= INT32_MAX) {
+        return;
+    }
+
+    ext2_super_block *superblock = file->fs->superblock;
+    ext2_lock_superblock(file->fs);
+    if (!(superblock->s_feature_ro_compat & EXT2_FEATURE_RO_COMPAT_LARGE_FILE)) {
+        superblock->s_feature_ro_compat |= EXT2_FEATURE_RO_COMPAT_LARGE_FILE;
+        ext2_mark_superblock_dirty(file->fs);
+    }
+    ext2_unlock_superblock(file->fs);
+}
+
+/**
+ * @brief Records a change to the file's contents in its inode.
+ */
+static void touch_inode(ext2_file *file) {
+    file->inode->i_mtime = file->inode->i_ctime = (uint32_t) time(NULL);
+    ext2_inode_mark_dirty(file->fs, file->inode);
+}
+
+/**
+ * @brief Returns the number of blocks addressable through i_block and its indirect trees.
+ */
+static uint64_t max_file_blocks(const ext2_file *file) {
+    const uint64_t per = file->map.per_block;
+    return EXT2_IND_BLOCK + per + per * per + per * per * per;
+}
+
+/**
+ * @brief Refills the readahead window so that it starts at a logical block.
+ *
+ * The window doubles while reads stay sequential and drops back to
+ * EXT2_FILE_READAHEAD_MIN blocks after a seek.
+ */
+static int fill_readahead(
+    ext2_file *file,
+    const uint32_t logical_block
+) {
+    const uint32_t block_size = get_block_size(file->fs->superblock);
+    if (file->ra_buffer == NULL) {
+        file->ra_buffer = malloc((size_t) EXT2_FILE_READAHEAD_MAX * block_size);
+        if (file->ra_buffer == NULL) {
+            log_error("Error (file_read): Failed to allocate readahead buffer.");
+            return ERROR;
+        }
+    }
+
+    uint32_t window = EXT2_FILE_READAHEAD_MIN;
+    if (logical_block == file->next_block && file->ra_window > 0) {
+        window = file->ra_window * 2 < EXT2_FILE_READAHEAD_MAX ? file->ra_window * 2 : EXT2_FILE_READAHEAD_MAX;
+    }
+
+    const uint64_t blocks_left = file_block_count(file) - logical_block;
+    const uint32_t count = blocks_left < window ? (uint32_t) blocks_left : window;
+
+    file->ra_count = 0;
+    const int status = read_blocks(file, logical_block, count, file->ra_buffer);
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    file->ra_start = logical_block;
+    file->ra_count = count;
+    file->ra_window = window;
+    return SUCCESS;
+}
+
+ext2_file *ext2_file_open(ext2_filesystem *fs, const uint32_t inode_num) {
+    if (fs == NULL || fs->superblock == NULL) {
+        log_error("Error (file_open): NULL pointer argument provided.");
+        return NULL;
+    }
+
+    ext2_file *file = calloc(1, sizeof(ext2_file));
+    if (file == NULL) {
+        log_error("Error (file_open): Failed to allocate file handle.");
+        return NULL;
+    }
+
+    file->inode = ext2_inode_get(fs, inode_num);
+    if (file->inode == NULL) {
+        log_error("Error (file_open): Failed to read inode %u.", inode_num);
+        free(file);
+        return NULL;
+    }
+    if ((file->inode->i_mode & EXT2_S_IFMT) != EXT2_S_IFREG) {
+        log_error("Error (file_open): Inode %u is not a regular file.", inode_num);
+        ext2_inode_put(fs, file->inode);
+        free(file);
+        return NULL;
+    }
+
+    file->fs = fs;
+    file->inode_num = inode_num;
+    ext2_block_map_init(&file->map, fs, file->inode);
+    return file;
+}
+
+ssize_t ext2_file_pread(
+    ext2_file *file,
+    void *buffer,
+    size_t count,
+    const uint64_t offset
+) {
+    if (file == NULL || buffer == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    const uint64_t size = ext2_inode_size(file->inode);
+    if (offset >= size) {
+        return 0;
+    }
+    if (count > size - offset) {
+        count = (size_t) (size - offset);
+    }
+
+    const uint32_t block_size = get_block_size(file->fs->superblock);
+    uint8_t *out = buffer;
+    size_t done = 0;
+
+    while (done < count) {
+        const uint64_t position = offset + done;
+        const uint32_t logical_block = (uint32_t) (position / block_size);
+        const uint32_t offset_in_block = (uint32_t) (position % block_size);
+        int status;
+
+        // Served from the readahead window.
+        if (file->ra_count > 0 && logical_block >= file->ra_start &&
+            logical_block < file->ra_start + file->ra_count) {
+            const uint64_t window_end = (uint64_t) (file->ra_start + file->ra_count) * block_size;
+            size_t chunk = (size_t) (window_end - position);
+            if (chunk > count - done) {
+                chunk = count - done;
+            }
+            memcpy(out + done, file->ra_buffer + (position - (uint64_t) file->ra_start * block_size), chunk);
+            done += chunk;
+            file->next_block = (uint32_t) ((position + chunk - 1) / block_size) + 1;
+            continue;
+        }
+
+        // Large aligned reads go straight into the caller's buffer.
+        const size_t whole_blocks = (count - done) / block_size;
+        if (offset_in_block == 0 && whole_blocks >= EXT2_FILE_READAHEAD_MIN) {
+            status = read_blocks(file, logical_block, (uint32_t) whole_blocks, out + done);
+            if (status != SUCCESS) {
+                return status;
+            }
+            done += whole_blocks * block_size;
+            file->next_block = logical_block + (uint32_t) whole_blocks;
+            continue;
+        }
+
+        status = fill_readahead(file, logical_block);
+        if (status != SUCCESS) {
+            return status;
+        }
+    }
+
+    return (ssize_t) done;
+}
+
+ssize_t ext2_file_read(
+    ext2_file *file,
+    void *buffer,
+    const size_t count
+) {
+    if (file == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    const ssize_t n = ext2_file_pread(file, buffer, count, file->position);
+    if (n > 0) {
+        file->position += (uint64_t) n;
+    }
+    return n;
+}
+
+ssize_t ext2_file_pwrite(
+    ext2_file *file,
+    const void *buffer,
+    const size_t count,
+    const uint64_t offset
+) {
+    if (file == NULL || (buffer == NULL && count > 0)) {
+        return INVALID_PARAMETER;
+    }
+    if (file->fs->flags & EXT2_OPEN_MMAP) {
+        log_error("Error (file_write): Cannot write to a read-only mapped image.");
+        return ERROR;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    const uint32_t block_size = get_block_size(file->fs->superblock);
+    uint64_t limit = max_file_blocks(file);
+    if (limit > UINT32_MAX) {
+        limit = UINT32_MAX;
+    }
+    if (offset + count < offset || (offset + count + block_size - 1) / block_size > limit) {
+        log_error("Error (file_write): Write of %zu bytes at %llu is past the largest file size.",
+                count, (unsigned long long) offset);
+        return INVALID_PARAMETER;
+    }
+
+    // The readahead window would go stale.
+    const uint32_t first_block = (uint32_t) (offset / block_size);
+    const uint32_t last_block = (uint32_t) ((offset + count - 1) / block_size);
+    if (file->ra_count > 0 && first_block < file->ra_start + file->ra_count && last_block >= file->ra_start) {
+        file->ra_count = 0;
+    }
+
+    const uint8_t *in = buffer;
+    size_t done = 0;
+    while (done < count) {
+        const uint64_t position = offset + done;
+        const uint32_t logical_block = (uint32_t) (position / block_size);
+        const uint32_t offset_in_block = (uint32_t) (position % block_size);
+        const size_t chunk = count - done < block_size - offset_in_block ? count - done : block_size - offset_in_block;
+
+        uint8_t *data = dirty_block(file, logical_block, chunk < block_size);
+        if (data == NULL) {
+            return ERROR;
+        }
+        memcpy(data + offset_in_block, in + done, chunk);
+        done += chunk;
+
+        if (position + chunk > ext2_inode_size(file->inode)) {
+            set_file_size(file, position + chunk);
+        }
+        if (file->dirty_count >= EXT2_FILE_DIRTY_MAX) {
+            const int status = ext2_file_flush(file);
+            if (status != SUCCESS) {
+                return status;
+            }
+        }
+    }
+
+    touch_inode(file);
+    return (ssize_t) done;
+}
+
+ssize_t ext2_file_write(
+    ext2_file *file,
+    const void *buffer,
+    const size_t count
+) {
+    if (file == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    const ssize_t n = ext2_file_pwrite(file, buffer, count, file->position);
+    if (n > 0) {
+        file->position += (uint64_t) n;
+    }
+    return n;
+}
+
+/**
+ * @brief Gives physical blocks to a run of unmapped logical blocks.
+ *
+ * @param file The open file.
+ * @param logical_block First block of the run.
+ * @param count Length of the run.
+ * @param extents_out Receives the allocated extents (at least `count` entries).
+ * @param extent_count_out Set to the number of extents used.
+ * @return 0 on success, or a negative error code on failure.
+ */
+static int allocate_run(
+    ext2_file *file,
+    const uint32_t logical_block,
+    const uint32_t count,
+    ext2_block_extent *extents_out,
+    uint32_t *extent_count_out
+) {
+    const uint32_t block_size = get_block_size(file->fs->superblock);
+
+    // Continue right after the previous block of the file when there is one.
+    uint32_t goal = 0;
+    if (logical_block > 0 && ext2_block_map_lookup(&file->map, logical_block - 1, &goal) == SUCCESS && goal != 0) {
+        goal++;
+    } else {
+        goal = ext2_inode_block_goal(file->fs, file->inode_num);
+    }
+
+    int status = ext2_allocate_blocks(file->fs, goal, count, extents_out, count, extent_count_out);
+    if (status != SUCCESS) {
+        log_error("Error (file_flush): Allocating %u blocks for inode %u failed.", count, file->inode_num);
+        return status;
+    }
+
+    uint32_t logical = logical_block;
+    uint32_t allocated = count;
+    for (uint32_t e = 0; e < *extent_count_out && status == SUCCESS; ++e) {
+        for (uint32_t k = 0; k < extents_out[e].length; ++k) {
+            uint32_t indirect = 0;
+            status = ext2_block_map_set(&file->map, file->inode, logical, extents_out[e].start + k, &indirect);
+            if (status != SUCCESS) {
+                log_error("Error (file_flush): Mapping block %u of inode %u failed.", logical, file->inode_num);
+                // Return the data blocks that were never mapped.
+                ext2_block_extent rest = {extents_out[e].start + k, extents_out[e].length - k};
+                ext2_free_blocks(file->fs, &rest, 1);
+                ext2_free_blocks(file->fs, extents_out + e + 1, *extent_count_out - e - 1);
+                allocated -= count - (logical - logical_block);
+                break;
+            }
+            allocated += indirect;
+            logical++;
+        }
+    }
+
+    file->inode->i_blocks += allocated * (block_size / 512);
+    return status;
+}
+
+int ext2_file_flush(ext2_file *file) {
+    if (file == NULL) {
+        return INVALID_PARAMETER;
+    }
+    if (file->dirty_count == 0) {
+        return SUCCESS;
+    }
+
+    const uint32_t block_size = get_block_size(file->fs->superblock);
+    uint8_t *staging = malloc((size_t) EXT2_FILE_WRITE_RUN_MAX * block_size);
+    if (staging == NULL) {
+        log_error("Error (file_flush): Failed to allocate the staging buffer.");
+        return ERROR;
+    }
+
+    int status = SUCCESS;
+    uint32_t i = 0;
+    while (i < file->dirty_count && status == SUCCESS) {
+        // Logically consecutive buffered blocks.
+        uint32_t length = 1;
+        while (i + length < file->dirty_count && length < EXT2_FILE_WRITE_RUN_MAX &&
+               file->dirty[i + length].logical == file->dirty[i].logical + length) {
+            ++length;
+        }
+
+        // The part of them that is mapped to one physical run, or unmapped.
+        ext2_block_extent run;
+        status = ext2_block_map_range(&file->map, file->dirty[i].logical, length, &run);
+        if (status != SUCCESS) {
+            break;
+        }
+
+        ext2_block_extent extents[EXT2_FILE_WRITE_RUN_MAX];
+        uint32_t extent_count = 1;
+        extents[0] = run;
+        if (run.start == 0) {
+            status = allocate_run(file, file->dirty[i].logical, run.length, extents, &extent_count);
+            if (status != SUCCESS) {
+                break;
+            }
+        }
+
+        for (uint32_t k = 0; k < run.length; ++k) {
+            memcpy(staging + (size_t) k * block_size, file->dirty[i + k].data, block_size);
+        }
+        const uint8_t *source = staging;
+        for (uint32_t e = 0; e < extent_count && status == SUCCESS; ++e) {
+            const size_t bytes = (size_t) extents[e].length * block_size;
+            if (filesystem_write_direct(file->fs, (off_t) extents[e].start * block_size, bytes, source) != SUCCESS) {
+                log_error("Error (file_flush): Writing %u blocks at block %u of inode %u failed.",
+                        extents[e].length, extents[e].start, file->inode_num);
+                status = IO_ERROR;
+            }
+            file->device_writes++;
+            source += bytes;
+        }
+        if (status == SUCCESS) {
+            i += run.length;
+        }
+    }
+    free(staging);
+
+    // Blocks that made it to the image leave the list; the rest stay buffered.
+    for (uint32_t k = 0; k < i; ++k) {
+        free(file->dirty[k].data);
+    }
+    memmove(file->dirty, file->dirty + i, (file->dirty_count - i) * sizeof(ext2_dirty_block));
+    file->dirty_count -= i;
+
+    ext2_inode_mark_dirty(file->fs, file->inode);
+    return status;
+}
+
+/**
+ * @brief Blocks freed by a truncate, merged into extents as they are collected.
+ */
+typedef struct {
+    ext2_block_extent *extents;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t blocks;
+} freed_list;
+
+static int add_freed(
+    freed_list *list,
+    const uint32_t block_id
+) {
+    list->blocks++;
+    if (list->count > 0) {
+        ext2_block_extent *last = &list->extents[list->count - 1];
+        if (last->start + last->length == block_id) {
+            last->length++;
+            return SUCCESS;
+        }
+    }
+
+    if (list->count == list->capacity) {
+        const uint32_t capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+        ext2_block_extent *grown = realloc(list->extents, capacity * sizeof(ext2_block_extent));
+        if (grown == NULL) {
+            log_error("Error (file_truncate): Failed to grow the freed block list.");
+            return ERROR;
+        }
+        list->extents = grown;
+        list->capacity = capacity;
+    }
+    list->extents[list->count].start = block_id;
+    list->extents[list->count].length = 1;
+    list->count++;
+    return SUCCESS;
+}
+
+/**
+ * @brief Frees the part of an indirect tree that maps blocks at or past `keep`.
+ *
+ * @param file The open file.
+ * @param block_id The indirect block at the root of the subtree.
+ * @param levels 1 if the block holds data block numbers, 2 or 3 for deeper trees.
+ * @param first_logical First logical block mapped by the subtree.
+ * @param keep Number of logical blocks to keep.
+ * @param freed Collects the freed blocks.
+ * @param released_out Set to 1 if `block_id` itself was freed.
+ * @return 0 on success, or a negative error code on failure.
+ */
+static int release_tree(
+    ext2_file *file,
+    const uint32_t block_id,
+    const int levels,
+    const uint64_t first_logical,
+    const uint64_t keep,
+    freed_list *freed,
+    int *released_out
+) {
+    const uint32_t block_size = get_block_size(file->fs->superblock);
+    const uint32_t per = file->map.per_block;
+    uint64_t span = 1;
+    for (int level = 1; level < levels; ++level) {
+        span *= per;
+    }
+
+    *released_out = 0;
+    uint32_t *entries = malloc(block_size);
+    if (entries == NULL) {
+        return ERROR;
+    }
+    if (filesystem_read(file->fs, (off_t) block_id * block_size, block_size, entries) != SUCCESS) {
+        log_error("Error (file_truncate): Reading indirect block %u failed.", block_id);
+        free(entries);
+        return IO_ERROR;
+    }
+
+    int status = SUCCESS;
+    int modified = 0;
+    for (uint32_t slot = 0; slot < per && status == SUCCESS; ++slot) {
+        const uint64_t child_first = first_logical + slot * span;
+        if (entries[slot] == 0 || child_first + span <= keep) {
+            continue;
+        }
+
+        int released = 1;
+        if (levels == 1) {
+            status = add_freed(freed, entries[slot]);
+        } else {
+            status = release_tree(file, entries[slot], levels - 1, child_first, keep, freed, &released);
+        }
+        if (status == SUCCESS && released) {
+            entries[slot] = 0;
+            modified = 1;
+        }
+    }
+
+    if (status == SUCCESS) {
+        if (first_logical >= keep) {
+            status = add_freed(freed, block_id);
+            *released_out = status == SUCCESS;
+        } else if (modified &&
+                   filesystem_write(file->fs, (off_t) block_id * block_size, block_size, entries) != SUCCESS) {
+            status = IO_ERROR;
+        }
+    }
+    free(entries);
+    return status;
+}
+
+int ext2_file_truncate(
+    ext2_file *file,
+    const uint64_t new_size
+) {
+    if (file == NULL) {
+        return INVALID_PARAMETER;
+    }
+    if (file->fs->flags & EXT2_OPEN_MMAP) {
+        log_error("Error (file_truncate): Cannot truncate on a read-only mapped image.");
+        return ERROR;
+    }
+
+    const uint32_t block_size = get_block_size(file->fs->superblock);
+    const uint64_t keep = (new_size + block_size - 1) / block_size;
+    if (keep > max_file_blocks(file) || keep > UINT32_MAX) {
+        return INVALID_PARAMETER;
+    }
+
+    int status = SUCCESS;
+    if (new_size < ext2_inode_size(file->inode)) {
+        discard_dirty(file, (uint32_t) keep);
+        file->ra_count = 0;
+
+        // Zero the rest of the new last block, so growing the file again reads zeros.
+        const uint32_t tail = (uint32_t) (new_size % block_size);
+        uint32_t last_physical = 0;
+        if (tail != 0 &&
+            ext2_block_map_lookup(&file->map, (uint32_t) keep - 1, &last_physical) == SUCCESS &&
+            (last_physical != 0 || dirty_lower_bound(file, (uint32_t) keep - 1) < file->dirty_count)) {
+            uint8_t *data = dirty_block(file, (uint32_t) keep - 1, 1);
+            if (data == NULL) {
+                return ERROR;
+            }
+            memset(data + tail, 0, block_size - tail);
+        }
+
+        freed_list freed = {0};
+        ext2_inode *inode = file->inode;
+        for (uint64_t logical = keep; logical < EXT2_IND_BLOCK && status == SUCCESS; ++logical) {
+            if (inode->i_block[logical] != 0) {
+                status = add_freed(&freed, inode->i_block[logical]);
+                inode->i_block[logical] = 0;
+            }
+        }
+
+        const uint64_t per = file->map.per_block;
+        uint64_t first = EXT2_IND_BLOCK;
+        uint64_t span = per;
+        for (int levels = 1; levels <= 3 && status == SUCCESS; ++levels) {
+            uint32_t *root = &inode->i_block[EXT2_IND_BLOCK + levels - 1];
+            if (*root != 0 && first + span > keep) {
+                int released;
+                status = release_tree(file, *root, levels, first, keep, &freed, &released);
+                if (released) {
+                    *root = 0;
+                }
+            }
+            first += span;
+            span *= per;
+        }
+
+        if (ext2_free_blocks(file->fs, freed.extents, freed.count) != SUCCESS) {
+            status = IO_ERROR;
+        }
+        inode->i_blocks -= freed.blocks * (block_size / 512);
+        free(freed.extents);
+        ext2_block_map_invalidate(&file->map);
+    }
+
+    set_file_size(file, new_size);
+    touch_inode(file);
+    return status;
+}
+
+uint64_t ext2_file_size(const ext2_file *file) {
+    return ext2_inode_size(file->inode);
+}
+
+void ext2_file_close(ext2_file *file) {
+    if (file == NULL) {
+        return;
+    }
+
+    if (ext2_file_flush(file) != SUCCESS) {
+        log_error("Error (file_close): Flushing inode %u failed; buffered data was lost.", file->inode_num);
+    }
+    discard_dirty(file, 0);
+    free(file->dirty);
+    ext2_block_map_release(&file->map);
+    ext2_inode_put(file->fs, file->inode);
+    free(file->ra_buffer);
+    free(file);
+}
@@ -1,12 +1,203 @@
 #include "filesystem.h"
 #include "superblock.h"
 #include "block_group.h"
+#include "block_cache.h"
+#include "block_device.h"
+#include "bitmap.h"
+#include "inode_cache.h"
+#include "dentry_cache.h"
+#include "free_index.h"
 #include "globals.h"
 
 #include <stdlib.h>
 #include <string.h>
 
+/**
+ * @brief Writes dirty inodes, bitmaps, group descriptors and the superblock, in that order.
+ *
+ * Free counts only reach the image after the bitmaps they describe.
+ */
+static int flush_metadata(ext2_filesystem *fs) {
+    int status = SUCCESS;
+    if (ext2_flush_inodes(fs) != SUCCESS) {
+        status = IO_ERROR;
+    }
+    if (ext2_flush_group_bitmaps(fs) != SUCCESS) {
+        status = IO_ERROR;
+    }
+    if (ext2_flush_group_descriptors(fs) != SUCCESS) {
+        status = IO_ERROR;
+    }
+    if (ext2_flush_superblock(fs) != SUCCESS) {
+        status = IO_ERROR;
+    }
+    return status;
+}
+
+/**
+ * @brief Frees the locks of a context.
+ */
+static void destroy_locks(ext2_fs_locks *locks, const uint32_t groups_count) {
+    if (locks == NULL) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < groups_count; ++i) {
+        pthread_mutex_destroy(&locks->groups[i]);
+    }
+    pthread_mutex_destroy(&locks->superblock);
+    free(locks->groups);
+    free(locks);
+}
+
+/**
+ * @brief Makes a new context safe to share between threads.
+ *
+ * Creates the group and superblock locks, and allocates the per-group bitmap
+ * and descriptor tracking up front instead of on first use.
+ *
+ * @return 0 on success, or ERROR with nothing allocated.
+ */
+static int create_locks(ext2_filesystem *fs) {
+    const uint32_t groups_count = fs->bgdt->groups_count;
+
+    fs->locks = calloc(1, sizeof(ext2_fs_locks));
+    fs->bitmaps = calloc(groups_count, sizeof(ext2_group_bitmaps));
+    fs->group_desc_dirty = calloc(groups_count, sizeof(uint8_t));
+    if (fs->locks != NULL) {
+        fs->locks->groups = malloc(groups_count * sizeof(pthread_mutex_t));
+    }
+    if (fs->locks == NULL || fs->locks->groups == NULL || fs->bitmaps == NULL || fs->group_desc_dirty == NULL) {
+        log_error("Failed to allocate locks for %u block groups.\n", groups_count);
+        if (fs->locks != NULL) {
+            free(fs->locks->groups);
+        }
+        free(fs->locks);
+        free(fs->bitmaps);
+        free(fs->group_desc_dirty);
+        fs->locks = NULL;
+        fs->bitmaps = NULL;
+        fs->group_desc_dirty = NULL;
+        return ERROR;
+    }
+
+    for (uint32_t i = 0; i < groups_count; ++i) {
+        pthread_mutex_init(&fs->locks->groups[i], NULL);
+    }
+    pthread_mutex_init(&fs->locks->superblock, NULL);
+    return SUCCESS;
+}
+
+/**
+ * @brief Creates the inode and dentry caches of a new context.
+ * @return 0 on success, or ERROR with neither cache created.
+ */
+static int create_lookup_caches(ext2_filesystem *fs) {
+    fs->icache = inode_cache_create(EXT2_DEFAULT_INODE_CACHE_SIZE);
+    fs->dcache = dentry_cache_create(EXT2_DEFAULT_DENTRY_CACHE_SIZE);
+    if (fs->icache == NULL || fs->dcache == NULL) {
+        log_error("Failed to create inode and dentry caches.\n");
+        inode_cache_destroy(fs->icache);
+        dentry_cache_destroy(fs->dcache);
+        fs->icache = NULL;
+        fs->dcache = NULL;
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Finishes a context for a mapped device, borrowing metadata from the mapping.
+ *
+ * The page cache already holds the image, so no block cache is created.
+ */
+static ext2_filesystem *init_mapped(ext2_filesystem *fs, ext2_block_device *device) {
+    ext2_super_block *superblock = ext2_map_superblock(device);
+    if (superblock == NULL) {
+        log_error("Failed to read superblock.\n");
+        free(fs);
+        return NULL;
+    }
+
+    ext2_group_desc_table *bgdt = ext2_map_group_descriptor_table(device, superblock);
+    if (bgdt == NULL) {
+        log_error("Failed to read block group descriptor table.\n");
+        free(fs);
+        return NULL;
+    }
+
+    fs->device = device;
+    fs->superblock = superblock;
+    fs->bgdt = bgdt;
+    fs->flags = EXT2_OPEN_MMAP;
+    if (create_lookup_caches(fs) != SUCCESS) {
+        free(bgdt);
+        free(fs);
+        return NULL;
+    }
+    if (create_locks(fs) != SUCCESS) {
+        inode_cache_destroy(fs->icache);
+        dentry_cache_destroy(fs->dcache);
+        free(bgdt);
+        free(fs);
+        return NULL;
+    }
+
+    return fs;
+}
+
 ext2_filesystem *filesystem_init(FILE *device) {
+    return filesystem_init_with_cache(device, EXT2_DEFAULT_CACHE_BLOCKS);
+}
+
+ext2_filesystem *filesystem_init_with_cache(FILE *device, const uint32_t cache_blocks) {
+    if (device == NULL) {
+        log_error("device cannot be NULL.\n");
+        return NULL;
+    }
+
+    ext2_block_device *block_device = block_device_from_stream(device, 1);
+    if (block_device == NULL) {
+        return NULL;
+    }
+
+    ext2_filesystem *fs = filesystem_init_device(block_device, cache_blocks);
+    if (fs == NULL) {
+        // The caller keeps ownership of the stream on failure.
+        block_device->owns_handle = 0;
+        block_device_close(block_device);
+    }
+
+    return fs;
+}
+
+ext2_filesystem *filesystem_open(const char *path, const int flags) {
+    if ((flags & EXT2_OPEN_MMAP) && (flags & EXT2_OPEN_WRITE)) {
+        log_error("filesystem_open: EXT2_OPEN_MMAP images are read-only.\n");
+        return NULL;
+    }
+
+    ext2_block_device *device = (flags & EXT2_OPEN_MMAP)
+                                    ? block_device_open_mapped(path)
+                                    : block_device_open(path, (flags & EXT2_OPEN_WRITE) != 0);
+    if (device == NULL) {
+        return NULL;
+    }
+    if ((flags & EXT2_OPEN_IO_URING) && device->map == NULL) {
+        block_device_enable_io_uring(device, 0); // Falls back to synchronous I/O
+    }
+
+    ext2_filesystem *fs = filesystem_init_device(device, EXT2_DEFAULT_CACHE_BLOCKS);
+    if (fs == NULL) {
+        block_device_close(device);
+        return NULL;
+    }
+
+    fs->flags |= flags;
+    return fs;
+}
+
+ext2_filesystem *filesystem_init_device(ext2_block_device *device, const uint32_t cache_blocks) {
     if (device == NULL) {
         log_error("device cannot be NULL.\n");
         return NULL;
@@ -20,44 +211,191 @@ ext2_filesystem *filesystem_init(FILE *device) {
 
     memset(fs, 0, sizeof(ext2_filesystem));
 
-    ext2_super_block *superblock = read_superblock(device);
+    if (device->map != NULL) {
+        return init_mapped(fs, device);
+    }
+
+    ext2_super_block *superblock = ext2_read_superblock(device);
     if (superblock == NULL) {
         log_error("Failed to read superblock.\n");
         free(fs);
         return NULL;
     }
 
-    ext2_group_desc_table *bgdt = read_group_descriptor_table(device, superblock);
-    if (fs->bgdt == NULL) {
+    ext2_group_desc_table *bgdt = ext2_read_group_descriptor_table(device, superblock);
+    if (bgdt == NULL) {
         log_error("Failed to read block group descriptor table.\n");
         free(superblock);
         free(fs);
         return NULL;
     }
 
+    if (cache_blocks > 0) {
+        fs->cache = block_cache_create(device, get_block_size(superblock), cache_blocks);
+        if (fs->cache == NULL) {
+            log_error("Failed to create block cache.\n");
+            free(bgdt->groups);
+            free(bgdt);
+            free(superblock);
+            free(fs);
+            return NULL;
+        }
+    }
+
+    if (create_lookup_caches(fs) != SUCCESS) {
+        block_cache_destroy(fs->cache);
+        free(bgdt->groups);
+        free(bgdt);
+        free(superblock);
+        free(fs);
+        return NULL;
+    }
+
     fs->device = device;
     fs->superblock = superblock;
     fs->bgdt = bgdt;
 
+    if (create_locks(fs) != SUCCESS) {
+        inode_cache_destroy(fs->icache);
+        dentry_cache_destroy(fs->dcache);
+        block_cache_destroy(fs->cache);
+        free(bgdt->groups);
+        free(bgdt);
+        free(superblock);
+        free(fs);
+        return NULL;
+    }
+
     return fs;
 }
 
+int filesystem_sync(ext2_filesystem *fs) {
+    if (fs == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    if (flush_metadata(fs) != SUCCESS) {
+        log_error("filesystem_sync: writing metadata");
+        return IO_ERROR;
+    }
+
+    if (fs->cache != NULL) {
+        return block_cache_flush(fs->cache);
+    }
+
+    if (block_device_flush(fs->device) != SUCCESS) {
+        log_error("filesystem_sync: flushing device");
+        return IO_ERROR;
+    }
+
+    return SUCCESS;
+}
+
 void filesystem_free(ext2_filesystem *fs) {
     if (fs == NULL) {
         return;
     }
 
-    if (fs->superblock) {
+    // Mapped metadata belongs to the device and goes away with it.
+    const int owns_metadata = (fs->flags & EXT2_OPEN_MMAP) == 0;
+
+    if (flush_metadata(fs) != SUCCESS) {
+        log_error("Warning (filesystem_free): Some metadata could not be written back.\n");
+    }
+    ext2_release_group_bitmaps(fs);
+    free(fs->group_desc_dirty);
+    free_index_destroy(fs->free_index);
+    inode_cache_destroy(fs->icache);
+    dentry_cache_destroy(fs->dcache);
+    destroy_locks(fs->locks, fs->bgdt != NULL ? fs->bgdt->groups_count : 0);
+
+    if (fs->cache) {
+        block_cache_destroy(fs->cache);
+    }
+    if (fs->superblock && owns_metadata) {
         free(fs->superblock);
     }
     if (fs->bgdt) {
-        if (fs->bgdt->groups) {
+        if (fs->bgdt->groups && owns_metadata) {
             free(fs->bgdt->groups);
         }
         free(fs->bgdt);
     }
     if (fs->device) {
-        fclose(fs->device);
+        block_device_close(fs->device);
     }
     free(fs);
 }
+
+int filesystem_read(ext2_filesystem *fs, const off_t offset, const size_t length, void *buffer) {
+    if (fs->cache != NULL) {
+        return block_cache_read(fs->cache, offset, length, buffer);
+    }
+
+    return block_device_read(fs->device, offset, length, buffer);
+}
+
+int filesystem_write(ext2_filesystem *fs, const off_t offset, const size_t length, const void *buffer) {
+    if (fs->cache != NULL) {
+        return block_cache_write(fs->cache, offset, length, buffer);
+    }
+
+    return block_device_write(fs->device, offset, length, buffer);
+}
+
+int filesystem_read_direct(ext2_filesystem *fs, const off_t offset, const size_t length, void *buffer) {
+    if (fs->cache != NULL) {
+        return block_cache_read_direct(fs->cache, offset, length, buffer);
+    }
+
+    return block_device_read(fs->device, offset, length, buffer);
+}
+
+int filesystem_write_direct(ext2_filesystem *fs, const off_t offset, const size_t length, const void *buffer) {
+    if (fs->cache != NULL) {
+        return block_cache_write_direct(fs->cache, offset, length, buffer);
+    }
+
+    return block_device_write(fs->device, offset, length, buffer);
+}
+
+const void *filesystem_map(const ext2_filesystem *fs, const off_t offset, const size_t length) {
+    if (fs == NULL) {
+        return NULL;
+    }
+
+    return block_device_map(fs->device, offset, length);
+}
+
+ext2_filesystem *filesystem_wrap_stream(
+    ext2_stream_context *context,
+    FILE *device,
+    const ext2_super_block *superblock,
+    const ext2_group_desc *groups
+) {
+    memset(context, 0, sizeof(ext2_stream_context));
+
+    // The stream API takes const metadata for read-only calls; the context never
+    // writes through these pointers on those paths.
+    context->table.groups = (ext2_group_desc *) groups;
+    context->table.groups_count = groups != NULL ? get_block_group_count(superblock) : 0;
+
+    block_device_init_stream(&context->device, device);
+
+    context->fs.device = &context->device;
+    context->fs.superblock = (ext2_super_block *) superblock;
+    context->fs.bgdt = &context->table;
+    context->fs.cache = NULL;
+
+    return &context->fs;
+}
+
+int filesystem_finish_stream(ext2_filesystem *fs, const int status) {
+    const int flush_status = flush_metadata(fs);
+    ext2_release_group_bitmaps(fs);
+    free(fs->group_desc_dirty);
+    fs->group_desc_dirty = NULL;
+    free_index_destroy(fs->free_index);
+    fs->free_index = NULL;
+    return status != SUCCESS ? status : flush_status;
+}
@@ -0,0 +1,196 @@
+/**
+ * @file free_index.c
+ * @brief Implements the max segment trees over the block groups' free counts.
+ *
+ * Searches to the right of a group start at its leaf and climb until they can
+ * step onto a right sibling whose maximum is large enough, then descend into the
+ * leftmost qualifying leaf below it; searches to the left mirror this. Both
+ * touch at most two nodes per level.
+ */
+
+#include "free_index.h"
+#include "globals.h"
+
+#include <stdlib.h>
+
+/**
+ * @brief Returns the tree for one kind of count.
+ */
+static uint16_t *tree_of(
+    const ext2_free_index *index,
+    const ext2_bitmap_kind kind
+) {
+    return kind == EXT2_BLOCK_BITMAP ? index->free_blocks : index->free_inodes;
+}
+
+static uint16_t max_u16(const uint16_t a, const uint16_t b) {
+    return a > b ? a : b;
+}
+
+ext2_free_index *free_index_create(
+    const ext2_group_desc *groups,
+    const uint32_t groups_count
+) {
+    if (groups == NULL || groups_count == 0) {
+        log_error("Error (free_index): No block groups to index.\n");
+        return NULL;
+    }
+
+    ext2_free_index *index = calloc(1, sizeof(ext2_free_index));
+    if (index == NULL) {
+        log_error("Error (free_index): Failed to allocate the index.\n");
+        return NULL;
+    }
+    index->groups_count = groups_count;
+    index->leaves = 1;
+    while (index->leaves < groups_count) {
+        index->leaves <<= 1;
+    }
+    index->free_blocks = calloc(2 * (size_t) index->leaves, sizeof(uint16_t));
+    index->free_inodes = calloc(2 * (size_t) index->leaves, sizeof(uint16_t));
+    if (index->free_blocks == NULL || index->free_inodes == NULL) {
+        log_error("Error (free_index): Failed to allocate trees for %u groups.\n", groups_count);
+        free_index_destroy(index);
+        return NULL;
+    }
+
+    for (uint32_t g = 0; g < groups_count; ++g) {
+        index->free_blocks[index->leaves + g] = groups[g].bg_free_blocks_count;
+        index->free_inodes[index->leaves + g] = groups[g].bg_free_inodes_count;
+    }
+    for (uint32_t node = index->leaves - 1; node >= 1; --node) {
+        index->free_blocks[node] = max_u16(index->free_blocks[2 * node], index->free_blocks[2 * node + 1]);
+        index->free_inodes[node] = max_u16(index->free_inodes[2 * node], index->free_inodes[2 * node + 1]);
+    }
+
+    return index;
+}
+
+void free_index_destroy(ext2_free_index *index) {
+    if (index == NULL) {
+        return;
+    }
+
+    free(index->free_blocks);
+    free(index->free_inodes);
+    free(index);
+}
+
+void free_index_update(
+    ext2_free_index *index,
+    const ext2_bitmap_kind kind,
+    const uint32_t group_idx,
+    const uint16_t free_count
+) {
+    if (index == NULL || group_idx >= index->groups_count) {
+        return;
+    }
+
+    uint16_t *tree = tree_of(index, kind);
+    uint32_t node = index->leaves + group_idx;
+    tree[node] = free_count;
+    for (node >>= 1; node >= 1; node >>= 1) {
+        const uint16_t value = max_u16(tree[2 * node], tree[2 * node + 1]);
+        if (tree[node] == value) {
+            break; // Nothing above changes either
+        }
+        tree[node] = value;
+    }
+}
+
+int free_index_find_next(
+    const ext2_free_index *index,
+    const ext2_bitmap_kind kind,
+    const uint32_t from,
+    uint32_t min_free,
+    uint32_t *group_out
+) {
+    if (index == NULL || group_out == NULL || from >= index->groups_count) {
+        return ERROR;
+    }
+    if (min_free == 0) {
+        min_free = 1; // Unused leaves hold 0 and must never match
+    }
+
+    const uint16_t *tree = tree_of(index, kind);
+    uint32_t node = index->leaves + from;
+    while (tree[node] < min_free) {
+        // Climb past right children; the subtree right of a left child is its sibling.
+        while (node & 1) {
+            node >>= 1;
+            if (node == 0) {
+                return ERROR;
+            }
+        }
+        node++;
+    }
+    while (node < index->leaves) {
+        node <<= 1;
+        if (tree[node] < min_free) {
+            node++;
+        }
+    }
+
+    *group_out = node - index->leaves;
+    return SUCCESS;
+}
+
+int free_index_find_prev(
+    const ext2_free_index *index,
+    const ext2_bitmap_kind kind,
+    const uint32_t from,
+    uint32_t min_free,
+    uint32_t *group_out
+) {
+    if (index == NULL || group_out == NULL || from >= index->groups_count) {
+        return ERROR;
+    }
+    if (min_free == 0) {
+        min_free = 1;
+    }
+
+    const uint16_t *tree = tree_of(index, kind);
+    uint32_t node = index->leaves + from;
+    while (tree[node] < min_free) {
+        // Climb past left children; the subtree left of a right child is its sibling.
+        while ((node & 1) == 0) {
+            node >>= 1;
+        }
+        if (node == 1) {
+            return ERROR;
+        }
+        node--;
+    }
+    while (node < index->leaves) {
+        node = 2 * node + 1;
+        if (tree[node] < min_free) {
+            node--;
+        }
+    }
+
+    *group_out = node - index->leaves;
+    return SUCCESS;
+}
+
+int free_index_find_near(
+    const ext2_free_index *index,
+    const ext2_bitmap_kind kind,
+    const uint32_t goal,
+    const uint32_t min_free,
+    uint32_t *group_out
+) {
+    if (index == NULL || group_out == NULL || goal >= index->groups_count) {
+        return ERROR;
+    }
+
+    uint32_t above;
+    uint32_t below;
+    const int found_above = free_index_find_next(index, kind, goal, min_free, &above) == SUCCESS;
+    const int found_below = goal > 0 && free_index_find_prev(index, kind, goal - 1, min_free, &below) == SUCCESS;
+    if (!found_above && !found_below) {
+        return ERROR;
+    }
+
+    *group_out = found_above && (!found_below || above - goal <= goal - below) ? above : below;
+    return SUCCESS;
+}
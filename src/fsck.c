@@ -0,0 +1,884 @@
+/**
+ * @file fsck.c
+ * @brief Implements the read-only, multi-threaded consistency check.
+ *
+ * Pass 1 hands block groups to worker threads. Each worker reads its group's
+ * bitmaps and inode table from the device in one go, walks the block tree of
+ * every inode in use and parses the directories among them. The workers share
+ * two tables, both updated atomically: a bitmap of claimed blocks, which also
+ * catches blocks claimed twice, and the number of directory entries naming
+ * each inode. Pass 2 hands out the groups again and compares those tables with
+ * each group's bitmaps and link counts. The superblock totals are checked last.
+ */
+
+#include "fsck.h"
+#include "block_device.h"
+#include "superblock.h"
+#include "inode.h"
+#include "bmap.h"
+#include "globals.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define EXT2_RESIZE_INO         7      // Reserved inode holding the reserved GDT blocks
+#define FSCK_GOOD_OLD_FIRST_INO 11     // First non-reserved inode on revision 0 filesystems
+#define FSCK_SPARSE_SUPER2      0x0200 // s_feature_compat: backups only in s_backup_bgs
+
+/**
+ * @brief What pass 1 learned about one block group.
+ */
+typedef struct {
+    int readable;          //!< Non-zero if both bitmaps were read.
+    int inodes_read;       //!< Non-zero if the inode table was read (or is known to be empty).
+    uint32_t free_blocks;  //!< Free bits in the block bitmap.
+    uint32_t free_inodes;  //!< Free bits in the inode bitmap.
+} fsck_group;
+
+typedef struct fsck_state fsck_state;
+
+/**
+ * @brief Private buffers and results of one worker thread.
+ */
+typedef struct {
+    fsck_state *state;
+    uint8_t *table;             //!< The inode table of the group being checked.
+    uint8_t *indirect[3];       //!< One indirect block per tree depth.
+    uint8_t *dir_block;         //!< The directory block being parsed.
+    uint32_t *dir_blocks;       //!< Data blocks of the directory being walked, in logical order.
+    uint32_t dir_count;
+    uint32_t dir_capacity;
+    ext2_fsck_finding *findings;
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t dropped;
+    uint64_t inodes;
+    uint64_t directories;
+    int status;                 //!< First allocation failure, if any.
+} fsck_worker;
+
+struct fsck_state {
+    ext2_filesystem *fs;
+    const ext2_super_block *sb;
+    uint32_t block_size;
+    uint32_t groups;
+    uint32_t first_ino;
+    uint32_t inode_size;          //!< Size of an inode table entry.
+    uint32_t table_blocks;        //!< Blocks in each inode table.
+    uint32_t max_findings;
+    _Atomic uint64_t *claimed;    //!< One bit per block.
+    _Atomic uint16_t *refs;       //!< Directory entries naming each inode, by inode number.
+    uint16_t *links;              //!< i_links_count of each inode, by inode number.
+    uint8_t *block_bitmaps;       //!< Each group's block bitmap, one block per group.
+    uint8_t *inode_bitmaps;       //!< Each group's inode bitmap, one block per group.
+    fsck_group *group_info;
+    atomic_uint next_group;       //!< Next group to hand out in the current pass.
+    void (*pass)(fsck_worker *worker, uint32_t group);
+};
+
+static const char *problem_names[] = {
+    [EXT2_FSCK_UNREADABLE] = "unreadable",
+    [EXT2_FSCK_GROUP_FREE_BLOCKS] = "group_free_blocks",
+    [EXT2_FSCK_GROUP_FREE_INODES] = "group_free_inodes",
+    [EXT2_FSCK_GROUP_USED_DIRS] = "group_used_dirs",
+    [EXT2_FSCK_SUPER_FREE_BLOCKS] = "super_free_blocks",
+    [EXT2_FSCK_SUPER_FREE_INODES] = "super_free_inodes",
+    [EXT2_FSCK_BAD_BLOCK] = "bad_block",
+    [EXT2_FSCK_DUPLICATE_BLOCK] = "duplicate_block",
+    [EXT2_FSCK_BLOCK_COUNT] = "block_count",
+    [EXT2_FSCK_BLOCK_NOT_MARKED] = "block_not_marked",
+    [EXT2_FSCK_BLOCK_NOT_USED] = "block_not_used",
+    [EXT2_FSCK_BAD_DIR_ENTRY] = "bad_dir_entry",
+    [EXT2_FSCK_INODE_NOT_MARKED] = "inode_not_marked",
+    [EXT2_FSCK_INODE_NOT_USED] = "inode_not_used",
+    [EXT2_FSCK_DANGLING_ENTRY] = "dangling_entry",
+    [EXT2_FSCK_LINK_COUNT] = "link_count",
+};
+
+const char *ext2_fsck_problem_name(const ext2_fsck_problem problem) {
+    if ((size_t) problem >= sizeof(problem_names) / sizeof(problem_names[0])) {
+        return "unknown";
+    }
+    return problem_names[problem];
+}
+
+static int test_bit(const uint8_t *bitmap, const uint32_t bit) {
+    return (bitmap[bit / 8] >> (bit % 8)) & 1;
+}
+
+static uint32_t count_set_bits(const uint8_t *bitmap, const uint32_t bits) {
+    uint32_t total = 0;
+    uint32_t i = 0;
+    for (; i + 8 <= bits; i += 8) {
+        total += (uint32_t) __builtin_popcount(bitmap[i / 8]);
+    }
+    for (; i < bits; ++i) {
+        total += (uint32_t) test_bit(bitmap, i);
+    }
+    return total;
+}
+
+static uint32_t group_first_block(const fsck_state *state, const uint32_t group) {
+    return state->sb->s_first_data_block + group * state->sb->s_blocks_per_group;
+}
+
+static uint32_t group_block_count(const fsck_state *state, const uint32_t group) {
+    const uint32_t first = group_first_block(state, group);
+    const uint32_t remaining = state->sb->s_blocks_count - first;
+    return remaining < state->sb->s_blocks_per_group ? remaining : state->sb->s_blocks_per_group;
+}
+
+static int is_power_of(uint32_t value, const uint32_t base) {
+    while (value > 1 && value % base == 0) {
+        value /= base;
+    }
+    return value == 1;
+}
+
+/**
+ * @brief Checks whether a group starts with a copy of the superblock and descriptors.
+ */
+static int group_has_super(const ext2_super_block *sb, const uint32_t group) {
+    if (group == 0) {
+        return 1;
+    }
+    if (sb->s_feature_compat & FSCK_SPARSE_SUPER2) {
+        return group == sb->s_backup_bgs[0] || group == sb->s_backup_bgs[1];
+    }
+    if (!(sb->s_feature_ro_compat & EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER)) {
+        return 1;
+    }
+    return group == 1 || is_power_of(group, 3) || is_power_of(group, 5) || is_power_of(group, 7);
+}
+
+/**
+ * @brief Lists the metadata block ranges a group's descriptor and layout account for.
+ *
+ * @return The number of ranges written to `ranges`.
+ */
+static uint32_t group_metadata(const fsck_state *state, const uint32_t group, ext2_block_extent ranges[4]) {
+    const ext2_super_block *sb = state->sb;
+    const ext2_group_desc *desc = &state->fs->bgdt->groups[group];
+    uint32_t count = 0;
+
+    if (group_has_super(sb, group)) {
+        const uint32_t per_block = state->block_size / sizeof(ext2_group_desc);
+        const uint32_t gdt_blocks = (state->groups + per_block - 1) / per_block;
+        ranges[count].start = group_first_block(state, group);
+        ranges[count].length = 1 + gdt_blocks + sb->s_reserved_gdt_blocks;
+        count++;
+    }
+    ranges[count++] = (ext2_block_extent) {desc->bg_block_bitmap, 1};
+    ranges[count++] = (ext2_block_extent) {desc->bg_inode_bitmap, 1};
+    ranges[count++] = (ext2_block_extent) {desc->bg_inode_table, state->table_blocks};
+    return count;
+}
+
+static int uninit_flags_valid(const fsck_state *state) {
+    return (state->sb->s_feature_ro_compat & EXT2_FEATURE_RO_COMPAT_GDT_CSUM) != 0;
+}
+
+static void add_finding(
+    fsck_worker *worker,
+    const ext2_fsck_problem problem,
+    const uint32_t group,
+    const uint32_t inode,
+    const uint32_t block,
+    const uint32_t count,
+    const int64_t expected,
+    const int64_t found
+) {
+    if (worker->count >= worker->state->max_findings) {
+        worker->dropped++;
+        return;
+    }
+    if (worker->count == worker->capacity) {
+        const uint32_t capacity = worker->capacity == 0 ? 64 : worker->capacity * 2;
+        ext2_fsck_finding *grown = realloc(worker->findings, capacity * sizeof(ext2_fsck_finding));
+        if (grown == NULL) {
+            worker->dropped++;
+            worker->status = ERROR;
+            return;
+        }
+        worker->findings = grown;
+        worker->capacity = capacity;
+    }
+    worker->findings[worker->count++] = (ext2_fsck_finding) {
+        problem, group, inode, block, count, expected, found
+    };
+}
+
+static uint32_t inode_group(const fsck_state *state, const uint32_t inode_num) {
+    return (inode_num - 1) / state->sb->s_inodes_per_group;
+}
+
+/**
+ * @brief Marks a block as claimed.
+ * @return Non-zero if nothing had claimed it before.
+ */
+static int claim_block(const fsck_state *state, const uint32_t block) {
+    const uint64_t bit = UINT64_C(1) << (block % 64);
+    return (atomic_fetch_or_explicit(&state->claimed[block / 64], bit, memory_order_relaxed) & bit) == 0;
+}
+
+static int block_claimed(const fsck_state *state, const uint32_t block) {
+    return (atomic_load_explicit(&state->claimed[block / 64], memory_order_relaxed) >> (block % 64)) & 1;
+}
+
+static int block_in_range(const fsck_state *state, const uint32_t block) {
+    return block >= state->sb->s_first_data_block && block < state->sb->s_blocks_count;
+}
+
+/**
+ * @brief Per-inode state of a block tree walk.
+ */
+typedef struct {
+    uint32_t inode_num;
+    uint32_t blocks;  //!< Blocks mapped so far, including indirect blocks.
+    int directory;    //!< Non-zero to collect data blocks for parsing.
+} fsck_walk;
+
+static void remember_dir_block(fsck_worker *worker, const uint32_t block) {
+    if (worker->dir_count == worker->dir_capacity) {
+        const uint32_t capacity = worker->dir_capacity == 0 ? 64 : worker->dir_capacity * 2;
+        uint32_t *grown = realloc(worker->dir_blocks, capacity * sizeof(uint32_t));
+        if (grown == NULL) {
+            worker->status = ERROR;
+            return;
+        }
+        worker->dir_blocks = grown;
+        worker->dir_capacity = capacity;
+    }
+    worker->dir_blocks[worker->dir_count++] = block;
+}
+
+/**
+ * @brief Claims a block of an inode's tree and, for indirect blocks, everything below it.
+ *
+ * @param depth 0 for a data block, 1-3 for single to triple indirect blocks.
+ */
+static void walk_tree(fsck_worker *worker, fsck_walk *walk, const uint32_t block, const int depth) {
+    const fsck_state *state = worker->state;
+    const uint32_t group = inode_group(state, walk->inode_num);
+
+    if (!block_in_range(state, block)) {
+        add_finding(worker, EXT2_FSCK_BAD_BLOCK, group, walk->inode_num, block, 1, 0, 0);
+        return;
+    }
+    walk->blocks++;
+    if (!claim_block(state, block)) {
+        add_finding(worker, EXT2_FSCK_DUPLICATE_BLOCK, group, walk->inode_num, block, 1, 1, 2);
+        if (depth > 0) {
+            return; // Following a cross-linked indirect block would only repeat its owner's findings
+        }
+    }
+
+    if (depth == 0) {
+        if (walk->directory) {
+            remember_dir_block(worker, block);
+        }
+        return;
+    }
+
+    uint32_t *entries = (uint32_t *) worker->indirect[depth - 1];
+    if (block_device_read(state->fs->device, (off_t) block * state->block_size, state->block_size, entries) != SUCCESS) {
+        add_finding(worker, EXT2_FSCK_UNREADABLE, group, walk->inode_num, block, 1, 0, 0);
+        return;
+    }
+    const uint32_t per_block = state->block_size / sizeof(uint32_t);
+    for (uint32_t i = 0; i < per_block; ++i) {
+        if (entries[i] != 0) {
+            walk_tree(worker, walk, entries[i], depth - 1);
+        }
+    }
+}
+
+/**
+ * @brief Parses a directory's blocks, counting a reference for every entry.
+ */
+static void scan_directory(fsck_worker *worker, const uint32_t dir_num, const ext2_inode *dir) {
+    const fsck_state *state = worker->state;
+    const uint32_t block_size = state->block_size;
+    const uint32_t group = inode_group(state, dir_num);
+
+    for (uint32_t b = 0; b < worker->dir_count; ++b) {
+        const uint32_t block = worker->dir_blocks[b];
+        if (block_device_read(state->fs->device, (off_t) block * block_size, block_size, worker->dir_block) != SUCCESS) {
+            add_finding(worker, EXT2_FSCK_UNREADABLE, group, dir_num, block, 1, 0, 0);
+            continue;
+        }
+
+        // The first block must start with "." and "..".
+        const int first = block == dir->i_block[0];
+        uint32_t index = 0;
+        for (uint32_t offset = 0; offset < block_size; ++index) {
+            const ext2_directory_entry *entry = (const ext2_directory_entry *) (worker->dir_block + offset);
+            if (offset + EXT2_DIR_ENTRY_FIXED_SIZE > block_size || entry->rec_len < EXT2_DIR_ENTRY_FIXED_SIZE ||
+                entry->rec_len % 4 != 0 || entry->rec_len > block_size - offset ||
+                EXT2_DIR_ENTRY_FIXED_SIZE + entry->name_len > entry->rec_len) {
+                add_finding(worker, EXT2_FSCK_BAD_DIR_ENTRY, group, dir_num, block, 1, 0, offset);
+                break;
+            }
+
+            int bad = entry->inode > state->sb->s_inodes_count;
+            if (first && index == 0) {
+                bad |= entry->name_len != 1 || entry->name[0] != '.' || entry->inode != dir_num;
+            } else if (first && index == 1) {
+                bad |= entry->name_len != 2 || memcmp(entry->name, "..", 2) != 0 || entry->inode == 0;
+            }
+            if (bad) {
+                add_finding(worker, EXT2_FSCK_BAD_DIR_ENTRY, group, dir_num, block, 1, 0, offset);
+            } else if (entry->inode != 0) {
+                atomic_fetch_add_explicit(&state->refs[entry->inode], 1, memory_order_relaxed);
+            }
+            offset += entry->rec_len;
+        }
+    }
+}
+
+/**
+ * @brief Claims every block an inode maps and checks its block count.
+ */
+static void check_inode(fsck_worker *worker, const uint32_t inode_num, const ext2_inode *inode) {
+    const fsck_state *state = worker->state;
+    const uint32_t group = inode_group(state, inode_num);
+    const uint16_t type = inode->i_mode & EXT2_S_IFMT;
+    const uint32_t sectors_per_block = state->block_size / 512;
+
+    if (type == EXT2_S_IFCHR || type == EXT2_S_IFBLK || type == EXT2_S_IFIFO || type == EXT2_S_IFSOCK) {
+        return; // i_block holds a device number, not block pointers
+    }
+    const uint32_t acl_sectors = inode->i_file_acl != 0 ? sectors_per_block : 0;
+    if (type == EXT2_S_IFLNK && inode->i_blocks == acl_sectors) {
+        return; // Fast symlink: the target is stored in i_block
+    }
+
+    fsck_walk walk = {inode_num, 0, type == EXT2_S_IFDIR};
+    worker->dir_count = 0;
+
+    if (inode_num == EXT2_RESIZE_INO && (state->sb->s_feature_compat & EXT2_FEATURE_COMPAT_RESIZE_INO)) {
+        // Its tree maps the reserved descriptor blocks, which are claimed as metadata.
+        if (inode->i_block[EXT2_DIND_BLOCK] != 0) {
+            walk_tree(worker, &walk, inode->i_block[EXT2_DIND_BLOCK], 0);
+        }
+        return;
+    }
+
+    for (int i = 0; i < EXT2_IND_BLOCK; ++i) {
+        if (inode->i_block[i] != 0) {
+            walk_tree(worker, &walk, inode->i_block[i], 0);
+        }
+    }
+    for (int depth = 1; depth <= 3; ++depth) {
+        const uint32_t root = inode->i_block[EXT2_IND_BLOCK + depth - 1];
+        if (root != 0) {
+            walk_tree(worker, &walk, root, depth);
+        }
+    }
+
+    if (inode->i_file_acl != 0) {
+        // Extended attribute blocks may be shared, so a second claim is not a duplicate.
+        if (block_in_range(state, inode->i_file_acl)) {
+            claim_block(state, inode->i_file_acl);
+            walk.blocks++;
+        } else {
+            add_finding(worker, EXT2_FSCK_BAD_BLOCK, group, inode_num, inode->i_file_acl, 1, 0, 0);
+        }
+    }
+
+    const uint64_t expected_sectors = (uint64_t) walk.blocks * sectors_per_block;
+    if (expected_sectors != inode->i_blocks) {
+        add_finding(worker, EXT2_FSCK_BLOCK_COUNT, group, inode_num, 0, 1, (int64_t) expected_sectors,
+                    inode->i_blocks);
+    }
+
+    if (walk.directory) {
+        scan_directory(worker, inode_num, inode);
+    }
+}
+
+static int is_reserved(const fsck_state *state, const uint32_t inode_num) {
+    return inode_num < state->first_ino && inode_num != EXT2_ROOT_INO;
+}
+
+/**
+ * @brief Decides whether an inode is in use: by its links, or for reserved inodes by the bitmap.
+ */
+static int inode_in_use(
+    const fsck_state *state,
+    const uint32_t inode_num,
+    const uint16_t links,
+    const uint8_t *inode_bitmap,
+    const uint32_t index
+) {
+    return is_reserved(state, inode_num) ? test_bit(inode_bitmap, index) : links != 0;
+}
+
+/**
+ * @brief Pass 1 for one group: bitmaps, free counts, inode table and the trees of its inodes.
+ */
+static void check_group(fsck_worker *worker, const uint32_t group) {
+    fsck_state *state = worker->state;
+    const ext2_super_block *sb = state->sb;
+    const ext2_group_desc *desc = &state->fs->bgdt->groups[group];
+    const uint32_t block_size = state->block_size;
+    uint8_t *block_bitmap = state->block_bitmaps + (size_t) group * block_size;
+    uint8_t *inode_bitmap = state->inode_bitmaps + (size_t) group * block_size;
+    const uint32_t blocks_in_group = group_block_count(state, group);
+    const int uninit = uninit_flags_valid(state);
+    const int blocks_uninit = uninit && (desc->bg_flags & EXT2_BG_BLOCK_UNINIT);
+    const int inodes_uninit = uninit && (desc->bg_flags & EXT2_BG_INODE_UNINIT);
+
+    // Both bitmaps and the whole inode table go to the device as one batch, which
+    // keeps the device streaming and lets an io_uring device overlap the reads.
+    ext2_io_request requests[3];
+    uint32_t count = 0;
+    ext2_io_request *block_read = NULL;
+    ext2_io_request *inode_read = NULL;
+    ext2_io_request *table_read = NULL;
+    if (!blocks_uninit) {
+        block_read = &requests[count++];
+        *block_read = (ext2_io_request) {
+            .offset = (off_t) desc->bg_block_bitmap * block_size, .length = block_size, .buffer = block_bitmap,
+        };
+    }
+    if (!inodes_uninit) {
+        inode_read = &requests[count++];
+        *inode_read = (ext2_io_request) {
+            .offset = (off_t) desc->bg_inode_bitmap * block_size, .length = block_size, .buffer = inode_bitmap,
+        };
+        table_read = &requests[count++];
+        *table_read = (ext2_io_request) {
+            .offset = (off_t) desc->bg_inode_table * block_size,
+            .length = (size_t) state->table_blocks * block_size,
+            .buffer = worker->table,
+        };
+    }
+    block_device_submit(state->fs->device, requests, count);
+
+    if (blocks_uninit) {
+        // The bitmap was never written: only the group's own metadata is in use.
+        memset(block_bitmap, 0, block_size);
+        ext2_block_extent ranges[4];
+        const uint32_t first = group_first_block(state, group);
+        const uint32_t extents = group_metadata(state, group, ranges);
+        for (uint32_t r = 0; r < extents; ++r) {
+            for (uint32_t b = ranges[r].start; b < ranges[r].start + ranges[r].length; ++b) {
+                if (b >= first && b - first < blocks_in_group) {
+                    block_bitmap[(b - first) / 8] |= (uint8_t) (1u << ((b - first) % 8));
+                }
+            }
+        }
+    } else if ((size_t) block_read->result != block_read->length) {
+        add_finding(worker, EXT2_FSCK_UNREADABLE, group, 0, desc->bg_block_bitmap, 1, 0, 0);
+        return;
+    }
+
+    if (inodes_uninit) {
+        memset(inode_bitmap, 0, block_size);
+    } else if ((size_t) inode_read->result != inode_read->length) {
+        add_finding(worker, EXT2_FSCK_UNREADABLE, group, 0, desc->bg_inode_bitmap, 1, 0, 0);
+        return;
+    }
+
+    fsck_group *info = &state->group_info[group];
+    info->readable = 1;
+    info->free_blocks = blocks_in_group - count_set_bits(block_bitmap, blocks_in_group);
+    info->free_inodes = sb->s_inodes_per_group - count_set_bits(inode_bitmap, sb->s_inodes_per_group);
+    if (info->free_blocks != desc->bg_free_blocks_count) {
+        add_finding(worker, EXT2_FSCK_GROUP_FREE_BLOCKS, group, 0, 0, 1, info->free_blocks, desc->bg_free_blocks_count);
+    }
+    if (info->free_inodes != desc->bg_free_inodes_count) {
+        add_finding(worker, EXT2_FSCK_GROUP_FREE_INODES, group, 0, 0, 1, info->free_inodes, desc->bg_free_inodes_count);
+    }
+    if (inodes_uninit) {
+        info->inodes_read = 1;
+        return;
+    }
+
+    if ((size_t) table_read->result != table_read->length) {
+        add_finding(worker, EXT2_FSCK_UNREADABLE, group, 0, desc->bg_inode_table, state->table_blocks, 0, 0);
+        return;
+    }
+    info->inodes_read = 1;
+
+    uint32_t directories = 0;
+    for (uint32_t i = 0; i < sb->s_inodes_per_group; ++i) {
+        const uint32_t inode_num = group * sb->s_inodes_per_group + i + 1;
+        const ext2_inode *inode = EXT2_INODE_AT(worker->table, i, state->inode_size);
+        state->links[inode_num] = inode->i_links_count;
+        if (!inode_in_use(state, inode_num, inode->i_links_count, inode_bitmap, i)) {
+            continue;
+        }
+
+        worker->inodes++;
+        if ((inode->i_mode & EXT2_S_IFMT) == EXT2_S_IFDIR) {
+            directories++;
+        }
+        check_inode(worker, inode_num, inode);
+    }
+
+    worker->directories += directories;
+    if (directories != desc->bg_used_dirs_count) {
+        add_finding(worker, EXT2_FSCK_GROUP_USED_DIRS, group, 0, 0, 1, directories, desc->bg_used_dirs_count);
+    }
+}
+
+/**
+ * @brief Reports a run of blocks whose claimed state disagrees with the bitmap.
+ */
+static void flush_run(
+    fsck_worker *worker,
+    const uint32_t group,
+    const ext2_fsck_problem problem,
+    const uint32_t start,
+    const uint32_t length
+) {
+    if (length > 0) {
+        const int marked = problem == EXT2_FSCK_BLOCK_NOT_USED;
+        add_finding(worker, problem, group, 0, start, length, !marked, marked);
+    }
+}
+
+/**
+ * @brief Pass 2 for one group: claimed blocks against the bitmap, references against link counts.
+ */
+static void compare_group(fsck_worker *worker, const uint32_t group) {
+    const fsck_state *state = worker->state;
+    const ext2_super_block *sb = state->sb;
+    if (!state->group_info[group].readable) {
+        return;
+    }
+
+    const uint8_t *block_bitmap = state->block_bitmaps + (size_t) group * state->block_size;
+    const uint32_t first = group_first_block(state, group);
+    const uint32_t blocks_in_group = group_block_count(state, group);
+
+    ext2_fsck_problem run_problem = EXT2_FSCK_BLOCK_NOT_MARKED;
+    uint32_t run_start = 0;
+    uint32_t run_length = 0;
+    for (uint32_t i = 0; i < blocks_in_group; ++i) {
+        const int claimed = block_claimed(state, first + i);
+        const int marked = test_bit(block_bitmap, i);
+        if (claimed == marked) {
+            flush_run(worker, group, run_problem, run_start, run_length);
+            run_length = 0;
+            continue;
+        }
+
+        const ext2_fsck_problem problem = claimed ? EXT2_FSCK_BLOCK_NOT_MARKED : EXT2_FSCK_BLOCK_NOT_USED;
+        if (run_length > 0 && problem == run_problem) {
+            run_length++;
+            continue;
+        }
+        flush_run(worker, group, run_problem, run_start, run_length);
+        run_problem = problem;
+        run_start = first + i;
+        run_length = 1;
+    }
+    flush_run(worker, group, run_problem, run_start, run_length);
+
+    if (!state->group_info[group].inodes_read) {
+        return;
+    }
+
+    const uint8_t *inode_bitmap = state->inode_bitmaps + (size_t) group * state->block_size;
+    for (uint32_t i = 0; i < sb->s_inodes_per_group; ++i) {
+        const uint32_t inode_num = group * sb->s_inodes_per_group + i + 1;
+        if (is_reserved(state, inode_num)) {
+            continue; // Marked by mke2fs and not linked from any directory
+        }
+
+        const uint16_t links = state->links[inode_num];
+        const uint16_t refs = atomic_load_explicit(&state->refs[inode_num], memory_order_relaxed);
+        const int marked = test_bit(inode_bitmap, i);
+        if (links != 0 && !marked) {
+            add_finding(worker, EXT2_FSCK_INODE_NOT_MARKED, group, inode_num, 0, 1, 1, 0);
+        } else if (links == 0 && marked) {
+            add_finding(worker, EXT2_FSCK_INODE_NOT_USED, group, inode_num, 0, 1, 0, 1);
+        }
+
+        if (links == 0 && refs != 0) {
+            add_finding(worker, EXT2_FSCK_DANGLING_ENTRY, group, inode_num, 0, 1, refs, 0);
+        } else if (links != 0 && refs != links) {
+            add_finding(worker, EXT2_FSCK_LINK_COUNT, group, inode_num, 0, 1, refs, links);
+        }
+    }
+}
+
+static void *run_worker(void *arg) {
+    fsck_worker *worker = arg;
+    fsck_state *state = worker->state;
+    for (;;) {
+        const uint32_t group = atomic_fetch_add_explicit(&state->next_group, 1, memory_order_relaxed);
+        if (group >= state->groups) {
+            break;
+        }
+        state->pass(worker, group);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Runs one pass over all groups, with the calling thread as one of the workers.
+ */
+static void run_pass(
+    fsck_state *state,
+    fsck_worker *workers,
+    const uint32_t threads,
+    void (*pass)(fsck_worker *worker, uint32_t group)
+) {
+    state->pass = pass;
+    atomic_store(&state->next_group, 0);
+
+    pthread_t *handles = calloc(threads, sizeof(pthread_t));
+    uint8_t *started = calloc(threads, 1);
+    for (uint32_t t = 1; handles != NULL && started != NULL && t < threads; ++t) {
+        // A thread that cannot be started just leaves its share to the others.
+        started[t] = pthread_create(&handles[t], NULL, run_worker, &workers[t]) == 0;
+    }
+    run_worker(&workers[0]);
+    for (uint32_t t = 1; handles != NULL && started != NULL && t < threads; ++t) {
+        if (started[t]) {
+            pthread_join(handles[t], NULL);
+        }
+    }
+    free(handles);
+    free(started);
+}
+
+static int init_worker(fsck_worker *worker, fsck_state *state) {
+    memset(worker, 0, sizeof(fsck_worker));
+    worker->state = state;
+    worker->table = malloc((size_t) state->table_blocks * state->block_size);
+    worker->dir_block = malloc(state->block_size);
+    for (int i = 0; i < 3; ++i) {
+        worker->indirect[i] = malloc(state->block_size);
+        if (worker->indirect[i] == NULL) {
+            return ERROR;
+        }
+    }
+    return worker->table != NULL && worker->dir_block != NULL ? SUCCESS : ERROR;
+}
+
+static void free_worker(fsck_worker *worker) {
+    free(worker->table);
+    free(worker->dir_block);
+    for (int i = 0; i < 3; ++i) {
+        free(worker->indirect[i]);
+    }
+    free(worker->dir_blocks);
+    free(worker->findings);
+}
+
+static int compare_findings(const void *a, const void *b) {
+    const ext2_fsck_finding *left = a;
+    const ext2_fsck_finding *right = b;
+    if (left->group != right->group) {
+        return left->group < right->group ? -1 : 1;
+    }
+    if (left->inode != right->inode) {
+        return left->inode < right->inode ? -1 : 1;
+    }
+    if (left->block != right->block) {
+        return left->block < right->block ? -1 : 1;
+    }
+    return (int) left->problem - (int) right->problem;
+}
+
+static void free_state(fsck_state *state) {
+    free(state->claimed);
+    free(state->refs);
+    free(state->links);
+    free(state->block_bitmaps);
+    free(state->inode_bitmaps);
+    free(state->group_info);
+}
+
+static uint32_t default_thread_count(void) {
+    const long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (uint32_t) online : 1;
+}
+
+int ext2_fsck(ext2_filesystem *fs, const ext2_fsck_options *options, ext2_fsck_report *report_out) {
+    if (fs == NULL || fs->superblock == NULL || fs->bgdt == NULL || fs->device == NULL || report_out == NULL) {
+        log_error("Error (fsck): NULL pointer argument provided.\n");
+        return INVALID_PARAMETER;
+    }
+    memset(report_out, 0, sizeof(ext2_fsck_report));
+
+    const ext2_super_block *sb = fs->superblock;
+    fsck_state state = {0};
+    state.fs = fs;
+    state.sb = sb;
+    state.block_size = get_block_size(sb);
+    state.groups = fs->bgdt->groups_count;
+    state.first_ino = sb->s_rev_level == EXT2_GOOD_OLD_REV ? FSCK_GOOD_OLD_FIRST_INO : sb->s_first_ino;
+    state.inode_size = get_inode_size(sb);
+    state.table_blocks = (uint32_t) (((uint64_t) sb->s_inodes_per_group * state.inode_size + state.block_size - 1) /
+                                     state.block_size);
+    state.max_findings = options != NULL && options->max_findings != 0
+                             ? options->max_findings
+                             : EXT2_FSCK_DEFAULT_MAX_FINDINGS;
+    if (state.inode_size < sizeof(ext2_inode) || state.groups == 0 || sb->s_inodes_per_group > state.block_size * 8 ||
+        sb->s_blocks_per_group > state.block_size * 8) {
+        log_error("Error (fsck): Superblock geometry is not usable.\n");
+        return ERROR;
+    }
+
+    state.claimed = calloc(((size_t) sb->s_blocks_count + 63) / 64, sizeof(uint64_t));
+    state.refs = calloc((size_t) sb->s_inodes_count + 1, sizeof(uint16_t));
+    state.links = calloc((size_t) sb->s_inodes_count + 1, sizeof(uint16_t));
+    state.block_bitmaps = malloc((size_t) state.groups * state.block_size);
+    state.inode_bitmaps = malloc((size_t) state.groups * state.block_size);
+    state.group_info = calloc(state.groups, sizeof(fsck_group));
+    if (state.claimed == NULL || state.refs == NULL || state.links == NULL || state.block_bitmaps == NULL ||
+        state.inode_bitmaps == NULL || state.group_info == NULL) {
+        log_error("Error (fsck): Failed to allocate check state.\n");
+        free_state(&state);
+        return ERROR;
+    }
+
+    uint32_t threads = options != NULL && options->threads != 0 ? options->threads : default_thread_count();
+    if (threads > state.groups) {
+        threads = state.groups;
+    }
+    if (fs->device->stream != NULL) {
+        threads = 1; // A stdio stream has a shared file position
+    }
+
+    fsck_worker *workers = calloc(threads, sizeof(fsck_worker));
+    int status = workers != NULL ? SUCCESS : ERROR;
+    for (uint32_t t = 0; status == SUCCESS && t < threads; ++t) {
+        status = init_worker(&workers[t], &state);
+    }
+    if (status != SUCCESS) {
+        log_error("Error (fsck): Failed to allocate worker buffers.\n");
+        for (uint32_t t = 0; workers != NULL && t < threads; ++t) {
+            free_worker(&workers[t]);
+        }
+        free(workers);
+        free_state(&state);
+        return ERROR;
+    }
+
+    // Metadata is claimed first, so a file that points into it shows up as a duplicate.
+    for (uint32_t group = 0; group < state.groups; ++group) {
+        ext2_block_extent ranges[4];
+        const uint32_t count = group_metadata(&state, group, ranges);
+        for (uint32_t r = 0; r < count; ++r) {
+            for (uint32_t b = ranges[r].start; b < ranges[r].start + ranges[r].length; ++b) {
+                if (!block_in_range(&state, b)) {
+                    add_finding(&workers[0], EXT2_FSCK_BAD_BLOCK, group, 0, b, 1, 0, 0);
+                } else if (!claim_block(&state, b)) {
+                    add_finding(&workers[0], EXT2_FSCK_DUPLICATE_BLOCK, group, 0, b, 1, 1, 2);
+                }
+            }
+        }
+    }
+
+    run_pass(&state, workers, threads, check_group);
+    run_pass(&state, workers, threads, compare_group);
+
+    uint64_t free_blocks = 0;
+    uint64_t free_inodes = 0;
+    int all_readable = 1;
+    for (uint32_t group = 0; group < state.groups; ++group) {
+        all_readable &= state.group_info[group].readable;
+        free_blocks += state.group_info[group].free_blocks;
+        free_inodes += state.group_info[group].free_inodes;
+    }
+    if (all_readable && free_blocks != sb->s_free_blocks_count) {
+        add_finding(&workers[0], EXT2_FSCK_SUPER_FREE_BLOCKS, EXT2_FSCK_NO_GROUP, 0, 0, 1, (int64_t) free_blocks,
+                    sb->s_free_blocks_count);
+    }
+    if (all_readable && free_inodes != sb->s_free_inodes_count) {
+        add_finding(&workers[0], EXT2_FSCK_SUPER_FREE_INODES, EXT2_FSCK_NO_GROUP, 0, 0, 1, (int64_t) free_inodes,
+                    sb->s_free_inodes_count);
+    }
+
+    // Merge the workers' findings, keeping at most max_findings.
+    uint64_t total = 0;
+    for (uint32_t t = 0; t < threads; ++t) {
+        total += workers[t].count;
+        report_out->dropped += workers[t].dropped;
+        report_out->inodes_in_use += workers[t].inodes;
+        report_out->directories += workers[t].directories;
+        if (workers[t].status != SUCCESS) {
+            status = workers[t].status;
+        }
+    }
+    const uint32_t kept = total < state.max_findings ? (uint32_t) total : state.max_findings;
+    report_out->findings = kept > 0 ? malloc(kept * sizeof(ext2_fsck_finding)) : NULL;
+    if (kept > 0 && report_out->findings == NULL) {
+        status = ERROR;
+    }
+    for (uint32_t t = 0; status == SUCCESS && t < threads; ++t) {
+        const uint32_t take = workers[t].count < kept - report_out->count ? workers[t].count : kept - report_out->count;
+        if (take > 0) {
+            memcpy(report_out->findings + report_out->count, workers[t].findings, take * sizeof(ext2_fsck_finding));
+            report_out->count += take;
+        }
+    }
+    report_out->dropped += total - report_out->count;
+    if (report_out->count > 1) {
+        qsort(report_out->findings, report_out->count, sizeof(ext2_fsck_finding), compare_findings);
+    }
+
+    for (size_t w = 0; w < ((size_t) sb->s_blocks_count + 63) / 64; ++w) {
+        report_out->blocks_claimed += (uint64_t) __builtin_popcountll(atomic_load(&state.claimed[w]));
+    }
+    report_out->groups = state.groups;
+    report_out->threads = threads;
+
+    for (uint32_t t = 0; t < threads; ++t) {
+        free_worker(&workers[t]);
+    }
+    free(workers);
+    free_state(&state);
+
+    if (status != SUCCESS) {
+        log_error("Error (fsck): Ran out of memory while checking.\n");
+        ext2_fsck_report_free(report_out);
+    }
+    return status;
+}
+
+void ext2_fsck_report_free(ext2_fsck_report *report) {
+    if (report == NULL) {
+        return;
+    }
+    free(report->findings);
+    report->findings = NULL;
+    report->count = 0;
+}
+
+int ext2_fsck_write_json(FILE *out, const ext2_fsck_report *report) {
+    if (out == NULL || report == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    for (uint32_t i = 0; i < report->count; ++i) {
+        const ext2_fsck_finding *finding = &report->findings[i];
+        char group[16] = "null";
+        if (finding->group != EXT2_FSCK_NO_GROUP) {
+            snprintf(group, sizeof(group), "%u", finding->group);
+        }
+        fprintf(out,
+                "{\"type\":\"problem\",\"problem\":\"%s\",\"group\":%s,\"inode\":%u,\"block\":%u,\"count\":%u,"
+                "\"expected\":%lld,\"found\":%lld}\n",
+                ext2_fsck_problem_name(finding->problem), group, finding->inode, finding->block, finding->count,
+                (long long) finding->expected, (long long) finding->found);
+    }
+    fprintf(out,
+            "{\"type\":\"summary\",\"groups\":%u,\"threads\":%u,\"inodes_in_use\":%llu,\"directories\":%llu,"
+            "\"blocks_claimed\":%llu,\"problems\":%llu,\"dropped\":%llu}\n",
+            report->groups, report->threads, (unsigned long long) report->inodes_in_use,
+            (unsigned long long) report->directories, (unsigned long long) report->blocks_claimed,
+            (unsigned long long) (report->count + report->dropped), (unsigned long long) report->dropped);
+
+    return ferror(out) ? IO_ERROR : SUCCESS;
+}
@@ -0,0 +1,789 @@
+/**
+ * @file htree.c
+ * @brief Implements hash-indexed (htree) directory lookup and index maintenance.
+ */
+
+#include "htree.h"
+#include "directory.h"
+#include "bmap.h"
+#include "superblock.h"
+#include "filesystem.h"
+#include "globals.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define DX_ROOT_INFO_OFFSET    24          // After the "." entry and the ".." header
+#define DX_ROOT_ENTRIES_OFFSET 32          // After the root info
+#define DX_NODE_ENTRIES_OFFSET 8           // After the empty entry that hides the node from linear scans
+#define DX_BLOCK_MASK          0x0FFFFFFF  // The top bits of ext2_dx_entry.block are reserved
+#define DX_MAX_LEVELS          2           // The root and one level of nodes
+#define DX_HASH_EOF            0x7FFFFFFFU // Reserved for end-of-directory in readdir cookies
+
+// ---- Hash functions ----
+
+#define ROL32(x, s) (((x) << (s)) | ((x) >> (32 - (s))))
+
+#define MD4_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MD4_G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define MD4_H(x, y, z) ((x) ^ (y) ^ (z))
+#define MD4_ROUND(f, a, b, c, d, x, s) ((a) += f((b), (c), (d)) + (x), (a) = ROL32((a), (s)))
+#define MD4_K2 013240474631U
+#define MD4_K3 015666365641U
+
+/**
+ * @brief The reduced MD4 round used by the half_md4 directory hash.
+ */
+static void half_md4_transform(uint32_t buf[4], const uint32_t in[8]) {
+    uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+    MD4_ROUND(MD4_F, a, b, c, d, in[0], 3);
+    MD4_ROUND(MD4_F, d, a, b, c, in[1], 7);
+    MD4_ROUND(MD4_F, c, d, a, b, in[2], 11);
+    MD4_ROUND(MD4_F, b, c, d, a, in[3], 19);
+    MD4_ROUND(MD4_F, a, b, c, d, in[4], 3);
+    MD4_ROUND(MD4_F, d, a, b, c, in[5], 7);
+    MD4_ROUND(MD4_F, c, d, a, b, in[6], 11);
+    MD4_ROUND(MD4_F, b, c, d, a, in[7], 19);
+
+    MD4_ROUND(MD4_G, a, b, c, d, in[1] + MD4_K2, 3);
+    MD4_ROUND(MD4_G, d, a, b, c, in[3] + MD4_K2, 5);
+    MD4_ROUND(MD4_G, c, d, a, b, in[5] + MD4_K2, 9);
+    MD4_ROUND(MD4_G, b, c, d, a, in[7] + MD4_K2, 13);
+    MD4_ROUND(MD4_G, a, b, c, d, in[0] + MD4_K2, 3);
+    MD4_ROUND(MD4_G, d, a, b, c, in[2] + MD4_K2, 5);
+    MD4_ROUND(MD4_G, c, d, a, b, in[4] + MD4_K2, 9);
+    MD4_ROUND(MD4_G, b, c, d, a, in[6] + MD4_K2, 13);
+
+    MD4_ROUND(MD4_H, a, b, c, d, in[3] + MD4_K3, 3);
+    MD4_ROUND(MD4_H, d, a, b, c, in[7] + MD4_K3, 9);
+    MD4_ROUND(MD4_H, c, d, a, b, in[2] + MD4_K3, 11);
+    MD4_ROUND(MD4_H, b, c, d, a, in[6] + MD4_K3, 15);
+    MD4_ROUND(MD4_H, a, b, c, d, in[1] + MD4_K3, 3);
+    MD4_ROUND(MD4_H, d, a, b, c, in[5] + MD4_K3, 9);
+    MD4_ROUND(MD4_H, c, d, a, b, in[0] + MD4_K3, 11);
+    MD4_ROUND(MD4_H, b, c, d, a, in[4] + MD4_K3, 15);
+
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+/**
+ * @brief 16 rounds of TEA, as used by the tea directory hash.
+ */
+static void tea_transform(uint32_t buf[4], const uint32_t in[4]) {
+    uint32_t sum = 0;
+    uint32_t b0 = buf[0], b1 = buf[1];
+    const uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+
+    for (int n = 0; n < 16; ++n) {
+        sum += 0x9E3779B9;
+        b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+        b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    }
+
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+/**
+ * @brief The original ext3 directory hash.
+ */
+static uint32_t legacy_hash(const char *name, size_t len, const int is_unsigned) {
+    uint32_t hash0 = 0x12A3FE2D, hash1 = 0x37ABE8F9;
+
+    for (size_t i = 0; i < len; ++i) {
+        const int c = is_unsigned ? (int) (unsigned char) name[i] : (int) (signed char) name[i];
+        uint32_t hash = hash1 + (hash0 ^ (uint32_t) (c * 7152373));
+        if (hash & 0x80000000) {
+            hash -= 0x7FFFFFFF;
+        }
+        hash1 = hash0;
+        hash0 = hash;
+    }
+    return hash0 << 1;
+}
+
+/**
+ * @brief Packs up to `words * 4` bytes of a name into hash input words, padding with the length.
+ */
+static void name_to_words(const char *name, size_t len, uint32_t *words, int count, const int is_unsigned) {
+    uint32_t pad = (uint32_t) len | ((uint32_t) len << 8);
+    pad |= pad << 16;
+
+    uint32_t value = pad;
+    if (len > (size_t) count * 4) {
+        len = (size_t) count * 4;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        const int c = is_unsigned ? (int) (unsigned char) name[i] : (int) (signed char) name[i];
+        value = (uint32_t) c + (value << 8);
+        if (i % 4 == 3) {
+            *words++ = value;
+            value = pad;
+            count--;
+        }
+    }
+    if (--count >= 0) {
+        *words++ = value;
+    }
+    while (--count >= 0) {
+        *words++ = pad;
+    }
+}
+
+int ext2_dx_hash(
+    const char *name,
+    size_t name_len,
+    const int hash_version,
+    const uint32_t seed[4],
+    uint32_t *hash_out,
+    uint32_t *minor_hash_out
+) {
+    if (name == NULL || hash_out == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    uint32_t buf[4] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476};
+    if (seed != NULL && (seed[0] | seed[1] | seed[2] | seed[3]) != 0) {
+        memcpy(buf, seed, sizeof(buf));
+    }
+
+    uint32_t hash;
+    uint32_t minor_hash = 0;
+    uint32_t in[8];
+    switch (hash_version) {
+        case EXT2_DX_HASH_LEGACY:
+        case EXT2_DX_HASH_LEGACY_UNSIGNED:
+            hash = legacy_hash(name, name_len, hash_version == EXT2_DX_HASH_LEGACY_UNSIGNED);
+            break;
+        case EXT2_DX_HASH_HALF_MD4:
+        case EXT2_DX_HASH_HALF_MD4_UNSIGNED:
+            do {
+                name_to_words(name, name_len, in, 8, hash_version == EXT2_DX_HASH_HALF_MD4_UNSIGNED);
+                half_md4_transform(buf, in);
+                name += 32;
+                name_len = name_len > 32 ? name_len - 32 : 0;
+            } while (name_len > 0);
+            hash = buf[1];
+            minor_hash = buf[2];
+            break;
+        case EXT2_DX_HASH_TEA:
+        case EXT2_DX_HASH_TEA_UNSIGNED:
+            do {
+                name_to_words(name, name_len, in, 4, hash_version == EXT2_DX_HASH_TEA_UNSIGNED);
+                tea_transform(buf, in);
+                name += 16;
+                name_len = name_len > 16 ? name_len - 16 : 0;
+            } while (name_len > 0);
+            hash = buf[0];
+            minor_hash = buf[1];
+            break;
+        default:
+            return INVALID_PARAMETER;
+    }
+
+    hash &= ~1u;
+    if (hash == DX_HASH_EOF << 1) {
+        hash = (DX_HASH_EOF - 1) << 1;
+    }
+
+    *hash_out = hash;
+    if (minor_hash_out != NULL) {
+        *minor_hash_out = minor_hash;
+    }
+    return SUCCESS;
+}
+
+// ---- Index traversal ----
+
+/**
+ * @brief One index block on the path from the root to a leaf.
+ */
+typedef struct {
+    uint32_t logical;       // Directory block holding this index level
+    uint8_t *data;          // Copy of that block
+    ext2_dx_entry *entries; // Index entries within `data`
+    uint32_t at;            // Entry followed towards the leaf
+} dx_frame;
+
+/**
+ * @brief The index path to the leaf a hash belongs to.
+ */
+typedef struct {
+    ext2_filesystem *fs;
+    ext2_block_map map;
+    uint32_t block_size;
+    int hash_version; // Including the unsigned offset
+    uint32_t hash;
+    int levels;       // Frames in use: 1 + indirect_levels
+    dx_frame frames[DX_MAX_LEVELS];
+} dx_path;
+
+static ext2_dx_countlimit *countlimit(const dx_frame *frame) {
+    return (ext2_dx_countlimit *) frame->entries;
+}
+
+static uint32_t root_limit(const uint32_t block_size) {
+    return (block_size - DX_ROOT_ENTRIES_OFFSET) / sizeof(ext2_dx_entry);
+}
+
+static uint32_t node_limit(const uint32_t block_size) {
+    return (block_size - DX_NODE_ENTRIES_OFFSET) / sizeof(ext2_dx_entry);
+}
+
+static int read_dir_block(dx_path *path, const uint32_t logical, void *buffer) {
+    uint32_t physical;
+    if (ext2_block_map_lookup(&path->map, logical, &physical) != SUCCESS || physical == 0 ||
+        physical >= path->fs->superblock->s_blocks_count) {
+        log_error("Error (htree): Directory block %u is not mapped.\n", logical);
+        return ERROR;
+    }
+    if (filesystem_read(path->fs, (off_t) physical * path->block_size, path->block_size, buffer) != SUCCESS) {
+        log_error("Error (htree): Reading directory block %u failed.\n", logical);
+        return IO_ERROR;
+    }
+    return SUCCESS;
+}
+
+static int write_dir_block(dx_path *path, const uint32_t logical, const void *buffer) {
+    uint32_t physical;
+    if (ext2_block_map_lookup(&path->map, logical, &physical) != SUCCESS || physical == 0) {
+        return IO_ERROR;
+    }
+    return filesystem_write(path->fs, (off_t) physical * path->block_size, path->block_size, buffer) == SUCCESS
+               ? SUCCESS
+               : IO_ERROR;
+}
+
+/**
+ * @brief Picks the entry of an index block whose range holds the path's hash.
+ */
+static void search_frame(const dx_path *path, dx_frame *frame) {
+    // The first entry covers everything below entries[1].hash.
+    uint32_t low = 1;
+    uint32_t high = countlimit(frame)->count;
+    while (low < high) {
+        const uint32_t middle = low + (high - low) / 2;
+        if (frame->entries[middle].hash > path->hash) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    frame->at = low - 1;
+}
+
+/**
+ * @brief Loads an index node into a frame and checks its header.
+ */
+static int load_node(dx_path *path, dx_frame *frame, const uint32_t logical) {
+    const int status = read_dir_block(path, logical, frame->data);
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    frame->logical = logical;
+    frame->entries = (ext2_dx_entry *) (frame->data + DX_NODE_ENTRIES_OFFSET);
+    const ext2_dx_countlimit *cl = countlimit(frame);
+    if (cl->limit != node_limit(path->block_size) || cl->count == 0 || cl->count > cl->limit) {
+        log_error("Error (htree): Index node %u has a bad header.\n", logical);
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+static void release_path(dx_path *path) {
+    for (int i = 0; i < DX_MAX_LEVELS; ++i) {
+        free(path->frames[i].data);
+        path->frames[i].data = NULL;
+    }
+    ext2_block_map_release(&path->map);
+}
+
+/**
+ * @brief Walks from the index root to the leaf for a name.
+ *
+ * @return 0 on success, ERROR if the index is damaged or uses an unknown hash,
+ *         or another negative error code. The path must be released either way.
+ */
+static int probe(
+    dx_path *path,
+    ext2_filesystem *fs,
+    const ext2_inode *dir_inode,
+    const char *name,
+    const size_t name_len
+) {
+    memset(path, 0, sizeof(dx_path));
+    path->fs = fs;
+    path->block_size = get_block_size(fs->superblock);
+    ext2_block_map_init(&path->map, fs, dir_inode);
+
+    for (int i = 0; i < DX_MAX_LEVELS; ++i) {
+        path->frames[i].data = malloc(path->block_size);
+        if (path->frames[i].data == NULL) {
+            log_error("Error (htree): Failed to allocate index buffers.\n");
+            return ERROR;
+        }
+    }
+
+    dx_frame *root = &path->frames[0];
+    int status = read_dir_block(path, 0, root->data);
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    const ext2_dx_root_info *info = (const ext2_dx_root_info *) (root->data + DX_ROOT_INFO_OFFSET);
+    root->entries = (ext2_dx_entry *) (root->data + DX_ROOT_ENTRIES_OFFSET);
+    const ext2_dx_countlimit *cl = countlimit(root);
+    if (info->reserved_zero != 0 || info->info_length != sizeof(ext2_dx_root_info) ||
+        info->indirect_levels >= DX_MAX_LEVELS || cl->limit != root_limit(path->block_size) ||
+        cl->count == 0 || cl->count > cl->limit) {
+        log_error("Error (htree): Directory has a bad index root.\n");
+        return ERROR;
+    }
+
+    path->hash_version = info->hash_version;
+    if (path->hash_version <= EXT2_DX_HASH_TEA && (fs->superblock->s_flags & EXT2_FLAGS_UNSIGNED_HASH)) {
+        path->hash_version += EXT2_DX_HASH_LEGACY_UNSIGNED;
+    }
+    if (ext2_dx_hash(name, name_len, path->hash_version, fs->superblock->s_hash_seed, &path->hash, NULL) != SUCCESS) {
+        log_error("Error (htree): Unknown hash version %u.\n", info->hash_version);
+        return ERROR;
+    }
+
+    path->levels = info->indirect_levels + 1;
+    search_frame(path, root);
+    for (int level = 1; level < path->levels; ++level) {
+        const dx_frame *parent = &path->frames[level - 1];
+        status = load_node(path, &path->frames[level], parent->entries[parent->at].block & DX_BLOCK_MASK);
+        if (status != SUCCESS) {
+            return status;
+        }
+        search_frame(path, &path->frames[level]);
+    }
+    return SUCCESS;
+}
+
+static uint32_t leaf_of(const dx_path *path) {
+    const dx_frame *frame = &path->frames[path->levels - 1];
+    return frame->entries[frame->at].block & DX_BLOCK_MASK;
+}
+
+/**
+ * @brief Moves the path to the next leaf in hash order.
+ *
+ * @param path The path to advance.
+ * @param hash_out Set to the starting hash of the next leaf.
+ * @return 1 if there is a next leaf, 0 after the last one, or a negative error code.
+ */
+static int next_leaf(dx_path *path, uint32_t *hash_out) {
+    int level = path->levels - 1;
+    while (level >= 0 && path->frames[level].at + 1 >= countlimit(&path->frames[level])->count) {
+        level--;
+    }
+    if (level < 0) {
+        return 0;
+    }
+
+    dx_frame *frame = &path->frames[level];
+    frame->at++;
+    *hash_out = frame->entries[frame->at].hash;
+
+    for (++level; level < path->levels; ++level) {
+        const dx_frame *parent = &path->frames[level - 1];
+        const int status = load_node(path, &path->frames[level], parent->entries[parent->at].block & DX_BLOCK_MASK);
+        if (status != SUCCESS) {
+            return status;
+        }
+        path->frames[level].at = 0;
+    }
+    return 1;
+}
+
+int ext2_htree_is_indexed(const ext2_filesystem *fs, const ext2_inode *dir_inode) {
+    return fs != NULL && dir_inode != NULL &&
+           (fs->superblock->s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX) &&
+           (dir_inode->i_flags & EXT2_INDEX_FL);
+}
+
+int ext2_htree_lookup(
+    ext2_filesystem *fs,
+    const ext2_inode *dir_inode,
+    const char *name,
+    const size_t name_len,
+    uint32_t *inode_out
+) {
+    if (fs == NULL || dir_inode == NULL || name == NULL || inode_out == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    if (name_len == 0 || name_len > EXT2_NAME_LEN) {
+        return 0;
+    }
+
+    ext2_name_key key;
+    ext2_name_key_init(&key, name, (uint8_t) name_len);
+
+    dx_path path;
+    int status = probe(&path, fs, dir_inode, name, name_len);
+    uint8_t *leaf = status == SUCCESS ? malloc(path.block_size) : NULL;
+    if (status == SUCCESS && leaf == NULL) {
+        status = ERROR;
+    }
+
+    int result = status;
+    while (status == SUCCESS) {
+        status = read_dir_block(&path, leaf_of(&path), leaf);
+        if (status != SUCCESS) {
+            result = status;
+            break;
+        }
+
+        result = ext2_dir_block_find((const char *) leaf, path.block_size, &key, inode_out);
+        if (result < 0) {
+            log_error("Error (htree): Malformed entry in leaf block %u.\n", leaf_of(&path));
+        }
+        if (result != 0) {
+            break;
+        }
+
+        // Names with the same hash may continue into the next leaf.
+        uint32_t next_hash;
+        const int more = next_leaf(&path, &next_hash);
+        if (more < 0) {
+            result = more;
+            break;
+        }
+        if (more == 0 || (next_hash & ~1u) != path.hash) {
+            break;
+        }
+    }
+
+    free(leaf);
+    release_path(&path);
+    return result;
+}
+
+// ---- Index maintenance ----
+
+/**
+ * @brief Inserts an index entry right after the frame's current one.
+ */
+static void insert_index_entry(dx_frame *frame, const uint32_t hash, const uint32_t block) {
+    ext2_dx_countlimit *cl = countlimit(frame);
+    const uint32_t position = frame->at + 1;
+    memmove(&frame->entries[position + 1], &frame->entries[position],
+            (cl->count - position) * sizeof(ext2_dx_entry));
+    frame->entries[position].hash = hash;
+    frame->entries[position].block = block;
+    cl->count++;
+}
+
+/**
+ * @brief Appends a block to the directory for index use.
+ *
+ * The block is written as a single empty entry straight away, so the directory
+ * still reads as a valid linear one if the index is dropped before the block is filled.
+ */
+static int append_block(dx_path *path, ext2_inode *dir_inode, uint32_t *logical_out) {
+    uint8_t *empty = calloc(1, path->block_size);
+    if (empty == NULL) {
+        return ERROR;
+    }
+    ((ext2_directory_entry *) empty)->rec_len = (uint16_t) path->block_size;
+
+    uint32_t physical;
+    int status = ext2_directory_append_block(path->fs, dir_inode, logical_out, &physical);
+    // Appending may have written a new pointer into an indirect block this map holds.
+    ext2_block_map_invalidate(&path->map);
+    if (status == SUCCESS) {
+        status = write_dir_block(path, *logical_out, empty);
+    }
+    free(empty);
+    return status;
+}
+
+/**
+ * @brief Initialises an empty index node block.
+ */
+static void format_node(uint8_t *data, const uint32_t block_size, const uint16_t count) {
+    memset(data, 0, block_size);
+    ext2_directory_entry *fake = (ext2_directory_entry *) data;
+    fake->rec_len = (uint16_t) block_size;
+
+    ext2_dx_countlimit *cl = (ext2_dx_countlimit *) (data + DX_NODE_ENTRIES_OFFSET);
+    cl->limit = (uint16_t) node_limit(block_size);
+    cl->count = count;
+}
+
+/**
+ * @brief Makes sure the deepest index block on the path has a free slot.
+ *
+ * @return 0 on success, 1 if the index cannot grow any further, or a negative error code.
+ */
+static int make_index_room(dx_path *path, ext2_inode *dir_inode) {
+    dx_frame *deepest = &path->frames[path->levels - 1];
+    if (countlimit(deepest)->count < countlimit(deepest)->limit) {
+        return SUCCESS;
+    }
+
+    const uint32_t block_size = path->block_size;
+    dx_frame *root = &path->frames[0];
+    uint32_t node_logical;
+    int status;
+
+    if (path->levels == 1) {
+        // Full root: move its entries into a new node and add a level.
+        status = append_block(path, dir_inode, &node_logical);
+        if (status != SUCCESS) {
+            return status;
+        }
+
+        dx_frame *node = &path->frames[1];
+        const uint16_t count = countlimit(root)->count;
+        format_node(node->data, block_size, count);
+        node->logical = node_logical;
+        node->entries = (ext2_dx_entry *) (node->data + DX_NODE_ENTRIES_OFFSET);
+        memcpy(&node->entries[1], &root->entries[1], (count - 1) * sizeof(ext2_dx_entry));
+        node->entries[0].block = root->entries[0].block;
+        node->at = root->at;
+
+        countlimit(root)->count = 1;
+        root->entries[0].block = node_logical;
+        root->at = 0;
+        ((ext2_dx_root_info *) (root->data + DX_ROOT_INFO_OFFSET))->indirect_levels = 1;
+        path->levels = 2;
+
+        if (write_dir_block(path, node_logical, node->data) != SUCCESS ||
+            write_dir_block(path, 0, root->data) != SUCCESS) {
+            return IO_ERROR;
+        }
+        return SUCCESS;
+    }
+
+    // Full node: split it in two, which needs a slot in the root.
+    if (countlimit(root)->count >= countlimit(root)->limit) {
+        log_error("Warning (htree): Directory index is full.\n");
+        return 1;
+    }
+
+    uint8_t *sibling = malloc(block_size);
+    if (sibling == NULL) {
+        return ERROR;
+    }
+    status = append_block(path, dir_inode, &node_logical);
+    if (status != SUCCESS) {
+        free(sibling);
+        return status;
+    }
+
+    dx_frame *node = &path->frames[1];
+    const uint16_t count = countlimit(node)->count;
+    const uint16_t half = count / 2;
+    format_node(sibling, block_size, (uint16_t) (count - half));
+    ext2_dx_entry *moved = (ext2_dx_entry *) (sibling + DX_NODE_ENTRIES_OFFSET);
+    const uint32_t split_hash = node->entries[half].hash;
+    moved[0].block = node->entries[half].block;
+    memcpy(&moved[1], &node->entries[half + 1], (count - half - 1) * sizeof(ext2_dx_entry));
+    countlimit(node)->count = half;
+
+    insert_index_entry(root, split_hash, node_logical);
+
+    if (write_dir_block(path, node->logical, node->data) != SUCCESS ||
+        write_dir_block(path, node_logical, sibling) != SUCCESS ||
+        write_dir_block(path, 0, root->data) != SUCCESS) {
+        free(sibling);
+        return IO_ERROR;
+    }
+
+    // Continue in whichever half now holds the path's entry.
+    if (node->at >= half) {
+        free(node->data);
+        node->data = sibling;
+        node->entries = moved;
+        node->logical = node_logical;
+        node->at -= half;
+        root->at++;
+    } else {
+        free(sibling);
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief A live entry of a leaf being split.
+ */
+typedef struct {
+    uint32_t hash;
+    uint16_t offset;
+    uint16_t size;
+} dx_map_entry;
+
+static int compare_map_entries(const void *a, const void *b) {
+    const dx_map_entry *left = a;
+    const dx_map_entry *right = b;
+    if (left->hash != right->hash) {
+        return left->hash < right->hash ? -1 : 1;
+    }
+    return left->offset < right->offset ? -1 : left->offset > right->offset;
+}
+
+/**
+ * @brief Packs a range of entries into a block; the last one takes up the rest of it.
+ */
+static void pack_entries(
+    uint8_t *block,
+    const uint32_t block_size,
+    const uint8_t *source,
+    const dx_map_entry *entries,
+    const uint32_t count
+) {
+    memset(block, 0, block_size);
+    uint32_t offset = 0;
+    ext2_directory_entry *last = (ext2_directory_entry *) block;
+    last->rec_len = (uint16_t) block_size;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        memcpy(block + offset, source + entries[i].offset, entries[i].size);
+        last = (ext2_directory_entry *) (block + offset);
+        last->rec_len = entries[i].size;
+        offset += entries[i].size;
+    }
+    last->rec_len = (uint16_t) (last->rec_len + block_size - offset);
+}
+
+/**
+ * @brief Splits the full leaf on the path and inserts the new entry into the right half.
+ *
+ * @return 0 on success, 1 if the leaf cannot be split, or a negative error code.
+ */
+static int split_leaf(
+    dx_path *path,
+    ext2_inode *dir_inode,
+    uint8_t *leaf,
+    const uint32_t inode_num,
+    const char *name,
+    const uint8_t name_len,
+    const uint8_t file_type
+) {
+    const uint32_t block_size = path->block_size;
+    const uint32_t leaf_logical = leaf_of(path);
+
+    dx_map_entry *map = malloc(block_size / EXT2_DIR_REC_LEN(1) * sizeof(dx_map_entry));
+    uint8_t *source = malloc(block_size);
+    uint8_t *sibling = malloc(block_size);
+    if (map == NULL || source == NULL || sibling == NULL) {
+        free(map);
+        free(source);
+        free(sibling);
+        return ERROR;
+    }
+    memcpy(source, leaf, block_size);
+
+    uint32_t count = 0;
+    uint32_t total = 0;
+    for (uint32_t offset = 0; offset + EXT2_DIR_ENTRY_FIXED_SIZE <= block_size;) {
+        const ext2_directory_entry *entry = (const ext2_directory_entry *) (source + offset);
+        if (entry->rec_len < EXT2_DIR_ENTRY_FIXED_SIZE || entry->rec_len > block_size - offset) {
+            break;
+        }
+        if (entry->inode != 0) {
+            ext2_dx_hash(entry->name, entry->name_len, path->hash_version, path->fs->superblock->s_hash_seed,
+                         &map[count].hash, NULL);
+            map[count].offset = (uint16_t) offset;
+            map[count].size = EXT2_DIR_REC_LEN(entry->name_len);
+            total += map[count].size;
+            count++;
+        }
+        offset += entry->rec_len;
+    }
+
+    int status = SUCCESS;
+    if (count < 2) {
+        status = 1;
+    }
+
+    uint32_t split = 0;
+    if (status == SUCCESS) {
+        qsort(map, count, sizeof(dx_map_entry), compare_map_entries);
+        for (uint32_t size = 0; split < count - 1 && size + map[split].size <= total / 2; ++split) {
+            size += map[split].size;
+        }
+        if (split == 0) {
+            split = 1;
+        }
+    }
+
+    uint32_t sibling_logical = 0;
+    if (status == SUCCESS) {
+        status = append_block(path, dir_inode, &sibling_logical);
+    }
+    if (status == SUCCESS) {
+        const uint32_t split_hash = map[split].hash;
+        const uint32_t continued = map[split - 1].hash == split_hash;
+
+        pack_entries(leaf, block_size, source, map, split);
+        pack_entries(sibling, block_size, source, map + split, count - split);
+        insert_index_entry(&path->frames[path->levels - 1], split_hash | continued, sibling_logical);
+
+        uint8_t *target = path->hash >= split_hash ? sibling : leaf;
+        if (!ext2_dir_block_insert((char *) target, block_size, inode_num, name, name_len, file_type)) {
+            status = 1;
+        } else if (write_dir_block(path, leaf_logical, leaf) != SUCCESS ||
+                   write_dir_block(path, sibling_logical, sibling) != SUCCESS ||
+                   write_dir_block(path, path->frames[path->levels - 1].logical,
+                                   path->frames[path->levels - 1].data) != SUCCESS) {
+            status = IO_ERROR;
+        }
+    }
+
+    free(map);
+    free(source);
+    free(sibling);
+    return status;
+}
+
+int ext2_htree_add_entry(
+    ext2_filesystem *fs,
+    ext2_inode *dir_inode,
+    const uint32_t inode_num,
+    const char *name,
+    const uint8_t name_len,
+    const uint8_t file_type
+) {
+    if (fs == NULL || dir_inode == NULL || name == NULL || name_len == 0) {
+        return INVALID_PARAMETER;
+    }
+
+    dx_path path;
+    int status = probe(&path, fs, dir_inode, name, name_len);
+    if (status == ERROR) {
+        status = 1; // Damaged index
+    }
+    uint8_t *leaf = status == SUCCESS ? malloc(path.block_size) : NULL;
+    if (status == SUCCESS && leaf == NULL) {
+        status = ERROR;
+    }
+
+    if (status == SUCCESS) {
+        status = read_dir_block(&path, leaf_of(&path), leaf);
+    }
+    if (status == SUCCESS) {
+        if (ext2_dir_block_insert((char *) leaf, path.block_size, inode_num, name, name_len, file_type)) {
+            status = write_dir_block(&path, leaf_of(&path), leaf);
+        } else {
+            // The leaf is full: make room for one more index entry, then split it.
+            status = make_index_room(&path, dir_inode);
+            if (status == SUCCESS) {
+                status = split_leaf(&path, dir_inode, leaf, inode_num, name, name_len, file_type);
+            }
+        }
+    }
+
+    free(leaf);
+    release_path(&path);
+    return status;
+}
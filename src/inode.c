@@ -3,16 +3,22 @@
  * @brief Implements functions for reading and writing ext2 inodes.
  *
  * These functions handle the I/O operations to load an inode from a
- * filesystem image into memory and to write a modified inode back to the image.
+ * filesystem image into memory and to write a modified inode back to the image,
+ * and the bulk scan that walks whole inode tables a chunk at a time. Table
+ * entries are get_inode_size() bytes apart; the accessors for the fields past
+ * the first 128 bytes of large inodes take the entry's size alongside it.
  */
 
 #include "inode.h"
+#include "inode_cache.h"
 #include "superblock.h"
 #include "block_group.h"
+#include "filesystem.h"
 #include "globals.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /**
  * @brief Calculates the disk offset of a given inode.
@@ -52,12 +58,484 @@ static int calculate_inode_disk_offset(
 
     const uint32_t block_size = get_block_size(superblock);
     const off_t inode_table_start_byte_offset = (off_t)inode_table_start_block_id * block_size;
-    const off_t inode_offset_in_table_bytes = (off_t)inode_index_in_group * superblock->s_inode_size;
+    const off_t inode_offset_in_table_bytes = (off_t)inode_index_in_group * get_inode_size(superblock);
 
     *offset_out = inode_table_start_byte_offset + inode_offset_in_table_bytes;
     return SUCCESS;
 }
 
+int ext2_load_inode(
+    ext2_filesystem *fs,
+    const uint32_t inode_num,
+    ext2_inode *inode_out
+) {
+    if (fs == NULL || fs->superblock == NULL || fs->bgdt == NULL || inode_out == NULL) {
+        log_error("Error (read_inode): NULL pointer argument provided.\n");
+        return INVALID_PARAMETER;
+    }
+
+    off_t inode_disk_offset;
+    const int calc_status = calculate_inode_disk_offset(fs->superblock, fs->bgdt->groups, inode_num, &inode_disk_offset);
+    if (calc_status != 0) {
+        log_error("Error (read_inode): Failed to calculate location for inode %u (status: %d).\n", inode_num, calc_status);
+        return ERROR;
+    }
+
+    if (filesystem_read(fs, inode_disk_offset, sizeof(ext2_inode), inode_out) != SUCCESS) {
+        log_error("Error (read_inode): Reading inode %u failed.\n", inode_num);
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+int ext2_read_inode(
+    ext2_filesystem *fs,
+    const uint32_t inode_num,
+    ext2_inode *inode_out
+) {
+    if (fs == NULL || inode_out == NULL) {
+        log_error("Error (read_inode): NULL pointer argument provided.\n");
+        return INVALID_PARAMETER;
+    }
+    if (fs->icache == NULL) {
+        return ext2_load_inode(fs, inode_num, inode_out);
+    }
+
+    ext2_inode *cached = ext2_inode_get(fs, inode_num);
+    if (cached == NULL) {
+        return ERROR;
+    }
+    *inode_out = *cached;
+    ext2_inode_put(fs, cached);
+    return SUCCESS;
+}
+
+int ext2_read_inode_full(
+    ext2_filesystem *fs,
+    const uint32_t inode_num,
+    void *entry_out,
+    const size_t length
+) {
+    if (fs == NULL || fs->superblock == NULL || fs->bgdt == NULL || entry_out == NULL) {
+        log_error("Error (read_inode): NULL pointer argument provided.\n");
+        return INVALID_PARAMETER;
+    }
+    const uint32_t inode_size = get_inode_size(fs->superblock);
+    if (length < sizeof(ext2_inode) || inode_size < sizeof(ext2_inode)) {
+        log_error("Error (read_inode): Entry of %u bytes does not fit %zu.\n", inode_size, length);
+        return INVALID_PARAMETER;
+    }
+
+    off_t inode_disk_offset;
+    const int calc_status = calculate_inode_disk_offset(fs->superblock, fs->bgdt->groups, inode_num, &inode_disk_offset);
+    if (calc_status != SUCCESS) {
+        log_error("Error (read_inode): Failed to calculate location for inode %u (status: %d).\n", inode_num, calc_status);
+        return ERROR;
+    }
+
+    const size_t read_length = length < inode_size ? length : inode_size;
+    if (filesystem_read(fs, inode_disk_offset, read_length, entry_out) != SUCCESS) {
+        log_error("Error (read_inode): Reading inode %u failed.\n", inode_num);
+        return ERROR;
+    }
+    memset((uint8_t *) entry_out + read_length, 0, length - read_length);
+
+    ext2_inode_peek(fs, inode_num, entry_out);
+    return SUCCESS;
+}
+
+const ext2_inode *ext2_map_inode(
+    const ext2_filesystem *fs,
+    const uint32_t inode_num
+) {
+    if (fs == NULL || fs->superblock == NULL || fs->bgdt == NULL) {
+        log_error("Error (map_inode): NULL pointer argument provided.\n");
+        return NULL;
+    }
+
+    off_t inode_disk_offset;
+    if (calculate_inode_disk_offset(fs->superblock, fs->bgdt->groups, inode_num, &inode_disk_offset) != SUCCESS) {
+        return NULL;
+    }
+
+    return filesystem_map(fs, inode_disk_offset, get_inode_size(fs->superblock));
+}
+
+int ext2_store_inode(
+    ext2_filesystem *fs,
+    const uint32_t inode_num,
+    const ext2_inode *inode_in
+) {
+    if (fs == NULL || fs->superblock == NULL || fs->bgdt == NULL || inode_in == NULL) {
+        log_error("Error (write_inode): NULL pointer argument provided.\n");
+        return INVALID_PARAMETER;
+    }
+
+    off_t inode_disk_offset;
+    const int calc_status = calculate_inode_disk_offset(fs->superblock, fs->bgdt->groups, inode_num, &inode_disk_offset);
+    if (calc_status != SUCCESS) {
+        log_error("Error (write_inode): Failed to calculate location for inode %u (status: %d).\n", inode_num, calc_status);
+        return ERROR;
+    }
+
+    if (filesystem_write(fs, inode_disk_offset, sizeof(ext2_inode), inode_in) != SUCCESS) {
+        log_error("Error (write_inode): Writing inode %u failed.\n", inode_num);
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+int ext2_write_inode(
+    ext2_filesystem *fs,
+    const uint32_t inode_num,
+    const ext2_inode *inode_in
+) {
+    if (fs == NULL || inode_in == NULL) {
+        log_error("Error (write_inode): NULL pointer argument provided.\n");
+        return INVALID_PARAMETER;
+    }
+    if (fs->icache == NULL) {
+        return ext2_store_inode(fs, inode_num, inode_in);
+    }
+
+    ext2_inode *cached = ext2_inode_get(fs, inode_num);
+    if (cached == NULL) {
+        return ERROR;
+    }
+    *cached = *inode_in;
+    ext2_inode_mark_dirty(fs, cached);
+    ext2_inode_put(fs, cached);
+    return SUCCESS;
+}
+
+uint64_t ext2_inode_size(const ext2_inode *inode) {
+    if ((inode->i_mode & EXT2_S_IFMT) == EXT2_S_IFREG) {
+        return (uint64_t) inode->i_dir_acl << 32 | inode->i_size;
+    }
+    return inode->i_size;
+}
+
+uint32_t ext2_inode_extra_isize(const ext2_inode *inode, const uint32_t inode_size) {
+    if (inode == NULL || inode_size <= EXT2_GOOD_OLD_INODE_SIZE) {
+        return 0;
+    }
+
+    const ext2_inode_large *large = (const ext2_inode_large *) inode;
+    const uint32_t extra = large->i_extra_isize;
+    if (extra % 4 != 0 || EXT2_GOOD_OLD_INODE_SIZE + extra > inode_size) {
+        return 0;
+    }
+    return extra;
+}
+
+/**
+ * @brief Tells whether `length` bytes at `offset` of an entry are covered by its i_extra_isize.
+ */
+static int has_extra_field(
+    const ext2_inode *inode,
+    const uint32_t inode_size,
+    const size_t offset,
+    const size_t length
+) {
+    return offset + length <= EXT2_GOOD_OLD_INODE_SIZE + (size_t) ext2_inode_extra_isize(inode, inode_size);
+}
+
+int ext2_inode_get_time(
+    const ext2_inode *inode,
+    const uint32_t inode_size,
+    const ext2_inode_time which,
+    struct timespec *time_out
+) {
+    if (inode == NULL || time_out == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    const ext2_inode_large *large = (const ext2_inode_large *) inode;
+    uint32_t seconds;
+    size_t extra_offset;
+    switch (which) {
+        case EXT2_INODE_ATIME:
+            seconds = inode->i_atime;
+            extra_offset = offsetof(ext2_inode_large, i_atime_extra);
+            break;
+        case EXT2_INODE_CTIME:
+            seconds = inode->i_ctime;
+            extra_offset = offsetof(ext2_inode_large, i_ctime_extra);
+            break;
+        case EXT2_INODE_MTIME:
+            seconds = inode->i_mtime;
+            extra_offset = offsetof(ext2_inode_large, i_mtime_extra);
+            break;
+        case EXT2_INODE_CRTIME:
+            if (!has_extra_field(inode, inode_size, offsetof(ext2_inode_large, i_crtime), sizeof(uint32_t))) {
+                return ERROR;
+            }
+            seconds = large->i_crtime;
+            extra_offset = offsetof(ext2_inode_large, i_crtime_extra);
+            break;
+        default:
+            return INVALID_PARAMETER;
+    }
+
+    // The extra word holds two epoch bits that extend the signed seconds, then the nanoseconds.
+    time_out->tv_sec = (time_t) (int32_t) seconds;
+    time_out->tv_nsec = 0;
+    if (has_extra_field(inode, inode_size, extra_offset, sizeof(uint32_t))) {
+        uint32_t extra;
+        memcpy(&extra, (const uint8_t *) inode + extra_offset, sizeof(extra));
+        time_out->tv_sec += (time_t) ((int64_t) (extra & 3) << 32);
+        time_out->tv_nsec = (long) (extra >> 2);
+    }
+    return SUCCESS;
+}
+
+int ext2_inode_xattr_get(
+    const ext2_inode *inode,
+    const uint32_t inode_size,
+    const uint8_t name_index,
+    const char *name,
+    const void **value_out,
+    uint32_t *value_size_out
+) {
+    if (inode == NULL || name == NULL || value_out == NULL || value_size_out == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    const uint32_t extra = ext2_inode_extra_isize(inode, inode_size);
+    const uint32_t start = EXT2_GOOD_OLD_INODE_SIZE + extra;
+    if (extra == 0 || start + sizeof(uint32_t) > inode_size) {
+        return 0;
+    }
+    uint32_t magic;
+    memcpy(&magic, (const uint8_t *) inode + start, sizeof(magic));
+    if (magic != EXT2_XATTR_MAGIC) {
+        return 0;
+    }
+
+    // Entries and value offsets count from just after the magic number.
+    const uint8_t *first = (const uint8_t *) inode + start + sizeof(uint32_t);
+    const size_t area = inode_size - start - sizeof(uint32_t);
+    const size_t name_len = strlen(name);
+    size_t offset = 0;
+    while (offset + sizeof(uint32_t) <= area && *(const uint32_t *) (first + offset) != 0) {
+        const ext2_xattr_entry *entry = (const ext2_xattr_entry *) (first + offset);
+        if (offset + sizeof(ext2_xattr_entry) > area ||
+            offset + sizeof(ext2_xattr_entry) + entry->e_name_len > area) {
+            log_error("Error (xattr): Entry at offset %zu runs past the inode.\n", offset);
+            return ERROR;
+        }
+
+        if (entry->e_name_index == name_index && entry->e_name_len == name_len &&
+            memcmp(entry->e_name, name, name_len) == 0) {
+            if (entry->e_value_inum != 0 || (size_t) entry->e_value_offs + entry->e_value_size > area) {
+                log_error("Error (xattr): Value of attribute \"%s\" is not stored in the inode.\n", name);
+                return ERROR;
+            }
+            *value_out = first + entry->e_value_offs;
+            *value_size_out = entry->e_value_size;
+            return 1;
+        }
+        offset += (sizeof(ext2_xattr_entry) + entry->e_name_len + 3) & ~(size_t) 3;
+    }
+    return 0;
+}
+
+static int test_inode_bit(const uint8_t *bitmap, const uint32_t index) {
+    return (bitmap[index / 8] >> (index % 8)) & 1;
+}
+
+/**
+ * @brief Finds the first set bit in [from, limit), skipping clear bytes whole.
+ * @return The bit's index, or `limit` if there is none.
+ */
+static uint32_t next_used_inode(const uint8_t *bitmap, uint32_t from, const uint32_t limit) {
+    while (from < limit) {
+        if (from % 8 == 0 && bitmap[from / 8] == 0) {
+            from += 8;
+            continue;
+        }
+        if (test_inode_bit(bitmap, from)) {
+            return from;
+        }
+        from++;
+    }
+    return limit;
+}
+
+/**
+ * @brief Prepares the scan's current group: works out how much of its table is worth reading and copies its bitmap.
+ */
+static int load_scan_group(ext2_inode_scan *scan) {
+    ext2_filesystem *fs = scan->fs;
+    const ext2_super_block *sb = fs->superblock;
+    const ext2_group_desc *desc = &fs->bgdt->groups[scan->group];
+    const uint32_t block_size = get_block_size(sb);
+
+    scan->next_index = 0;
+    scan->chunk = NULL;
+    scan->chunk_count = 0;
+    scan->group_ready = 1;
+
+    // The uninit flags and bg_itable_unused are only maintained alongside descriptor checksums.
+    const int uninit_valid = (sb->s_feature_ro_compat & EXT2_FEATURE_RO_COMPAT_GDT_CSUM) != 0;
+    scan->limit = sb->s_inodes_per_group;
+    if (uninit_valid && (desc->bg_flags & EXT2_BG_INODE_UNINIT)) {
+        scan->limit = 0;
+        return SUCCESS;
+    }
+    if (uninit_valid && desc->bg_itable_unused <= scan->limit) {
+        scan->limit -= desc->bg_itable_unused;
+    }
+
+    // A bitmap the context holds in memory may be newer than the image.
+    int copied = 0;
+    ext2_lock_group(fs, scan->group);
+    if (fs->bitmaps != NULL && fs->bitmaps[scan->group].inode_bitmap != NULL) {
+        memcpy(scan->bitmap, fs->bitmaps[scan->group].inode_bitmap, block_size);
+        copied = 1;
+    }
+    ext2_unlock_group(fs, scan->group);
+    if (!copied && filesystem_read_direct(fs, (off_t) desc->bg_inode_bitmap * block_size, block_size,
+                                          scan->bitmap) != SUCCESS) {
+        log_error("Error (inode_scan): Reading the inode bitmap of group %u failed.\n", scan->group);
+        return IO_ERROR;
+    }
+
+    while (scan->limit > 0 && !test_inode_bit(scan->bitmap, scan->limit - 1)) {
+        scan->limit--;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Reads the chunk of the current group's inode table that starts with the block holding inode `index`.
+ */
+static int load_scan_chunk(ext2_inode_scan *scan, const uint32_t index) {
+    ext2_filesystem *fs = scan->fs;
+    const uint32_t block_size = get_block_size(fs->superblock);
+    const uint32_t per_block = block_size / scan->inode_size;
+
+    const uint32_t first = index - index % per_block;
+    uint32_t count = scan->limit - first;
+    if (count > scan->chunk_inodes) {
+        count = scan->chunk_inodes;
+    }
+    const size_t length = ((size_t) count * scan->inode_size + block_size - 1) / block_size * block_size;
+    const off_t offset = (off_t) fs->bgdt->groups[scan->group].bg_inode_table * block_size +
+                         (off_t) first * scan->inode_size;
+
+    if (scan->buffer == NULL) {
+        scan->chunk = filesystem_map(fs, offset, length);
+    } else if (filesystem_read_direct(fs, offset, length, scan->buffer) == SUCCESS) {
+        scan->chunk = scan->buffer;
+    } else {
+        scan->chunk = NULL;
+    }
+    if (scan->chunk == NULL) {
+        log_error("Error (inode_scan): Reading inodes %u-%u of group %u failed.\n", first, first + count - 1,
+                scan->group);
+        return IO_ERROR;
+    }
+
+    scan->chunk_first = first;
+    scan->chunk_count = count;
+    return SUCCESS;
+}
+
+int ext2_inode_scan_open(
+    ext2_inode_scan *scan,
+    ext2_filesystem *fs,
+    uint32_t chunk_blocks
+) {
+    if (scan == NULL || fs == NULL || fs->superblock == NULL || fs->bgdt == NULL) {
+        log_error("Error (inode_scan): NULL pointer argument provided.\n");
+        return INVALID_PARAMETER;
+    }
+
+    const ext2_super_block *sb = fs->superblock;
+    const uint32_t block_size = get_block_size(sb);
+    memset(scan, 0, sizeof(ext2_inode_scan));
+    scan->fs = fs;
+    scan->inode_size = get_inode_size(sb);
+    if (scan->inode_size < sizeof(ext2_inode) || scan->inode_size > block_size || sb->s_inodes_per_group == 0) {
+        log_error("Error (inode_scan): Unsupported inode size %u.\n", scan->inode_size);
+        return ERROR;
+    }
+
+    const uint32_t table_blocks =
+        (uint32_t) (((uint64_t) sb->s_inodes_per_group * scan->inode_size + block_size - 1) / block_size);
+    if (chunk_blocks == 0) {
+        chunk_blocks = EXT2_INODE_SCAN_CHUNK_BLOCKS;
+    }
+    if (chunk_blocks > table_blocks) {
+        chunk_blocks = table_blocks;
+    }
+    scan->chunk_inodes = chunk_blocks * (block_size / scan->inode_size);
+
+    const int mapped = fs->device != NULL && fs->device->map != NULL;
+    scan->bitmap = malloc(block_size);
+    scan->buffer = mapped ? NULL : malloc((size_t) chunk_blocks * block_size);
+    if (scan->bitmap == NULL || (!mapped && scan->buffer == NULL)) {
+        log_error("Error (inode_scan): Failed to allocate scan buffers.\n");
+        ext2_inode_scan_close(scan);
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+int ext2_inode_scan_next(
+    ext2_inode_scan *scan,
+    uint32_t *inode_num_out,
+    const ext2_inode **inode_out
+) {
+    if (scan == NULL || scan->fs == NULL || inode_num_out == NULL || inode_out == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    const ext2_filesystem *fs = scan->fs;
+    for (;;) {
+        if (!scan->group_ready) {
+            if (scan->group >= fs->bgdt->groups_count) {
+                return 0;
+            }
+            const int status = load_scan_group(scan);
+            if (status != SUCCESS) {
+                return status;
+            }
+        }
+
+        const uint32_t index = next_used_inode(scan->bitmap, scan->next_index, scan->limit);
+        if (index >= scan->limit) {
+            scan->group++;
+            scan->group_ready = 0;
+            continue;
+        }
+        if (scan->chunk == NULL || index < scan->chunk_first || index >= scan->chunk_first + scan->chunk_count) {
+            const int status = load_scan_chunk(scan, index);
+            if (status != SUCCESS) {
+                return status;
+            }
+        }
+
+        scan->next_index = index + 1;
+        *inode_num_out = scan->group * fs->superblock->s_inodes_per_group + index + 1;
+        *inode_out = EXT2_INODE_AT(scan->chunk, index - scan->chunk_first, scan->inode_size);
+        return 1;
+    }
+}
+
+void ext2_inode_scan_close(ext2_inode_scan *scan) {
+    if (scan == NULL) {
+        return;
+    }
+
+    free(scan->bitmap);
+    free(scan->buffer);
+    memset(scan, 0, sizeof(ext2_inode_scan));
+}
+
 /**
  * @brief Reads an inode from the filesystem into memory.
  *
@@ -80,28 +558,8 @@ int read_inode(
         return INVALID_PARAMETER;
     }
 
-    off_t inode_disk_offset;
-    const int calc_status = calculate_inode_disk_offset(superblock, block_group_descriptor_table, inode_num, &inode_disk_offset);
-    if (calc_status != 0) {
-        log_error("Error (read_inode): Failed to calculate location for inode %u (status: %d).\n", inode_num, calc_status);
-        return ERROR;
-    }
-
-    if (fseeko(file, inode_disk_offset, SEEK_SET) != 0) {
-        log_error("Error (read_inode): Seeking to inode location");
-        return ERROR;
-    }
-
-    if (fread(inode_out, sizeof(ext2_inode), 1, file) != 1) {
-        if (feof(file)) {
-            log_error("Error (read_inode): Reading inode %u: unexpected end of file.\n", inode_num);
-        } else if (ferror(file)) {
-            log_error("Error (read_inode): Reading inode");
-        }
-        return ERROR;
-    }
-
-    return SUCCESS;
+    ext2_stream_context context;
+    return ext2_read_inode(filesystem_wrap_stream(&context, file, superblock, block_group_descriptor_table), inode_num, inode_out);
 }
 
 /**
@@ -126,26 +584,6 @@ int write_inode(
         return INVALID_PARAMETER;
     }
 
-    off_t inode_disk_offset;
-    const int calc_status = calculate_inode_disk_offset(superblock, block_group_descriptor_table, inode_num, &inode_disk_offset);
-    if (calc_status != SUCCESS) {
-        log_error("Error (write_inode): Failed to calculate location for inode %u (status: %d).\n", inode_num, calc_status);
-        return ERROR;
-    }
-
-    if (fseeko(file, inode_disk_offset, SEEK_SET) != 0) {
-        log_error("Error (write_inode): Seeking to inode location");
-        return ERROR;
-    }
-
-    if (fwrite(inode_in, sizeof(ext2_inode), 1, file) != 1) {
-        if (ferror(file)) {
-            log_error("Error (write_inode): Writing inode");
-        } else {
-            log_error("Error (write_inode): Writing inode %u: fwrite did not write the expected number of items.\n", inode_num);
-        }
-        return ERROR;
-    }
-
-    return SUCCESS;
+    ext2_stream_context context;
+    return ext2_write_inode(filesystem_wrap_stream(&context, file, superblock, block_group_descriptor_table), inode_num, inode_in);
 }
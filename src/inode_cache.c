@@ -0,0 +1,397 @@
+/**
+ * @file inode_cache.c
+ * @brief Implements the reference-counted, write-back inode cache with CLOCK eviction.
+ *
+ * The structure mirrors the block cache: inode numbers are spread over shards,
+ * entries are located through each shard's chained hash table, never-used
+ * entries are handed out first, and the shard's clock hand then sweeps its ring,
+ * skipping referenced-by-caller entries and giving recently used ones a second
+ * chance. A shard stays locked while one of its misses reads the inode table.
+ */
+
+#include "inode_cache.h"
+#include "inode.h"
+#include "cache_shard.h"
+#include "globals.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_ENTRY UINT32_MAX
+
+/**
+ * @brief Returns the shard responsible for an inode.
+ */
+static ext2_cache_shard *shard_of(
+    const ext2_inode_cache *cache,
+    const uint32_t inode_num
+) {
+    return &cache->shards[inode_num & (cache->shard_count - 1)];
+}
+
+/**
+ * @brief Maps an inode number to a hash chain of its shard using Fibonacci hashing.
+ */
+static uint32_t hash_inode(
+    const ext2_cache_shard *shard,
+    const uint32_t inode_num
+) {
+    return (uint32_t) (inode_num * 2654435761u) >> (32 - shard->hash_bits);
+}
+
+static uint32_t find_entry(
+    const ext2_inode_cache *cache,
+    const ext2_cache_shard *shard,
+    const uint32_t inode_num
+) {
+    uint32_t index = shard->hash_heads[hash_inode(shard, inode_num)];
+    while (index != NO_ENTRY) {
+        if (cache->entries[index].inode_num == inode_num) {
+            return index;
+        }
+        index = cache->entries[index].hash_next;
+    }
+    return NO_ENTRY;
+}
+
+static void hash_insert(
+    ext2_inode_cache *cache,
+    ext2_cache_shard *shard,
+    const uint32_t index
+) {
+    const uint32_t chain = hash_inode(shard, cache->entries[index].inode_num);
+    cache->entries[index].hash_next = shard->hash_heads[chain];
+    shard->hash_heads[chain] = index;
+}
+
+static void hash_remove(
+    ext2_inode_cache *cache,
+    ext2_cache_shard *shard,
+    const uint32_t index
+) {
+    uint32_t *link = &shard->hash_heads[hash_inode(shard, cache->entries[index].inode_num)];
+    while (*link != NO_ENTRY) {
+        if (*link == index) {
+            *link = cache->entries[index].hash_next;
+            return;
+        }
+        link = &cache->entries[*link].hash_next;
+    }
+}
+
+/**
+ * @brief Recovers the cache entry that holds an inode handed out by ext2_inode_get().
+ */
+static ext2_cached_inode *entry_of(ext2_inode *inode) {
+    return (ext2_cached_inode *) ((char *) inode - offsetof(ext2_cached_inode, inode));
+}
+
+/**
+ * @brief Tells whether an entry lives in the context's cache or is a private uncached copy.
+ */
+static int is_cached(const ext2_filesystem *fs, const ext2_cached_inode *entry) {
+    const ext2_inode_cache *cache = fs->icache;
+    return cache != NULL && entry >= cache->entries && entry < cache->entries + cache->capacity;
+}
+
+static int store_entry(
+    ext2_filesystem *fs,
+    ext2_cached_inode *entry
+) {
+    if (ext2_store_inode(fs, entry->inode_num, &entry->inode) != SUCCESS) {
+        log_error("Error (inode_cache): Writing back inode %u", entry->inode_num);
+        return IO_ERROR;
+    }
+
+    entry->dirty = 0;
+    if (fs->icache != NULL) {
+        EXT2_CACHE_COUNT(fs->icache->stats.writebacks);
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Picks an entry of a shard for a new inode, evicting an old one if necessary.
+ * @return Index of an unreferenced, unhashed entry, or NO_ENTRY if none is available.
+ */
+static uint32_t claim_entry(
+    ext2_filesystem *fs,
+    ext2_cache_shard *shard
+) {
+    ext2_inode_cache *cache = fs->icache;
+    if (shard->used < shard->capacity) {
+        return shard->first + shard->used++;
+    }
+
+    // Two full sweeps: the first may only clear reference bits.
+    for (uint32_t step = 0; step < 2 * shard->capacity; ++step) {
+        const uint32_t index = shard->first + shard->clock_hand;
+        ext2_cached_inode *entry = &cache->entries[index];
+        shard->clock_hand = (shard->clock_hand + 1) % shard->capacity;
+
+        if (entry->ref_count > 0) {
+            continue;
+        }
+        if (entry->referenced) {
+            entry->referenced = 0;
+            continue;
+        }
+        if (entry->valid) {
+            if (entry->dirty && store_entry(fs, entry) != SUCCESS) {
+                return NO_ENTRY;
+            }
+            hash_remove(cache, shard, index);
+            entry->valid = 0;
+            EXT2_CACHE_COUNT(cache->stats.evictions);
+        }
+        return index;
+    }
+
+    log_error("Error (inode_cache): All %u inodes of a shard are referenced.", shard->capacity);
+    return NO_ENTRY;
+}
+
+/**
+ * @brief Reads an inode into a private heap copy for contexts without a cache.
+ */
+static ext2_inode *get_uncached(
+    ext2_filesystem *fs,
+    const uint32_t inode_num
+) {
+    ext2_cached_inode *entry = calloc(1, sizeof(ext2_cached_inode));
+    if (entry == NULL) {
+        log_error("Error (inode_cache): Failed to allocate inode %u.", inode_num);
+        return NULL;
+    }
+
+    if (ext2_load_inode(fs, inode_num, &entry->inode) != SUCCESS) {
+        free(entry);
+        return NULL;
+    }
+
+    entry->inode_num = inode_num;
+    entry->ref_count = 1;
+    entry->valid = 1;
+    return &entry->inode;
+}
+
+ext2_inode_cache *inode_cache_create(const uint32_t capacity) {
+    if (capacity == 0) {
+        log_error("Error (inode_cache_create): Invalid parameters.\n");
+        return NULL;
+    }
+
+    ext2_inode_cache *cache = calloc(1, sizeof(ext2_inode_cache));
+    if (cache == NULL) {
+        log_error("Error (inode_cache_create): Failed to allocate cache.\n");
+        return NULL;
+    }
+
+    cache->capacity = capacity;
+
+    cache->shards = cache_shards_create(capacity, &cache->shard_count);
+    cache->entries = calloc(capacity, sizeof(ext2_cached_inode));
+    if (cache->shards == NULL || cache->entries == NULL) {
+        log_error("Error (inode_cache_create): Failed to allocate %u entries.\n", capacity);
+        cache_shards_destroy(cache->shards, cache->shard_count);
+        free(cache->entries);
+        free(cache);
+        return NULL;
+    }
+
+    for (uint32_t s = 0; s < cache->shard_count; ++s) {
+        const ext2_cache_shard *shard = &cache->shards[s];
+        for (uint32_t i = shard->first; i < shard->first + shard->capacity; ++i) {
+            cache->entries[i].hash_next = NO_ENTRY;
+            cache->entries[i].shard = s;
+        }
+    }
+
+    return cache;
+}
+
+void inode_cache_destroy(ext2_inode_cache *cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    cache_shards_destroy(cache->shards, cache->shard_count);
+    free(cache->entries);
+    free(cache);
+}
+
+ext2_inode *ext2_inode_get(
+    ext2_filesystem *fs,
+    const uint32_t inode_num
+) {
+    if (fs == NULL || inode_num == 0) {
+        return NULL;
+    }
+
+    ext2_inode_cache *cache = fs->icache;
+    if (cache == NULL) {
+        return get_uncached(fs, inode_num);
+    }
+
+    ext2_cache_shard *shard = shard_of(cache, inode_num);
+    pthread_mutex_lock(&shard->lock);
+
+    uint32_t index = find_entry(cache, shard, inode_num);
+    if (index != NO_ENTRY) {
+        ext2_cached_inode *entry = &cache->entries[index];
+        EXT2_CACHE_COUNT(cache->stats.hits);
+        entry->referenced = 1;
+        entry->ref_count++;
+        pthread_mutex_unlock(&shard->lock);
+        return &entry->inode;
+    }
+
+    EXT2_CACHE_COUNT(cache->stats.misses);
+    index = claim_entry(fs, shard);
+    if (index == NO_ENTRY) {
+        pthread_mutex_unlock(&shard->lock);
+        return NULL;
+    }
+
+    ext2_cached_inode *entry = &cache->entries[index];
+    if (ext2_load_inode(fs, inode_num, &entry->inode) != SUCCESS) {
+        pthread_mutex_unlock(&shard->lock);
+        return NULL;
+    }
+
+    entry->inode_num = inode_num;
+    entry->dirty = 0;
+    entry->referenced = 1;
+    entry->valid = 1;
+    entry->ref_count = 1;
+    hash_insert(cache, shard, index);
+    pthread_mutex_unlock(&shard->lock);
+    return &entry->inode;
+}
+
+int ext2_inode_peek(
+    ext2_filesystem *fs,
+    const uint32_t inode_num,
+    ext2_inode *inode_out
+) {
+    if (fs == NULL || fs->icache == NULL || inode_out == NULL) {
+        return 0;
+    }
+
+    ext2_inode_cache *cache = fs->icache;
+    ext2_cache_shard *shard = shard_of(cache, inode_num);
+    pthread_mutex_lock(&shard->lock);
+    const uint32_t index = find_entry(cache, shard, inode_num);
+    if (index != NO_ENTRY) {
+        *inode_out = cache->entries[index].inode;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return index != NO_ENTRY;
+}
+
+void ext2_inode_put(
+    ext2_filesystem *fs,
+    ext2_inode *inode
+) {
+    if (fs == NULL || inode == NULL) {
+        return;
+    }
+
+    ext2_cached_inode *entry = entry_of(inode);
+    if (is_cached(fs, entry)) {
+        ext2_cache_shard *shard = &fs->icache->shards[entry->shard];
+        pthread_mutex_lock(&shard->lock);
+        if (entry->ref_count > 0) {
+            entry->ref_count--;
+        }
+        pthread_mutex_unlock(&shard->lock);
+        return;
+    }
+
+    if (entry->dirty) {
+        store_entry(fs, entry);
+    }
+    free(entry);
+}
+
+void ext2_inode_mark_dirty(
+    ext2_filesystem *fs,
+    ext2_inode *inode
+) {
+    if (fs == NULL || inode == NULL) {
+        return;
+    }
+
+    ext2_cached_inode *entry = entry_of(inode);
+    if (!is_cached(fs, entry)) {
+        entry->dirty = 1;
+        return;
+    }
+
+    ext2_cache_shard *shard = &fs->icache->shards[entry->shard];
+    pthread_mutex_lock(&shard->lock);
+    entry->dirty = 1;
+    pthread_mutex_unlock(&shard->lock);
+}
+
+int ext2_flush_inodes(ext2_filesystem *fs) {
+    if (fs == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    ext2_inode_cache *cache = fs->icache;
+    if (cache == NULL) {
+        return SUCCESS;
+    }
+
+    int status = SUCCESS;
+    for (uint32_t s = 0; s < cache->shard_count; ++s) {
+        ext2_cache_shard *shard = &cache->shards[s];
+        pthread_mutex_lock(&shard->lock);
+        for (uint32_t i = shard->first; i < shard->first + shard->used; ++i) {
+            ext2_cached_inode *entry = &cache->entries[i];
+            if (entry->valid && entry->dirty && store_entry(fs, entry) != SUCCESS) {
+                status = IO_ERROR;
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return status;
+}
+
+int ext2_set_inode_cache_size(
+    ext2_filesystem *fs,
+    const uint32_t capacity
+) {
+    if (fs == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    ext2_inode_cache *old_cache = fs->icache;
+    if (old_cache != NULL) {
+        for (uint32_t i = 0; i < old_cache->capacity; ++i) {
+            if (old_cache->entries[i].ref_count > 0) {
+                log_error("Error (set_inode_cache_size): Inode %u is still referenced.",
+                        old_cache->entries[i].inode_num);
+                return ERROR;
+            }
+        }
+        if (ext2_flush_inodes(fs) != SUCCESS) {
+            return IO_ERROR;
+        }
+    }
+
+    ext2_inode_cache *new_cache = NULL;
+    if (capacity > 0) {
+        new_cache = inode_cache_create(capacity);
+        if (new_cache == NULL) {
+            return ERROR;
+        }
+    }
+
+    inode_cache_destroy(old_cache);
+    fs->icache = new_cache;
+    return SUCCESS;
+}
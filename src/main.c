@@ -1,8 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "superblock.h"
-#include "block_group.h"
+#include "filesystem.h"
 #include "directory.h"
 #include "globals.h"
 
@@ -10,17 +9,17 @@
 #define MAX_ARGS 10
 
 // Command handler for 'ls'
-void handle_ls(FILE *file, const ext2_super_block *superblock, const ext2_group_desc *bgdt, int argc, char *argv[]) {
+void handle_ls(ext2_filesystem *fs, int argc, char *argv[]) {
     const char *path = (argc > 1) ? argv[1] : "/";
     printf("Listing directory for path: %s\n", path);
-    const uint32_t inode_num = get_inode_for_path(file, superblock, bgdt, path);
+    const uint32_t inode_num = ext2_lookup(fs, path);
 
     if (inode_num == 0) {
         log_error("Could not find path: %s\n", path);
         return;
     }
 
-    list_directory_entries(file, superblock, bgdt, inode_num);
+    ext2_list_directory(fs, inode_num);
 }
 
 // Function to parse the command line input
@@ -41,24 +40,14 @@ int main(int argc, char *argv[]) {
 
     const char *filename = argv[1];
 
-    FILE *file = fopen(filename, "rb");
-    if (file == NULL) {
-        log_error("Error opening filesystem image: %s\n", filename);
-        return EXIT_FAILURE;
-    }
-
-    ext2_super_block *superblock = read_superblock(file);
-    if (superblock == NULL) {
-        log_error("Failed to read superblock from %s.\n", filename);
-        fclose(file);
-        return EXIT_FAILURE;
+    // The shell only inspects the image, so map it; fall back to pread() for
+    // devices that cannot be mapped.
+    ext2_filesystem *fs = filesystem_open(filename, EXT2_OPEN_MMAP);
+    if (fs == NULL) {
+        fs = filesystem_open(filename, 0);
     }
-
-    ext2_group_desc_table *gdt = read_group_descriptor_table(file, superblock);
-    if (gdt == NULL) {
-        log_error("Failed to read block group descriptors from %s.\n", filename);
-        free(superblock);
-        fclose(file);
+    if (fs == NULL) {
+        log_error("Failed to load filesystem from %s.\n", filename);
         return EXIT_FAILURE;
     }
 
@@ -84,7 +73,7 @@ int main(int argc, char *argv[]) {
         const char *command = cmd_argv[0];
 
         if (strcmp(command, "ls") == 0) {
-            handle_ls(file, superblock, gdt->groups, cmd_argc, cmd_argv);
+            handle_ls(fs, cmd_argc, cmd_argv);
         } else if (strcmp(command, "exit") == 0 || strcmp(command, "quit") == 0) {
             printf("Exiting shell.\n");
             break;
@@ -94,10 +83,7 @@ int main(int argc, char *argv[]) {
     }
 
     // Cleanup
-    free(gdt);
-    free(superblock);
-    fclose(file);
+    filesystem_free(fs);
 
     return EXIT_SUCCESS;
 }
-
@@ -7,32 +7,29 @@
  */
 
 #include "superblock.h"
+#include "block_device.h"
+#include "filesystem.h"
 #include "globals.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 
-ext2_super_block *read_superblock(
-    FILE *file
+ext2_super_block *ext2_read_superblock(
+    ext2_block_device *device
 ) {
-    if (file == NULL) {
-        log_error("Error: read_superblock received a NULL file pointer.\n");
+    if (device == NULL) {
+        log_error("Error: read_superblock received a NULL device.\n");
         return NULL;
     }
 
-    if (fseek(file, EXT2_SUPERBLOCK_OFFSET, SEEK_SET) != 0) {
-        log_error("Error seeking to superblock");
+    ext2_super_block *superblock = malloc(sizeof(ext2_super_block));
+    if (superblock == NULL) {
+        log_error("Error allocating memory for superblock.\n");
         return NULL;
     }
 
-    ext2_super_block *superblock = malloc(sizeof(ext2_super_block));
-
-    if (fread(superblock, sizeof(ext2_super_block), 1, file) != 1) {
-        if (feof(file)) {
-            log_error("Error reading superblock: unexpected end of file.\n");
-        } else if (ferror(file)) {
-            log_error("Error reading superblock");
-        }
+    if (block_device_read(device, EXT2_SUPERBLOCK_OFFSET, sizeof(ext2_super_block), superblock) != SUCCESS) {
+        log_error("Error reading superblock: unexpected end of file or I/O error.\n");
         free(superblock);
         return NULL;
     }
@@ -47,15 +44,48 @@ ext2_super_block *read_superblock(
     return superblock;
 }
 
-int write_superblock(
-    FILE *file,
-    const ext2_super_block *superblock
+ext2_super_block *ext2_map_superblock(
+    ext2_block_device *device
 ) {
-    if (file == NULL || superblock == NULL) {
+    // The mapping is PROT_READ; callers get a mutable pointer only to match ext2_filesystem.
+    ext2_super_block *superblock = (ext2_super_block *) block_device_map(device, EXT2_SUPERBLOCK_OFFSET,
+                                                                         sizeof(ext2_super_block));
+    if (superblock == NULL) {
+        log_error("Error mapping superblock: image too small or not mapped.\n");
+        return NULL;
+    }
+
+    if (superblock->s_magic != EXT2_SUPER_MAGIC) {
+        log_error("Error: Not an ext2 filesystem (magic number mismatch: expected 0x%X, got 0x%X)\n",
+                EXT2_SUPER_MAGIC, superblock->s_magic);
+        return NULL;
+    }
+
+    return superblock;
+}
+
+ext2_super_block *read_superblock(
+    FILE *file
+) {
+    if (file == NULL) {
+        log_error("Error: read_superblock received a NULL file pointer.\n");
+        return NULL;
+    }
+
+    ext2_block_device device;
+    block_device_init_stream(&device, file);
+    return ext2_read_superblock(&device);
+}
+
+int ext2_write_superblock(
+    ext2_filesystem *fs
+) {
+    if (fs == NULL || fs->superblock == NULL) {
         log_error("Error: write_superblock received a NULL pointer.\n");
         return INVALID_PARAMETER;
     }
 
+    const ext2_super_block *superblock = fs->superblock;
     if (superblock->s_magic != EXT2_SUPER_MAGIC) {
         log_error(
             "Error: write_superblock attempted to write an invalid superblock (magic number mismatch: expected 0x%X, got 0x%X).\n",
@@ -63,21 +93,68 @@ int write_superblock(
         return ERROR;
     }
 
-    if (fseek(file, EXT2_SUPERBLOCK_OFFSET, SEEK_SET) != 0) {
-        log_error("Error seeking to superblock for writing");
-        return ERROR;
+    if (filesystem_write(fs, EXT2_SUPERBLOCK_OFFSET, sizeof(ext2_super_block), superblock) != SUCCESS) {
+        log_error("Error writing superblock");
+        return IO_ERROR;
+    }
+
+    return SUCCESS;
+}
+
+void ext2_lock_superblock(
+    const ext2_filesystem *fs
+) {
+    if (fs != NULL && fs->locks != NULL) {
+        pthread_mutex_lock(&fs->locks->superblock);
+    }
+}
+
+void ext2_unlock_superblock(
+    const ext2_filesystem *fs
+) {
+    if (fs != NULL && fs->locks != NULL) {
+        pthread_mutex_unlock(&fs->locks->superblock);
+    }
+}
+
+void ext2_mark_superblock_dirty(
+    ext2_filesystem *fs
+) {
+    if (fs != NULL) {
+        fs->superblock_dirty = 1;
+    }
+}
+
+int ext2_flush_superblock(
+    ext2_filesystem *fs
+) {
+    if (fs == NULL) {
+        return SUCCESS;
     }
 
-    if (fwrite(superblock, sizeof(ext2_super_block), 1, file) != 1) {
-        if (ferror(file)) {
-            log_error("Error writing superblock");
-        } else {
-            log_error("Error writing superblock: fwrite did not write the expected number of items.\n");
+    ext2_lock_superblock(fs);
+    int status = SUCCESS;
+    if (fs->superblock_dirty) {
+        status = ext2_write_superblock(fs);
+        if (status == SUCCESS) {
+            fs->superblock_dirty = 0;
         }
-        return IO_ERROR;
     }
+    ext2_unlock_superblock(fs);
+    return status;
+}
 
-    return SUCCESS;
+int write_superblock(
+    FILE *file,
+    const ext2_super_block *superblock
+) {
+    if (file == NULL || superblock == NULL) {
+        log_error("Error: write_superblock received a NULL pointer.\n");
+        return INVALID_PARAMETER;
+    }
+
+    ext2_stream_context context;
+    return ext2_write_superblock(filesystem_wrap_stream(&context, file, superblock, NULL));
 }
 
 uint32_t get_block_size(const ext2_super_block *superblock) {
@@ -111,3 +188,14 @@ uint32_t get_block_group_count(const ext2_super_block *superblock) {
 
     return (blocks_count + blocks_per_group - 1) / blocks_per_group;
 }
+
+uint32_t get_inode_size(const ext2_super_block *superblock) {
+    if (superblock == NULL) {
+        return 0;
+    }
+
+    if (superblock->s_rev_level == EXT2_GOOD_OLD_REV) {
+        return EXT2_GOOD_OLD_INODE_SIZE;
+    }
+    return superblock->s_inode_size;
+}
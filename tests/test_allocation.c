@@ -4,8 +4,11 @@
 #include "block_group.h"
 #include "bitmap.h"
 #include "inode.h"
+#include "filesystem.h"
+#include "block_device.h"
 
 #include <check.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -139,6 +142,406 @@ START_TEST(allocate_inode_should_fail_when_no_inodes_are_available) {
 
 END_TEST
 
+START_TEST(ext2_allocate_block_should_defer_bitmap_writes_until_sync) {
+    // Arrange
+    ext2_filesystem *fs = filesystem_init_device(block_device_from_stream(fs_image, 0), 0);
+    ck_assert_ptr_nonnull(fs);
+    uint32_t block_nums[3];
+    uint8_t on_disk[1024];
+
+    // Act
+    for (int i = 0; i < 3; ++i) {
+        ck_assert_int_eq(ext2_allocate_block(fs, &block_nums[i]), SUCCESS);
+    }
+    read_bitmap(fs_image, sb, bgdt->groups[0].bg_block_bitmap, on_disk);
+    const uint8_t before_sync = on_disk[0];
+    const int sync_result = filesystem_sync(fs);
+    read_bitmap(fs_image, sb, bgdt->groups[0].bg_block_bitmap, on_disk);
+
+    // Assert
+    ck_assert_uint_eq(block_nums[0], 1);
+    ck_assert_uint_eq(block_nums[2], 3);
+    ck_assert_uint_eq(before_sync, 0x00);
+    ck_assert_int_eq(sync_result, SUCCESS);
+    ck_assert_uint_eq(on_disk[0], 0x07);
+
+    // Cleanup (the device does not own fs_image)
+    filesystem_free(fs);
+}
+
+END_TEST
+
+START_TEST(ext2_allocate_inode_should_defer_descriptor_writes_until_sync) {
+    // Arrange
+    ext2_filesystem *fs = filesystem_init_device(block_device_from_stream(fs_image, 0), 0);
+    ck_assert_ptr_nonnull(fs);
+    uint32_t new_inode_num;
+
+    // Act
+    ck_assert_int_eq(ext2_allocate_inode(fs, &new_inode_num), SUCCESS);
+    ck_assert_int_eq(ext2_allocate_inode(fs, &new_inode_num), SUCCESS);
+    ext2_group_desc *before_sync = read_group_descriptor(fs_image, sb, 0);
+    ext2_super_block *sb_before_sync = read_superblock(fs_image);
+    const int sync_result = filesystem_sync(fs);
+    ext2_group_desc *after_sync = read_group_descriptor(fs_image, sb, 0);
+    ext2_super_block *sb_after_sync = read_superblock(fs_image);
+
+    // Assert
+    ck_assert_int_eq(sync_result, SUCCESS);
+    ck_assert_uint_eq(before_sync->bg_free_inodes_count, 16);
+    ck_assert_uint_eq(sb_before_sync->s_free_inodes_count, 32);
+    ck_assert_uint_eq(after_sync->bg_free_inodes_count, 14);
+    ck_assert_uint_eq(sb_after_sync->s_free_inodes_count, 30);
+
+    // Cleanup
+    free(before_sync);
+    free(after_sync);
+    free(sb_before_sync);
+    free(sb_after_sync);
+    filesystem_free(fs);
+}
+
+END_TEST
+
+START_TEST(ext2_allocate_block_near_should_prefer_the_goal_and_its_neighbours) {
+    // Arrange
+    ext2_filesystem *fs = filesystem_init_device(block_device_from_stream(fs_image, 0), 0);
+    ck_assert_ptr_nonnull(fs);
+    uint32_t first;
+    uint32_t second;
+
+    // Act
+    const int first_result = ext2_allocate_block_near(fs, 20, &first);
+    const int second_result = ext2_allocate_block_near(fs, 20, &second);
+
+    // Assert
+    ck_assert_int_eq(first_result, SUCCESS);
+    ck_assert_int_eq(second_result, SUCCESS);
+    ck_assert_uint_eq(first, 20);
+    ck_assert_uint_eq(second, 21);
+    ck_assert_uint_eq(fs->bgdt->groups[1].bg_free_blocks_count, 14);
+
+    // Cleanup
+    filesystem_free(fs);
+}
+
+END_TEST
+
+START_TEST(ext2_allocate_block_near_should_fall_back_to_a_nearby_group) {
+    // Arrange
+    ext2_filesystem *fs = filesystem_init_device(block_device_from_stream(fs_image, 0), 0);
+    ck_assert_ptr_nonnull(fs);
+    fs->bgdt->groups[1].bg_free_blocks_count = 0;
+    uint32_t block_num;
+
+    // Act
+    const int result = ext2_allocate_block_near(fs, 20, &block_num);
+
+    // Assert
+    ck_assert_int_eq(result, SUCCESS);
+    ck_assert_uint_eq(block_num, 1);
+    ck_assert_uint_eq(ext2_inode_block_goal(fs, 17), 17);
+
+    // Cleanup
+    filesystem_free(fs);
+}
+
+END_TEST
+
+START_TEST(ext2_allocate_block_near_should_return_to_a_group_once_blocks_are_freed) {
+    // Arrange: group 0 claims to be full
+    ext2_filesystem *fs = filesystem_init_device(block_device_from_stream(fs_image, 0), 0);
+    ck_assert_ptr_nonnull(fs);
+    fs->bgdt->groups[0].bg_free_blocks_count = 0;
+    set_bit(ext2_get_group_bitmap(fs, 0, EXT2_BLOCK_BITMAP), 4); // Block 5 is taken
+    uint32_t elsewhere;
+    ck_assert_int_eq(ext2_allocate_block_near(fs, 2, &elsewhere), SUCCESS);
+    const ext2_block_extent freed = {.start = 5, .length = 1};
+    uint32_t block_num;
+
+    // Act
+    ck_assert_int_eq(ext2_free_blocks(fs, &freed, 1), SUCCESS);
+    const int result = ext2_allocate_block_near(fs, 2, &block_num);
+
+    // Assert
+    ck_assert_uint_eq(elsewhere, 17);
+    ck_assert_int_eq(result, SUCCESS);
+    ck_assert_uint_eq(block_num, 2);
+    ck_assert_uint_eq(fs->bgdt->groups[0].bg_free_blocks_count, 0);
+
+    // Cleanup
+    filesystem_free(fs);
+}
+
+END_TEST
+
+START_TEST(ext2_allocate_inode_for_should_spread_top_level_directories) {
+    // Arrange
+    ext2_filesystem *fs = filesystem_init_device(block_device_from_stream(fs_image, 0), 0);
+    ck_assert_ptr_nonnull(fs);
+    uint32_t first_dir;
+    uint32_t second_dir;
+    uint32_t file_in_second_dir;
+
+    // Act
+    ck_assert_int_eq(ext2_allocate_inode_for(fs, EXT2_ROOT_INO, 1, &first_dir), SUCCESS);
+    ck_assert_int_eq(ext2_allocate_inode_for(fs, EXT2_ROOT_INO, 1, &second_dir), SUCCESS);
+    ck_assert_int_eq(ext2_allocate_inode_for(fs, second_dir, 0, &file_in_second_dir), SUCCESS);
+
+    // Assert
+    ck_assert_uint_eq(first_dir, 1);
+    ck_assert_uint_eq(second_dir, 17);
+    ck_assert_uint_eq(file_in_second_dir, 18);
+    ck_assert_uint_eq(fs->bgdt->groups[0].bg_used_dirs_count, 1);
+    ck_assert_uint_eq(fs->bgdt->groups[1].bg_used_dirs_count, 1);
+
+    // Cleanup
+    filesystem_free(fs);
+}
+
+END_TEST
+
+START_TEST(ext2_allocate_inode_for_should_keep_subdirectories_near_their_parent) {
+    // Arrange: a top-level directory in each group, and group 0 a little below average on free inodes
+    ext2_filesystem *fs = filesystem_init_device(block_device_from_stream(fs_image, 0), 0);
+    ck_assert_ptr_nonnull(fs);
+    uint32_t parent_dir;
+    uint32_t other_dir;
+    uint32_t file;
+    ck_assert_int_eq(ext2_allocate_inode_for(fs, EXT2_ROOT_INO, 1, &parent_dir), SUCCESS);
+    ck_assert_int_eq(ext2_allocate_inode_for(fs, EXT2_ROOT_INO, 1, &other_dir), SUCCESS);
+    ck_assert_int_eq(ext2_allocate_inode_for(fs, parent_dir, 0, &file), SUCCESS);
+    ck_assert_int_eq(ext2_allocate_inode_for(fs, parent_dir, 0, &file), SUCCESS);
+    ck_assert_uint_eq(parent_dir, 1);
+    ck_assert_uint_eq(other_dir, 17);
+    uint32_t child_dir;
+
+    // Act
+    const int result = ext2_allocate_inode_for(fs, parent_dir, 1, &child_dir);
+
+    // Assert: the parent is not the root, so its group is kept
+    ck_assert_int_eq(result, SUCCESS);
+    ck_assert_uint_eq(child_dir, 4);
+    ck_assert_uint_eq(fs->bgdt->groups[0].bg_used_dirs_count, 2);
+    ck_assert_uint_eq(fs->bgdt->groups[1].bg_used_dirs_count, 1);
+
+    // Cleanup
+    filesystem_free(fs);
+}
+
+END_TEST
+
+START_TEST(ext2_allocate_inode_for_should_fill_groups_in_order_with_linear_policy) {
+    // Arrange
+    ext2_filesystem *fs = filesystem_init_device(block_device_from_stream(fs_image, 0), 0);
+    ck_assert_ptr_nonnull(fs);
+    fs->inode_policy = EXT2_INODE_ALLOC_LINEAR;
+    uint32_t first_dir;
+    uint32_t second_dir;
+
+    // Act
+    ck_assert_int_eq(ext2_allocate_inode_for(fs, EXT2_ROOT_INO, 1, &first_dir), SUCCESS);
+    ck_assert_int_eq(ext2_allocate_inode_for(fs, EXT2_ROOT_INO, 1, &second_dir), SUCCESS);
+
+    // Assert
+    ck_assert_uint_eq(first_dir, 1);
+    ck_assert_uint_eq(second_dir, 2);
+    ck_assert_uint_eq(fs->bgdt->groups[0].bg_used_dirs_count, 2);
+
+    // Cleanup
+    filesystem_free(fs);
+}
+
+END_TEST
+
+START_TEST(ext2_free_blocks_should_not_count_blocks_that_are_already_free) {
+    // Arrange: blocks 14-19 in use, straddling groups 0 and 1
+    ext2_filesystem *fs = filesystem_init_device(block_device_from_stream(fs_image, 0), 0);
+    ck_assert_ptr_nonnull(fs);
+    set_bit_range(ext2_get_group_bitmap(fs, 0, EXT2_BLOCK_BITMAP), 13, 3);
+    set_bit_range(ext2_get_group_bitmap(fs, 1, EXT2_BLOCK_BITMAP), 0, 3);
+    fs->bgdt->groups[0].bg_free_blocks_count = 13;
+    fs->bgdt->groups[1].bg_free_blocks_count = 13;
+    fs->superblock->s_free_blocks_count = 26;
+    const ext2_block_extent freed = {.start = 15, .length = 4};
+
+    // Act
+    const int first = ext2_free_blocks(fs, &freed, 1);
+    const int second = ext2_free_blocks(fs, &freed, 1);
+
+    // Assert: the second call finds nothing to return
+    ck_assert_int_eq(first, SUCCESS);
+    ck_assert_int_eq(second, SUCCESS);
+    ck_assert_uint_eq(fs->bgdt->groups[0].bg_free_blocks_count, 15);
+    ck_assert_uint_eq(fs->bgdt->groups[1].bg_free_blocks_count, 15);
+    ck_assert_uint_eq(fs->superblock->s_free_blocks_count, 30);
+
+    // Cleanup
+    filesystem_free(fs);
+}
+
+END_TEST
+
+START_TEST(ext2_allocate_blocks_should_return_contiguous_extents) {
+    // Arrange
+    ext2_filesystem *fs = filesystem_init_device(block_device_from_stream(fs_image, 0), 0);
+    ck_assert_ptr_nonnull(fs);
+    set_bit(ext2_get_group_bitmap(fs, 0, EXT2_BLOCK_BITMAP), 4); // Block 5 is taken
+    ext2_block_extent extents[8];
+    uint32_t extent_count;
+
+    // Act
+    const int result = ext2_allocate_blocks(fs, 1, 20, extents, 8, &extent_count);
+
+    // Assert
+    ck_assert_int_eq(result, SUCCESS);
+    ck_assert_uint_eq(extent_count, 3);
+    ck_assert_uint_eq(extents[0].start, 1);
+    ck_assert_uint_eq(extents[0].length, 4);
+    ck_assert_uint_eq(extents[1].start, 6);
+    ck_assert_uint_eq(extents[1].length, 11);
+    ck_assert_uint_eq(extents[2].start, 17);
+    ck_assert_uint_eq(extents[2].length, 5);
+    ck_assert_uint_eq(fs->bgdt->groups[0].bg_free_blocks_count, 1);
+    ck_assert_uint_eq(fs->bgdt->groups[1].bg_free_blocks_count, 11);
+    ck_assert_uint_eq(fs->superblock->s_free_blocks_count, 12);
+
+    // Cleanup
+    filesystem_free(fs);
+}
+
+END_TEST
+
+START_TEST(ext2_allocate_blocks_should_undo_a_batch_that_does_not_fit) {
+    // Arrange
+    ext2_filesystem *fs = filesystem_init_device(block_device_from_stream(fs_image, 0), 0);
+    ck_assert_ptr_nonnull(fs);
+    set_bit(ext2_get_group_bitmap(fs, 0, EXT2_BLOCK_BITMAP), 4);
+    ext2_block_extent extents[2];
+    uint32_t extent_count = 99;
+
+    // Act
+    const int too_many_extents = ext2_allocate_blocks(fs, 1, 20, extents, 2, &extent_count);
+    const int too_many_blocks = ext2_allocate_blocks(fs, 1, 40, extents, 2, &extent_count);
+
+    // Assert
+    ck_assert_int_eq(too_many_extents, ERROR);
+    ck_assert_int_eq(too_many_blocks, ERROR);
+    ck_assert_uint_eq(extent_count, 0);
+    ck_assert_uint_eq(fs->bgdt->groups[0].bg_free_blocks_count, 16);
+    ck_assert_uint_eq(fs->superblock->s_free_blocks_count, 32);
+    ck_assert_uint_eq(ext2_get_group_bitmap(fs, 0, EXT2_BLOCK_BITMAP)[0], 0x10);
+
+    // Cleanup
+    filesystem_free(fs);
+}
+
+END_TEST
+
+START_TEST(ext2_allocate_inodes_should_fill_the_hinted_group_first) {
+    // Arrange
+    ext2_filesystem *fs = filesystem_init_device(block_device_from_stream(fs_image, 0), 0);
+    ck_assert_ptr_nonnull(fs);
+    uint32_t inodes[20];
+
+    // Act
+    const int result = ext2_allocate_inodes(fs, 1, 20, inodes);
+
+    // Assert
+    ck_assert_int_eq(result, SUCCESS);
+    ck_assert_uint_eq(inodes[0], 17);
+    ck_assert_uint_eq(inodes[15], 32);
+    ck_assert_uint_eq(inodes[16], 1);
+    ck_assert_uint_eq(inodes[19], 4);
+    ck_assert_uint_eq(fs->bgdt->groups[0].bg_free_inodes_count, 12);
+    ck_assert_uint_eq(fs->bgdt->groups[1].bg_free_inodes_count, 0);
+    ck_assert_uint_eq(fs->superblock->s_free_inodes_count, 12);
+
+    // Cleanup
+    filesystem_free(fs);
+}
+
+END_TEST
+
+#define ALLOCATING_THREADS 4
+#define BLOCKS_PER_THREAD 7
+
+typedef struct {
+    ext2_filesystem *fs;
+    uint32_t goal;
+    uint32_t blocks[BLOCKS_PER_THREAD];
+    int result;
+} allocating_thread;
+
+static void *allocate_blocks_near_goal(void *arg) {
+    allocating_thread *thread = arg;
+    thread->result = SUCCESS;
+    for (uint32_t i = 0; i < BLOCKS_PER_THREAD && thread->result == SUCCESS; ++i) {
+        thread->result = ext2_allocate_block_near(thread->fs, thread->goal, &thread->blocks[i]);
+    }
+    return NULL;
+}
+
+START_TEST(ext2_allocate_block_near_should_hand_out_each_block_once_across_threads) {
+    // Arrange
+    ext2_filesystem *fs = filesystem_init_device(block_device_from_stream(fs_image, 0), 0);
+    ck_assert_ptr_nonnull(fs);
+    allocating_thread threads[ALLOCATING_THREADS];
+    pthread_t ids[ALLOCATING_THREADS];
+
+    // Act: two threads per group, together asking for all but a few blocks
+    for (uint32_t t = 0; t < ALLOCATING_THREADS; ++t) {
+        threads[t] = (allocating_thread) {.fs = fs, .goal = t % 2 == 0 ? 1 : 17};
+        ck_assert_int_eq(pthread_create(&ids[t], NULL, allocate_blocks_near_goal, &threads[t]), 0);
+    }
+    for (uint32_t t = 0; t < ALLOCATING_THREADS; ++t) {
+        pthread_join(ids[t], NULL);
+    }
+
+    // Assert
+    uint8_t seen[33] = {0};
+    for (uint32_t t = 0; t < ALLOCATING_THREADS; ++t) {
+        ck_assert_int_eq(threads[t].result, SUCCESS);
+        for (uint32_t i = 0; i < BLOCKS_PER_THREAD; ++i) {
+            const uint32_t block = threads[t].blocks[i];
+            ck_assert_uint_ge(block, 1);
+            ck_assert_uint_le(block, 32);
+            ck_assert_uint_eq(seen[block], 0);
+            seen[block] = 1;
+        }
+    }
+    const uint32_t allocated = ALLOCATING_THREADS * BLOCKS_PER_THREAD;
+    ck_assert_uint_eq(fs->bgdt->groups[0].bg_free_blocks_count + fs->bgdt->groups[1].bg_free_blocks_count,
+                      32 - allocated);
+    ck_assert_uint_eq(fs->superblock->s_free_blocks_count, 32 - allocated);
+
+    // Cleanup
+    filesystem_free(fs);
+}
+
+END_TEST
+
+START_TEST(ext2_load_group_bitmaps_should_load_every_group_in_one_batch) {
+    // Arrange
+    ext2_filesystem *fs = filesystem_init_device(block_device_from_stream(fs_image, 0), 16);
+    ck_assert_ptr_nonnull(fs);
+
+    // Act
+    const int result = ext2_load_group_bitmaps(fs, EXT2_INODE_BITMAP);
+
+    // Assert
+    ck_assert_int_eq(result, SUCCESS);
+    ck_assert_uint_eq(fs->cache->stats.prefetched, 2);
+    ck_assert_ptr_nonnull(fs->bitmaps[0].inode_bitmap);
+    ck_assert_ptr_nonnull(fs->bitmaps[1].inode_bitmap);
+    ck_assert_ptr_null(fs->bitmaps[0].block_bitmap);
+
+    // Cleanup
+    filesystem_free(fs);
+}
+
+END_TEST
+
 Suite *allocation_suite(void) {
     Suite *s = suite_create("Allocation");
     TCase *tc_core = tcase_create("Core");
@@ -147,6 +550,20 @@ Suite *allocation_suite(void) {
     tcase_add_test(tc_core, allocate_inode_should_succeed_when_inodes_are_available);
     tcase_add_test(tc_core, allocate_block_should_succeed_when_blocks_are_available);
     tcase_add_test(tc_core, allocate_inode_should_fail_when_no_inodes_are_available);
+    tcase_add_test(tc_core, ext2_allocate_block_should_defer_bitmap_writes_until_sync);
+    tcase_add_test(tc_core, ext2_allocate_inode_should_defer_descriptor_writes_until_sync);
+    tcase_add_test(tc_core, ext2_allocate_block_near_should_prefer_the_goal_and_its_neighbours);
+    tcase_add_test(tc_core, ext2_allocate_block_near_should_fall_back_to_a_nearby_group);
+    tcase_add_test(tc_core, ext2_allocate_block_near_should_return_to_a_group_once_blocks_are_freed);
+    tcase_add_test(tc_core, ext2_allocate_inode_for_should_spread_top_level_directories);
+    tcase_add_test(tc_core, ext2_allocate_inode_for_should_keep_subdirectories_near_their_parent);
+    tcase_add_test(tc_core, ext2_allocate_inode_for_should_fill_groups_in_order_with_linear_policy);
+    tcase_add_test(tc_core, ext2_free_blocks_should_not_count_blocks_that_are_already_free);
+    tcase_add_test(tc_core, ext2_allocate_blocks_should_return_contiguous_extents);
+    tcase_add_test(tc_core, ext2_allocate_blocks_should_undo_a_batch_that_does_not_fit);
+    tcase_add_test(tc_core, ext2_allocate_inodes_should_fill_the_hinted_group_first);
+    tcase_add_test(tc_core, ext2_allocate_block_near_should_hand_out_each_block_once_across_threads);
+    tcase_add_test(tc_core, ext2_load_group_bitmaps_should_load_every_group_in_one_batch);
 
     suite_add_tcase(s, tc_core);
     return s;
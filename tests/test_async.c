@@ -0,0 +1,262 @@
+#include "async.h"
+#include "globals.h"
+#include "superblock.h"
+#include "block_group.h"
+#include "inode.h"
+#include "filesystem.h"
+#include "block_device.h"
+
+#include <check.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_SIZE 1024
+#define IMAGE_BLOCKS 64
+#define ROOT_BLOCK 7
+#define SUB_BLOCK 8
+#define FILE_INODE 12
+#define SUB_INODE 13
+#define IN_FLIGHT 1000
+
+// Mock data
+static ext2_super_block *sb;
+static ext2_group_desc group;
+static FILE *fs_image;
+static ext2_filesystem *fs;
+
+static void write_entry(
+    uint8_t *block,
+    const uint32_t offset,
+    const uint32_t inode_num,
+    const uint16_t rec_len,
+    const uint8_t file_type,
+    const char *name
+) {
+    ext2_directory_entry *entry = (ext2_directory_entry *) (block + offset);
+    entry->inode = inode_num;
+    entry->rec_len = rec_len;
+    entry->name_len = (uint8_t) strlen(name);
+    entry->file_type = file_type;
+    memcpy(entry->name, name, strlen(name));
+}
+
+static void write_directory(const uint32_t inode_num, const uint32_t parent, const uint32_t block_id,
+                            const uint32_t child, const uint8_t child_type, const char *child_name) {
+    ext2_inode dir = {0};
+    dir.i_mode = EXT2_S_IFDIR | 0755;
+    dir.i_links_count = 2;
+    dir.i_size = BLOCK_SIZE;
+    dir.i_blocks = BLOCK_SIZE / 512;
+    dir.i_block[0] = block_id;
+    ck_assert_int_eq(write_inode(fs_image, sb, &group, inode_num, &dir), SUCCESS);
+
+    uint8_t block[BLOCK_SIZE] = {0};
+    write_entry(block, 0, inode_num, 12, EXT2_FT_DIR, ".");
+    write_entry(block, 12, parent, 12, EXT2_FT_DIR, "..");
+    write_entry(block, 24, child, 16, child_type, child_name);
+    write_entry(block, 40, SUB_INODE, BLOCK_SIZE - 40, EXT2_FT_DIR, inode_num == EXT2_ROOT_INO ? "sub" : "self");
+    fseek(fs_image, (long) block_id * BLOCK_SIZE, SEEK_SET);
+    fwrite(block, 1, BLOCK_SIZE, fs_image);
+}
+
+// A single group: the root directory (block 7) holds "file" (inode 12) and
+// "sub" (inode 13, block 8), which holds "inner" (inode 12 again) and "self".
+void setup(void) {
+    sb = calloc(1, sizeof(ext2_super_block));
+    ck_assert_ptr_nonnull(sb);
+    sb->s_magic = EXT2_SUPER_MAGIC;
+    sb->s_inodes_count = 16;
+    sb->s_blocks_count = IMAGE_BLOCKS;
+    sb->s_inodes_per_group = 16;
+    sb->s_blocks_per_group = IMAGE_BLOCKS;
+    sb->s_inode_size = sizeof(ext2_inode);
+    sb->s_first_data_block = 1;
+    memset(&group, 0, sizeof(group));
+    group.bg_block_bitmap = 3;
+    group.bg_inode_bitmap = 4;
+    group.bg_inode_table = 5;
+
+    fs_image = tmpfile();
+    ck_assert_ptr_nonnull(fs_image);
+    static const uint8_t zero_block[BLOCK_SIZE];
+    for (int i = 0; i < IMAGE_BLOCKS; ++i) {
+        fwrite(zero_block, 1, BLOCK_SIZE, fs_image);
+    }
+    write_superblock(fs_image, sb);
+    write_group_descriptor(fs_image, sb, 0, &group);
+
+    ext2_inode file = {0};
+    file.i_mode = EXT2_S_IFREG | 0644;
+    file.i_links_count = 2;
+    file.i_size = 1234;
+    ck_assert_int_eq(write_inode(fs_image, sb, &group, FILE_INODE, &file), SUCCESS);
+    write_directory(EXT2_ROOT_INO, EXT2_ROOT_INO, ROOT_BLOCK, FILE_INODE, EXT2_FT_REG_FILE, "file");
+    write_directory(SUB_INODE, EXT2_ROOT_INO, SUB_BLOCK, FILE_INODE, EXT2_FT_REG_FILE, "inner");
+    fflush(fs_image);
+
+    fs = filesystem_init_device(block_device_from_stream(fs_image, 0), 16);
+    ck_assert_ptr_nonnull(fs);
+}
+
+void teardown(void) {
+    filesystem_free(fs);
+    free(sb);
+    fclose(fs_image);
+}
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    ext2_async_op *op;
+} callback_result;
+
+static void keep_op(ext2_async_op *op, void *user_data) {
+    callback_result *result = user_data;
+    pthread_mutex_lock(&result->lock);
+    result->op = op;
+    pthread_cond_signal(&result->done);
+    pthread_mutex_unlock(&result->lock);
+}
+
+START_TEST(ext2_lookup_async_should_resolve_paths)
+{
+    // Arrange
+    ext2_async *engine = ext2_async_create(fs, 2);
+    ck_assert_ptr_nonnull(engine);
+
+    // Act
+    ext2_async_op *found = ext2_lookup_async(engine, "/sub/inner", NULL, NULL);
+    ext2_async_op *missing = ext2_lookup_async(engine, "/sub/missing", NULL, NULL);
+    ck_assert_ptr_nonnull(found);
+    ck_assert_ptr_nonnull(missing);
+
+    // Assert
+    ck_assert_int_eq(ext2_async_wait(found), SUCCESS);
+    ck_assert_uint_eq(found->inode_num, FILE_INODE);
+    ck_assert_int_eq(ext2_async_wait(missing), ERROR);
+    ck_assert_uint_eq(missing->inode_num, 0);
+    ck_assert_int_eq(ext2_async_poll(found), 1);
+
+    // Cleanup
+    ext2_async_op_free(found);
+    ext2_async_op_free(missing);
+    ext2_async_destroy(engine);
+}
+END_TEST
+
+START_TEST(ext2_read_inode_async_should_hand_the_inode_to_the_callback)
+{
+    // Arrange
+    ext2_async *engine = ext2_async_create(fs, 1);
+    ck_assert_ptr_nonnull(engine);
+    callback_result result = {.op = NULL};
+    pthread_mutex_init(&result.lock, NULL);
+    pthread_cond_init(&result.done, NULL);
+
+    // Act
+    ck_assert_ptr_nonnull(ext2_read_inode_async(engine, FILE_INODE, keep_op, &result));
+    pthread_mutex_lock(&result.lock);
+    while (result.op == NULL) {
+        pthread_cond_wait(&result.done, &result.lock);
+    }
+    pthread_mutex_unlock(&result.lock);
+
+    // Assert
+    ck_assert_int_eq(result.op->status, SUCCESS);
+    ck_assert_uint_eq(result.op->inode_num, FILE_INODE);
+    ck_assert_uint_eq(result.op->inode.i_size, 1234);
+    ck_assert_uint_eq(result.op->inode.i_mode & EXT2_S_IFMT, EXT2_S_IFREG);
+
+    // Cleanup
+    ext2_async_op_free(result.op);
+    ext2_async_destroy(engine);
+    pthread_cond_destroy(&result.done);
+    pthread_mutex_destroy(&result.lock);
+}
+END_TEST
+
+START_TEST(ext2_readdir_async_should_copy_the_entries)
+{
+    // Arrange
+    ext2_async *engine = ext2_async_create(fs, 1);
+    ck_assert_ptr_nonnull(engine);
+
+    // Act
+    ext2_async_op *op = ext2_readdir_async(engine, SUB_INODE, NULL, NULL);
+    ck_assert_ptr_nonnull(op);
+    const int status = ext2_async_wait(op);
+
+    // Assert
+    ck_assert_int_eq(status, SUCCESS);
+    ck_assert_uint_eq(op->entry_count, 4);
+    ck_assert_str_eq(op->entries[0].name, ".");
+    ck_assert_str_eq(op->entries[1].name, "..");
+    ck_assert_str_eq(op->entries[2].name, "inner");
+    ck_assert_uint_eq(op->entries[2].inode, FILE_INODE);
+    ck_assert_uint_eq(op->entries[2].name_len, 5);
+    ck_assert_uint_eq(op->entries[2].file_type, EXT2_FT_REG_FILE);
+    ck_assert_str_eq(op->entries[3].name, "self");
+
+    // Cleanup
+    ext2_async_op_free(op);
+    ext2_async_destroy(engine);
+}
+END_TEST
+
+START_TEST(ext2_async_destroy_should_complete_every_queued_operation)
+{
+    // Arrange
+    ext2_async *engine = ext2_async_create(fs, 2);
+    ck_assert_ptr_nonnull(engine);
+    ext2_async_op **ops = calloc(IN_FLIGHT, sizeof(ext2_async_op *));
+    ck_assert_ptr_nonnull(ops);
+
+    // Act
+    for (uint32_t i = 0; i < IN_FLIGHT; ++i) {
+        ops[i] = i % 2 == 0 ? ext2_lookup_async(engine, "/sub/inner", NULL, NULL)
+                            : ext2_readdir_async(engine, EXT2_ROOT_INO, NULL, NULL);
+        ck_assert_ptr_nonnull(ops[i]);
+    }
+    ext2_async_destroy(engine);
+
+    // Assert
+    for (uint32_t i = 0; i < IN_FLIGHT; ++i) {
+        ck_assert_int_eq(ext2_async_poll(ops[i]), 1);
+        ck_assert_int_eq(ext2_async_wait(ops[i]), SUCCESS);
+        if (i % 2 == 0) {
+            ck_assert_uint_eq(ops[i]->inode_num, FILE_INODE);
+        } else {
+            ck_assert_uint_eq(ops[i]->entry_count, 4);
+        }
+        ext2_async_op_free(ops[i]);
+    }
+
+    // Cleanup
+    free(ops);
+}
+END_TEST
+
+Suite *async_suite(void) {
+    Suite *s = suite_create("Async");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, ext2_lookup_async_should_resolve_paths);
+    tcase_add_test(tc_core, ext2_read_inode_async_should_hand_the_inode_to_the_callback);
+    tcase_add_test(tc_core, ext2_readdir_async_should_copy_the_entries);
+    tcase_add_test(tc_core, ext2_async_destroy_should_complete_every_queued_operation);
+
+    suite_add_tcase(s, tc_core);
+    return s;
+}
+
+int main(void) {
+    Suite *s = async_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    const int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -24,8 +24,18 @@ void setup(void) {
 void teardown(void) {
     free(bitmap_buffer);
     free(sb);
+    set_bitmap_scanner(EXT2_BITMAP_SCAN_AUTO);
 }
 
+/**
+ * Loop tests run once per scanner; `_i` is the ext2_bitmap_scanner under test.
+ * Scanners this CPU cannot run pass trivially.
+ */
+#define SCANNER_LOOP_START EXT2_BITMAP_SCAN_BYTEWISE
+#define SCANNER_LOOP_END (EXT2_BITMAP_SCAN_AVX2 + 1)
+#define USE_SCANNER_OR_SKIP(scanner) \
+    do { if (set_bitmap_scanner((ext2_bitmap_scanner) (scanner)) != SUCCESS) return; } while (0)
+
 START_TEST(set_bit_should_set_the_correct_bit)
 {
     // Act
@@ -52,6 +62,7 @@ END_TEST
 START_TEST(find_first_free_bit_should_find_the_correct_bit)
 {
     // Arrange
+    USE_SCANNER_OR_SKIP(_i);
     set_bit(bitmap_buffer, 0);
     set_bit(bitmap_buffer, 1);
 
@@ -68,6 +79,7 @@ END_TEST
 START_TEST(find_first_free_bit_should_return_error_when_bitmap_is_full)
 {
     // Arrange
+    USE_SCANNER_OR_SKIP(_i);
     memset(bitmap_buffer, 0xFF, BITMAP_SIZE);
 
     // Act
@@ -79,6 +91,179 @@ START_TEST(find_first_free_bit_should_return_error_when_bitmap_is_full)
 }
 END_TEST
 
+START_TEST(find_first_free_bit_should_skip_long_allocated_runs)
+{
+    // Arrange
+    USE_SCANNER_OR_SKIP(_i);
+    memset(bitmap_buffer, 0xFF, BITMAP_SIZE);
+    clear_bit(bitmap_buffer, 5000);
+    clear_bit(bitmap_buffer, 7000);
+
+    // Act
+    uint32_t free_bit_index;
+    int result = find_first_free_bit(bitmap_buffer, BITMAP_SIZE * 8, &free_bit_index);
+
+    // Assert
+    ck_assert_int_eq(result, SUCCESS);
+    ck_assert_uint_eq(free_bit_index, 5000);
+}
+END_TEST
+
+START_TEST(find_first_free_bit_should_ignore_bits_past_the_end)
+{
+    // Arrange
+    USE_SCANNER_OR_SKIP(_i);
+    memset(bitmap_buffer, 0xFF, BITMAP_SIZE);
+    clear_bit(bitmap_buffer, 1003);
+    uint32_t free_bit_index;
+
+    // Act
+    int before_end = find_first_free_bit(bitmap_buffer, 1004, &free_bit_index);
+    int past_end = find_first_free_bit(bitmap_buffer, 1003, &free_bit_index);
+
+    // Assert
+    ck_assert_int_eq(before_end, SUCCESS);
+    ck_assert_uint_eq(free_bit_index, 1003);
+    ck_assert_int_eq(past_end, ERROR);
+}
+END_TEST
+
+START_TEST(find_first_free_bit_should_match_the_bytewise_scanner)
+{
+    // Arrange
+    USE_SCANNER_OR_SKIP(_i);
+    srand(1234);
+
+    for (int round = 0; round < 200; ++round) {
+        memset(bitmap_buffer, 0xFF, BITMAP_SIZE);
+        const uint32_t size_in_bits = 1 + (uint32_t) rand() % (BITMAP_SIZE * 8);
+        const uint32_t free_bits = (uint32_t) rand() % 3;
+        for (uint32_t i = 0; i < free_bits; ++i) {
+            clear_bit(bitmap_buffer, (uint32_t) rand() % (BITMAP_SIZE * 8));
+        }
+
+        // Act
+        uint32_t expected_index = 0;
+        uint32_t actual_index = 0;
+        set_bitmap_scanner(EXT2_BITMAP_SCAN_BYTEWISE);
+        const int expected = find_first_free_bit(bitmap_buffer, size_in_bits, &expected_index);
+        set_bitmap_scanner((ext2_bitmap_scanner) _i);
+        const int actual = find_first_free_bit(bitmap_buffer, size_in_bits, &actual_index);
+
+        // Assert
+        ck_assert_int_eq(actual, expected);
+        if (expected == SUCCESS) {
+            ck_assert_uint_eq(actual_index, expected_index);
+        }
+    }
+}
+END_TEST
+
+START_TEST(set_bit_range_should_set_only_the_requested_bits)
+{
+    // Act
+    set_bit_range(bitmap_buffer, 5, 20);
+
+    // Assert
+    for (uint32_t bit = 0; bit < 40; ++bit) {
+        const int expected = bit >= 5 && bit < 25;
+        ck_assert_int_eq(bitmap_buffer[bit / 8] >> (bit % 8) & 1, expected);
+    }
+}
+END_TEST
+
+START_TEST(clear_bit_range_should_clear_only_the_requested_bits)
+{
+    // Arrange
+    memset(bitmap_buffer, 0xFF, BITMAP_SIZE);
+
+    // Act
+    clear_bit_range(bitmap_buffer, 3, 2);
+    clear_bit_range(bitmap_buffer, 100, 300);
+
+    // Assert
+    for (uint32_t bit = 0; bit < 512; ++bit) {
+        const int expected = !((bit >= 3 && bit < 5) || (bit >= 100 && bit < 400));
+        ck_assert_int_eq(bitmap_buffer[bit / 8] >> (bit % 8) & 1, expected);
+    }
+}
+END_TEST
+
+START_TEST(count_bits_in_range_should_count_only_the_requested_bits)
+{
+    // Arrange
+    set_bit_range(bitmap_buffer, 5, 20);
+    set_bit_range(bitmap_buffer, 100, 300);
+
+    // Act & Assert
+    ck_assert_uint_eq(count_bits_in_range(bitmap_buffer, 0, 512), 320);
+    ck_assert_uint_eq(count_bits_in_range(bitmap_buffer, 3, 4), 2);
+    ck_assert_uint_eq(count_bits_in_range(bitmap_buffer, 20, 90), 15);
+    ck_assert_uint_eq(count_bits_in_range(bitmap_buffer, 399, 10), 1);
+    ck_assert_uint_eq(count_bits_in_range(bitmap_buffer, 26, 0), 0);
+}
+END_TEST
+
+START_TEST(find_free_run_should_skip_runs_that_are_too_short)
+{
+    // Arrange
+    memset(bitmap_buffer, 0xFF, BITMAP_SIZE);
+    clear_bit_range(bitmap_buffer, 10, 4);
+    clear_bit_range(bitmap_buffer, 200, 70);
+
+    // Act
+    uint32_t start;
+    uint32_t length;
+    int result = find_free_run(bitmap_buffer, BITMAP_SIZE * 8, 8, 0, &start, &length);
+
+    // Assert
+    ck_assert_int_eq(result, SUCCESS);
+    ck_assert_uint_eq(start, 200);
+    ck_assert_uint_eq(length, 70);
+}
+END_TEST
+
+START_TEST(find_free_run_should_start_at_goal_and_wrap_around)
+{
+    // Arrange
+    memset(bitmap_buffer, 0xFF, BITMAP_SIZE);
+    clear_bit_range(bitmap_buffer, 64, 16);
+    clear_bit_range(bitmap_buffer, 4000, 16);
+    uint32_t start;
+    uint32_t length;
+
+    // Act & Assert: a goal inside a free run starts the run at the goal
+    ck_assert_int_eq(find_free_run(bitmap_buffer, BITMAP_SIZE * 8, 4, 4004, &start, &length), SUCCESS);
+    ck_assert_uint_eq(start, 4004);
+    ck_assert_uint_eq(length, 12);
+
+    // Act & Assert: nothing after the goal, so the search wraps
+    ck_assert_int_eq(find_free_run(bitmap_buffer, BITMAP_SIZE * 8, 16, 5000, &start, &length), SUCCESS);
+    ck_assert_uint_eq(start, 64);
+    ck_assert_uint_eq(length, 16);
+}
+END_TEST
+
+START_TEST(find_free_run_should_stop_at_the_end_of_the_bitmap)
+{
+    // Arrange
+    memset(bitmap_buffer, 0xFF, BITMAP_SIZE);
+    clear_bit_range(bitmap_buffer, 990, 30);
+    uint32_t start;
+    uint32_t length;
+
+    // Act
+    int fits = find_free_run(bitmap_buffer, 1000, 10, 0, &start, &length);
+    int too_long = find_free_run(bitmap_buffer, 1000, 11, 0, &start, &length);
+
+    // Assert
+    ck_assert_int_eq(fits, SUCCESS);
+    ck_assert_uint_eq(start, 990);
+    ck_assert_uint_eq(length, 10);
+    ck_assert_int_eq(too_long, ERROR);
+}
+END_TEST
+
 START_TEST(write_and_read_bitmap_should_preserve_data)
 {
     // Arrange
@@ -111,8 +296,17 @@ Suite *bitmap_suite(void) {
     tcase_add_checked_fixture(tc_core, setup, teardown);
     tcase_add_test(tc_core, set_bit_should_set_the_correct_bit);
     tcase_add_test(tc_core, clear_bit_should_clear_the_correct_bit);
-    tcase_add_test(tc_core, find_first_free_bit_should_find_the_correct_bit);
-    tcase_add_test(tc_core, find_first_free_bit_should_return_error_when_bitmap_is_full);
+    tcase_add_loop_test(tc_core, find_first_free_bit_should_find_the_correct_bit, SCANNER_LOOP_START, SCANNER_LOOP_END);
+    tcase_add_loop_test(tc_core, find_first_free_bit_should_return_error_when_bitmap_is_full, SCANNER_LOOP_START, SCANNER_LOOP_END);
+    tcase_add_loop_test(tc_core, find_first_free_bit_should_skip_long_allocated_runs, SCANNER_LOOP_START, SCANNER_LOOP_END);
+    tcase_add_loop_test(tc_core, find_first_free_bit_should_ignore_bits_past_the_end, SCANNER_LOOP_START, SCANNER_LOOP_END);
+    tcase_add_loop_test(tc_core, find_first_free_bit_should_match_the_bytewise_scanner, SCANNER_LOOP_START, SCANNER_LOOP_END);
+    tcase_add_test(tc_core, set_bit_range_should_set_only_the_requested_bits);
+    tcase_add_test(tc_core, clear_bit_range_should_clear_only_the_requested_bits);
+    tcase_add_test(tc_core, count_bits_in_range_should_count_only_the_requested_bits);
+    tcase_add_test(tc_core, find_free_run_should_skip_runs_that_are_too_short);
+    tcase_add_test(tc_core, find_free_run_should_start_at_goal_and_wrap_around);
+    tcase_add_test(tc_core, find_free_run_should_stop_at_the_end_of_the_bitmap);
     tcase_add_test(tc_core, write_and_read_bitmap_should_preserve_data);
 
     suite_add_tcase(s, tc_core);
@@ -0,0 +1,269 @@
+#include "block_cache.h"
+#include "block_device.h"
+#include "globals.h"
+
+#include <check.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_SIZE 1024
+#define IMAGE_BLOCKS 16
+
+static FILE *fs_image;
+static ext2_block_device *device;
+
+void setup(void) {
+    fs_image = tmpfile();
+    ck_assert_ptr_nonnull(fs_image);
+
+    // Fill every block with its own block number so reads are easy to verify
+    uint8_t block[BLOCK_SIZE];
+    for (uint32_t i = 0; i < IMAGE_BLOCKS; ++i) {
+        memset(block, (int) i, BLOCK_SIZE);
+        fwrite(block, BLOCK_SIZE, 1, fs_image);
+    }
+    rewind(fs_image);
+
+    device = block_device_from_stream(fs_image, 0);
+    ck_assert_ptr_nonnull(device);
+}
+
+void teardown(void) {
+    block_device_close(device);
+    fclose(fs_image);
+}
+
+static uint8_t read_raw_byte(const off_t offset) {
+    uint8_t value = 0;
+    fseeko(fs_image, offset, SEEK_SET);
+    fread(&value, 1, 1, fs_image);
+    return value;
+}
+
+START_TEST(block_cache_get_should_count_hits_and_misses)
+{
+    // Arrange
+    ext2_block_cache *cache = block_cache_create(device, BLOCK_SIZE, 4);
+    ck_assert_ptr_nonnull(cache);
+
+    // Act
+    ext2_block_buffer *first = block_cache_get(cache, 3);
+    block_cache_release(cache, first);
+    ext2_block_buffer *second = block_cache_get(cache, 3);
+    block_cache_release(cache, second);
+
+    // Assert
+    ck_assert_ptr_eq(first, second);
+    ck_assert_uint_eq(first->data[0], 3);
+    ck_assert_uint_eq(cache->stats.misses, 1);
+    ck_assert_uint_eq(cache->stats.hits, 1);
+
+    // Cleanup
+    block_cache_destroy(cache);
+}
+END_TEST
+
+START_TEST(block_cache_write_should_defer_until_flush)
+{
+    // Arrange
+    ext2_block_cache *cache = block_cache_create(device, BLOCK_SIZE, 4);
+    ck_assert_ptr_nonnull(cache);
+    const uint8_t value = 0xAB;
+
+    // Act
+    const int result = block_cache_write(cache, 2 * BLOCK_SIZE + 10, 1, &value);
+
+    // Assert
+    ck_assert_int_eq(result, SUCCESS);
+    ck_assert_uint_eq(read_raw_byte(2 * BLOCK_SIZE + 10), 2);
+
+    ck_assert_int_eq(block_cache_flush(cache), SUCCESS);
+    ck_assert_uint_eq(read_raw_byte(2 * BLOCK_SIZE + 10), 0xAB);
+    ck_assert_uint_eq(read_raw_byte(2 * BLOCK_SIZE + 11), 2);
+
+    // Cleanup
+    block_cache_destroy(cache);
+}
+END_TEST
+
+START_TEST(block_cache_should_write_back_dirty_blocks_on_eviction)
+{
+    // Arrange
+    ext2_block_cache *cache = block_cache_create(device, BLOCK_SIZE, 2);
+    ck_assert_ptr_nonnull(cache);
+    const uint8_t value = 0xCD;
+    ck_assert_int_eq(block_cache_write(cache, 1 * BLOCK_SIZE, 1, &value), SUCCESS);
+
+    // Act: touch enough other blocks to force block 1 out
+    uint8_t scratch;
+    for (uint32_t block_id = 5; block_id < 10; ++block_id) {
+        ck_assert_int_eq(block_cache_read(cache, (off_t) block_id * BLOCK_SIZE, 1, &scratch), SUCCESS);
+        ck_assert_uint_eq(scratch, block_id);
+    }
+
+    // Assert
+    ck_assert_uint_gt(cache->stats.evictions, 0);
+    ck_assert_uint_eq(cache->stats.writebacks, 1);
+    ck_assert_uint_eq(read_raw_byte(1 * BLOCK_SIZE), 0xCD);
+
+    // Cleanup
+    block_cache_destroy(cache);
+}
+END_TEST
+
+START_TEST(block_cache_should_not_evict_pinned_blocks)
+{
+    // Arrange
+    ext2_block_cache *cache = block_cache_create(device, BLOCK_SIZE, 2);
+    ck_assert_ptr_nonnull(cache);
+    ext2_block_buffer *pinned_a = block_cache_get(cache, 1);
+    ext2_block_buffer *pinned_b = block_cache_get(cache, 2);
+
+    // Act
+    ext2_block_buffer *third = block_cache_get(cache, 3);
+
+    // Assert
+    ck_assert_ptr_null(third);
+    ck_assert_uint_eq(pinned_a->block_id, 1);
+    ck_assert_uint_eq(pinned_b->block_id, 2);
+
+    block_cache_release(cache, pinned_a);
+    third = block_cache_get(cache, 3);
+    ck_assert_ptr_nonnull(third);
+    ck_assert_uint_eq(third->data[0], 3);
+
+    // Cleanup
+    block_cache_release(cache, third);
+    block_cache_release(cache, pinned_b);
+    block_cache_destroy(cache);
+}
+END_TEST
+
+START_TEST(block_cache_read_should_span_block_boundaries)
+{
+    // Arrange
+    ext2_block_cache *cache = block_cache_create(device, BLOCK_SIZE, 4);
+    ck_assert_ptr_nonnull(cache);
+    uint8_t buffer[4];
+
+    // Act
+    const int result = block_cache_read(cache, 4 * BLOCK_SIZE - 2, sizeof(buffer), buffer);
+
+    // Assert
+    ck_assert_int_eq(result, SUCCESS);
+    ck_assert_uint_eq(buffer[0], 3);
+    ck_assert_uint_eq(buffer[1], 3);
+    ck_assert_uint_eq(buffer[2], 4);
+    ck_assert_uint_eq(buffer[3], 4);
+
+    // Cleanup
+    block_cache_destroy(cache);
+}
+END_TEST
+
+#define READER_THREADS 4
+#define READS_PER_THREAD 1000
+
+typedef struct {
+    ext2_block_cache *cache;
+    uint32_t first_block;
+    uint32_t mismatches;
+} reader_thread;
+
+static void *read_blocks(void *arg) {
+    reader_thread *reader = arg;
+    uint8_t buffer[BLOCK_SIZE];
+    for (uint32_t i = 0; i < READS_PER_THREAD; ++i) {
+        const uint32_t block = (reader->first_block + i) % IMAGE_BLOCKS;
+        if (block_cache_read(reader->cache, (off_t) block * BLOCK_SIZE, BLOCK_SIZE, buffer) != SUCCESS ||
+            buffer[0] != block || buffer[BLOCK_SIZE - 1] != block) {
+            reader->mismatches++;
+        }
+    }
+    return NULL;
+}
+
+START_TEST(block_cache_should_serve_concurrent_readers)
+{
+    // Arrange
+    ext2_block_cache *cache = block_cache_create(device, BLOCK_SIZE, 256);
+    ck_assert_ptr_nonnull(cache);
+    reader_thread readers[READER_THREADS];
+    pthread_t ids[READER_THREADS];
+
+    // Act
+    for (uint32_t t = 0; t < READER_THREADS; ++t) {
+        readers[t] = (reader_thread) {.cache = cache, .first_block = t * 3};
+        ck_assert_int_eq(pthread_create(&ids[t], NULL, read_blocks, &readers[t]), 0);
+    }
+    for (uint32_t t = 0; t < READER_THREADS; ++t) {
+        pthread_join(ids[t], NULL);
+    }
+
+    // Assert: every block was loaded exactly once, however the threads interleaved
+    ck_assert_uint_gt(cache->shard_count, 1);
+    for (uint32_t t = 0; t < READER_THREADS; ++t) {
+        ck_assert_uint_eq(readers[t].mismatches, 0);
+    }
+    ck_assert_uint_eq(cache->stats.misses, IMAGE_BLOCKS);
+    ck_assert_uint_eq(cache->stats.hits + cache->stats.misses, READER_THREADS * READS_PER_THREAD);
+
+    // Cleanup
+    block_cache_destroy(cache);
+}
+END_TEST
+
+START_TEST(block_cache_prefetch_should_turn_later_lookups_into_hits)
+{
+    // Arrange
+    ext2_block_cache *cache = block_cache_create(device, BLOCK_SIZE, 8);
+    ck_assert_ptr_nonnull(cache);
+    block_cache_release(cache, block_cache_get(cache, 2));
+    const uint32_t blocks[] = {2, 3, 5, 3};
+
+    // Act
+    const int result = block_cache_prefetch(cache, blocks, 4);
+    ext2_block_buffer *buffer = block_cache_get(cache, 5);
+
+    // Assert
+    ck_assert_int_eq(result, SUCCESS);
+    ck_assert_uint_eq(cache->stats.prefetched, 2);
+    ck_assert_uint_eq(cache->stats.misses, 1);
+    ck_assert_uint_eq(cache->stats.hits, 1);
+    ck_assert_ptr_nonnull(buffer);
+    ck_assert_uint_eq(buffer->data[0], 5);
+    ck_assert_uint_eq(buffer->data[BLOCK_SIZE - 1], 5);
+
+    // Cleanup
+    block_cache_release(cache, buffer);
+    block_cache_destroy(cache);
+}
+END_TEST
+
+Suite *block_cache_suite(void) {
+    Suite *s = suite_create("BlockCache");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, block_cache_get_should_count_hits_and_misses);
+    tcase_add_test(tc_core, block_cache_write_should_defer_until_flush);
+    tcase_add_test(tc_core, block_cache_should_write_back_dirty_blocks_on_eviction);
+    tcase_add_test(tc_core, block_cache_should_not_evict_pinned_blocks);
+    tcase_add_test(tc_core, block_cache_read_should_span_block_boundaries);
+    tcase_add_test(tc_core, block_cache_should_serve_concurrent_readers);
+    tcase_add_test(tc_core, block_cache_prefetch_should_turn_later_lookups_into_hits);
+
+    suite_add_tcase(s, tc_core);
+    return s;
+}
+
+int main(void) {
+    Suite *s = block_cache_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    const int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,388 @@
+#include "block_device.h"
+#include "globals.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define IMAGE_SIZE 4096
+
+static char image_path[] = "/tmp/ext2_block_device_testXXXXXX";
+static int image_fd;
+
+void setup(void) {
+    strcpy(image_path, "/tmp/ext2_block_device_testXXXXXX");
+    image_fd = mkstemp(image_path);
+    ck_assert_int_ge(image_fd, 0);
+
+    uint8_t contents[IMAGE_SIZE];
+    for (uint32_t i = 0; i < IMAGE_SIZE; ++i) {
+        contents[i] = (uint8_t) (i / 1024);
+    }
+    ck_assert_int_eq(write(image_fd, contents, IMAGE_SIZE), IMAGE_SIZE);
+}
+
+void teardown(void) {
+    close(image_fd);
+    unlink(image_path);
+}
+
+START_TEST(block_device_open_should_read_at_the_given_offset)
+{
+    // Arrange
+    ext2_block_device *device = block_device_open(image_path, 0);
+    ck_assert_ptr_nonnull(device);
+    uint8_t buffer[4];
+
+    // Act
+    const int result = block_device_read(device, 2 * 1024 - 2, sizeof(buffer), buffer);
+
+    // Assert
+    ck_assert_int_eq(result, SUCCESS);
+    ck_assert_uint_eq(buffer[0], 1);
+    ck_assert_uint_eq(buffer[3], 2);
+
+    // Cleanup
+    block_device_close(device);
+}
+END_TEST
+
+START_TEST(block_device_read_should_fail_past_end_of_image)
+{
+    // Arrange
+    ext2_block_device *device = block_device_open(image_path, 0);
+    ck_assert_ptr_nonnull(device);
+    uint8_t buffer[16];
+
+    // Act
+    const int result = block_device_read(device, IMAGE_SIZE - 8, sizeof(buffer), buffer);
+
+    // Assert
+    ck_assert_int_ne(result, SUCCESS);
+    ck_assert_int_eq(device->read(device, IMAGE_SIZE - 8, sizeof(buffer), buffer), 8);
+
+    // Cleanup
+    block_device_close(device);
+}
+END_TEST
+
+START_TEST(block_device_write_should_be_visible_to_later_reads)
+{
+    // Arrange
+    ext2_block_device *device = block_device_open(image_path, 1);
+    ck_assert_ptr_nonnull(device);
+    const uint8_t data[3] = {0xAA, 0xBB, 0xCC};
+    uint8_t verify[3];
+
+    // Act
+    const int result = block_device_write(device, 3000, sizeof(data), data);
+
+    // Assert
+    ck_assert_int_eq(result, SUCCESS);
+    ck_assert_int_eq(block_device_flush(device), SUCCESS);
+    ck_assert_int_eq(pread(image_fd, verify, sizeof(verify), 3000), sizeof(verify));
+    ck_assert_mem_eq(verify, data, sizeof(data));
+
+    // Cleanup
+    block_device_close(device);
+}
+END_TEST
+
+START_TEST(block_device_open_should_reject_writes_when_read_only)
+{
+    // Arrange
+    ext2_block_device *device = block_device_open(image_path, 0);
+    ck_assert_ptr_nonnull(device);
+    const uint8_t data = 0xFF;
+
+    // Act
+    const int result = block_device_write(device, 0, 1, &data);
+
+    // Assert
+    ck_assert_int_eq(result, IO_ERROR);
+
+    // Cleanup
+    block_device_close(device);
+}
+END_TEST
+
+START_TEST(block_device_from_stream_should_share_the_stream_api)
+{
+    // Arrange
+    FILE *stream = fdopen(dup(image_fd), "r+b");
+    ck_assert_ptr_nonnull(stream);
+    ext2_block_device *device = block_device_from_stream(stream, 1);
+    ck_assert_ptr_nonnull(device);
+    uint8_t value = 0;
+
+    // Act
+    const int result = block_device_read(device, 3 * 1024, 1, &value);
+
+    // Assert
+    ck_assert_int_eq(result, SUCCESS);
+    ck_assert_uint_eq(value, 3);
+
+    // Cleanup (closes the stream as well)
+    block_device_close(device);
+}
+END_TEST
+
+START_TEST(block_device_map_should_point_into_the_image)
+{
+    // Arrange
+    ext2_block_device *device = block_device_open_mapped(image_path);
+    ck_assert_ptr_nonnull(device);
+
+    // Act
+    const uint8_t *inside = block_device_map(device, 3 * 1024, 1024);
+    const void *outside = block_device_map(device, IMAGE_SIZE - 8, 16);
+
+    // Assert
+    ck_assert_ptr_nonnull(inside);
+    ck_assert_uint_eq(inside[0], 3);
+    ck_assert_uint_eq(inside[1023], 3);
+    ck_assert_ptr_null(outside);
+
+    // Cleanup
+    block_device_close(device);
+}
+END_TEST
+
+START_TEST(block_device_open_mapped_should_reject_writes)
+{
+    // Arrange
+    ext2_block_device *device = block_device_open_mapped(image_path);
+    ck_assert_ptr_nonnull(device);
+    const uint8_t data[2] = {0xAA, 0xBB};
+    uint8_t verify[2];
+
+    // Act
+    const int result = block_device_write(device, 100, sizeof(data), data);
+
+    // Assert
+    ck_assert_int_ne(result, SUCCESS);
+    ck_assert_int_eq(block_device_read(device, 100, sizeof(verify), verify), SUCCESS);
+    ck_assert_uint_eq(verify[0], 0);
+
+    // Cleanup
+    block_device_close(device);
+}
+END_TEST
+
+START_TEST(block_device_map_should_return_null_for_unmapped_devices)
+{
+    // Arrange
+    ext2_block_device *device = block_device_open(image_path, 0);
+    ck_assert_ptr_nonnull(device);
+
+    // Act
+    const void *pointer = block_device_map(device, 0, 16);
+
+    // Assert
+    ck_assert_ptr_null(pointer);
+
+    // Cleanup
+    block_device_close(device);
+}
+END_TEST
+
+START_TEST(block_device_submit_should_run_a_batch_of_reads_and_writes)
+{
+    // Arrange: a batch larger than the ring, whether or not io_uring is available
+    ext2_block_device *device = block_device_open(image_path, 1);
+    ck_assert_ptr_nonnull(device);
+    const int engine = block_device_enable_io_uring(device, 2);
+    ck_assert(engine == SUCCESS || engine == ERROR);
+    uint8_t reads[4][16];
+    const uint8_t data[4] = {0xAA, 0xBB, 0xCC, 0xDD};
+    ext2_io_request requests[6];
+    for (uint32_t i = 0; i < 4; ++i) {
+        requests[i] = (ext2_io_request) {.offset = (off_t) i * 1024, .length = sizeof(reads[i]), .buffer = reads[i]};
+    }
+    requests[4] = (ext2_io_request) {.offset = 512, .length = 2, .buffer = (void *) data, .write = 1};
+    requests[5] = (ext2_io_request) {.offset = 3584, .length = 2, .buffer = (void *) (data + 2), .write = 1};
+
+    // Act
+    const int result = block_device_submit(device, requests, 6);
+
+    // Assert
+    ck_assert_int_eq(result, SUCCESS);
+    for (uint32_t i = 0; i < 4; ++i) {
+        ck_assert_int_eq(requests[i].result, 16);
+        ck_assert_uint_eq(reads[i][0], i);
+        ck_assert_uint_eq(reads[i][15], i);
+    }
+    ck_assert_int_eq(requests[4].result, 2);
+    uint8_t verify[2];
+    ck_assert_int_eq(block_device_read(device, 3584, sizeof(verify), verify), SUCCESS);
+    ck_assert_mem_eq(verify, data + 2, sizeof(verify));
+
+    // Cleanup
+    block_device_close(device);
+}
+END_TEST
+
+START_TEST(block_device_submit_should_report_short_reads_at_end_of_image)
+{
+    // Arrange
+    ext2_block_device *device = block_device_open(image_path, 0);
+    ck_assert_ptr_nonnull(device);
+    block_device_enable_io_uring(device, 0);
+    uint8_t first[8];
+    uint8_t last[16];
+    ext2_io_request requests[2] = {
+        {.offset = 0, .length = sizeof(first), .buffer = first},
+        {.offset = IMAGE_SIZE - 8, .length = sizeof(last), .buffer = last},
+    };
+
+    // Act
+    const int result = block_device_submit(device, requests, 2);
+
+    // Assert
+    ck_assert_int_ne(result, SUCCESS);
+    ck_assert_int_eq(requests[0].result, 8);
+    ck_assert_int_eq(requests[1].result, 8);
+    ck_assert_uint_eq(last[7], 3);
+
+    // Cleanup
+    block_device_close(device);
+}
+END_TEST
+
+START_TEST(block_device_enable_io_uring_should_leave_stream_devices_synchronous)
+{
+    // Arrange
+    FILE *stream = fdopen(dup(image_fd), "r");
+    ck_assert_ptr_nonnull(stream);
+    ext2_block_device *device = block_device_from_stream(stream, 1);
+    ck_assert_ptr_nonnull(device);
+    uint8_t buffer[4];
+    ext2_io_request request = {.offset = 2048, .length = sizeof(buffer), .buffer = buffer};
+
+    // Act
+    const int enabled = block_device_enable_io_uring(device, 0);
+    const int result = block_device_submit(device, &request, 1);
+
+    // Assert
+    ck_assert_int_eq(enabled, ERROR);
+    ck_assert_ptr_null(device->ring);
+    ck_assert_int_eq(result, SUCCESS);
+    ck_assert_uint_eq(buffer[0], 2);
+
+    // Cleanup
+    block_device_close(device);
+}
+END_TEST
+
+START_TEST(block_device_submit_should_withdraw_requests_the_kernel_did_not_take)
+{
+    // Arrange: the first io_uring_enter() fails before anything is submitted
+    ext2_block_device *device = block_device_open(image_path, 0);
+    ck_assert_ptr_nonnull(device);
+    if (block_device_enable_io_uring(device, 2) != SUCCESS) {
+        block_device_close(device);
+        return; // No io_uring here; nothing to test
+    }
+    ck_assert_int_eq(block_device_fail_io_uring_enter(device, 0, 1), SUCCESS);
+    uint8_t first[4][8];
+    ext2_io_request requests[4];
+    for (uint32_t i = 0; i < 4; ++i) {
+        requests[i] = (ext2_io_request) {.offset = (off_t) i * 1024, .length = sizeof(first[i]), .buffer = first[i]};
+    }
+
+    // Act
+    const int result = block_device_submit(device, requests, 4);
+    memset(first, 0xEE, sizeof(first));
+    uint8_t second[8];
+    ext2_io_request request = {.offset = 3072, .length = sizeof(second), .buffer = second};
+    const int next = block_device_submit(device, &request, 1);
+
+    // Assert: the withdrawn entries were not submitted with the next batch
+    ck_assert_int_eq(result, SUCCESS);
+    for (uint32_t i = 0; i < 4; ++i) {
+        ck_assert_int_eq(requests[i].result, 8);
+    }
+    ck_assert_int_eq(next, SUCCESS);
+    ck_assert_uint_eq(second[0], 3);
+    for (uint32_t i = 0; i < 4; ++i) {
+        ck_assert_uint_eq(first[i][0], 0xEE);
+    }
+    ck_assert_int_eq(block_device_enable_io_uring(device, 0), SUCCESS);
+
+    // Cleanup
+    block_device_close(device);
+}
+END_TEST
+
+START_TEST(block_device_submit_should_cancel_accepted_requests_when_waiting_fails)
+{
+    // Arrange: a read from an empty pipe stays in flight until it is cancelled
+    int pipe_fds[2];
+    ck_assert_int_eq(pipe(pipe_fds), 0);
+    ext2_block_device *device = block_device_from_fd(pipe_fds[0], 1);
+    ck_assert_ptr_nonnull(device);
+    if (block_device_enable_io_uring(device, 0) != SUCCESS) {
+        block_device_close(device);
+        close(pipe_fds[1]);
+        return; // No io_uring here; nothing to test
+    }
+    ck_assert_int_eq(block_device_fail_io_uring_enter(device, 1, 1), SUCCESS);
+    uint8_t buffer[4];
+    memset(buffer, 0xEE, sizeof(buffer));
+    ext2_io_request request = {.offset = 0, .length = sizeof(buffer), .buffer = buffer};
+
+    // Act
+    const int result = block_device_submit(device, &request, 1);
+    const uint8_t data[4] = {1, 2, 3, 4};
+    ck_assert_int_eq(write(pipe_fds[1], data, sizeof(data)), sizeof(data));
+    usleep(20000);
+
+    // Assert: the kernel no longer owns the buffer, and the ring is retired
+    ck_assert_int_ne(result, SUCCESS);
+    ck_assert_uint_eq(buffer[0], 0xEE);
+    ck_assert_uint_eq(buffer[3], 0xEE);
+    ck_assert_ptr_null(device->submit);
+    ck_assert_int_eq(block_device_enable_io_uring(device, 0), ERROR);
+    uint8_t unread[4];
+    ck_assert_int_eq(read(pipe_fds[0], unread, sizeof(unread)), sizeof(unread));
+    ck_assert_mem_eq(unread, data, sizeof(data));
+
+    // Cleanup
+    block_device_close(device);
+    close(pipe_fds[1]);
+}
+END_TEST
+
+Suite *block_device_suite(void) {
+    Suite *s = suite_create("BlockDevice");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, block_device_open_should_read_at_the_given_offset);
+    tcase_add_test(tc_core, block_device_read_should_fail_past_end_of_image);
+    tcase_add_test(tc_core, block_device_write_should_be_visible_to_later_reads);
+    tcase_add_test(tc_core, block_device_open_should_reject_writes_when_read_only);
+    tcase_add_test(tc_core, block_device_from_stream_should_share_the_stream_api);
+    tcase_add_test(tc_core, block_device_map_should_point_into_the_image);
+    tcase_add_test(tc_core, block_device_open_mapped_should_reject_writes);
+    tcase_add_test(tc_core, block_device_map_should_return_null_for_unmapped_devices);
+    tcase_add_test(tc_core, block_device_submit_should_run_a_batch_of_reads_and_writes);
+    tcase_add_test(tc_core, block_device_submit_should_report_short_reads_at_end_of_image);
+    tcase_add_test(tc_core, block_device_submit_should_withdraw_requests_the_kernel_did_not_take);
+    tcase_add_test(tc_core, block_device_submit_should_cancel_accepted_requests_when_waiting_fails);
+    tcase_add_test(tc_core, block_device_enable_io_uring_should_leave_stream_devices_synchronous);
+
+    suite_add_tcase(s, tc_core);
+    return s;
+}
+
+int main(void) {
+    Suite *s = block_device_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    const int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
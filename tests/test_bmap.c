@@ -0,0 +1,186 @@
+#include "bmap.h"
+#include "globals.h"
+#include "superblock.h"
+#include "filesystem.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_SIZE 1024
+#define PER_BLOCK (BLOCK_SIZE / 4)
+
+// Mock data
+static ext2_super_block sb;
+static ext2_inode inode;
+static FILE *fs_image;
+static ext2_stream_context context;
+static ext2_filesystem *fs;
+
+static void write_pointer(const uint32_t block_id, const uint32_t slot, const uint32_t value) {
+    fseek(fs_image, (long) block_id * BLOCK_SIZE + (long) slot * 4, SEEK_SET);
+    fwrite(&value, sizeof(value), 1, fs_image);
+}
+
+void setup(void) {
+    memset(&sb, 0, sizeof(sb));
+    sb.s_blocks_count = 128;
+    sb.s_log_block_size = 0; // -> 1024 bytes
+
+    fs_image = tmpfile();
+    ck_assert_ptr_nonnull(fs_image);
+    static const uint8_t zero_block[BLOCK_SIZE];
+    for (int i = 0; i < 128; ++i) {
+        fwrite(zero_block, 1, BLOCK_SIZE, fs_image);
+    }
+
+    // Direct blocks 50-61, then 62, 63 and a hole through the single indirect block 20.
+    memset(&inode, 0, sizeof(inode));
+    for (uint32_t i = 0; i < 12; ++i) {
+        inode.i_block[i] = 50 + i;
+    }
+    inode.i_block[EXT2_IND_BLOCK] = 20;
+    write_pointer(20, 0, 62);
+    write_pointer(20, 1, 63);
+    write_pointer(20, 5, 35);
+
+    // Double indirect: 21 -> [1] 22 -> [3] 40.
+    inode.i_block[EXT2_DIND_BLOCK] = 21;
+    write_pointer(21, 1, 22);
+    write_pointer(22, 3, 40);
+
+    // Triple indirect: 23 -> [0] 24 -> [0] 25 -> [2] 41.
+    inode.i_block[EXT2_TIND_BLOCK] = 23;
+    write_pointer(23, 0, 24);
+    write_pointer(24, 0, 25);
+    write_pointer(25, 2, 41);
+    fflush(fs_image);
+
+    fs = filesystem_wrap_stream(&context, fs_image, &sb, NULL);
+}
+
+void teardown(void) {
+    fclose(fs_image);
+}
+
+START_TEST(bmap_should_follow_every_level_of_the_block_tree) {
+    // Arrange
+    uint32_t direct, single, dbl, triple;
+
+    // Act
+    ck_assert_int_eq(ext2_bmap(fs, &inode, 3, &direct), SUCCESS);
+    ck_assert_int_eq(ext2_bmap(fs, &inode, 12 + 5, &single), SUCCESS);
+    ck_assert_int_eq(ext2_bmap(fs, &inode, 12 + PER_BLOCK + PER_BLOCK + 3, &dbl), SUCCESS);
+    ck_assert_int_eq(ext2_bmap(fs, &inode, 12 + PER_BLOCK + PER_BLOCK * PER_BLOCK + 2, &triple), SUCCESS);
+
+    // Assert
+    ck_assert_uint_eq(direct, 53);
+    ck_assert_uint_eq(single, 35);
+    ck_assert_uint_eq(dbl, 40);
+    ck_assert_uint_eq(triple, 41);
+}
+
+END_TEST
+
+START_TEST(bmap_should_report_holes_and_reject_blocks_past_the_tree) {
+    // Arrange
+    uint32_t hole = 99, missing_subtree = 99, beyond;
+    const uint64_t per = PER_BLOCK;
+    const uint32_t past_end = (uint32_t) (12 + per + per * per + per * per * per);
+
+    // Act
+    const int hole_result = ext2_bmap(fs, &inode, 12 + 2, &hole);
+    const int subtree_result = ext2_bmap(fs, &inode, 12 + PER_BLOCK + 5 * PER_BLOCK, &missing_subtree);
+    const int beyond_result = ext2_bmap(fs, &inode, past_end, &beyond);
+
+    // Assert
+    ck_assert_int_eq(hole_result, SUCCESS);
+    ck_assert_uint_eq(hole, 0);
+    ck_assert_int_eq(subtree_result, SUCCESS);
+    ck_assert_uint_eq(missing_subtree, 0);
+    ck_assert_int_eq(beyond_result, INVALID_PARAMETER);
+}
+
+END_TEST
+
+START_TEST(bmap_should_fail_on_an_out_of_range_indirect_block) {
+    // Arrange
+    inode.i_block[EXT2_IND_BLOCK] = 5000;
+    uint32_t physical;
+
+    // Act
+    const int result = ext2_bmap(fs, &inode, 12, &physical);
+
+    // Assert
+    ck_assert_int_eq(result, IO_ERROR);
+}
+
+END_TEST
+
+START_TEST(block_map_range_should_merge_contiguous_blocks_across_the_indirect_boundary) {
+    // Arrange
+    ext2_block_map map;
+    ck_assert_int_eq(ext2_block_map_init(&map, fs, &inode), SUCCESS);
+    ext2_block_extent run, holes, capped;
+
+    // Act
+    ck_assert_int_eq(ext2_block_map_range(&map, 0, 100, &run), SUCCESS);
+    ck_assert_int_eq(ext2_block_map_range(&map, 14, 100, &holes), SUCCESS);
+    ck_assert_int_eq(ext2_block_map_range(&map, 2, 4, &capped), SUCCESS);
+
+    // Assert
+    ck_assert_uint_eq(run.start, 50);
+    ck_assert_uint_eq(run.length, 14); // 50-61 direct, 62-63 indirect
+    ck_assert_uint_eq(holes.start, 0);
+    ck_assert_uint_eq(holes.length, 3); // Logical 14-16, then block 35
+    ck_assert_uint_eq(capped.start, 52);
+    ck_assert_uint_eq(capped.length, 4);
+
+    ext2_block_map_release(&map);
+}
+
+END_TEST
+
+START_TEST(block_map_should_read_each_indirect_block_once_when_walking_forward) {
+    // Arrange
+    ext2_block_map map;
+    ck_assert_int_eq(ext2_block_map_init(&map, fs, &inode), SUCCESS);
+
+    // Act
+    for (uint32_t logical = 0; logical < 12 + PER_BLOCK; ++logical) {
+        uint32_t physical;
+        ck_assert_int_eq(ext2_block_map_lookup(&map, logical, &physical), SUCCESS);
+    }
+
+    // Assert
+    ck_assert_uint_eq(map.indirect_reads, 1);
+
+    ext2_block_map_release(&map);
+}
+
+END_TEST
+
+Suite *bmap_suite(void) {
+    Suite *s = suite_create("Bmap");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, bmap_should_follow_every_level_of_the_block_tree);
+    tcase_add_test(tc_core, bmap_should_report_holes_and_reject_blocks_past_the_tree);
+    tcase_add_test(tc_core, bmap_should_fail_on_an_out_of_range_indirect_block);
+    tcase_add_test(tc_core, block_map_range_should_merge_contiguous_blocks_across_the_indirect_boundary);
+    tcase_add_test(tc_core, block_map_should_read_each_indirect_block_once_when_walking_forward);
+
+    suite_add_tcase(s, tc_core);
+    return s;
+}
+
+int main(void) {
+    Suite *s = bmap_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    const int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
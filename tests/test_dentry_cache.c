@@ -0,0 +1,203 @@
+#include "dentry_cache.h"
+#include "directory.h"
+#include "globals.h"
+#include "superblock.h"
+#include "block_group.h"
+#include "inode.h"
+#include "filesystem.h"
+#include "block_device.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_SIZE 1024
+
+static ext2_dentry_cache *cache;
+
+void setup(void) {
+    cache = dentry_cache_create(4);
+    ck_assert_ptr_nonnull(cache);
+}
+
+void teardown(void) {
+    dentry_cache_destroy(cache);
+}
+
+// Builds an image whose root directory (inode 2, block 15) holds "etc" -> 12,
+// and "etc" (inode 12, block 16) holds "passwd" -> 13.
+static FILE *create_tree_image(ext2_super_block *sb, ext2_group_desc *groups) {
+    memset(sb, 0, sizeof(*sb));
+    sb->s_magic = EXT2_SUPER_MAGIC;
+    sb->s_inodes_count = 16;
+    sb->s_blocks_count = 32;
+    sb->s_inodes_per_group = 16;
+    sb->s_blocks_per_group = 32;
+    sb->s_inode_size = sizeof(ext2_inode);
+    sb->s_first_data_block = 1;
+    memset(groups, 0, sizeof(*groups));
+    groups->bg_inode_table = 5;
+
+    FILE *image = tmpfile();
+    ck_assert_ptr_nonnull(image);
+    static const uint8_t zero_block[BLOCK_SIZE];
+    for (int i = 0; i < 32; ++i) {
+        fwrite(zero_block, 1, BLOCK_SIZE, image);
+    }
+    write_superblock(image, sb);
+    write_group_descriptor(image, sb, 0, groups);
+
+    const struct { uint32_t dir, block, child; const char *name; } dirs[] = {
+        {EXT2_ROOT_INO, 15, 12, "etc"},
+        {12, 16, 13, "passwd"},
+    };
+    for (size_t i = 0; i < 2; ++i) {
+        ext2_inode dir = {0};
+        dir.i_mode = EXT2_S_IFDIR | 0755;
+        dir.i_size = BLOCK_SIZE;
+        dir.i_block[0] = dirs[i].block;
+        ck_assert_int_eq(write_inode(image, sb, groups, dirs[i].dir, &dir), SUCCESS);
+
+        uint8_t block[BLOCK_SIZE] = {0};
+        ext2_directory_entry *entry = (ext2_directory_entry *) block;
+        entry->inode = dirs[i].child;
+        entry->rec_len = BLOCK_SIZE;
+        entry->name_len = (uint8_t) strlen(dirs[i].name);
+        memcpy(entry->name, dirs[i].name, entry->name_len);
+        fseek(image, (long) dirs[i].block * BLOCK_SIZE, SEEK_SET);
+        fwrite(block, 1, BLOCK_SIZE, image);
+    }
+    ext2_inode file = {0};
+    file.i_mode = EXT2_S_IFREG | 0644;
+    ck_assert_int_eq(write_inode(image, sb, groups, 13, &file), SUCCESS);
+    fflush(image);
+    return image;
+}
+
+START_TEST(lookup_should_return_inserted_entries) {
+    // Arrange
+    dentry_cache_insert(cache, 2, "etc", 3, 12);
+    uint32_t child = 99;
+
+    // Act
+    const int found = dentry_cache_lookup(cache, 2, "etc", 3, &child);
+    const int other_parent = dentry_cache_lookup(cache, 3, "etc", 3, &child);
+
+    // Assert
+    ck_assert_int_eq(found, 1);
+    ck_assert_uint_eq(child, 12);
+    ck_assert_int_eq(other_parent, 0);
+    ck_assert_uint_eq(cache->stats.hits, 1);
+    ck_assert_uint_eq(cache->stats.misses, 1);
+}
+
+END_TEST
+
+START_TEST(lookup_should_remember_missing_names) {
+    // Arrange
+    dentry_cache_insert(cache, 2, "nope", 4, 0);
+    uint32_t child = 99;
+
+    // Act
+    const int found = dentry_cache_lookup(cache, 2, "nope", 4, &child);
+
+    // Assert
+    ck_assert_int_eq(found, 1);
+    ck_assert_uint_eq(child, 0);
+    ck_assert_uint_eq(cache->stats.negative_hits, 1);
+}
+
+END_TEST
+
+START_TEST(invalidate_should_drop_a_name_in_one_or_every_directory) {
+    // Arrange
+    dentry_cache_insert(cache, 2, "x", 1, 0);
+    dentry_cache_insert(cache, 5, "x", 1, 0);
+    dentry_cache_insert(cache, 5, "y", 1, 0);
+    uint32_t child;
+
+    // Act & Assert
+    dentry_cache_invalidate(cache, 5, "y", 1);
+    ck_assert_int_eq(dentry_cache_lookup(cache, 5, "y", 1, &child), 0);
+    ck_assert_int_eq(dentry_cache_lookup(cache, 5, "x", 1, &child), 1);
+
+    dentry_cache_invalidate(cache, 0, "x", 1);
+    ck_assert_int_eq(dentry_cache_lookup(cache, 2, "x", 1, &child), 0);
+    ck_assert_int_eq(dentry_cache_lookup(cache, 5, "x", 1, &child), 0);
+    ck_assert_uint_eq(cache->stats.invalidations, 3);
+}
+
+END_TEST
+
+START_TEST(insert_should_evict_when_the_cache_is_full) {
+    // Arrange
+    char name[2] = "a";
+
+    // Act
+    for (int i = 0; i < 6; ++i) {
+        name[0] = (char) ('a' + i);
+        dentry_cache_insert(cache, 2, name, 1, 20 + i);
+    }
+
+    // Assert
+    uint32_t child;
+    ck_assert_uint_eq(cache->stats.evictions, 2);
+    ck_assert_int_eq(dentry_cache_lookup(cache, 2, "f", 1, &child), 1);
+    ck_assert_uint_eq(child, 25);
+}
+
+END_TEST
+
+START_TEST(ext2_lookup_should_resolve_repeated_paths_from_the_cache) {
+    // Arrange
+    ext2_super_block sb;
+    ext2_group_desc group;
+    FILE *image = create_tree_image(&sb, &group);
+    ext2_filesystem *fs = filesystem_init_device(block_device_from_stream(image, 0), 0);
+    ck_assert_ptr_nonnull(fs);
+
+    // Act
+    const uint32_t first = ext2_lookup(fs, "/etc/passwd");
+    const uint32_t second = ext2_lookup(fs, "//etc//passwd");
+    const uint32_t missing = ext2_lookup(fs, "/etc/shadow");
+    const uint32_t missing_again = ext2_lookup(fs, "/etc/shadow");
+
+    // Assert
+    ck_assert_uint_eq(first, 13);
+    ck_assert_uint_eq(second, 13);
+    ck_assert_uint_eq(missing, 0);
+    ck_assert_uint_eq(missing_again, 0);
+    ck_assert_uint_eq(fs->dcache->stats.misses, 3);        // etc, passwd, shadow
+    ck_assert_uint_eq(fs->dcache->stats.hits, 4);          // etc three times, passwd once
+    ck_assert_uint_eq(fs->dcache->stats.negative_hits, 1); // shadow
+
+    filesystem_free(fs);
+    fclose(image);
+}
+
+END_TEST
+
+Suite *dentry_cache_suite(void) {
+    Suite *s = suite_create("DentryCache");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, lookup_should_return_inserted_entries);
+    tcase_add_test(tc_core, lookup_should_remember_missing_names);
+    tcase_add_test(tc_core, invalidate_should_drop_a_name_in_one_or_every_directory);
+    tcase_add_test(tc_core, insert_should_evict_when_the_cache_is_full);
+    tcase_add_test(tc_core, ext2_lookup_should_resolve_repeated_paths_from_the_cache);
+
+    suite_add_tcase(s, tc_core);
+    return s;
+}
+
+int main(void) {
+    Suite *s = dentry_cache_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    const int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
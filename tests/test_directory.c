@@ -1,8 +1,10 @@
 #include "directory.h"
+#include "dentry_cache.h"
 #include "globals.h"
 #include "inode.h"
 #include "superblock.h"
 #include "block_group.h"
+#include "filesystem.h"
 
 #include <check.h>
 #include <stdio.h>
@@ -15,9 +17,63 @@ static ext2_group_desc *bgdt;
 static ext2_inode *dir_inode;
 static FILE *fs_image;
 static char *block_buffer;
+static ext2_stream_context context;
+
+static void write_entry(
+    char *block,
+    const uint32_t offset,
+    const uint32_t inode_num,
+    const uint16_t rec_len,
+    const char *name
+) {
+    ext2_directory_entry *entry = (ext2_directory_entry *) (block + offset);
+    entry->inode = inode_num;
+    entry->rec_len = rec_len;
+    entry->name_len = (uint8_t) strlen(name);
+    entry->file_type = EXT2_FT_REG_FILE;
+    memcpy(entry->name, name, strlen(name));
+}
+
+static void write_block(const uint32_t block_id, const void *data) {
+    fseeko(fs_image, (off_t) block_id * get_block_size(sb), SEEK_SET);
+    fwrite(data, get_block_size(sb), 1, fs_image);
+}
+
+// Inode 3 is a 13-block directory: "a" and a deleted entry in block 16, a hole,
+// a malformed block 19, and "b" in block 18 behind indirect block 17.
+static void write_large_directory(void) {
+    const uint32_t block_size = get_block_size(sb);
+    char block[1024] = {0};
+    write_entry(block, 0, 5, 12, "a");
+    write_entry(block, 12, 0, (uint16_t) (block_size - 12), "gone");
+    write_block(16, block);
+
+    memset(block, 0, sizeof(block));
+    write_entry(block, 0, 6, 3, "bad");
+    write_block(19, block);
+
+    memset(block, 0, sizeof(block));
+    write_entry(block, 0, 7, (uint16_t) block_size, "b");
+    write_block(18, block);
+
+    uint32_t indirect[256] = {18};
+    write_block(17, indirect);
+
+    ext2_inode inode = {0};
+    inode.i_mode = EXT2_S_IFDIR;
+    inode.i_size = 13 * block_size;
+    inode.i_block[0] = 16;
+    inode.i_block[2] = 19;
+    inode.i_block[12] = 17;
+    ck_assert_int_eq(write_inode(fs_image, sb, bgdt, 3, &inode), SUCCESS);
+
+    inode.i_mode = EXT2_S_IFREG;
+    ck_assert_int_eq(write_inode(fs_image, sb, bgdt, 4, &inode), SUCCESS);
+    fflush(fs_image);
+}
 
 void setup(void) {
-    sb = malloc(sizeof(ext2_super_block));
+    sb = calloc(1, sizeof(ext2_super_block));
     ck_assert_ptr_nonnull(sb);
     sb->s_inodes_count = 32;
     sb->s_blocks_count = 32;
@@ -31,7 +87,7 @@ void setup(void) {
     bgdt[0].bg_inode_table = 10;
     bgdt[1].bg_inode_table = 20;
 
-    dir_inode = malloc(sizeof(ext2_inode));
+    dir_inode = calloc(1, sizeof(ext2_inode));
     ck_assert_ptr_nonnull(dir_inode);
     dir_inode->i_mode = EXT2_S_IFDIR;
     dir_inode->i_size = get_block_size(sb);
@@ -92,12 +148,173 @@ START_TEST(find_entry_in_directory_should_return_inode_for_existing_entry)
 }
 END_TEST
 
+START_TEST(ext2_add_directory_entry_should_only_invalidate_the_parents_lookup)
+{
+    // Arrange: cached misses for the same name in the parent and in another directory
+    ext2_filesystem *fs = filesystem_wrap_stream(&context, fs_image, sb, bgdt);
+    fs->dcache = dentry_cache_create(16);
+    ck_assert_ptr_nonnull(fs->dcache);
+    dentry_cache_insert(fs->dcache, 1, "new", 3, 0);
+    dentry_cache_insert(fs->dcache, 5, "new", 3, 0);
+    uint32_t child;
+
+    // Act
+    const int result = ext2_add_directory_entry(fs, 1, dir_inode, 9, "new", EXT2_FT_REG_FILE);
+
+    // Assert
+    ck_assert_int_eq(result, SUCCESS);
+    ck_assert_int_eq(dentry_cache_lookup(fs->dcache, 1, "new", 3, &child), 0);
+    ck_assert_int_eq(dentry_cache_lookup(fs->dcache, 5, "new", 3, &child), 1);
+    ck_assert_uint_eq(child, 0);
+
+    // Cleanup
+    dentry_cache_destroy(fs->dcache);
+    fs->dcache = NULL;
+    filesystem_finish_stream(fs, SUCCESS);
+}
+END_TEST
+
+START_TEST(dir_iter_should_return_every_entry_in_order)
+{
+    // Arrange
+    ext2_filesystem *fs = filesystem_wrap_stream(&context, fs_image, sb, bgdt);
+    ext2_dir_iter iter;
+    ck_assert_int_eq(ext2_dir_iter_open(&iter, fs, 1), SUCCESS);
+    const ext2_directory_entry *first, *second, *end;
+
+    // Act
+    const int r1 = ext2_dir_iter_next(&iter, &first);
+    ck_assert_int_eq(r1, 1);
+    ck_assert_uint_eq(first->inode, 1);
+    ck_assert_uint_eq(first->name_len, 1);
+    const int r2 = ext2_dir_iter_next(&iter, &second);
+    const int r3 = ext2_dir_iter_next(&iter, &end);
+
+    // Assert
+    ck_assert_int_eq(r2, 1);
+    ck_assert_uint_eq(second->inode, 2);
+    ck_assert_mem_eq(second->name, "..", 2);
+    ck_assert_int_eq(r3, 0);
+
+    ext2_dir_iter_close(&iter);
+}
+END_TEST
+
+START_TEST(dir_iter_should_follow_indirect_blocks_and_skip_holes_and_bad_blocks)
+{
+    // Arrange
+    write_large_directory();
+    ext2_filesystem *fs = filesystem_wrap_stream(&context, fs_image, sb, bgdt);
+    ext2_dir_iter iter;
+    ck_assert_int_eq(ext2_dir_iter_open(&iter, fs, 3), SUCCESS);
+    uint32_t inodes[4];
+    int count = 0;
+    const ext2_directory_entry *entry;
+
+    // Act
+    int result;
+    while ((result = ext2_dir_iter_next(&iter, &entry)) > 0 && count < 4) {
+        inodes[count++] = entry->inode;
+    }
+
+    // Assert
+    ck_assert_int_eq(result, 0);
+    ck_assert_int_eq(count, 2);
+    ck_assert_uint_eq(inodes[0], 5);
+    ck_assert_uint_eq(inodes[1], 7);
+
+    ext2_dir_iter_close(&iter);
+}
+END_TEST
+
+START_TEST(dir_iter_open_should_reject_non_directories)
+{
+    // Arrange
+    write_large_directory();
+    ext2_filesystem *fs = filesystem_wrap_stream(&context, fs_image, sb, bgdt);
+    ext2_dir_iter iter;
+
+    // Act
+    const int result = ext2_dir_iter_open(&iter, fs, 4);
+
+    // Assert
+    ck_assert_int_eq(result, ERROR);
+}
+END_TEST
+
+START_TEST(dir_block_find_should_ignore_name_padding)
+{
+    // Arrange
+    char block[1024] = {0};
+    write_entry(block, 0, 5, 12, "ab");
+    memcpy(block + 8 + 2, "XY", 2); // Padding after the name is not guaranteed to be zero
+    write_entry(block, 12, 6, 1024 - 12, "abc");
+    ext2_name_key key;
+    ext2_name_key_init(&key, "ab", 2);
+    uint32_t inode_num = 0;
+
+    // Act
+    const int result = ext2_dir_block_find(block, 1024, &key, &inode_num);
+
+    // Assert
+    ck_assert_int_eq(result, 1);
+    ck_assert_uint_eq(inode_num, 5);
+}
+END_TEST
+
+START_TEST(dir_block_find_should_compare_names_past_the_prefix)
+{
+    // Arrange
+    char block[1024] = {0};
+    write_entry(block, 0, 5, 20, "alpha_one");
+    write_entry(block, 20, 6, 1024 - 20, "alpha_two");
+    ext2_name_key two, six;
+    ext2_name_key_init(&two, "alpha_two", 9);
+    ext2_name_key_init(&six, "alpha_six", 9);
+    uint32_t inode_num = 0;
+
+    // Act
+    const int found = ext2_dir_block_find(block, 1024, &two, &inode_num);
+    const int missing = ext2_dir_block_find(block, 1024, &six, &inode_num);
+
+    // Assert
+    ck_assert_int_eq(found, 1);
+    ck_assert_uint_eq(inode_num, 6);
+    ck_assert_int_eq(missing, 0);
+}
+END_TEST
+
+START_TEST(dir_block_find_should_reject_malformed_records)
+{
+    // Arrange
+    char block[1024] = {0};
+    write_entry(block, 0, 5, 12, "a");
+    write_entry(block, 12, 6, 3, "bad");
+    ext2_name_key key;
+    ext2_name_key_init(&key, "zz", 2);
+    uint32_t inode_num = 0;
+
+    // Act
+    const int result = ext2_dir_block_find(block, 1024, &key, &inode_num);
+
+    // Assert
+    ck_assert_int_eq(result, ERROR);
+}
+END_TEST
+
 Suite *directory_suite(void) {
     Suite *s = suite_create("Directory");
     TCase *tc_core = tcase_create("Core");
 
     tcase_add_checked_fixture(tc_core, setup, teardown);
     tcase_add_test(tc_core, find_entry_in_directory_should_return_inode_for_existing_entry);
+    tcase_add_test(tc_core, ext2_add_directory_entry_should_only_invalidate_the_parents_lookup);
+    tcase_add_test(tc_core, dir_iter_should_return_every_entry_in_order);
+    tcase_add_test(tc_core, dir_iter_should_follow_indirect_blocks_and_skip_holes_and_bad_blocks);
+    tcase_add_test(tc_core, dir_iter_open_should_reject_non_directories);
+    tcase_add_test(tc_core, dir_block_find_should_ignore_name_padding);
+    tcase_add_test(tc_core, dir_block_find_should_compare_names_past_the_prefix);
+    tcase_add_test(tc_core, dir_block_find_should_reject_malformed_records);
 
     suite_add_tcase(s, tc_core);
     return s;
@@ -0,0 +1,374 @@
+#include "file.h"
+#include "bmap.h"
+#include "globals.h"
+#include "superblock.h"
+#include "block_group.h"
+#include "inode.h"
+#include "filesystem.h"
+#include "block_device.h"
+#include "block_cache.h"
+#include "bitmap.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_SIZE 1024
+#define IMAGE_BLOCKS 128
+#define FILE_INODE 12
+#define FILE_BLOCKS 20
+#define FILE_SIZE (FILE_BLOCKS * BLOCK_SIZE - 300)
+#define HOLE_BLOCK 16
+#define FIRST_FREE_BLOCK 80
+#define FREE_BLOCKS (IMAGE_BLOCKS - FIRST_FREE_BLOCK)
+#define NEW_INODE 13
+
+// Mock data
+static ext2_super_block *sb;
+static ext2_group_desc group;
+static FILE *fs_image;
+static ext2_filesystem *fs;
+
+static uint8_t expected_byte(const uint64_t offset) {
+    if (offset / BLOCK_SIZE == HOLE_BLOCK) {
+        return 0;
+    }
+    return (uint8_t) (offset * 7 + offset / BLOCK_SIZE);
+}
+
+// Inode 12 is a 20-block file: logical 0-11 in blocks 40-51, 12-15 in 52-55
+// through indirect block 30, a hole at 16, and 17-19 in blocks 70-72. Inode 13
+// is empty. Blocks from 80 on are free.
+void setup(void) {
+    sb = calloc(1, sizeof(ext2_super_block));
+    ck_assert_ptr_nonnull(sb);
+    sb->s_magic = EXT2_SUPER_MAGIC;
+    sb->s_inodes_count = 16;
+    sb->s_blocks_count = IMAGE_BLOCKS;
+    sb->s_free_blocks_count = FREE_BLOCKS;
+    sb->s_inodes_per_group = 16;
+    sb->s_blocks_per_group = IMAGE_BLOCKS;
+    sb->s_inode_size = sizeof(ext2_inode);
+    sb->s_first_data_block = 1;
+    memset(&group, 0, sizeof(group));
+    group.bg_block_bitmap = 3;
+    group.bg_inode_bitmap = 4;
+    group.bg_inode_table = 5;
+    group.bg_free_blocks_count = FREE_BLOCKS;
+
+    fs_image = tmpfile();
+    ck_assert_ptr_nonnull(fs_image);
+    static const uint8_t zero_block[BLOCK_SIZE];
+    for (int i = 0; i < IMAGE_BLOCKS; ++i) {
+        fwrite(zero_block, 1, BLOCK_SIZE, fs_image);
+    }
+    write_superblock(fs_image, sb);
+    write_group_descriptor(fs_image, sb, 0, &group);
+
+    // Bit i is block i + 1; the last bit lies past the end of the image.
+    uint8_t block_bitmap[BLOCK_SIZE] = {0};
+    for (uint32_t bit = 0; bit < IMAGE_BLOCKS; ++bit) {
+        if (bit + 1 < FIRST_FREE_BLOCK || bit + 1 >= IMAGE_BLOCKS) {
+            block_bitmap[bit / 8] |= (uint8_t) (1u << (bit % 8));
+        }
+    }
+    write_bitmap(fs_image, sb, group.bg_block_bitmap, block_bitmap);
+
+    ext2_inode inode = {0};
+    inode.i_mode = EXT2_S_IFREG | 0644;
+    inode.i_size = FILE_SIZE;
+    inode.i_blocks = FILE_BLOCKS * (BLOCK_SIZE / 512); // 19 data blocks and the indirect block
+    uint32_t indirect[BLOCK_SIZE / 4] = {0};
+    for (uint32_t logical = 0; logical < FILE_BLOCKS; ++logical) {
+        uint32_t physical;
+        if (logical < 16) {
+            physical = 40 + logical;
+        } else if (logical == HOLE_BLOCK) {
+            continue;
+        } else {
+            physical = 70 + logical - 17;
+        }
+        if (logical < 12) {
+            inode.i_block[logical] = physical;
+        } else {
+            indirect[logical - 12] = physical;
+        }
+
+        uint8_t block[BLOCK_SIZE];
+        for (uint32_t i = 0; i < BLOCK_SIZE; ++i) {
+            block[i] = expected_byte((uint64_t) logical * BLOCK_SIZE + i);
+        }
+        fseek(fs_image, (long) physical * BLOCK_SIZE, SEEK_SET);
+        fwrite(block, 1, BLOCK_SIZE, fs_image);
+    }
+    inode.i_block[EXT2_IND_BLOCK] = 30;
+    fseek(fs_image, 30L * BLOCK_SIZE, SEEK_SET);
+    fwrite(indirect, 1, BLOCK_SIZE, fs_image);
+    ck_assert_int_eq(write_inode(fs_image, sb, &group, FILE_INODE, &inode), SUCCESS);
+
+    ext2_inode empty = {0};
+    empty.i_mode = EXT2_S_IFREG | 0644;
+    ck_assert_int_eq(write_inode(fs_image, sb, &group, NEW_INODE, &empty), SUCCESS);
+
+    ext2_inode dir = {0};
+    dir.i_mode = EXT2_S_IFDIR | 0755;
+    ck_assert_int_eq(write_inode(fs_image, sb, &group, EXT2_ROOT_INO, &dir), SUCCESS);
+    fflush(fs_image);
+
+    fs = filesystem_init_device(block_device_from_stream(fs_image, 0), EXT2_DEFAULT_CACHE_BLOCKS);
+    ck_assert_ptr_nonnull(fs);
+}
+
+void teardown(void) {
+    filesystem_free(fs);
+    free(sb);
+    fclose(fs_image);
+}
+
+static void assert_matches_file(const uint8_t *data, const uint64_t offset, const size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        ck_assert_msg(data[i] == expected_byte(offset + i), "byte %llu differs",
+                (unsigned long long) (offset + i));
+    }
+}
+
+START_TEST(file_read_should_return_the_whole_file_with_coalesced_reads) {
+    // Arrange
+    ext2_file *file = ext2_file_open(fs, FILE_INODE);
+    ck_assert_ptr_nonnull(file);
+    uint8_t *data = malloc(FILE_BLOCKS * BLOCK_SIZE);
+
+    // Act
+    const ssize_t n = ext2_file_read(file, data, FILE_BLOCKS * BLOCK_SIZE);
+    const ssize_t at_end = ext2_file_read(file, data, 1);
+
+    // Assert
+    ck_assert_int_eq(n, FILE_SIZE);
+    ck_assert_int_eq(at_end, 0);
+    assert_matches_file(data, 0, FILE_SIZE);
+    ck_assert_uint_le(file->device_reads, 3); // 40-55, 70-71, then the tail block 72
+
+    free(data);
+    ext2_file_close(file);
+}
+
+END_TEST
+
+START_TEST(file_pread_should_handle_unaligned_ranges_and_holes) {
+    // Arrange
+    ext2_file *file = ext2_file_open(fs, FILE_INODE);
+    ck_assert_ptr_nonnull(file);
+    uint8_t data[3000];
+    const uint64_t offsets[] = {0, 1000, 11 * BLOCK_SIZE + 17, 15 * BLOCK_SIZE + 900, FILE_SIZE - 10};
+
+    for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); ++i) {
+        // Act
+        const ssize_t n = ext2_file_pread(file, data, sizeof(data), offsets[i]);
+
+        // Assert
+        const uint64_t expected = FILE_SIZE - offsets[i] < sizeof(data) ? FILE_SIZE - offsets[i] : sizeof(data);
+        ck_assert_int_eq(n, (ssize_t) expected);
+        assert_matches_file(data, offsets[i], (size_t) n);
+    }
+    ck_assert_uint_eq(file->position, 0);
+
+    ext2_file_close(file);
+}
+
+END_TEST
+
+START_TEST(file_read_should_grow_readahead_for_small_sequential_reads) {
+    // Arrange
+    ext2_file *file = ext2_file_open(fs, FILE_INODE);
+    ck_assert_ptr_nonnull(file);
+    uint8_t data[100];
+    uint64_t offset = 0;
+
+    // Act
+    ssize_t n;
+    while ((n = ext2_file_read(file, data, sizeof(data))) > 0) {
+        assert_matches_file(data, offset, (size_t) n);
+        offset += (uint64_t) n;
+    }
+
+    // Assert
+    ck_assert_uint_eq(offset, FILE_SIZE);
+    ck_assert_uint_gt(file->ra_window, EXT2_FILE_READAHEAD_MIN);
+    ck_assert_uint_le(file->device_reads, 5); // Windows of 4, 8 and 8 blocks, split at the hole
+
+    ext2_file_close(file);
+}
+
+END_TEST
+
+START_TEST(file_open_should_reject_non_regular_files) {
+    // Act
+    ext2_file *file = ext2_file_open(fs, EXT2_ROOT_INO);
+
+    // Assert
+    ck_assert_ptr_null(file);
+}
+
+END_TEST
+
+static uint8_t written_byte(const uint64_t offset) {
+    return (uint8_t) (offset * 11 + 5);
+}
+
+START_TEST(file_write_should_be_visible_before_and_after_flush) {
+    // Arrange
+    ext2_file *file = ext2_file_open(fs, FILE_INODE);
+    ck_assert_ptr_nonnull(file);
+    uint8_t data[1500];
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = written_byte(i);
+    }
+    uint8_t back[2000];
+
+    // Act
+    const ssize_t n = ext2_file_pwrite(file, data, sizeof(data), 500);
+    const ssize_t before = ext2_file_pread(file, back, sizeof(back), 250);
+    const int flushed = ext2_file_flush(file);
+
+    // Assert
+    ck_assert_int_eq(n, sizeof(data));
+    ck_assert_int_eq(before, sizeof(back));
+    ck_assert_int_eq(flushed, SUCCESS);
+    ck_assert_uint_eq(file->dirty_count, 0);
+    ck_assert_uint_eq(file->device_writes, 1); // Blocks 0 and 1 are physically adjacent
+    ck_assert_uint_eq(fs->bgdt->groups[0].bg_free_blocks_count, FREE_BLOCKS); // Overwrites allocate nothing
+    ext2_file_close(file);
+
+    file = ext2_file_open(fs, FILE_INODE);
+    ck_assert_int_eq(ext2_file_pread(file, back, sizeof(back), 250), sizeof(back));
+    assert_matches_file(back, 250, 250);
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        ck_assert_uint_eq(back[250 + i], written_byte(i));
+    }
+    assert_matches_file(back + 1750, 2000, 250);
+    ck_assert_uint_eq(ext2_file_size(file), FILE_SIZE);
+    ext2_file_close(file);
+}
+
+END_TEST
+
+START_TEST(file_write_should_allocate_one_contiguous_run_at_flush) {
+    // Arrange
+    ext2_file *file = ext2_file_open(fs, NEW_INODE);
+    ck_assert_ptr_nonnull(file);
+    const size_t size = 20 * BLOCK_SIZE - 100;
+    uint8_t *data = malloc(size);
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = written_byte(i);
+    }
+
+    // Act
+    for (size_t done = 0; done < size; done += 100) {
+        ck_assert_int_eq(ext2_file_write(file, data + done, size - done < 100 ? size - done : 100),
+                size - done < 100 ? size - done : 100);
+    }
+    const uint32_t free_before_flush = fs->bgdt->groups[0].bg_free_blocks_count;
+    const uint32_t first_before_flush = file->inode->i_block[0];
+    const int flushed = ext2_file_flush(file);
+
+    // Assert
+    ck_assert_uint_eq(free_before_flush, FREE_BLOCKS);
+    ck_assert_uint_eq(first_before_flush, 0);
+    ck_assert_int_eq(flushed, SUCCESS);
+    ck_assert_uint_eq(fs->bgdt->groups[0].bg_free_blocks_count, FREE_BLOCKS - 21); // 20 data + 1 indirect
+    ck_assert_uint_eq(file->inode->i_blocks, 21 * (BLOCK_SIZE / 512));
+    ck_assert_uint_eq(file->device_writes, 1);
+
+    ext2_block_extent run;
+    ck_assert_int_eq(ext2_block_map_range(&file->map, 0, 20, &run), SUCCESS);
+    ck_assert_uint_eq(run.start, FIRST_FREE_BLOCK);
+    ck_assert_uint_eq(run.length, 20);
+
+    uint8_t *back = malloc(size);
+    ck_assert_int_eq(ext2_file_pread(file, back, size, 0), size);
+    ck_assert_mem_eq(back, data, size);
+
+    free(back);
+    free(data);
+    ext2_file_close(file);
+}
+
+END_TEST
+
+START_TEST(file_truncate_should_free_blocks_past_the_new_end) {
+    // Arrange
+    ext2_file *file = ext2_file_open(fs, FILE_INODE);
+    ck_assert_ptr_nonnull(file);
+    const uint64_t new_size = 5 * BLOCK_SIZE + 100;
+    uint8_t back[BLOCK_SIZE];
+
+    // Act
+    const int shrunk = ext2_file_truncate(file, new_size);
+    const int grown = ext2_file_truncate(file, 6 * BLOCK_SIZE);
+
+    // Assert
+    ck_assert_int_eq(shrunk, SUCCESS);
+    ck_assert_int_eq(grown, SUCCESS);
+    // Logical 6-15 and 17-19 plus the indirect block.
+    ck_assert_uint_eq(fs->bgdt->groups[0].bg_free_blocks_count, FREE_BLOCKS + 14);
+    ck_assert_uint_eq(file->inode->i_blocks, 6 * (BLOCK_SIZE / 512));
+    ck_assert_uint_eq(file->inode->i_block[EXT2_IND_BLOCK], 0);
+    ck_assert_uint_eq(file->inode->i_block[6], 0);
+
+    ck_assert_int_eq(ext2_file_pread(file, back, sizeof(back), 5 * BLOCK_SIZE), BLOCK_SIZE);
+    assert_matches_file(back, 5 * BLOCK_SIZE, 100);
+    for (size_t i = 100; i < sizeof(back); ++i) {
+        ck_assert_uint_eq(back[i], 0);
+    }
+
+    ext2_file_close(file);
+}
+
+END_TEST
+
+START_TEST(file_write_should_reject_offsets_past_the_block_tree) {
+    // Arrange
+    ext2_file *file = ext2_file_open(fs, NEW_INODE);
+    ck_assert_ptr_nonnull(file);
+    const uint64_t per = BLOCK_SIZE / 4;
+    const uint64_t max_size = (12 + per + per * per + per * per * per) * BLOCK_SIZE;
+
+    // Act
+    const ssize_t result = ext2_file_pwrite(file, "x", 1, max_size);
+
+    // Assert
+    ck_assert_int_eq(result, INVALID_PARAMETER);
+    ck_assert_uint_eq(ext2_file_size(file), 0);
+
+    ext2_file_close(file);
+}
+
+END_TEST
+
+Suite *file_suite(void) {
+    Suite *s = suite_create("File");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, file_read_should_return_the_whole_file_with_coalesced_reads);
+    tcase_add_test(tc_core, file_pread_should_handle_unaligned_ranges_and_holes);
+    tcase_add_test(tc_core, file_read_should_grow_readahead_for_small_sequential_reads);
+    tcase_add_test(tc_core, file_open_should_reject_non_regular_files);
+    tcase_add_test(tc_core, file_write_should_be_visible_before_and_after_flush);
+    tcase_add_test(tc_core, file_write_should_allocate_one_contiguous_run_at_flush);
+    tcase_add_test(tc_core, file_truncate_should_free_blocks_past_the_new_end);
+    tcase_add_test(tc_core, file_write_should_reject_offsets_past_the_block_tree);
+
+    suite_add_tcase(s, tc_core);
+    return s;
+}
+
+int main(void) {
+    Suite *s = file_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    const int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
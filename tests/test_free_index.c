@@ -0,0 +1,159 @@
+#include "free_index.h"
+#include "globals.h"
+
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GROUPS 300 // Not a power of two, so the trees have unused leaves
+
+// Mock data
+static ext2_group_desc *groups;
+static ext2_free_index *summary;
+
+void setup(void) {
+    groups = calloc(GROUPS, sizeof(ext2_group_desc));
+    ck_assert_ptr_nonnull(groups);
+    summary = NULL;
+}
+
+void teardown(void) {
+    free_index_destroy(summary);
+    free(groups);
+}
+
+static void set_free_blocks(const uint16_t *counts, const uint32_t count) {
+    for (uint32_t g = 0; g < count; ++g) {
+        groups[g].bg_free_blocks_count = counts[g];
+    }
+}
+
+/**
+ * @brief The answer free_index_find_next() should give, found by walking the descriptors.
+ */
+static int linear_find_next(const uint32_t from, const uint32_t min_free, uint32_t *group_out) {
+    for (uint32_t g = from; g < GROUPS; ++g) {
+        if (groups[g].bg_free_blocks_count >= (min_free == 0 ? 1 : min_free)) {
+            *group_out = g;
+            return SUCCESS;
+        }
+    }
+    return ERROR;
+}
+
+static int linear_find_prev(const uint32_t from, const uint32_t min_free, uint32_t *group_out) {
+    for (uint32_t g = from + 1; g-- > 0;) {
+        if (groups[g].bg_free_blocks_count >= (min_free == 0 ? 1 : min_free)) {
+            *group_out = g;
+            return SUCCESS;
+        }
+    }
+    return ERROR;
+}
+
+START_TEST(free_index_should_find_groups_with_enough_free_on_either_side)
+{
+    // Arrange
+    const uint16_t counts[] = {0, 3, 0, 10, 2};
+    set_free_blocks(counts, 5);
+    summary = free_index_create(groups, 5);
+    ck_assert_ptr_nonnull(summary);
+    uint32_t group;
+
+    // Act & Assert
+    ck_assert_int_eq(free_index_find_next(summary, EXT2_BLOCK_BITMAP, 0, 1, &group), SUCCESS);
+    ck_assert_uint_eq(group, 1);
+    ck_assert_int_eq(free_index_find_next(summary, EXT2_BLOCK_BITMAP, 0, 5, &group), SUCCESS);
+    ck_assert_uint_eq(group, 3);
+    ck_assert_int_eq(free_index_find_next(summary, EXT2_BLOCK_BITMAP, 4, 3, &group), ERROR);
+    ck_assert_int_eq(free_index_find_prev(summary, EXT2_BLOCK_BITMAP, 4, 3, &group), SUCCESS);
+    ck_assert_uint_eq(group, 3);
+    ck_assert_int_eq(free_index_find_prev(summary, EXT2_BLOCK_BITMAP, 2, 4, &group), ERROR);
+    ck_assert_int_eq(free_index_find_next(summary, EXT2_INODE_BITMAP, 0, 1, &group), ERROR);
+}
+END_TEST
+
+START_TEST(free_index_find_near_should_prefer_the_higher_group_on_a_tie)
+{
+    // Arrange
+    const uint16_t counts[] = {5, 0, 0, 0, 5};
+    set_free_blocks(counts, 5);
+    summary = free_index_create(groups, 5);
+    ck_assert_ptr_nonnull(summary);
+    uint32_t tie;
+    uint32_t closer;
+
+    // Act
+    const int tie_result = free_index_find_near(summary, EXT2_BLOCK_BITMAP, 2, 1, &tie);
+    const int closer_result = free_index_find_near(summary, EXT2_BLOCK_BITMAP, 1, 1, &closer);
+
+    // Assert
+    ck_assert_int_eq(tie_result, SUCCESS);
+    ck_assert_uint_eq(tie, 4);
+    ck_assert_int_eq(closer_result, SUCCESS);
+    ck_assert_uint_eq(closer, 0);
+}
+END_TEST
+
+START_TEST(free_index_should_agree_with_a_linear_search_after_updates)
+{
+    // Arrange
+    srand(1);
+    for (uint32_t g = 0; g < GROUPS; ++g) {
+        groups[g].bg_free_blocks_count = rand() % 4 == 0 ? (uint16_t) (rand() % 100) : 0;
+        groups[g].bg_free_inodes_count = 7;
+    }
+    summary = free_index_create(groups, GROUPS);
+    ck_assert_ptr_nonnull(summary);
+
+    for (int round = 0; round < 50; ++round) {
+        // Act
+        const uint32_t changed = (uint32_t) rand() % GROUPS;
+        groups[changed].bg_free_blocks_count = rand() % 2 == 0 ? 0 : (uint16_t) (rand() % 100);
+        free_index_update(summary, EXT2_BLOCK_BITMAP, changed, groups[changed].bg_free_blocks_count);
+
+        // Assert
+        for (uint32_t from = 0; from < GROUPS; ++from) {
+            const uint32_t min_free = (uint32_t) rand() % 60;
+            uint32_t expected;
+            uint32_t found;
+            const int expected_status = linear_find_next(from, min_free, &expected);
+            ck_assert_int_eq(free_index_find_next(summary, EXT2_BLOCK_BITMAP, from, min_free, &found), expected_status);
+            if (expected_status == SUCCESS) {
+                ck_assert_uint_eq(found, expected);
+            }
+            const int expected_prev_status = linear_find_prev(from, min_free, &expected);
+            ck_assert_int_eq(free_index_find_prev(summary, EXT2_BLOCK_BITMAP, from, min_free, &found),
+                             expected_prev_status);
+            if (expected_prev_status == SUCCESS) {
+                ck_assert_uint_eq(found, expected);
+            }
+        }
+    }
+    uint32_t group;
+    ck_assert_int_eq(free_index_find_next(summary, EXT2_INODE_BITMAP, GROUPS - 1, 7, &group), SUCCESS);
+    ck_assert_uint_eq(group, GROUPS - 1);
+}
+END_TEST
+
+Suite *free_index_suite(void) {
+    Suite *s = suite_create("FreeIndex");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, free_index_should_find_groups_with_enough_free_on_either_side);
+    tcase_add_test(tc_core, free_index_find_near_should_prefer_the_higher_group_on_a_tie);
+    tcase_add_test(tc_core, free_index_should_agree_with_a_linear_search_after_updates);
+
+    suite_add_tcase(s, tc_core);
+    return s;
+}
+
+int main(void) {
+    Suite *s = free_index_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    const int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,272 @@
+#include "fsck.h"
+#include "globals.h"
+#include "superblock.h"
+#include "block_group.h"
+#include "inode.h"
+#include "bitmap.h"
+#include "filesystem.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_SIZE 1024
+#define IMAGE_BLOCKS 64
+#define USED_BLOCKS 9
+#define ROOT_BLOCK 7
+#define FILE_INODE 12
+
+// Mock data
+static ext2_super_block *sb;
+static ext2_group_desc group;
+static FILE *fs_image;
+static ext2_stream_context context;
+
+static void write_entry(
+    uint8_t *block,
+    const uint32_t offset,
+    const uint32_t inode_num,
+    const uint16_t rec_len,
+    const char *name
+) {
+    ext2_directory_entry *entry = (ext2_directory_entry *) (block + offset);
+    entry->inode = inode_num;
+    entry->rec_len = rec_len;
+    entry->name_len = (uint8_t) strlen(name);
+    memcpy(entry->name, name, strlen(name));
+}
+
+static ext2_inode file_inode(void) {
+    ext2_inode inode = {0};
+    inode.i_mode = EXT2_S_IFREG | 0644;
+    inode.i_links_count = 1;
+    inode.i_size = 2 * BLOCK_SIZE;
+    inode.i_blocks = 2 * (BLOCK_SIZE / 512);
+    inode.i_block[0] = 8;
+    inode.i_block[1] = 9;
+    return inode;
+}
+
+// A consistent single-group image: superblock and descriptors in blocks 1-2,
+// bitmaps in 3-4, the inode table in 5-6, the root directory in block 7 and a
+// two-block file (inode 12, named "file") in blocks 8-9. Inodes 1-10 are reserved.
+void setup(void) {
+    sb = calloc(1, sizeof(ext2_super_block));
+    ck_assert_ptr_nonnull(sb);
+    sb->s_magic = EXT2_SUPER_MAGIC;
+    sb->s_inodes_count = 16;
+    sb->s_blocks_count = IMAGE_BLOCKS;
+    sb->s_inodes_per_group = 16;
+    sb->s_blocks_per_group = IMAGE_BLOCKS;
+    sb->s_inode_size = sizeof(ext2_inode);
+    sb->s_first_data_block = 1;
+    sb->s_free_blocks_count = IMAGE_BLOCKS - 1 - USED_BLOCKS;
+    sb->s_free_inodes_count = 5;
+    memset(&group, 0, sizeof(group));
+    group.bg_block_bitmap = 3;
+    group.bg_inode_bitmap = 4;
+    group.bg_inode_table = 5;
+    group.bg_free_blocks_count = IMAGE_BLOCKS - 1 - USED_BLOCKS;
+    group.bg_free_inodes_count = 5;
+    group.bg_used_dirs_count = 1;
+
+    fs_image = tmpfile();
+    ck_assert_ptr_nonnull(fs_image);
+    static const uint8_t zero_block[BLOCK_SIZE];
+    for (int i = 0; i < IMAGE_BLOCKS; ++i) {
+        fwrite(zero_block, 1, BLOCK_SIZE, fs_image);
+    }
+
+    // Bit i is block i + 1; the last bit lies past the end of the image.
+    uint8_t bitmap[BLOCK_SIZE] = {0};
+    for (uint32_t bit = 0; bit < IMAGE_BLOCKS; ++bit) {
+        if (bit < USED_BLOCKS || bit + 1 >= IMAGE_BLOCKS) {
+            bitmap[bit / 8] |= (uint8_t) (1u << (bit % 8));
+        }
+    }
+    write_bitmap(fs_image, sb, group.bg_block_bitmap, bitmap);
+
+    // Reserved inodes 1-10 (including the root) and inode 12.
+    memset(bitmap, 0, sizeof(bitmap));
+    bitmap[0] = 0xFF;
+    bitmap[1] = 0x0B;
+    write_bitmap(fs_image, sb, group.bg_inode_bitmap, bitmap);
+
+    ext2_inode root = {0};
+    root.i_mode = EXT2_S_IFDIR | 0755;
+    root.i_links_count = 2;
+    root.i_size = BLOCK_SIZE;
+    root.i_blocks = BLOCK_SIZE / 512;
+    root.i_block[0] = ROOT_BLOCK;
+    ck_assert_int_eq(write_inode(fs_image, sb, &group, EXT2_ROOT_INO, &root), SUCCESS);
+
+    ext2_inode file = file_inode();
+    ck_assert_int_eq(write_inode(fs_image, sb, &group, FILE_INODE, &file), SUCCESS);
+
+    uint8_t block[BLOCK_SIZE] = {0};
+    write_entry(block, 0, EXT2_ROOT_INO, 12, ".");
+    write_entry(block, 12, EXT2_ROOT_INO, 12, "..");
+    write_entry(block, 24, FILE_INODE, BLOCK_SIZE - 24, "file");
+    fseek(fs_image, (long) ROOT_BLOCK * BLOCK_SIZE, SEEK_SET);
+    fwrite(block, 1, BLOCK_SIZE, fs_image);
+    fflush(fs_image);
+}
+
+void teardown(void) {
+    free(sb);
+    fclose(fs_image);
+}
+
+static void run_check(ext2_fsck_report *report) {
+    ext2_filesystem *fs = filesystem_wrap_stream(&context, fs_image, sb, &group);
+    ck_assert_int_eq(ext2_fsck(fs, NULL, report), SUCCESS);
+}
+
+static const ext2_fsck_finding *find_problem(const ext2_fsck_report *report, const ext2_fsck_problem problem) {
+    for (uint32_t i = 0; i < report->count; ++i) {
+        if (report->findings[i].problem == problem) {
+            return &report->findings[i];
+        }
+    }
+    return NULL;
+}
+
+START_TEST(fsck_should_accept_a_consistent_image)
+{
+    // Arrange
+    ext2_fsck_report report;
+
+    // Act
+    run_check(&report);
+
+    // Assert
+    ck_assert_uint_eq(report.count, 0);
+    ck_assert_uint_eq(report.groups, 1);
+    ck_assert_uint_eq(report.inodes_in_use, 11);
+    ck_assert_uint_eq(report.directories, 1);
+    ck_assert_uint_eq(report.blocks_claimed, USED_BLOCKS);
+
+    ext2_fsck_report_free(&report);
+}
+END_TEST
+
+START_TEST(fsck_should_compare_descriptor_counts_with_bitmaps)
+{
+    // Arrange
+    group.bg_free_blocks_count -= 4;
+    ext2_fsck_report report;
+
+    // Act
+    run_check(&report);
+
+    // Assert
+    ck_assert_uint_eq(report.count, 1);
+    ck_assert_int_eq(report.findings[0].problem, EXT2_FSCK_GROUP_FREE_BLOCKS);
+    ck_assert_int_eq(report.findings[0].expected, IMAGE_BLOCKS - 1 - USED_BLOCKS);
+    ck_assert_int_eq(report.findings[0].found, IMAGE_BLOCKS - 1 - USED_BLOCKS - 4);
+
+    ext2_fsck_report_free(&report);
+}
+END_TEST
+
+START_TEST(fsck_should_report_wrong_link_counts)
+{
+    // Arrange
+    ext2_inode file = file_inode();
+    file.i_links_count = 2;
+    ck_assert_int_eq(write_inode(fs_image, sb, &group, FILE_INODE, &file), SUCCESS);
+    fflush(fs_image);
+    ext2_fsck_report report;
+
+    // Act
+    run_check(&report);
+
+    // Assert
+    ck_assert_uint_eq(report.count, 1);
+    ck_assert_int_eq(report.findings[0].problem, EXT2_FSCK_LINK_COUNT);
+    ck_assert_uint_eq(report.findings[0].inode, FILE_INODE);
+    ck_assert_int_eq(report.findings[0].expected, 1);
+    ck_assert_int_eq(report.findings[0].found, 2);
+
+    ext2_fsck_report_free(&report);
+}
+END_TEST
+
+START_TEST(fsck_should_report_cross_linked_and_leaked_blocks)
+{
+    // Arrange
+    ext2_inode file = file_inode();
+    file.i_block[1] = ROOT_BLOCK;
+    ck_assert_int_eq(write_inode(fs_image, sb, &group, FILE_INODE, &file), SUCCESS);
+    fflush(fs_image);
+    ext2_fsck_report report;
+
+    // Act
+    run_check(&report);
+
+    // Assert
+    ck_assert_uint_eq(report.count, 2);
+    const ext2_fsck_finding *duplicate = find_problem(&report, EXT2_FSCK_DUPLICATE_BLOCK);
+    ck_assert_ptr_nonnull(duplicate);
+    ck_assert_uint_eq(duplicate->block, ROOT_BLOCK);
+    const ext2_fsck_finding *leaked = find_problem(&report, EXT2_FSCK_BLOCK_NOT_USED);
+    ck_assert_ptr_nonnull(leaked);
+    ck_assert_uint_eq(leaked->block, 9);
+    ck_assert_uint_eq(leaked->count, 1);
+
+    ext2_fsck_report_free(&report);
+}
+END_TEST
+
+START_TEST(fsck_write_json_should_emit_one_line_per_finding_and_a_summary)
+{
+    // Arrange
+    sb->s_free_inodes_count = 4;
+    ext2_fsck_report report;
+    run_check(&report);
+    FILE *out = tmpfile();
+    ck_assert_ptr_nonnull(out);
+
+    // Act
+    const int result = ext2_fsck_write_json(out, &report);
+
+    // Assert
+    ck_assert_int_eq(result, SUCCESS);
+    rewind(out);
+    char line[512];
+    ck_assert_ptr_nonnull(fgets(line, sizeof(line), out));
+    ck_assert_str_eq(line, "{\"type\":\"problem\",\"problem\":\"super_free_inodes\",\"group\":null,\"inode\":0,"
+                           "\"block\":0,\"count\":1,\"expected\":5,\"found\":4}\n");
+    ck_assert_ptr_nonnull(fgets(line, sizeof(line), out));
+    ck_assert(strncmp(line, "{\"type\":\"summary\",", 18) == 0);
+    ck_assert_ptr_null(fgets(line, sizeof(line), out));
+
+    fclose(out);
+    ext2_fsck_report_free(&report);
+}
+END_TEST
+
+Suite *fsck_suite(void) {
+    Suite *s = suite_create("Fsck");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, fsck_should_accept_a_consistent_image);
+    tcase_add_test(tc_core, fsck_should_compare_descriptor_counts_with_bitmaps);
+    tcase_add_test(tc_core, fsck_should_report_wrong_link_counts);
+    tcase_add_test(tc_core, fsck_should_report_cross_linked_and_leaked_blocks);
+    tcase_add_test(tc_core, fsck_write_json_should_emit_one_line_per_finding_and_a_summary);
+
+    suite_add_tcase(s, tc_core);
+    return s;
+}
+
+int main(void) {
+    Suite *s = fsck_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    const int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,367 @@
+#include "htree.h"
+#include "directory.h"
+#include "globals.h"
+#include "inode.h"
+#include "bitmap.h"
+#include "bmap.h"
+#include "superblock.h"
+#include "filesystem.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROOT_BLOCK 15
+#define BLOCK_BITMAP_BLOCK 3
+#define GROWN_BLOCKS 2048
+
+// Mock data
+static ext2_super_block *sb;
+static ext2_group_desc *bgdt;
+static ext2_inode *dir_inode;
+static FILE *fs_image;
+static ext2_stream_context context;
+
+static const char *names[] = {"alpha", "beta", "gamma", "delta"};
+static uint32_t hashes[4];
+
+static void write_entry(
+    char *block,
+    const uint32_t offset,
+    const uint32_t inode_num,
+    const uint16_t rec_len,
+    const char *name
+) {
+    ext2_directory_entry *entry = (ext2_directory_entry *) (block + offset);
+    entry->inode = inode_num;
+    entry->rec_len = rec_len;
+    entry->name_len = (uint8_t) strlen(name);
+    entry->file_type = EXT2_FT_REG_FILE;
+    memcpy(entry->name, name, strlen(name));
+}
+
+static void write_block(const uint32_t block_id, const void *data) {
+    fseeko(fs_image, (off_t) block_id * get_block_size(sb), SEEK_SET);
+    fwrite(data, get_block_size(sb), 1, fs_image);
+}
+
+static int compare_by_hash(const void *a, const void *b) {
+    const uint32_t left = hashes[*(const int *) a];
+    const uint32_t right = hashes[*(const int *) b];
+    return left < right ? -1 : left > right;
+}
+
+// The directory is an index root in block 15 with two leaves: the two names with
+// the lowest half_md4 hashes in block 16 and the other two in block 17. Name i
+// has inode 5 + i.
+void setup(void) {
+    sb = calloc(1, sizeof(ext2_super_block));
+    ck_assert_ptr_nonnull(sb);
+    sb->s_inodes_count = 32;
+    sb->s_blocks_count = 32;
+    sb->s_inodes_per_group = 16;
+    sb->s_blocks_per_group = 16;
+    sb->s_inode_size = sizeof(ext2_inode);
+    sb->s_log_block_size = 0; // 1024 bytes
+    sb->s_feature_compat = EXT2_FEATURE_COMPAT_DIR_INDEX;
+    sb->s_flags = EXT2_FLAGS_SIGNED_HASH;
+
+    bgdt = calloc(2, sizeof(ext2_group_desc));
+    ck_assert_ptr_nonnull(bgdt);
+    bgdt[0].bg_inode_table = 10;
+    bgdt[1].bg_inode_table = 20;
+
+    const uint32_t block_size = get_block_size(sb);
+    dir_inode = calloc(1, sizeof(ext2_inode));
+    ck_assert_ptr_nonnull(dir_inode);
+    dir_inode->i_mode = EXT2_S_IFDIR;
+    dir_inode->i_size = 3 * block_size;
+    dir_inode->i_links_count = 2;
+    dir_inode->i_blocks = 6;
+    dir_inode->i_flags = EXT2_INDEX_FL;
+    dir_inode->i_block[0] = ROOT_BLOCK;
+    dir_inode->i_block[1] = ROOT_BLOCK + 1;
+    dir_inode->i_block[2] = ROOT_BLOCK + 2;
+
+    int order[4] = {0, 1, 2, 3};
+    for (int i = 0; i < 4; ++i) {
+        ck_assert_int_eq(ext2_dx_hash(names[i], strlen(names[i]), EXT2_DX_HASH_HALF_MD4, sb->s_hash_seed,
+                                      &hashes[i], NULL), SUCCESS);
+    }
+    qsort(order, 4, sizeof(int), compare_by_hash);
+
+    fs_image = tmpfile();
+    ck_assert_ptr_nonnull(fs_image);
+
+    char block[1024] = {0};
+    write_entry(block, 0, 1, 12, ".");
+    write_entry(block, 12, 2, (uint16_t) (block_size - 12), "..");
+    ext2_dx_root_info *info = (ext2_dx_root_info *) (block + 24);
+    info->hash_version = EXT2_DX_HASH_HALF_MD4;
+    info->info_length = sizeof(ext2_dx_root_info);
+    ext2_dx_countlimit *cl = (ext2_dx_countlimit *) (block + 32);
+    cl->limit = (uint16_t) ((block_size - 32) / sizeof(ext2_dx_entry));
+    cl->count = 2;
+    ext2_dx_entry *entries = (ext2_dx_entry *) (block + 32);
+    entries[0].block = 1;
+    entries[1].hash = hashes[order[2]];
+    entries[1].block = 2;
+    write_block(ROOT_BLOCK, block);
+
+    for (int leaf = 0; leaf < 2; ++leaf) {
+        memset(block, 0, sizeof(block));
+        const int first = order[2 * leaf];
+        const int second = order[2 * leaf + 1];
+        write_entry(block, 0, 5 + first, 16, names[first]);
+        write_entry(block, 16, 5 + second, (uint16_t) (block_size - 16), names[second]);
+        write_block(ROOT_BLOCK + 1 + leaf, block);
+    }
+    fflush(fs_image);
+}
+
+void teardown(void) {
+    free(sb);
+    free(bgdt);
+    free(dir_inode);
+    fclose(fs_image);
+}
+
+START_TEST(dx_hash_should_match_reference_values)
+{
+    // Arrange
+    uint32_t legacy, half_md4, half_md4_minor, tea, tea_minor;
+
+    // Act
+    ext2_dx_hash("hello", 5, EXT2_DX_HASH_LEGACY, NULL, &legacy, NULL);
+    ext2_dx_hash("hello", 5, EXT2_DX_HASH_HALF_MD4, NULL, &half_md4, &half_md4_minor);
+    ext2_dx_hash("hello", 5, EXT2_DX_HASH_TEA, NULL, &tea, &tea_minor);
+
+    // Assert
+    ck_assert_uint_eq(legacy, 0x32252546);
+    ck_assert_uint_eq(half_md4, 0x1746da32);
+    ck_assert_uint_eq(half_md4_minor, 0x420013b5);
+    ck_assert_uint_eq(tea, 0x6f5bb1a8);
+    ck_assert_uint_eq(tea_minor, 0x231917c2);
+}
+END_TEST
+
+START_TEST(dx_hash_should_reject_unknown_versions)
+{
+    // Arrange
+    uint32_t hash;
+
+    // Act
+    const int result = ext2_dx_hash("hello", 5, 6, NULL, &hash, NULL);
+
+    // Assert
+    ck_assert_int_eq(result, INVALID_PARAMETER);
+}
+END_TEST
+
+START_TEST(htree_lookup_should_find_names_in_either_leaf)
+{
+    // Arrange
+    ext2_filesystem *fs = filesystem_wrap_stream(&context, fs_image, sb, bgdt);
+    ck_assert(ext2_htree_is_indexed(fs, dir_inode));
+
+    for (int i = 0; i < 4; ++i) {
+        uint32_t inode_num = 0;
+
+        // Act
+        const int result = ext2_htree_lookup(fs, dir_inode, names[i], strlen(names[i]), &inode_num);
+
+        // Assert
+        ck_assert_int_eq(result, 1);
+        ck_assert_uint_eq(inode_num, 5 + i);
+    }
+}
+END_TEST
+
+START_TEST(htree_lookup_should_report_missing_names)
+{
+    // Arrange
+    ext2_filesystem *fs = filesystem_wrap_stream(&context, fs_image, sb, bgdt);
+    uint32_t inode_num = 0;
+
+    // Act
+    const int result = ext2_htree_lookup(fs, dir_inode, "epsilon", 7, &inode_num);
+
+    // Assert
+    ck_assert_int_eq(result, 0);
+    ck_assert_uint_eq(inode_num, 0);
+}
+END_TEST
+
+START_TEST(htree_add_entry_should_place_entry_in_its_leaf)
+{
+    // Arrange
+    ext2_filesystem *fs = filesystem_wrap_stream(&context, fs_image, sb, bgdt);
+    uint32_t inode_num = 0;
+
+    // Act
+    const int result = ext2_htree_add_entry(fs, dir_inode, 9, "epsilon", 7, EXT2_FT_REG_FILE);
+
+    // Assert
+    ck_assert_int_eq(result, SUCCESS);
+    ck_assert_int_eq(ext2_htree_lookup(fs, dir_inode, "epsilon", 7, &inode_num), 1);
+    ck_assert_uint_eq(inode_num, 9);
+}
+END_TEST
+
+// Turns the image into a single group of GROWN_BLOCKS blocks with a block bitmap,
+// so inserts can append leaf and index blocks. Blocks up to the last leaf are in use.
+static void make_room_to_grow(void) {
+    sb->s_magic = EXT2_SUPER_MAGIC;
+    sb->s_blocks_count = GROWN_BLOCKS;
+    sb->s_blocks_per_group = GROWN_BLOCKS;
+    sb->s_free_blocks_count = GROWN_BLOCKS - (ROOT_BLOCK + 3);
+    bgdt[0].bg_block_bitmap = BLOCK_BITMAP_BLOCK;
+    bgdt[0].bg_free_blocks_count = (uint16_t) sb->s_free_blocks_count;
+
+    uint8_t bitmap[1024] = {0};
+    set_bit_range(bitmap, 0, ROOT_BLOCK + 3);
+    write_block(BLOCK_BITMAP_BLOCK, bitmap);
+    fflush(fs_image);
+}
+
+static void read_dir_block(ext2_filesystem *fs, const uint32_t logical, uint8_t *block) {
+    uint32_t physical = 0;
+    ck_assert_int_eq(ext2_bmap(fs, dir_inode, logical, &physical), SUCCESS);
+    ck_assert_uint_ne(physical, 0);
+    ck_assert_int_eq(filesystem_read(fs, (off_t) physical * get_block_size(sb), get_block_size(sb), block), SUCCESS);
+}
+
+// Every block must still parse as a linear directory block, so the index can be dropped.
+static void assert_blocks_form_a_linear_directory(ext2_filesystem *fs) {
+    const uint32_t block_size = get_block_size(sb);
+    uint8_t block[1024];
+    for (uint32_t logical = 0; logical < dir_inode->i_size / block_size; ++logical) {
+        read_dir_block(fs, logical, block);
+        uint32_t offset = 0;
+        while (offset < block_size) {
+            const ext2_directory_entry *entry = (const ext2_directory_entry *) (block + offset);
+            ck_assert_uint_ge(entry->rec_len, EXT2_DIR_REC_LEN(entry->name_len));
+            offset += entry->rec_len;
+        }
+        ck_assert_uint_eq(offset, block_size);
+    }
+}
+
+static void assert_names_are_found(ext2_filesystem *fs, const uint32_t count) {
+    char name[16];
+    for (uint32_t i = 0; i < count; ++i) {
+        snprintf(name, sizeof(name), "file%05u", i);
+        uint32_t inode_num = 0;
+        ck_assert_int_eq(ext2_htree_lookup(fs, dir_inode, name, strlen(name), &inode_num), 1);
+        ck_assert_uint_eq(inode_num, 100 + i);
+    }
+    for (int i = 0; i < 4; ++i) {
+        uint32_t inode_num = 0;
+        ck_assert_int_eq(ext2_htree_lookup(fs, dir_inode, names[i], strlen(names[i]), &inode_num), 1);
+        ck_assert_uint_eq(inode_num, 5 + i);
+    }
+}
+
+static void add_name(ext2_filesystem *fs, const uint32_t i) {
+    char name[16];
+    snprintf(name, sizeof(name), "file%05u", i);
+    ck_assert_int_eq(ext2_htree_add_entry(fs, dir_inode, 100 + i, name, (uint8_t) strlen(name), EXT2_FT_REG_FILE),
+                     SUCCESS);
+}
+
+START_TEST(htree_add_entry_should_split_a_full_leaf)
+{
+    // Arrange: two leaves hold at most 2 * 1024 / 20 of these names
+    make_room_to_grow();
+    ext2_filesystem *fs = filesystem_wrap_stream(&context, fs_image, sb, bgdt);
+    const uint32_t count = 200;
+
+    // Act
+    for (uint32_t i = 0; i < count; ++i) {
+        add_name(fs, i);
+    }
+
+    // Assert: the root points straight at every leaf
+    uint8_t root[1024];
+    read_dir_block(fs, 0, root);
+    const ext2_dx_root_info *info = (const ext2_dx_root_info *) (root + 24);
+    const ext2_dx_countlimit *cl = (const ext2_dx_countlimit *) (root + 32);
+    ck_assert_uint_eq(info->indirect_levels, 0);
+    ck_assert_uint_gt(cl->count, 2);
+    ck_assert_uint_eq(dir_inode->i_size / get_block_size(sb), 1 + cl->count);
+    assert_names_are_found(fs, count);
+    assert_blocks_form_a_linear_directory(fs);
+
+    // Cleanup
+    filesystem_finish_stream(fs, SUCCESS);
+}
+END_TEST
+
+START_TEST(htree_add_entry_should_add_an_index_level_and_split_nodes)
+{
+    // Arrange
+    make_room_to_grow();
+    ext2_filesystem *fs = filesystem_wrap_stream(&context, fs_image, sb, bgdt);
+    const uint32_t block_size = get_block_size(sb);
+    uint8_t root[1024];
+    const ext2_dx_root_info *info = (const ext2_dx_root_info *) (root + 24);
+    const ext2_dx_countlimit *root_cl = (const ext2_dx_countlimit *) (root + 32);
+    const ext2_dx_entry *root_entries = (const ext2_dx_entry *) (root + 32);
+
+    // Act: insert until the root has gained a level of nodes and one node has split
+    uint32_t count = 0;
+    do {
+        for (uint32_t end = count + 100; count < end; ++count) {
+            add_name(fs, count);
+        }
+        read_dir_block(fs, 0, root);
+    } while ((info->indirect_levels == 0 || root_cl->count < 2) && count < 20000);
+
+    // Assert: root -> nodes -> leaves, and every block is accounted for
+    ck_assert_uint_eq(info->indirect_levels, 1);
+    ck_assert_uint_eq(root_cl->count, 2);
+    uint32_t leaves = 0;
+    uint8_t node[1024];
+    for (uint32_t i = 0; i < root_cl->count; ++i) {
+        read_dir_block(fs, root_entries[i].block, node);
+        const ext2_dx_countlimit *cl = (const ext2_dx_countlimit *) (node + 8);
+        ck_assert_uint_eq(cl->limit, (block_size - 8) / sizeof(ext2_dx_entry));
+        ck_assert_uint_le(cl->count, cl->limit);
+        ck_assert_uint_gt(cl->count, cl->limit / 4);
+        leaves += cl->count;
+    }
+    ck_assert_uint_eq(dir_inode->i_size / block_size, 1 + root_cl->count + leaves);
+    assert_names_are_found(fs, count);
+    assert_blocks_form_a_linear_directory(fs);
+
+    // Cleanup
+    filesystem_finish_stream(fs, SUCCESS);
+}
+END_TEST
+
+Suite *htree_suite(void) {
+    Suite *s = suite_create("Htree");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, dx_hash_should_match_reference_values);
+    tcase_add_test(tc_core, dx_hash_should_reject_unknown_versions);
+    tcase_add_test(tc_core, htree_lookup_should_find_names_in_either_leaf);
+    tcase_add_test(tc_core, htree_lookup_should_report_missing_names);
+    tcase_add_test(tc_core, htree_add_entry_should_place_entry_in_its_leaf);
+    tcase_add_test(tc_core, htree_add_entry_should_split_a_full_leaf);
+    tcase_add_test(tc_core, htree_add_entry_should_add_an_index_level_and_split_nodes);
+
+    suite_add_tcase(s, tc_core);
+    return s;
+}
+
+int main(void) {
+    Suite *s = htree_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    const int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -2,6 +2,7 @@
 #include "globals.h"
 #include "superblock.h"
 #include "block_group.h"
+#include "filesystem.h"
 
 #include <check.h>
 #include <stdio.h>
@@ -144,6 +145,169 @@ START_TEST(write_inode_should_return_success_and_write_data_correctly)
 }
 END_TEST
 
+/**
+ * Two groups of 16 inodes with inode bitmaps in blocks 3 and 4. Every inode
+ * marked in `used` is written with i_size = 100 * its number.
+ */
+static FILE *create_scan_image(const uint32_t *used, const uint32_t count) {
+    sb->s_feature_ro_compat = 0;
+    memset(bgdt, 0, 2 * sizeof(ext2_group_desc));
+    bgdt[0].bg_inode_bitmap = 3;
+    bgdt[0].bg_inode_table = 10;
+    bgdt[1].bg_inode_bitmap = 4;
+    bgdt[1].bg_inode_table = 20;
+
+    FILE *fs_image = create_temp_fs_image(NULL, 0);
+    uint8_t zero_block[1024] = {0};
+    for (int i = 0; i < 24; ++i) {
+        fwrite(zero_block, 1, sizeof(zero_block), fs_image);
+    }
+
+    uint8_t bitmaps[2][1024] = {{0}};
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint32_t index = used[i] - 1;
+        bitmaps[index / 16][index % 16 / 8] |= (uint8_t) (1u << (index % 8));
+        ext2_inode inode = {0};
+        inode.i_mode = EXT2_S_IFREG;
+        inode.i_size = 100 * used[i];
+        ck_assert_int_eq(write_inode(fs_image, sb, bgdt, used[i], &inode), SUCCESS);
+    }
+    fseeko(fs_image, 3 * 1024, SEEK_SET);
+    fwrite(bitmaps, 1, sizeof(bitmaps), fs_image);
+    fflush(fs_image);
+    return fs_image;
+}
+
+START_TEST(ext2_inode_scan_should_return_only_inodes_in_use)
+{
+    // Arrange: chunks of one block (8 inodes) force several reads per group
+    const uint32_t used[] = {1, 2, 11, 20, 32};
+    FILE *fs_image = create_scan_image(used, 5);
+    ext2_stream_context context;
+    ext2_filesystem *fs = filesystem_wrap_stream(&context, fs_image, sb, bgdt);
+    ext2_inode_scan scan;
+    ck_assert_int_eq(ext2_inode_scan_open(&scan, fs, 1), SUCCESS);
+
+    // Act
+    uint32_t found[8];
+    uint32_t count = 0;
+    uint32_t inode_num;
+    const ext2_inode *inode;
+    int result;
+    while ((result = ext2_inode_scan_next(&scan, &inode_num, &inode)) == 1 && count < 8) {
+        ck_assert_uint_eq(inode->i_size, 100 * inode_num);
+        found[count++] = inode_num;
+    }
+
+    // Assert
+    ck_assert_int_eq(result, 0);
+    ck_assert_uint_eq(count, 5);
+    ck_assert_mem_eq(found, used, sizeof(used));
+
+    // Cleanup
+    ext2_inode_scan_close(&scan);
+    fclose(fs_image);
+}
+END_TEST
+
+START_TEST(ext2_inode_scan_should_skip_uninitialised_inode_tables)
+{
+    // Arrange: group 0 uses only its first 4 table entries, group 1 is uninitialised
+    const uint32_t used[] = {1, 3, 9, 17, 18};
+    FILE *fs_image = create_scan_image(used, 5);
+    sb->s_feature_ro_compat = EXT2_FEATURE_RO_COMPAT_GDT_CSUM;
+    bgdt[0].bg_itable_unused = 12;
+    bgdt[1].bg_flags = EXT2_BG_INODE_UNINIT;
+    ext2_stream_context context;
+    ext2_filesystem *fs = filesystem_wrap_stream(&context, fs_image, sb, bgdt);
+    ext2_inode_scan scan;
+    ck_assert_int_eq(ext2_inode_scan_open(&scan, fs, 0), SUCCESS);
+
+    // Act
+    uint32_t first;
+    uint32_t second;
+    const ext2_inode *inode;
+    const int first_result = ext2_inode_scan_next(&scan, &first, &inode);
+    const int second_result = ext2_inode_scan_next(&scan, &second, &inode);
+    const int end_result = ext2_inode_scan_next(&scan, &second, &inode);
+
+    // Assert
+    ck_assert_int_eq(first_result, 1);
+    ck_assert_uint_eq(first, 1);
+    ck_assert_int_eq(second_result, 1);
+    ck_assert_uint_eq(second, 3);
+    ck_assert_uint_eq(inode->i_size, 300);
+    ck_assert_int_eq(end_result, 0);
+
+    // Cleanup
+    ext2_inode_scan_close(&scan);
+    fclose(fs_image);
+}
+END_TEST
+
+START_TEST(ext2_read_inode_full_should_expose_large_inode_fields)
+{
+    // Arrange: 256-byte entries; inode 18 has nanosecond times and a "user.color" attribute
+    sb->s_rev_level = EXT2_DYNAMIC_REV;
+    sb->s_inode_size = 256;
+    const uint32_t inode_num = 18;
+    const off_t entry_offset = (off_t) bgdt[1].bg_inode_table * get_block_size(sb) + 256;
+    const size_t file_size = entry_offset + 256;
+    uint8_t *image = calloc(1, file_size);
+    ck_assert_ptr_nonnull(image);
+    ext2_inode_large *large = (ext2_inode_large *) (image + entry_offset);
+    large->inode = *test_inode;
+    large->inode.i_mtime = 1000;
+    large->i_extra_isize = 32;
+    large->i_mtime_extra = 123456789u << 2 | 1;
+    large->i_crtime = 500;
+    large->i_crtime_extra = 7u << 2;
+    uint8_t *xattrs = image + entry_offset + EXT2_GOOD_OLD_INODE_SIZE + 32;
+    const uint32_t magic = EXT2_XATTR_MAGIC;
+    memcpy(xattrs, &magic, sizeof(magic));
+    ext2_xattr_entry *entry = (ext2_xattr_entry *) (xattrs + 4);
+    entry->e_name_len = 5;
+    entry->e_name_index = 1;
+    entry->e_value_offs = 28;
+    entry->e_value_size = 4;
+    memcpy(entry->e_name, "color", 5);
+    memcpy(xattrs + 4 + 28, "blue", 4);
+    FILE *fs_image = create_temp_fs_image((const char *) image, file_size);
+    ext2_stream_context context;
+    ext2_filesystem *fs = filesystem_wrap_stream(&context, fs_image, sb, bgdt);
+    uint8_t full[256];
+
+    // Act
+    const int result = ext2_read_inode_full(fs, inode_num, full, sizeof(full));
+
+    // Assert
+    ck_assert_int_eq(result, SUCCESS);
+    const ext2_inode *inode = (const ext2_inode *) full;
+    ck_assert_uint_eq(inode->i_mode, test_inode->i_mode);
+    ck_assert_uint_eq(ext2_inode_extra_isize(inode, sizeof(full)), 32);
+
+    struct timespec time;
+    ck_assert_int_eq(ext2_inode_get_time(inode, sizeof(full), EXT2_INODE_MTIME, &time), SUCCESS);
+    ck_assert_int_eq(time.tv_sec, 1000 + (1LL << 32));
+    ck_assert_int_eq(time.tv_nsec, 123456789);
+    ck_assert_int_eq(ext2_inode_get_time(inode, sizeof(full), EXT2_INODE_CRTIME, &time), SUCCESS);
+    ck_assert_int_eq(time.tv_sec, 500);
+    ck_assert_int_eq(time.tv_nsec, 7);
+    ck_assert_int_eq(ext2_inode_get_time(inode, sizeof(ext2_inode), EXT2_INODE_CRTIME, &time), ERROR);
+
+    const void *value;
+    uint32_t value_size;
+    ck_assert_int_eq(ext2_inode_xattr_get(inode, sizeof(full), 1, "color", &value, &value_size), 1);
+    ck_assert_uint_eq(value_size, 4);
+    ck_assert(memcmp(value, "blue", 4) == 0);
+    ck_assert_int_eq(ext2_inode_xattr_get(inode, sizeof(full), 1, "size", &value, &value_size), 0);
+
+    // Cleanup
+    fclose(fs_image);
+    free(image);
+}
+END_TEST
+
 Suite *inode_suite(void) {
     Suite *s = suite_create("Inode");
     TCase *tc_core = tcase_create("Core");
@@ -153,6 +317,9 @@ Suite *inode_suite(void) {
     tcase_add_test(tc_core, read_inode_should_return_error_for_invalid_inode_number);
     tcase_add_test(tc_core, read_inode_should_return_error_for_null_parameters);
     tcase_add_test(tc_core, write_inode_should_return_success_and_write_data_correctly);
+    tcase_add_test(tc_core, ext2_inode_scan_should_return_only_inodes_in_use);
+    tcase_add_test(tc_core, ext2_inode_scan_should_skip_uninitialised_inode_tables);
+    tcase_add_test(tc_core, ext2_read_inode_full_should_expose_large_inode_fields);
 
     suite_add_tcase(s, tc_core);
     return s;
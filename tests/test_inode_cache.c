@@ -0,0 +1,221 @@
+#include "inode_cache.h"
+#include "inode.h"
+#include "globals.h"
+#include "superblock.h"
+#include "block_group.h"
+#include "filesystem.h"
+#include "block_device.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_SIZE 1024
+#define IMAGE_BLOCKS 32
+
+// Mock data
+static ext2_super_block *sb;
+static ext2_group_desc groups[2];
+static FILE *fs_image;
+static ext2_filesystem *fs;
+
+// Reads an inode straight from the image file, bypassing every cache.
+static ext2_inode read_inode_from_image(const uint32_t inode_num) {
+    ext2_inode inode;
+    const uint32_t group = (inode_num - 1) / sb->s_inodes_per_group;
+    const uint32_t index = (inode_num - 1) % sb->s_inodes_per_group;
+    fseek(fs_image, (long) groups[group].bg_inode_table * BLOCK_SIZE + (long) index * sb->s_inode_size, SEEK_SET);
+    ck_assert_uint_eq(fread(&inode, sizeof(inode), 1, fs_image), 1);
+    return inode;
+}
+
+static void write_mode_to_image(const uint32_t inode_num, const uint16_t mode) {
+    ext2_inode inode = read_inode_from_image(inode_num);
+    inode.i_mode = mode;
+    ck_assert_int_eq(write_inode(fs_image, sb, groups, inode_num, &inode), SUCCESS);
+    fflush(fs_image);
+}
+
+void setup(void) {
+    sb = calloc(1, sizeof(ext2_super_block));
+    ck_assert_ptr_nonnull(sb);
+    sb->s_magic = EXT2_SUPER_MAGIC;
+    sb->s_inodes_count = 32;
+    sb->s_blocks_count = IMAGE_BLOCKS;
+    sb->s_inodes_per_group = 16;
+    sb->s_blocks_per_group = 16;
+    sb->s_inode_size = sizeof(ext2_inode);
+    sb->s_log_block_size = 0; // -> 1024 bytes
+    sb->s_first_data_block = 1;
+
+    memset(groups, 0, sizeof(groups));
+    groups[0].bg_inode_table = 5;  // Blocks 5-6
+    groups[1].bg_inode_table = 20; // Blocks 20-21
+
+    fs_image = tmpfile();
+    ck_assert_ptr_nonnull(fs_image);
+    static const uint8_t zero_block[BLOCK_SIZE];
+    for (int i = 0; i < IMAGE_BLOCKS; ++i) {
+        fwrite(zero_block, 1, BLOCK_SIZE, fs_image);
+    }
+    write_superblock(fs_image, sb);
+    write_group_descriptor(fs_image, sb, 0, &groups[0]);
+    write_group_descriptor(fs_image, sb, 1, &groups[1]);
+    fflush(fs_image);
+
+    // No block cache, so every miss is visible as a read of the image file.
+    fs = filesystem_init_device(block_device_from_stream(fs_image, 0), 0);
+    ck_assert_ptr_nonnull(fs);
+    ck_assert_ptr_nonnull(fs->icache);
+}
+
+void teardown(void) {
+    filesystem_free(fs);
+    free(sb);
+    fclose(fs_image);
+}
+
+START_TEST(inode_get_should_return_the_same_copy_to_every_holder) {
+    // Act
+    ext2_inode *first = ext2_inode_get(fs, 3);
+    ext2_inode *second = ext2_inode_get(fs, 3);
+
+    // Assert
+    ck_assert_ptr_nonnull(first);
+    ck_assert_ptr_eq(first, second);
+    ck_assert_uint_eq(fs->icache->stats.misses, 1);
+    ck_assert_uint_eq(fs->icache->stats.hits, 1);
+
+    ext2_inode_put(fs, first);
+    ext2_inode_put(fs, second);
+}
+
+END_TEST
+
+START_TEST(read_inode_should_not_touch_the_image_on_a_hit) {
+    // Arrange
+    write_mode_to_image(17, EXT2_S_IFDIR | 0755);
+    ext2_inode warm;
+    ck_assert_int_eq(ext2_read_inode(fs, 17, &warm), SUCCESS);
+    write_mode_to_image(17, EXT2_S_IFREG | 0644);
+
+    // Act
+    ext2_inode again;
+    const int result = ext2_read_inode(fs, 17, &again);
+
+    // Assert
+    ck_assert_int_eq(result, SUCCESS);
+    ck_assert_uint_eq(warm.i_mode, EXT2_S_IFDIR | 0755);
+    ck_assert_uint_eq(again.i_mode, EXT2_S_IFDIR | 0755);
+    ck_assert_uint_eq(fs->icache->stats.hits, 1);
+}
+
+END_TEST
+
+START_TEST(write_inode_should_defer_the_write_until_sync) {
+    // Arrange
+    ext2_inode inode = {0};
+    inode.i_mode = EXT2_S_IFREG | 0600;
+    inode.i_size = 1234;
+
+    // Act
+    ck_assert_int_eq(ext2_write_inode(fs, 2, &inode), SUCCESS);
+    const ext2_inode before_sync = read_inode_from_image(2);
+    const int sync_result = filesystem_sync(fs);
+    const ext2_inode after_sync = read_inode_from_image(2);
+
+    // Assert
+    ck_assert_uint_eq(before_sync.i_size, 0);
+    ck_assert_int_eq(sync_result, SUCCESS);
+    ck_assert_uint_eq(after_sync.i_size, 1234);
+    ck_assert_uint_eq(after_sync.i_mode, EXT2_S_IFREG | 0600);
+}
+
+END_TEST
+
+START_TEST(eviction_should_write_back_dirty_inodes) {
+    // Arrange
+    ck_assert_int_eq(ext2_set_inode_cache_size(fs, 2), SUCCESS);
+    ext2_inode *dirty = ext2_inode_get(fs, 1);
+    ck_assert_ptr_nonnull(dirty);
+    dirty->i_links_count = 7;
+    ext2_inode_mark_dirty(fs, dirty);
+    ext2_inode_put(fs, dirty);
+
+    // Act: two more inodes push inode 1 out of a two-entry cache.
+    for (uint32_t inode_num = 2; inode_num <= 4; ++inode_num) {
+        ext2_inode_put(fs, ext2_inode_get(fs, inode_num));
+    }
+
+    // Assert
+    ck_assert_uint_ge(fs->icache->stats.evictions, 1);
+    ck_assert_uint_eq(fs->icache->stats.writebacks, 1);
+    ck_assert_uint_eq(read_inode_from_image(1).i_links_count, 7);
+}
+
+END_TEST
+
+START_TEST(inode_get_should_fail_when_every_entry_is_referenced) {
+    // Arrange
+    ck_assert_int_eq(ext2_set_inode_cache_size(fs, 1), SUCCESS);
+    ext2_inode *held = ext2_inode_get(fs, 1);
+    ck_assert_ptr_nonnull(held);
+
+    // Act
+    ext2_inode *other = ext2_inode_get(fs, 2);
+    const int resize_result = ext2_set_inode_cache_size(fs, 4);
+
+    // Assert
+    ck_assert_ptr_null(other);
+    ck_assert_int_eq(resize_result, ERROR);
+
+    ext2_inode_put(fs, held);
+    ck_assert_int_eq(ext2_set_inode_cache_size(fs, 4), SUCCESS);
+}
+
+END_TEST
+
+START_TEST(inode_put_should_write_back_private_copies_without_a_cache) {
+    // Arrange
+    ck_assert_int_eq(ext2_set_inode_cache_size(fs, 0), SUCCESS);
+    ck_assert_ptr_null(fs->icache);
+
+    // Act
+    ext2_inode *first = ext2_inode_get(fs, 18);
+    ck_assert_ptr_nonnull(first);
+    first->i_uid = 42;
+    ext2_inode_mark_dirty(fs, first);
+    ext2_inode_put(fs, first);
+    fflush(fs_image);
+
+    // Assert
+    ck_assert_uint_eq(read_inode_from_image(18).i_uid, 42);
+}
+
+END_TEST
+
+Suite *inode_cache_suite(void) {
+    Suite *s = suite_create("InodeCache");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, inode_get_should_return_the_same_copy_to_every_holder);
+    tcase_add_test(tc_core, read_inode_should_not_touch_the_image_on_a_hit);
+    tcase_add_test(tc_core, write_inode_should_defer_the_write_until_sync);
+    tcase_add_test(tc_core, eviction_should_write_back_dirty_inodes);
+    tcase_add_test(tc_core, inode_get_should_fail_when_every_entry_is_referenced);
+    tcase_add_test(tc_core, inode_put_should_write_back_private_copies_without_a_cache);
+
+    suite_add_tcase(s, tc_core);
+    return s;
+}
+
+int main(void) {
+    Suite *s = inode_cache_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    const int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}